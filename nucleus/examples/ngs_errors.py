@@ -250,13 +250,17 @@ def make_ngs_error_examples(ref_path,
   # looping over our reads.
   n_examples = 0
   with ref_reader, vcf_reader, sam_reader, examples_out:
+    # Reads from a sorted BAM come in increasing order, so a sweep query
+    # reuses the variants shared by neighboring reads instead of seeking and
+    # parsing them again for each read.
+    variant_sweep = vcf_reader.sweep_query()
     # Loop over the reads in our BAM file:
     for i, read in enumerate(sam_reader.iterate(), start=1):
       # Get the Range proto describing the chrom/start/stop spanned by our read.
       read_range = utils.read_range(read)
 
       # Get all of the variants that overlap our read range.
-      variants = list(vcf_reader.query(read_range))
+      variants = variant_sweep.query(read_range)
 
       # Get the reference bases spanned by our read.
       ref_bases = ref_reader.query(read_range)
@@ -47,6 +47,22 @@ with bed.BedWriter(output_path, header) as writer:
     writer.write(record)
 ```
 
+API for set operations on sorted BED files, which stream through their inputs
+rather than loading them, so are suited to very large files:
+
+```python
+from nucleus.io import bed
+
+bed.merge([input_path1, input_path2], output_path)
+bed.intersect([input_path1, input_path2], output_path)
+bed.subtract(input_path, [excluded_path], output_path)
+bed.complement(input_path, output_path, contigs)
+bed.coverage([input_path1, input_path2], output_path)
+```
+
+where `contigs` are `nucleus.genomics.v1.ContigInfo` protos, such as those of a
+FASTA's header; see `merge` for how the inputs must be sorted.
+
 For both reading and writing, if the path provided to the constructor contains
 '.tfrecord' as an extension, a `TFRecord` file is assumed and attempted to be
 read or written. Otherwise, the filename is treated as a true BED file.
@@ -61,6 +77,7 @@ from __future__ import print_function
 
 from nucleus.io import genomics_reader
 from nucleus.io import genomics_writer
+from nucleus.io.python import bed_algebra
 from nucleus.io.python import bed_reader
 from nucleus.io.python import bed_writer
 from nucleus.protos import bed_pb2
@@ -101,6 +118,21 @@ class NativeBedReader(genomics_reader.GenomicsReader):
     """Returns an iterable of BedRecord protos in the file."""
     return self._reader.iterate()
 
+  def sweep_query(self):
+    """Returns a cursor for querying many regions in file order.
+
+    BED files aren't indexed, so the cursor streams through the file, keeping
+    the records that overlap the current region for the next ones. The file
+    must be sorted by start within each contig. A region that goes back makes
+    the cursor reread the file from the beginning, so regions in any order
+    give correct results, only more slowly.
+
+    Returns:
+      A context manager whose query(region) method returns the list of
+      nucleus.genomics.v1.BedRecord protos overlapping region.
+    """
+    return self._reader.sweep_query()
+
   def __exit__(self, exit_type, exit_value, exit_traceback):
     self._reader.__exit__(exit_type, exit_value, exit_traceback)
 
@@ -114,6 +146,12 @@ class BedReader(genomics_reader.DispatchingGenomicsReader):
   def _record_proto(self):
     return bed_pb2.BedRecord
 
+  def sweep_query(self):
+    """Returns a sorted-region query cursor; see NativeBedReader for details."""
+    if not isinstance(self._reader, NativeBedReader):
+      raise NotImplementedError('sweep_query requires a native BED file')
+    return self._reader.sweep_query()
+
 
 class NativeBedWriter(genomics_writer.GenomicsWriter):
   """Class for writing to native BED files.
@@ -149,3 +187,76 @@ class BedWriter(genomics_writer.DispatchingGenomicsWriter):
 
   def _native_writer(self, output_path, header):
     return NativeBedWriter(output_path, header=header)
+
+
+def merge(input_paths, output_path, contigs=None):
+  """Writes the regions covered by any of the records of BED files.
+
+  Like the other set operations below, this makes a single pass through its
+  inputs, keeping one interval of each in memory, and writes its output sorted
+  like them, with overlapping or abutting regions joined into one record.
+
+  Args:
+    input_paths: list of str. Paths to native BED files, sorted by contig and
+      then by start.
+    output_path: str. The path of the BED3 file to write.
+    contigs: list of nucleus.genomics.v1.ContigInfo protos. The contigs of the
+      inputs, in their order. If None, the inputs' contigs are sorted by name,
+      comparing bytes as `LC_ALL=C sort -k1,1 -k2,2n` does.
+
+  Raises:
+    ValueError: if an input is unsorted or has a record on a contig that isn't
+      in contigs.
+  """
+  bed_algebra.merge_bed(list(input_paths), contigs or [], output_path)
+
+
+def intersect(input_paths, output_path, contigs=None):
+  """Writes the regions covered by records of every one of input_paths.
+
+  Args:
+    input_paths: list of str. Paths to sorted native BED files.
+    output_path: str. The path of the BED3 file to write.
+    contigs: list of nucleus.genomics.v1.ContigInfo protos. See merge.
+  """
+  bed_algebra.intersect_bed(list(input_paths), contigs or [], output_path)
+
+
+def subtract(input_path, subtracted_paths, output_path, contigs=None):
+  """Writes the regions of input_path not covered by subtracted_paths.
+
+  Args:
+    input_path: str. The path to a sorted native BED file.
+    subtracted_paths: list of str. Paths to sorted native BED files whose
+      records are removed from those of input_path.
+    output_path: str. The path of the BED3 file to write.
+    contigs: list of nucleus.genomics.v1.ContigInfo protos. See merge.
+  """
+  bed_algebra.subtract_bed(input_path, list(subtracted_paths), contigs or [],
+                           output_path)
+
+
+def complement(input_path, output_path, contigs):
+  """Writes the regions of contigs not covered by the records of input_path.
+
+  Args:
+    input_path: str. The path to a sorted native BED file.
+    output_path: str. The path of the BED3 file to write.
+    contigs: list of nucleus.genomics.v1.ContigInfo protos. The contigs of the
+      genome, in the order of the input, whose n_bases bound the output.
+  """
+  bed_algebra.complement_bed(input_path, list(contigs), output_path)
+
+
+def coverage(input_paths, output_path, contigs=None):
+  """Writes the number of records of input_paths covering each region.
+
+  The output is BED5, with the number of records covering each region as its
+  score, like a bedGraph. Regions covered by no records are omitted.
+
+  Args:
+    input_paths: list of str. Paths to sorted native BED files.
+    output_path: str. The path of the BED5 file to write.
+    contigs: list of nucleus.genomics.v1.ContigInfo protos. See merge.
+  """
+  bed_algebra.bed_coverage(list(input_paths), contigs or [], output_path)
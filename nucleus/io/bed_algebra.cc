@@ -0,0 +1,451 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of bed_algebra.h
+#include "nucleus/io/bed_algebra.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+#include "nucleus/io/bed_reader.h"
+#include "nucleus/io/bed_writer.h"
+#include "nucleus/protos/bed.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::BedHeader;
+using nucleus::genomics::v1::BedReaderOptions;
+using nucleus::genomics::v1::BedRecord;
+using nucleus::genomics::v1::BedWriterOptions;
+using nucleus::genomics::v1::ContigInfo;
+
+namespace {
+
+// The order of the contigs of the inputs and outputs: that of a list of
+// contigs, or by name if the list is empty.
+class ContigOrder {
+ public:
+  explicit ContigOrder(const std::vector<ContigInfo>& contigs) {
+    for (size_t i = 0; i < contigs.size(); ++i) {
+      ranks_[contigs[i].name()] = i;
+    }
+  }
+
+  // Returns whether contig may appear in the inputs.
+  bool Contains(const string& contig) const {
+    return ranks_.empty() || ranks_.count(contig) > 0;
+  }
+
+  // Returns whether contig a comes before contig b, both of which must be
+  // contained in the order.
+  bool Before(const string& a, const string& b) const {
+    return ranks_.empty() ? a < b : ranks_.at(a) < ranks_.at(b);
+  }
+
+ private:
+  std::unordered_map<string, int> ranks_;
+};
+
+// A stretch of bases of one contig, covered by depth records of an input.
+struct Segment {
+  string contig;
+  int64 start = 0;
+  int64 end = 0;
+  int64 depth = 0;
+};
+
+// Reads the records of a sorted BED file as a series of sorted, disjoint
+// Segments.
+class SegmentStream {
+ public:
+  // Opens the BED file at path, whose contigs must be in order. If
+  // count_depth, each segment is a stretch of bases covered by the same number
+  // of records; otherwise it's a maximal stretch of bases covered by any
+  // records, with a depth of 1.
+  static tf::Status Open(const string& path, const ContigOrder* order,
+                         bool count_depth,
+                         std::unique_ptr<SegmentStream>* stream) {
+    StatusOr<std::unique_ptr<BedReader>> reader =
+        BedReader::FromFile(path, BedReaderOptions());
+    TF_RETURN_IF_ERROR(reader.status());
+    stream->reset(new SegmentStream(path, order, count_depth,
+                                    std::move(reader.ValueOrDie())));
+    StatusOr<std::shared_ptr<BedIterable>> records =
+        (*stream)->reader_->Iterate();
+    TF_RETURN_IF_ERROR(records.status());
+    (*stream)->records_ = records.ValueOrDie();
+    return (*stream)->ReadRecord();
+  }
+
+  // Reads the next segment into *segment, returning false at the end of the
+  // file.
+  StatusOr<bool> Next(Segment* segment) {
+    if (!count_depth_) {
+      if (!has_pending_) return false;
+      segment->contig = pending_.reference_name();
+      segment->start = pending_.start();
+      segment->end = pending_.end();
+      segment->depth = 1;
+      while (true) {
+        TF_RETURN_IF_ERROR(ReadRecord());
+        if (!has_pending_ || pending_.reference_name() != segment->contig ||
+            pending_.start() > segment->end) {
+          return true;
+        }
+        segment->end = std::max<int64>(segment->end, pending_.end());
+      }
+    }
+
+    while (true) {
+      if (ends_.empty()) {
+        if (!has_pending_) return false;
+        contig_ = pending_.reference_name();
+        pos_ = pending_.start();
+      }
+      const bool pending_on_contig =
+          has_pending_ && pending_.reference_name() == contig_;
+      if (pending_on_contig && pending_.start() == pos_) {
+        ends_.push(pending_.end());
+        TF_RETURN_IF_ERROR(ReadRecord());
+        continue;
+      }
+      // The depth changes where the next record starts or an open one ends.
+      int64 end = ends_.top();
+      if (pending_on_contig) end = std::min<int64>(end, pending_.start());
+      segment->contig = contig_;
+      segment->start = pos_;
+      segment->end = end;
+      segment->depth = ends_.size();
+      pos_ = end;
+      while (!ends_.empty() && ends_.top() == pos_) ends_.pop();
+      return true;
+    }
+  }
+
+ private:
+  SegmentStream(const string& path, const ContigOrder* order,
+                bool count_depth, std::unique_ptr<BedReader> reader)
+      : path_(path),
+        order_(order),
+        count_depth_(count_depth),
+        reader_(std::move(reader)) {}
+
+  // Reads the next record spanning any bases into pending_, or sets
+  // has_pending_ to false at the end of the file.
+  tf::Status ReadRecord() {
+    while (true) {
+      StatusOr<bool> more = records_->Next(&pending_);
+      TF_RETURN_IF_ERROR(more.status());
+      has_pending_ = more.ValueOrDie();
+      if (!has_pending_) return tf::Status::OK();
+      const string& contig = pending_.reference_name();
+      if (!order_->Contains(contig)) {
+        return tf::errors::InvalidArgument("BED file ", path_,
+                                           " has a record on unknown contig ",
+                                           contig);
+      }
+      if (pending_.start() < 0 || pending_.start() > pending_.end()) {
+        return tf::errors::InvalidArgument("Malformed record in BED file ",
+                                           path_, ": ",
+                                           pending_.ShortDebugString());
+      }
+      if (has_read_ &&
+          (contig == last_contig_ ? pending_.start() < last_start_
+                                  : !order_->Before(last_contig_, contig))) {
+        return tf::errors::InvalidArgument(
+            "BED file ", path_, " is not sorted: ", contig, ":",
+            pending_.start(), " follows ", last_contig_, ":", last_start_);
+      }
+      has_read_ = true;
+      last_contig_ = contig;
+      last_start_ = pending_.start();
+      if (pending_.end() > pending_.start()) return tf::Status::OK();
+    }
+  }
+
+  const string path_;
+  const ContigOrder* order_;
+  const bool count_depth_;
+  std::unique_ptr<BedReader> reader_;
+  std::shared_ptr<BedIterable> records_;
+
+  // The next record that isn't part of a segment yet, if has_pending_.
+  BedRecord pending_;
+  bool has_pending_ = false;
+
+  // The contig and start of the last record read, to check their order.
+  bool has_read_ = false;
+  string last_contig_;
+  int64 last_start_ = 0;
+
+  // If count_depth_, the contig and start of the next segment, and the ends
+  // of the records overlapping it, earliest first.
+  string contig_;
+  int64 pos_ = 0;
+  std::priority_queue<int64, std::vector<int64>, std::greater<int64>> ends_;
+};
+
+tf::Status OpenAll(const std::vector<string>& paths, const ContigOrder* order,
+                   bool count_depth,
+                   std::vector<std::unique_ptr<SegmentStream>>* streams) {
+  for (const string& path : paths) {
+    streams->emplace_back();
+    TF_RETURN_IF_ERROR(
+        SegmentStream::Open(path, order, count_depth, &streams->back()));
+  }
+  return tf::Status::OK();
+}
+
+// Writes regions to a BED file, joining regions that abut and have the same
+// score into one record.
+class RegionWriter {
+ public:
+  static tf::Status Open(const string& path, int num_fields,
+                         std::unique_ptr<RegionWriter>* writer) {
+    BedHeader header;
+    header.set_num_fields(num_fields);
+    StatusOr<std::unique_ptr<BedWriter>> bed_writer =
+        BedWriter::ToFile(path, header, BedWriterOptions());
+    TF_RETURN_IF_ERROR(bed_writer.status());
+    writer->reset(new RegionWriter(std::move(bed_writer.ValueOrDie())));
+    return tf::Status::OK();
+  }
+
+  tf::Status Add(const string& contig, int64 start, int64 end, double score) {
+    if (has_pending_ && pending_.reference_name() == contig &&
+        pending_.end() == start && pending_.score() == score) {
+      pending_.set_end(end);
+      return tf::Status::OK();
+    }
+    if (has_pending_) TF_RETURN_IF_ERROR(writer_->Write(pending_));
+    pending_.set_reference_name(contig);
+    pending_.set_start(start);
+    pending_.set_end(end);
+    pending_.set_score(score);
+    has_pending_ = true;
+    return tf::Status::OK();
+  }
+
+  tf::Status Close() {
+    if (has_pending_) TF_RETURN_IF_ERROR(writer_->Write(pending_));
+    has_pending_ = false;
+    return writer_->Close();
+  }
+
+ private:
+  explicit RegionWriter(std::unique_ptr<BedWriter> writer)
+      : writer_(std::move(writer)) {
+    pending_.set_name(".");
+  }
+
+  std::unique_ptr<BedWriter> writer_;
+  BedRecord pending_;
+  bool has_pending_ = false;
+};
+
+// Calls visit(contig, start, end, depths) for each stretch of bases covered
+// by the segments of any of streams and by the same segments throughout, in
+// order, where depths[i] is the depth of streams[i] over the stretch, or 0.
+tf::Status Sweep(
+    const std::vector<std::unique_ptr<SegmentStream>>& streams,
+    const ContigOrder& order,
+    const std::function<tf::Status(const string&, int64, int64,
+                                   const std::vector<int64>&)>& visit) {
+  const size_t n = streams.size();
+  std::vector<Segment> heads(n);
+  std::vector<bool> live(n);
+  auto advance = [&](size_t i) -> tf::Status {
+    StatusOr<bool> more = streams[i]->Next(&heads[i]);
+    TF_RETURN_IF_ERROR(more.status());
+    live[i] = more.ValueOrDie();
+    return tf::Status::OK();
+  };
+  for (size_t i = 0; i < n; ++i) TF_RETURN_IF_ERROR(advance(i));
+
+  std::vector<int64> depths(n);
+  while (true) {
+    // Sweep the first contig any of the streams has segments left on.
+    const string* first = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+      if (!live[i]) continue;
+      if (first == nullptr || order.Before(heads[i].contig, *first))
+        first = &heads[i].contig;
+    }
+    if (first == nullptr) return tf::Status::OK();
+    const string contig = *first;
+
+    int64 pos = std::numeric_limits<int64>::max();
+    for (size_t i = 0; i < n; ++i) {
+      if (live[i] && heads[i].contig == contig)
+        pos = std::min<int64>(pos, heads[i].start);
+    }
+    while (true) {
+      // The stretch from pos ends where a segment starts or ends.
+      int64 end = std::numeric_limits<int64>::max();
+      bool covered = false;
+      for (size_t i = 0; i < n; ++i) {
+        depths[i] = 0;
+        if (!live[i] || heads[i].contig != contig) continue;
+        if (heads[i].start <= pos) {
+          depths[i] = heads[i].depth;
+          covered = true;
+          end = std::min<int64>(end, heads[i].end);
+        } else {
+          end = std::min<int64>(end, heads[i].start);
+        }
+      }
+      if (end == std::numeric_limits<int64>::max()) break;
+      if (covered) TF_RETURN_IF_ERROR(visit(contig, pos, end, depths));
+      pos = end;
+      for (size_t i = 0; i < n; ++i) {
+        if (live[i] && heads[i].contig == contig && heads[i].end == pos)
+          TF_RETURN_IF_ERROR(advance(i));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+tf::Status MergeBed(const std::vector<string>& input_paths,
+                    const std::vector<ContigInfo>& contigs,
+                    const string& output_path) {
+  const ContigOrder order(contigs);
+  std::vector<std::unique_ptr<SegmentStream>> streams;
+  TF_RETURN_IF_ERROR(OpenAll(input_paths, &order, false, &streams));
+  std::unique_ptr<RegionWriter> writer;
+  TF_RETURN_IF_ERROR(RegionWriter::Open(output_path, 3, &writer));
+  TF_RETURN_IF_ERROR(Sweep(
+      streams, order,
+      [&writer](const string& contig, int64 start, int64 end,
+                const std::vector<int64>& depths) {
+        return writer->Add(contig, start, end, 0);
+      }));
+  return writer->Close();
+}
+
+tf::Status IntersectBed(const std::vector<string>& input_paths,
+                        const std::vector<ContigInfo>& contigs,
+                        const string& output_path) {
+  const ContigOrder order(contigs);
+  std::vector<std::unique_ptr<SegmentStream>> streams;
+  TF_RETURN_IF_ERROR(OpenAll(input_paths, &order, false, &streams));
+  std::unique_ptr<RegionWriter> writer;
+  TF_RETURN_IF_ERROR(RegionWriter::Open(output_path, 3, &writer));
+  TF_RETURN_IF_ERROR(Sweep(
+      streams, order,
+      [&writer](const string& contig, int64 start, int64 end,
+                const std::vector<int64>& depths) {
+        if (std::find(depths.begin(), depths.end(), 0) != depths.end())
+          return tf::Status::OK();
+        return writer->Add(contig, start, end, 0);
+      }));
+  return writer->Close();
+}
+
+tf::Status SubtractBed(const string& input_path,
+                       const std::vector<string>& subtracted_paths,
+                       const std::vector<ContigInfo>& contigs,
+                       const string& output_path) {
+  const ContigOrder order(contigs);
+  std::vector<std::unique_ptr<SegmentStream>> streams;
+  TF_RETURN_IF_ERROR(OpenAll({input_path}, &order, false, &streams));
+  TF_RETURN_IF_ERROR(OpenAll(subtracted_paths, &order, false, &streams));
+  std::unique_ptr<RegionWriter> writer;
+  TF_RETURN_IF_ERROR(RegionWriter::Open(output_path, 3, &writer));
+  TF_RETURN_IF_ERROR(Sweep(
+      streams, order,
+      [&writer](const string& contig, int64 start, int64 end,
+                const std::vector<int64>& depths) {
+        if (depths[0] == 0 ||
+            std::any_of(depths.begin() + 1, depths.end(),
+                        [](int64 depth) { return depth > 0; })) {
+          return tf::Status::OK();
+        }
+        return writer->Add(contig, start, end, 0);
+      }));
+  return writer->Close();
+}
+
+tf::Status ComplementBed(const string& input_path,
+                         const std::vector<ContigInfo>& contigs,
+                         const string& output_path) {
+  if (contigs.empty())
+    return tf::errors::InvalidArgument("contigs must not be empty");
+  const ContigOrder order(contigs);
+  std::unique_ptr<SegmentStream> stream;
+  TF_RETURN_IF_ERROR(SegmentStream::Open(input_path, &order, false, &stream));
+  std::unique_ptr<RegionWriter> writer;
+  TF_RETURN_IF_ERROR(RegionWriter::Open(output_path, 3, &writer));
+
+  // The stream's segments are in the order of contigs, so each contig's are
+  // next when we reach it.
+  Segment segment;
+  StatusOr<bool> live = stream->Next(&segment);
+  TF_RETURN_IF_ERROR(live.status());
+  for (const ContigInfo& contig : contigs) {
+    int64 pos = 0;
+    while (live.ValueOrDie() && segment.contig == contig.name()) {
+      if (segment.end > contig.n_bases()) {
+        return tf::errors::InvalidArgument(
+            "BED file ", input_path, " has a record ending at ", segment.end,
+            " on contig ", contig.name(), " of ", contig.n_bases(), " bases");
+      }
+      if (segment.start > pos) {
+        TF_RETURN_IF_ERROR(
+            writer->Add(contig.name(), pos, segment.start, 0));
+      }
+      pos = segment.end;
+      live = stream->Next(&segment);
+      TF_RETURN_IF_ERROR(live.status());
+    }
+    if (pos < contig.n_bases()) {
+      TF_RETURN_IF_ERROR(writer->Add(contig.name(), pos, contig.n_bases(), 0));
+    }
+  }
+  return writer->Close();
+}
+
+tf::Status BedCoverage(const std::vector<string>& input_paths,
+                       const std::vector<ContigInfo>& contigs,
+                       const string& output_path) {
+  const ContigOrder order(contigs);
+  std::vector<std::unique_ptr<SegmentStream>> streams;
+  TF_RETURN_IF_ERROR(OpenAll(input_paths, &order, true, &streams));
+  std::unique_ptr<RegionWriter> writer;
+  TF_RETURN_IF_ERROR(RegionWriter::Open(output_path, 5, &writer));
+  TF_RETURN_IF_ERROR(Sweep(
+      streams, order,
+      [&writer](const string& contig, int64 start, int64 end,
+                const std::vector<int64>& depths) {
+        int64 depth = 0;
+        for (int64 d : depths) depth += d;
+        return writer->Add(contig, start, end, depth);
+      }));
+  return writer->Close();
+}
+
+}  // namespace nucleus
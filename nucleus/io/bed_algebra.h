@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Set operations on the regions of sorted BED files.
+//
+// Each function streams its inputs through BedReaders in a single sweep and
+// writes its result with a BedWriter, so files of tens of millions of records
+// are processed without holding them in memory: merging, intersecting,
+// subtracting and complementing keep one interval per input, and counting
+// coverage also keeps the ends of the records of each input that overlap the
+// current position.
+//
+// The inputs must be sorted by contig and then by start. If contigs is empty,
+// contigs are sorted by name, comparing bytes as `LC_ALL=C sort -k1,1 -k2,2n`
+// does; otherwise they must be in the order of contigs, and may only be the
+// contigs listed there. A record out of order, or on an unlisted contig, is an
+// InvalidArgument error.
+// Records spanning no bases are ignored.
+//
+// The outputs are sorted the same way. Intervals that overlap or abut are
+// joined, so that a region is written as a single record.
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_BED_ALGEBRA_H_
+#define THIRD_PARTY_NUCLEUS_IO_BED_ALGEBRA_H_
+
+#include <vector>
+
+#include "nucleus/platform/types.h"
+#include "nucleus/protos/reference.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+// Writes the bases covered by any of the records of input_paths, as BED3.
+tensorflow::Status MergeBed(
+    const std::vector<string>& input_paths,
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const string& output_path);
+
+// Writes the bases covered by records of every one of input_paths, as BED3.
+tensorflow::Status IntersectBed(
+    const std::vector<string>& input_paths,
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const string& output_path);
+
+// Writes the bases covered by records of input_path but by none of the
+// records of subtracted_paths, as BED3.
+tensorflow::Status SubtractBed(
+    const string& input_path, const std::vector<string>& subtracted_paths,
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const string& output_path);
+
+// Writes the bases of contigs covered by none of the records of input_path,
+// as BED3, including the whole of contigs it has no records on. contigs must
+// not be empty, and records must not extend past the ends of their contigs.
+tensorflow::Status ComplementBed(
+    const string& input_path,
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const string& output_path);
+
+// Writes, as BED5, the bases covered by records of input_paths, with the
+// number of records covering them as their score, like a bedGraph. Bases with
+// the same coverage are written as one record, named ".".
+tensorflow::Status BedCoverage(
+    const std::vector<string>& input_paths,
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const string& output_path);
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_BED_ALGEBRA_H_
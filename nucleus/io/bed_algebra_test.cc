@@ -0,0 +1,186 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/bed_algebra.h"
+
+#include <utility>
+#include <vector>
+
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::ContigInfo;
+
+string WriteBed(const string& name, const string& contents) {
+  const string path = MakeTempFile(name);
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), path,
+                                            contents));
+  return path;
+}
+
+string ReadBed(const string& path) {
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(), path,
+                                           &contents));
+  return contents;
+}
+
+class BedAlgebraTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    a_ = WriteBed("a.bed",
+                  "chr1\t0\t10\n"
+                  "chr1\t5\t20\n"
+                  "chr1\t25\t25\n"
+                  "chr1\t30\t40\n"
+                  "chr2\t0\t5\n");
+    b_ = WriteBed("b.bed",
+                  "chr1\t8\t12\n"
+                  "chr1\t35\t50\n"
+                  "chr3\t0\t10\n");
+    for (const auto& contig :
+         std::vector<std::pair<string, int64>>{
+             {"chr1", 100}, {"chr2", 50}, {"chr3", 20}}) {
+      ContigInfo info;
+      info.set_name(contig.first);
+      info.set_n_bases(contig.second);
+      info.set_pos_in_fasta(contigs_.size());
+      contigs_.push_back(info);
+    }
+    output_ = MakeTempFile("output.bed");
+  }
+
+  string a_;
+  string b_;
+  std::vector<ContigInfo> contigs_;
+  string output_;
+};
+
+TEST_F(BedAlgebraTest, Merge) {
+  ASSERT_THAT(MergeBed({a_, b_}, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t0\t20\n"
+      "chr1\t30\t50\n"
+      "chr2\t0\t5\n"
+      "chr3\t0\t10\n",
+      ReadBed(output_));
+  // The contigs are in the order of their names too.
+  ASSERT_THAT(MergeBed({a_}, {}, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t0\t20\n"
+      "chr1\t30\t40\n"
+      "chr2\t0\t5\n",
+      ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, MergeJoinsAbuttingRecords) {
+  const string abutting = WriteBed("abutting.bed",
+                                   "chr1\t0\t10\n"
+                                   "chr1\t10\t20\n"
+                                   "chr1\t21\t30\n");
+  ASSERT_THAT(MergeBed({abutting}, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t0\t20\n"
+      "chr1\t21\t30\n",
+      ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, Intersect) {
+  ASSERT_THAT(IntersectBed({a_, b_}, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t8\t12\n"
+      "chr1\t35\t40\n",
+      ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, Subtract) {
+  ASSERT_THAT(SubtractBed(a_, {b_}, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t0\t8\n"
+      "chr1\t12\t20\n"
+      "chr1\t30\t35\n"
+      "chr2\t0\t5\n",
+      ReadBed(output_));
+  ASSERT_THAT(SubtractBed(a_, {a_, b_}, contigs_, output_), IsOK());
+  EXPECT_EQ("", ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, Complement) {
+  ASSERT_THAT(ComplementBed(a_, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t20\t30\n"
+      "chr1\t40\t100\n"
+      "chr2\t5\t50\n"
+      "chr3\t0\t20\n",
+      ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, Coverage) {
+  ASSERT_THAT(BedCoverage({a_, b_}, contigs_, output_), IsOK());
+  EXPECT_EQ(
+      "chr1\t0\t5\t.\t1\n"
+      "chr1\t5\t8\t.\t2\n"
+      "chr1\t8\t10\t.\t3\n"
+      "chr1\t10\t12\t.\t2\n"
+      "chr1\t12\t20\t.\t1\n"
+      "chr1\t30\t35\t.\t1\n"
+      "chr1\t35\t40\t.\t2\n"
+      "chr1\t40\t50\t.\t1\n"
+      "chr2\t0\t5\t.\t1\n"
+      "chr3\t0\t10\t.\t1\n",
+      ReadBed(output_));
+}
+
+TEST_F(BedAlgebraTest, RejectsUnsortedInputs) {
+  const string unsorted = WriteBed("unsorted.bed",
+                                   "chr1\t10\t20\n"
+                                   "chr1\t5\t8\n");
+  EXPECT_THAT(MergeBed({a_, unsorted}, contigs_, output_),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::INVALID_ARGUMENT,
+                  "is not sorted: chr1:5 follows chr1:10"));
+  const string out_of_order = WriteBed("out_of_order.bed",
+                                       "chr2\t10\t20\n"
+                                       "chr1\t5\t8\n");
+  EXPECT_THAT(IntersectBed({out_of_order}, contigs_, output_),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::INVALID_ARGUMENT,
+                  "is not sorted: chr1:5 follows chr2:10"));
+  const string unknown = WriteBed("unknown.bed", "chrX\t10\t20\n");
+  EXPECT_THAT(BedCoverage({unknown}, contigs_, output_),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "has a record on unknown contig chrX"));
+}
+
+TEST_F(BedAlgebraTest, ComplementChecksContigs) {
+  EXPECT_THAT(ComplementBed(a_, {}, output_),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "contigs must not be empty"));
+  const string past_end = WriteBed("past_end.bed", "chr3\t10\t30\n");
+  EXPECT_THAT(ComplementBed(past_end, contigs_, output_),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "has a record ending at 30"));
+}
+
+}  // namespace nucleus
@@ -17,6 +17,8 @@
 // Implementation of bed_reader.h
 #include "nucleus/io/bed_reader.h"
 
+#include <algorithm>
+
 #include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_split.h"
@@ -161,14 +163,16 @@ StatusOr<std::unique_ptr<BedReader>> BedReader::FromFile(
   StatusOr<std::unique_ptr<TextReader>> status_or =
       TextReader::FromFile(bed_path);
   TF_RETURN_IF_ERROR(status_or.status());
-  return std::unique_ptr<BedReader>(
-      new BedReader(std::move(status_or.ValueOrDie()), options, header));
+  return std::unique_ptr<BedReader>(new BedReader(
+      bed_path, std::move(status_or.ValueOrDie()), options, header));
 }
 
-BedReader::BedReader(std::unique_ptr<TextReader> text_reader,
+BedReader::BedReader(const string& bed_path,
+                     std::unique_ptr<TextReader> text_reader,
                      const nucleus::genomics::v1::BedReaderOptions& options,
                      const nucleus::genomics::v1::BedHeader& header)
-    : options_(options),
+    : bed_path_(bed_path),
+      options_(options),
       header_(header),
       text_reader_(std::move(text_reader)) {}
 
@@ -203,6 +207,12 @@ StatusOr<std::shared_ptr<BedIterable>> BedReader::Iterate() const {
       MakeIterable<BedFullFileIterable>(this));
 }
 
+StatusOr<std::shared_ptr<BedSweepQuery>> BedReader::SweepQuery() const {
+  if (!text_reader_)
+    return tf::errors::FailedPrecondition("Cannot Query a closed BedReader.");
+  return MakeIterable<BedSweepQuery>(this);
+}
+
 // Iterable class definitions.
 StatusOr<bool> BedFullFileIterable::Next(
     nucleus::genomics::v1::BedRecord* out) {
@@ -227,4 +237,99 @@ BedFullFileIterable::~BedFullFileIterable() {}
 BedFullFileIterable::BedFullFileIterable(const BedReader* reader)
     : Iterable(reader) {}
 
+BedSweepQuery::BedSweepQuery(const BedReader* reader) : IterableBase(reader) {}
+
+BedSweepQuery::~BedSweepQuery() {}
+
+tf::Status BedSweepQuery::ReadNext() {
+  const BedReader* bed_reader = static_cast<const BedReader*>(reader_);
+  string line;
+  tf::Status status = NextNonCommentLine(*text_reader_, &line);
+  if (tf::errors::IsOutOfRange(status)) {
+    has_next_ = false;
+    read_whole_file_ = true;
+    return tf::Status::OK();
+  }
+  TF_RETURN_IF_ERROR(status);
+  int numTokens;
+  TF_RETURN_IF_ERROR(ConvertToPb(line, bed_reader->Options().num_fields(),
+                                 &numTokens, &next_));
+  TF_RETURN_IF_ERROR(bed_reader->Validate(numTokens));
+  has_next_ = true;
+  if (!read_whole_file_) contigs_.insert(next_.reference_name());
+  return tf::Status::OK();
+}
+
+tf::Status BedSweepQuery::Rewind() {
+  const BedReader* bed_reader = static_cast<const BedReader*>(reader_);
+  if (text_reader_) {
+    TF_RETURN_IF_ERROR(text_reader_->Close());
+    n_rewinds_++;
+  }
+  StatusOr<std::unique_ptr<TextReader>> status_or =
+      TextReader::FromFile(bed_reader->bed_path_);
+  TF_RETURN_IF_ERROR(status_or.status());
+  text_reader_ = std::move(status_or.ValueOrDie());
+  buffer_.clear();
+  return ReadNext();
+}
+
+tf::Status BedSweepQuery::SkipToContig(const string& contig) {
+  buffer_.clear();
+  while (has_next_ && next_.reference_name() != contig) {
+    TF_RETURN_IF_ERROR(ReadNext());
+  }
+  // Having reached the end of the file, we know all of its contigs, so there
+  // is no need to reread it for one that isn't there.
+  if (has_next_ || contigs_.count(contig) == 0) return tf::Status::OK();
+  TF_RETURN_IF_ERROR(Rewind());
+  while (has_next_ && next_.reference_name() != contig) {
+    TF_RETURN_IF_ERROR(ReadNext());
+  }
+  return tf::Status::OK();
+}
+
+StatusOr<std::vector<nucleus::genomics::v1::BedRecord>> BedSweepQuery::Query(
+    const nucleus::genomics::v1::Range& region) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (region.start() < 0 || region.start() >= region.end())
+    return tf::errors::InvalidArgument(
+        "Malformed region '", region.ShortDebugString(), "'");
+  if (!text_reader_) TF_RETURN_IF_ERROR(Rewind());
+  if (read_whole_file_ && contigs_.count(region.reference_name()) == 0) {
+    return std::vector<nucleus::genomics::v1::BedRecord>();
+  }
+  if (region.reference_name() != contig_) {
+    // Records of contig_ that haven't been read yet come before the next
+    // contig.
+    TF_RETURN_IF_ERROR(SkipToContig(region.reference_name()));
+    contig_ = region.reference_name();
+  } else if (region.start() < last_start_) {
+    TF_RETURN_IF_ERROR(Rewind());
+    TF_RETURN_IF_ERROR(SkipToContig(region.reference_name()));
+  }
+  last_start_ = region.start();
+
+  // Records ending by the start of region can't overlap it or any later
+  // region, so they are dropped.
+  buffer_.erase(
+      std::remove_if(buffer_.begin(), buffer_.end(),
+                     [&region](const nucleus::genomics::v1::BedRecord& r) {
+                       return r.end() <= region.start();
+                     }),
+      buffer_.end());
+  while (has_next_ && next_.reference_name() == contig_ &&
+         next_.start() < region.end()) {
+    if (next_.end() > region.start()) buffer_.push_back(next_);
+    TF_RETURN_IF_ERROR(ReadNext());
+  }
+
+  std::vector<nucleus::genomics::v1::BedRecord> records;
+  for (const auto& record : buffer_) {
+    if (record.start() >= region.end()) break;
+    records.push_back(record);
+  }
+  return records;
+}
+
 }  // namespace nucleus
@@ -17,9 +17,14 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_BED_READER_H_
 #define THIRD_PARTY_NUCLEUS_IO_BED_READER_H_
 
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
 #include "nucleus/io/reader_base.h"
 #include "nucleus/io/text_reader.h"
 #include "nucleus/protos/bed.pb.h"
+#include "nucleus/protos/range.pb.h"
 #include "nucleus/vendor/statusor.h"
 #include "nucleus/platform/types.h"
 
@@ -29,6 +34,8 @@ namespace nucleus {
 // Alias for the abstract base class for BED record iterables.
 using BedIterable = Iterable<nucleus::genomics::v1::BedRecord>;
 
+class BedSweepQuery;  // Forward declaration.
+
 // A BED reader.
 //
 // BED files are flexible stores of information about a genome annotation track.
@@ -68,6 +75,19 @@ class BedReader : public Reader {
   // constructed, or not OK otherwise.
   StatusOr<std::shared_ptr<BedIterable>> Iterate() const;
 
+  // Gets a cursor for querying the records overlapping many regions in the
+  // order of the file, such as the spans of reads from a BAM sorted like it.
+  //
+  // BED files have no index, so the cursor streams through the file once,
+  // keeping the records that overlap the current region for later regions.
+  // The file must be sorted by start within each contig. A region that starts
+  // before the previous one on its contig, or on a contig that was already
+  // passed, makes the cursor reread the file from its beginning, so regions
+  // in any order give correct results, only more slowly. Once the cursor has
+  // reached the end of the file, regions on contigs that aren't in it are
+  // answered without reading it again.
+  StatusOr<std::shared_ptr<BedSweepQuery>> SweepQuery() const;
+
   // Close the underlying resource descriptors. Returns a Status to indicate if
   // everything went OK with the close.
   tensorflow::Status Close();
@@ -90,10 +110,13 @@ class BedReader : public Reader {
  private:
   // Private constructor; use FromFile to safely create a BedReader from a
   // file.
-  BedReader(std::unique_ptr<TextReader> text_reader,
+  BedReader(const string& bed_path, std::unique_ptr<TextReader> text_reader,
             const nucleus::genomics::v1::BedReaderOptions& options,
             const nucleus::genomics::v1::BedHeader& header);
 
+  // The path of the BED file, so that BedSweepQuery can reread it.
+  const string bed_path_;
+
   // Our options that control the behavior of this class.
   const nucleus::genomics::v1::BedReaderOptions options_;
 
@@ -105,6 +128,57 @@ class BedReader : public Reader {
 
   // Allow BedIterable objects to access fp_.
   friend class BedFullFileIterable;
+  friend class BedSweepQuery;
+};
+
+// A cursor for querying the records overlapping a series of regions in file
+// order; see BedReader::SweepQuery.
+class BedSweepQuery : public IterableBase {
+ public:
+  // Returns the records that overlap any bases in region, in file order.
+  StatusOr<std::vector<nucleus::genomics::v1::BedRecord>> Query(
+      const nucleus::genomics::v1::Range& region);
+
+  // The number of times the file was reread from its beginning.
+  int64 NumRewinds() const { return n_rewinds_; }
+
+  // Constructor is invoked via BedReader::SweepQuery.
+  explicit BedSweepQuery(const BedReader* reader);
+  ~BedSweepQuery() override;
+
+ private:
+  // Reads the record after next_ into next_, or sets has_next_ to false at
+  // the end of the file.
+  tensorflow::Status ReadNext();
+
+  // Reopens the file and reads its first record.
+  tensorflow::Status Rewind();
+
+  // Skips the records before the first one on contig, rewinding if contig
+  // isn't found after the current record but is in the file.
+  tensorflow::Status SkipToContig(const string& contig);
+
+  // The cursor's own stream over the file, so that it can be reread.
+  std::unique_ptr<TextReader> text_reader_;
+
+  // The next record that hasn't been buffered or skipped, if has_next_.
+  nucleus::genomics::v1::BedRecord next_;
+  bool has_next_ = false;
+
+  // The contig and start of the previous region, or an empty contig before
+  // the first query.
+  string contig_;
+  int64 last_start_ = 0;
+
+  // The records read so far that end after last_start_, in file order.
+  std::vector<nucleus::genomics::v1::BedRecord> buffer_;
+
+  // The contigs of the records read so far, which are all those of the file
+  // once read_whole_file_ is set.
+  std::unordered_set<string> contigs_;
+  bool read_whole_file_ = false;
+
+  int64 n_rewinds_ = 0;
 };
 
 }  // namespace nucleus
@@ -20,6 +20,7 @@
 #include "nucleus/testing/protocol-buffer-matchers.h"
 #include "nucleus/testing/test_utils.h"
 #include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
 
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
@@ -32,6 +33,7 @@ namespace nucleus {
 using std::vector;
 
 using ::testing::Pointwise;
+using ::testing::SizeIs;
 
 constexpr char kBedFilename[] = "test_regions.bed";
 constexpr char kGzippedBedFilename[] = "test_regions.bed.gz";
@@ -112,6 +114,56 @@ TEST_F(BedReaderTest, FieldRestrictionWorks) {
   EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), expected));
 }
 
+TEST_F(BedReaderTest, SweepQueryWorks) {
+  std::unique_ptr<BedReader> reader =
+      std::move(BedReader::FromFile(GetTestData(kBedFilename),
+                                    nucleus::genomics::v1::BedReaderOptions())
+                    .ValueOrDie());
+  auto sweep = reader->SweepQuery().ValueOrDie();
+
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 5, 15)).ValueOrDie(),
+              Pointwise(EqualsProto(), {golden_[0]}));
+  // The first record still overlaps this region, so it is reused.
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 15, 150)).ValueOrDie(),
+              Pointwise(EqualsProto(), golden_));
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 150, 160)).ValueOrDie(),
+              Pointwise(EqualsProto(), {golden_[1]}));
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 200, 300)).ValueOrDie(),
+              SizeIs(0));
+  EXPECT_EQ(0, sweep->NumRewinds());
+
+  // Going back rereads the file.
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 0, 300)).ValueOrDie(),
+              Pointwise(EqualsProto(), golden_));
+  EXPECT_EQ(1, sweep->NumRewinds());
+
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 10, 10)).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Malformed region"));
+}
+
+TEST_F(BedReaderTest, SweepQueryOfMissingContigDoesNotReread) {
+  std::unique_ptr<BedReader> reader =
+      std::move(BedReader::FromFile(GetTestData(kBedFilename),
+                                    nucleus::genomics::v1::BedReaderOptions())
+                    .ValueOrDie());
+  auto sweep = reader->SweepQuery().ValueOrDie();
+
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 5, 15)).ValueOrDie(),
+              Pointwise(EqualsProto(), {golden_[0]}));
+  // Looking for chr2 reads to the end of the file, after which the file is
+  // known not to have it, nor chr3.
+  EXPECT_THAT(sweep->Query(MakeRange("chr2", 0, 100)).ValueOrDie(), SizeIs(0));
+  EXPECT_THAT(sweep->Query(MakeRange("chr3", 0, 100)).ValueOrDie(), SizeIs(0));
+  EXPECT_EQ(0, sweep->NumRewinds());
+
+  // Going back to chr1 still rereads the file, once.
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 150, 160)).ValueOrDie(),
+              Pointwise(EqualsProto(), {golden_[1]}));
+  EXPECT_THAT(sweep->Query(MakeRange("chr2", 0, 100)).ValueOrDie(), SizeIs(0));
+  EXPECT_EQ(1, sweep->NumRewinds());
+}
+
 TEST_F(BedReaderTest, MalformedBedRecord) {
   std::unique_ptr<BedReader> reader =
       std::move(BedReader::FromFile(GetTestData(kMalformedBedFilename),
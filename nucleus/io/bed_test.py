@@ -22,6 +22,7 @@ from absl.testing import parameterized
 
 from nucleus.io import bed
 from nucleus.protos import bed_pb2
+from nucleus.protos import reference_pb2
 from nucleus.testing import test_utils
 
 _VALID_NUM_BED_FIELDS = [3, 4, 5, 6, 8, 9, 12]
@@ -121,5 +122,58 @@ class BedWriterTests(parameterized.TestCase):
       self.assertEqual(records, v2_records)
 
 
+class BedAlgebraTests(parameterized.TestCase):
+  """Tests for the set operations on BED files."""
+
+  def setUp(self):
+    self.a = test_utils.test_tmpfile(
+        'a.bed', contents='chr1\t0\t10\nchr1\t5\t20\nchr2\t0\t5\n')
+    self.b = test_utils.test_tmpfile(
+        'b.bed', contents='chr1\t8\t12\nchr3\t0\t10\n')
+    self.contigs = [
+        reference_pb2.ContigInfo(name='chr1', n_bases=100),
+        reference_pb2.ContigInfo(name='chr2', n_bases=50),
+        reference_pb2.ContigInfo(name='chr3', n_bases=20),
+    ]
+    self.output = test_utils.test_tmpfile('output.bed')
+
+  def regions(self):
+    with bed.BedReader(self.output) as reader:
+      return [(r.reference_name, r.start, r.end, r.score)
+              for r in reader.iterate()]
+
+  def test_merge(self):
+    bed.merge([self.a, self.b], self.output)
+    self.assertEqual(self.regions(), [('chr1', 0, 20, 0), ('chr2', 0, 5, 0),
+                                      ('chr3', 0, 10, 0)])
+
+  def test_intersect(self):
+    bed.intersect([self.a, self.b], self.output, self.contigs)
+    self.assertEqual(self.regions(), [('chr1', 8, 12, 0)])
+
+  def test_subtract(self):
+    bed.subtract(self.a, [self.b], self.output)
+    self.assertEqual(self.regions(), [('chr1', 0, 8, 0), ('chr1', 12, 20, 0),
+                                      ('chr2', 0, 5, 0)])
+
+  def test_complement(self):
+    bed.complement(self.a, self.output, self.contigs)
+    self.assertEqual(self.regions(), [('chr1', 20, 100, 0), ('chr2', 5, 50, 0),
+                                      ('chr3', 0, 20, 0)])
+
+  def test_coverage(self):
+    bed.coverage([self.a, self.b], self.output)
+    self.assertEqual(self.regions(), [('chr1', 0, 5, 1), ('chr1', 5, 8, 2),
+                                      ('chr1', 8, 10, 3), ('chr1', 10, 12, 2),
+                                      ('chr1', 12, 20, 1), ('chr2', 0, 5, 1),
+                                      ('chr3', 0, 10, 1)])
+
+  def test_unsorted_input(self):
+    unsorted = test_utils.test_tmpfile(
+        'unsorted.bed', contents='chr2\t0\t10\nchr1\t0\t10\n')
+    with self.assertRaisesRegexp(ValueError, 'is not sorted'):
+      bed.merge([unsorted], self.output)
+
+
 if __name__ == '__main__':
   absltest.main()
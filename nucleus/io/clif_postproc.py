@@ -38,6 +38,11 @@ class WrappedCppIterable(six.Iterator):
   def __init__(self, cc_iterable):
     self._cc_iterable = cc_iterable
 
+  @property
+  def cc_iterable(self):
+    """Returns the underlying C++ iterable, for passing to other C++ code."""
+    return self._cc_iterable
+
   def __enter__(self):
     self._cc_iterable.__enter__()
     return self
@@ -11,7 +11,7 @@
 # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 # See the License for the specific language governing permissions and
 # limitations under the License.
-"""Classes for reading FASTA files.
+"""Classes for reading and writing FASTA files.
 
 The FASTA format is described at
 https://en.wikipedia.org/wiki/FASTA_format
@@ -31,6 +31,22 @@ with fasta.RefFastaReader(input_path) as reader:
 If `input_path` ends with '.gz', it is assumed to be compressed.  All FASTA
 files are assumed to be indexed with the index file located at
 `input_path + '.fai'`.
+
+API for writing:
+
+```python
+from nucleus.io import fasta
+
+with fasta.FastaWriter(output_path) as writer:
+  writer.write_bases('chr1', 'ACGTACGT')
+  for ref_seq in ref_seqs:
+    writer.write(ref_seq)
+```
+
+where `ref_seqs` are `nucleus.genomics.v1.ReferenceSequence` protos, each
+holding a whole contig. The FAI index (and, if `output_path` ends with '.gz' so
+that the FASTA is bgzipped, the GZI index) is written alongside the FASTA, so
+it can be read by `RefFastaReader` as soon as the writer is closed.
 """
 
 from __future__ import absolute_import
@@ -39,11 +55,12 @@ from __future__ import print_function
 
 import collections
 
-import six
-
 from nucleus.io import genomics_reader
+from nucleus.io import genomics_writer
 from nucleus.io.python import fasta_reader
+from nucleus.io.python import fasta_writer
 from nucleus.io.python import reference_fai
+from nucleus.io.python import reference_mmap
 from nucleus.protos import reference_pb2
 from nucleus.util import ranges
 
@@ -55,19 +72,25 @@ RefFastaHeader = collections.namedtuple(
 class RefFastaReader(genomics_reader.GenomicsReader):
   """Class for reading from FASTA files containing a reference genome."""
 
-  def __init__(self, input_path, cache_size=None):
+  def __init__(self, input_path, cache_size=None, use_mmap=False):
     """Initializes a RefFastaReader.
 
     Args:
       input_path: string. A path to a resource containing FASTA records.
       cache_size: integer. Number of bases to cache from previous queries.
         Defaults to 64K.  The cache can be disabled using cache_size=0.
+      use_mmap: bool. If True, the FASTA, which must be uncompressed, is
+        memory-mapped and read directly instead of through htslib. cache_size
+        is ignored, as there's no need for a cache.
     """
     super(RefFastaReader, self).__init__()
 
     fasta_path = input_path
     fai_path = fasta_path + '.fai'
-    if cache_size is None:
+    if use_mmap:
+      self._reader = reference_mmap.GenomeReferenceMmap.from_file(
+          fasta_path, fai_path)
+    elif cache_size is None:
       # Use the C++-defined default cache size.
       self._reader = reference_fai.GenomeReferenceFai.from_file(
           fasta_path, fai_path)
@@ -91,6 +114,20 @@ class RefFastaReader(genomics_reader.GenomicsReader):
     """Returns the base pairs (as a string) in the given region."""
     return self._reader.bases(region)
 
+  def query_batch(self, regions):
+    """Returns a list of the base pairs in each of regions, in their order.
+
+    This is much faster than calling query on each region when there are many
+    small regions, as nearby regions are fetched together.
+
+    Args:
+      regions: iterable of nucleus.genomics.v1.Range protos.
+
+    Returns:
+      A list of strings, the bases of each region.
+    """
+    return self._reader.bases_batch(list(regions))
+
   def is_valid(self, region):
     """Returns whether the region is contained in this FASTA file."""
     return self._reader.is_valid_interval(region)
@@ -156,8 +193,36 @@ class InMemoryRefReader(genomics_reader.GenomicsReader):
           reference_pb2.ContigInfo(
               name=contig_name, n_bases=end, pos_in_fasta=i))
 
-    self._reader = fasta_reader.InMemoryGenomeReference.create(
-        contigs, ref_seqs)
+    self._set_c_reader(
+        fasta_reader.InMemoryGenomeReference.create(contigs, ref_seqs))
+
+  @classmethod
+  def from_fasta(cls, input_path, num_threads=1, lazy=False):
+    """Returns an InMemoryRefReader holding all the bases of a FASTA file.
+
+    The FASTA is read by num_threads threads, in chunks, so that even a single
+    large contig is read in parallel.
+
+    Args:
+      input_path: string. A path to an indexed FASTA file, with its index at
+        `input_path + '.fai'`. It may be bgzipped.
+      num_threads: int. The number of threads reading the FASTA.
+      lazy: bool. If True, each contig is read the first time it is queried,
+        rather than all of them up front, so a job that only queries a few
+        contigs reads only those.
+
+    Returns:
+      An InMemoryRefReader.
+    """
+    reader = cls.__new__(cls)
+    super(InMemoryRefReader, reader).__init__()
+    reader._set_c_reader(
+        fasta_reader.InMemoryGenomeReference.from_fasta(
+            input_path, input_path + '.fai', num_threads, lazy))
+    return reader
+
+  def _set_c_reader(self, c_reader):
+    self._reader = c_reader
     self.header = RefFastaHeader(contigs=self._reader.contigs)
 
   def iterate(self):
@@ -173,6 +238,20 @@ class InMemoryRefReader(genomics_reader.GenomicsReader):
     """Returns the base pairs (as a string) in the given region."""
     return self._reader.bases(region)
 
+  def query_batch(self, regions):
+    """Returns a list of the base pairs in each of regions, in their order.
+
+    This is much faster than calling query on each region when there are many
+    small regions, as nearby regions are fetched together.
+
+    Args:
+      regions: iterable of nucleus.genomics.v1.Range protos.
+
+    Returns:
+      A list of strings, the bases of each region.
+    """
+    return self._reader.bases_batch(list(regions))
+
   def is_valid(self, region):
     """Returns whether the region is contained in this FASTA file."""
     return self._reader.is_valid_interval(region)
@@ -186,20 +265,64 @@ class InMemoryRefReader(genomics_reader.GenomicsReader):
     """Returns the underlying C++ reader."""
     return self._reader
 
-  def __str__(self):
+  @property
+  def load_seconds(self):
+    """Returns the seconds it took to read each contig read from a FASTA.
 
-    def _format_refseq(refseq):
-      bases = refseq.bases
-      if len(bases) >= 50:
-        bases = bases[0:50] + '...'
-      return 'Contig(chrom={} start={}, end={}, bases={})'.format(
-          refseq.region.reference_name, refseq.region.start, refseq.region.end,
-          bases)
+    Returns:
+      A dict from the names of the contigs read so far by a reader made by
+      from_fasta to the number of seconds it took to read each. Empty for other
+      readers.
+    """
+    return self._reader.load_seconds
 
+  def __str__(self):
+    # Only the contigs' names and lengths are shown, so that this neither
+    # copies the bases nor loads the contigs of a lazily loaded reader.
     contigs_strs = [
-        _format_refseq(refseq)
-        for refseq in six.itervalues(self._reader.reference_sequences)
+        'Contig(chrom={}, n_bases={})'.format(contig.name, contig.n_bases)
+        for contig in self.header.contigs
     ]
     return 'InMemoryRefReader(contigs={})'.format(''.join(contigs_strs))
 
   __repr__ = __str__
+
+
+class FastaWriter(genomics_writer.GenomicsWriter):
+  """Class for writing contigs to an indexed FASTA file."""
+
+  def __init__(self, output_path, line_bases=None):
+    """Initializes a FastaWriter.
+
+    Args:
+      output_path: str. The path to which to write the FASTA file. It is
+        bgzipped if output_path ends with '.gz'.
+      line_bases: int. The number of bases on each line of the FASTA. Defaults
+        to 60.
+    """
+    super(FastaWriter, self).__init__()
+
+    if line_bases is None:
+      # Use the C++-defined default line length.
+      self._writer = fasta_writer.FastaWriter.to_file(output_path)
+    else:
+      self._writer = fasta_writer.FastaWriter.to_file(output_path, line_bases)
+
+  def write(self, proto):
+    """Writes a ReferenceSequence proto holding a whole contig."""
+    self._writer.write(proto)
+
+  def write_bases(self, name, bases, description=''):
+    """Writes a contig with the given name, bases and description."""
+    self._writer.write_bases(name, description, bases)
+
+  def start_contig(self, name, description=''):
+    """Starts a contig whose bases are written by calls to append_bases."""
+    self._writer.start_contig(name, description)
+
+  def append_bases(self, bases):
+    """Appends bases to the contig started by the last start_contig call."""
+    self._writer.append_bases(bases)
+
+  def __exit__(self, exit_type, exit_value, exit_traceback):
+    self._writer.__exit__(exit_type, exit_value, exit_traceback)
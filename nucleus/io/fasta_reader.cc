@@ -18,12 +18,19 @@
 #include "nucleus/io/fasta_reader.h"
 
 #include <algorithm>
+#include <cstring>
+#include <thread>  // NOLINT
+#include <utility>
 
+#include "nucleus/io/reference_fai.h"
 #include "nucleus/util/utils.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
 
 namespace nucleus {
 
+using nucleus::genomics::v1::ContigInfo;
 using nucleus::genomics::v1::Range;
 using nucleus::genomics::v1::ReferenceSequence;
 
@@ -74,10 +81,182 @@ InMemoryGenomeReference::Create(
       new InMemoryGenomeReference(contigs, seqs_map));
 }
 
+StatusOr<std::unique_ptr<InMemoryGenomeReference>>
+InMemoryGenomeReference::FromFasta(const string& fasta_path,
+                                   const string& fai_path, int num_threads,
+                                   bool lazy) {
+  if (num_threads < 1)
+    return tensorflow::errors::InvalidArgument("num_threads must be positive");
+  // Each loading thread opens the FASTA itself; this reader just lists the
+  // contigs, and checks that it can be opened.
+  StatusOr<std::unique_ptr<GenomeReferenceFai>> fai =
+      GenomeReferenceFai::FromFile(fasta_path, fai_path, 0);
+  TF_RETURN_IF_ERROR(fai.status());
+  const std::vector<ContigInfo> contigs = fai.ValueOrDie()->Contigs();
+  TF_RETURN_IF_ERROR(fai.ValueOrDie()->Close());
+
+  // Every contig gets a ReferenceSequence up front, so that filling one in
+  // never changes the structure of the map other threads may be reading.
+  std::unordered_map<string, ReferenceSequence> seqs;
+  for (const ContigInfo& contig : contigs) {
+    ReferenceSequence seq;
+    *seq.mutable_region() = MakeRange(contig.name(), 0, 0);
+    seqs.emplace(contig.name(), std::move(seq));
+  }
+  std::unique_ptr<InMemoryGenomeReference> reference(
+      new InMemoryGenomeReference(contigs, std::move(seqs)));
+  reference->fasta_path_ = fasta_path;
+  reference->fai_path_ = fai_path;
+  reference->num_threads_ = num_threads;
+  reference->lazy_ = lazy;
+  reference->resident_.reset(new std::atomic<bool>[contigs.size()]);
+  reference->load_mutexes_.reset(new absl::Mutex[contigs.size()]);
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    reference->contig_index_[contigs[i].name()] = i;
+    reference->resident_[i].store(false, std::memory_order_relaxed);
+  }
+
+  if (!lazy) {
+    std::vector<int> indices(contigs.size());
+    for (size_t i = 0; i < contigs.size(); ++i) indices[i] = i;
+    TF_RETURN_IF_ERROR(reference->LoadContigs(indices));
+  }
+  return std::move(reference);
+}
+
+tensorflow::Status InMemoryGenomeReference::LoadContigs(
+    const std::vector<int>& indices) const {
+  // The chunks of the contigs, as (index in contigs_, start), and where the
+  // bases of each contig go.
+  std::vector<std::pair<int, int64>> chunks;
+  std::unordered_map<int, char*> contig_bases;
+  // The number of chunks of each contig left to read, and when reading the
+  // first began.
+  std::unordered_map<int, int64> chunks_left;
+  std::unordered_map<int, uint64> start_micros;
+  tensorflow::Env* env = tensorflow::Env::Default();
+  for (int index : indices) {
+    const ContigInfo& contig = contigs_[index];
+    ReferenceSequence& seq = seqs_.at(contig.name());
+    *seq.mutable_region() = MakeRange(contig.name(), 0, contig.n_bases());
+    seq.mutable_bases()->resize(contig.n_bases());
+    contig_bases[index] = &(*seq.mutable_bases())[0];
+    for (int64 start = 0; start < contig.n_bases();
+         start += IN_MEMORY_LOAD_CHUNK_BASES) {
+      chunks.emplace_back(index, start);
+    }
+    chunks_left[index] =
+        (contig.n_bases() + IN_MEMORY_LOAD_CHUNK_BASES - 1) /
+        IN_MEMORY_LOAD_CHUNK_BASES;
+    if (contig.n_bases() == 0) {
+      absl::MutexLock lock(&load_seconds_mutex_);
+      load_seconds_[contig.name()] = 0.0;
+      resident_[index].store(true, std::memory_order_release);
+    }
+  }
+
+  absl::Mutex mutex;
+  size_t next_chunk = 0;
+  tensorflow::Status status;
+  auto work = [&]() {
+    std::unique_ptr<GenomeReferenceFai> reader;
+    while (true) {
+      size_t chunk;
+      {
+        absl::MutexLock lock(&mutex);
+        if (next_chunk == chunks.size() || !status.ok()) break;
+        chunk = next_chunk++;
+        start_micros.emplace(chunks[chunk].first, env->NowMicros());
+      }
+      const int index = chunks[chunk].first;
+      const ContigInfo& contig = contigs_[index];
+      const int64 start = chunks[chunk].second;
+      const int64 end =
+          std::min<int64>(start + IN_MEMORY_LOAD_CHUNK_BASES, contig.n_bases());
+      StatusOr<string> bases;
+      if (reader == nullptr) {
+        StatusOr<std::unique_ptr<GenomeReferenceFai>> opened =
+            GenomeReferenceFai::FromFile(fasta_path_, fai_path_, 0);
+        if (opened.ok()) {
+          reader = std::move(opened.ValueOrDie());
+        } else {
+          bases = opened.status();
+        }
+      }
+      if (reader != nullptr) {
+        bases = reader->GetBases(MakeRange(contig.name(), start, end));
+      }
+      if (!bases.ok()) {
+        absl::MutexLock lock(&mutex);
+        if (status.ok()) status = bases.status();
+        break;
+      }
+      std::memcpy(contig_bases.at(index) + start, bases.ValueOrDie().data(),
+                  end - start);
+
+      absl::MutexLock lock(&mutex);
+      if (--chunks_left[index] == 0) {
+        const double seconds =
+            (env->NowMicros() - start_micros[index]) / 1e6;
+        VLOG(1) << "Read " << contig.n_bases() << " bases of "
+                << contig.name() << " in " << seconds << "s";
+        {
+          absl::MutexLock seconds_lock(&load_seconds_mutex_);
+          load_seconds_[contig.name()] = seconds;
+        }
+        resident_[index].store(true, std::memory_order_release);
+      }
+    }
+  };
+  const int num_threads =
+      std::min<int64>(num_threads_, std::max<size_t>(chunks.size(), 1));
+  if (num_threads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; ++i) workers.emplace_back(work);
+    for (std::thread& worker : workers) worker.join();
+  }
+  if (!status.ok()) {
+    // Contigs left partly read stay non-resident, and go back to being empty
+    // so that a later call reads them again from scratch.
+    for (int index : indices) {
+      if (resident_[index].load(std::memory_order_acquire)) continue;
+      ReferenceSequence& seq = seqs_.at(contigs_[index].name());
+      *seq.mutable_region() = MakeRange(contigs_[index].name(), 0, 0);
+      seq.clear_bases();
+    }
+  }
+  return status;
+}
+
+tensorflow::Status InMemoryGenomeReference::EnsureResident(
+    const string& contig_name) const {
+  const auto it = contig_index_.find(contig_name);
+  if (it == contig_index_.end()) {
+    return tensorflow::errors::NotFound("Unknown contig ", contig_name);
+  }
+  const int index = it->second;
+  if (resident_[index].load(std::memory_order_acquire))
+    return tensorflow::Status::OK();
+  // Another thread may have read the contig while we waited for the lock.
+  absl::MutexLock lock(&load_mutexes_[index]);
+  if (resident_[index].load(std::memory_order_acquire))
+    return tensorflow::Status::OK();
+  return LoadContigs({index});
+}
+
+std::unordered_map<string, double> InMemoryGenomeReference::LoadSeconds()
+    const {
+  absl::MutexLock lock(&load_seconds_mutex_);
+  return load_seconds_;
+}
+
 StatusOr<string> InMemoryGenomeReference::GetBases(const Range& range) const {
   if (!IsValidInterval(range))
     return tensorflow::errors::InvalidArgument("Invalid interval: ",
                                                range.ShortDebugString());
+  if (lazy_) TF_RETURN_IF_ERROR(EnsureResident(range.reference_name()));
 
   const ReferenceSequence& seq = seqs_.at(range.reference_name());
 
@@ -17,15 +17,20 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_FASTA_READER_H_
 #define THIRD_PARTY_NUCLEUS_IO_FASTA_READER_H_
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
+#include "absl/synchronization/mutex.h"
 #include "nucleus/io/reference.h"
 #include "nucleus/platform/types.h"
 #include "nucleus/vendor/statusor.h"
 
 namespace nucleus {
 
+// The most bases of a contig InMemoryGenomeReference::FromFasta reads at once.
+constexpr int64 IN_MEMORY_LOAD_CHUNK_BASES = 16 * 1024 * 1024;
 
 // An FASTA reader backed by in-memory ReferenceSequence protos.
 //
@@ -47,6 +52,11 @@ namespace nucleus {
 // base is at position 10. This makes it straightforward to cache a small region
 // of a full chromosome without having to store the entire chromosome sequence
 // in memory (potentially big!).
+//
+// An InMemoryGenomeReference can also hold all the bases of an indexed FASTA,
+// read by FromFasta either up front or a contig at a time as GetBases first
+// needs them. GetBases may be called concurrently from any number of threads,
+// and doesn't lock once the contig it reads is in memory.
 class InMemoryGenomeReference : public GenomeReference {
  public:
   // Creates a new InMemoryGenomeReference backed by ReferenceSequence protos.
@@ -54,6 +64,21 @@ class InMemoryGenomeReference : public GenomeReference {
       const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
       const std::vector<nucleus::genomics::v1::ReferenceSequence>& seqs);
 
+  // Creates a new InMemoryGenomeReference holding all the bases of the
+  // FASTA at fasta_path, indexed by the FAI at fai_path.
+  //
+  // Contigs are read in chunks of up to IN_MEMORY_LOAD_CHUNK_BASES bases by
+  // num_threads threads, each with its own GenomeReferenceFai, so that large
+  // contigs are read in parallel too. If lazy is false, all the contigs are
+  // read before FromFasta returns. Otherwise a contig is read the first time
+  // GetBases is asked for its bases, so a job touching only a few contigs
+  // reads only those; calls for other contigs that are already in memory
+  // don't wait for it. If reading a contig fails, GetBases returns the error
+  // and the next call for that contig tries to read it again.
+  static StatusOr<std::unique_ptr<InMemoryGenomeReference>> FromFasta(
+      const string& fasta_path, const string& fai_path, int num_threads,
+      bool lazy);
+
   // Disable copy and assignment operations
   InMemoryGenomeReference(const InMemoryGenomeReference& other) = delete;
   InMemoryGenomeReference& operator=(const InMemoryGenomeReference&) = delete;
@@ -63,6 +88,10 @@ class InMemoryGenomeReference : public GenomeReference {
     return contigs_;
   }
 
+  // The ReferenceSequence of each contig, by name. The contigs of a lazy
+  // reference that haven't been read yet have empty ReferenceSequences, which
+  // GetBases may fill in concurrently, so the map mustn't be read while
+  // GetBases may be called.
   const std::unordered_map<string, nucleus::genomics::v1::ReferenceSequence>&
       ReferenceSequences() const {
     return seqs_;
@@ -71,6 +100,11 @@ class InMemoryGenomeReference : public GenomeReference {
   StatusOr<string> GetBases(
       const nucleus::genomics::v1::Range& range) const override;
 
+  // The number of seconds it took to read each contig FromFasta has read so
+  // far, by name, from the start of reading its first chunk to the end of
+  // reading its last. Empty for references made by Create.
+  std::unordered_map<string, double> LoadSeconds() const;
+
  private:
   // Must use one of the static factory methods.
   explicit InMemoryGenomeReference(
@@ -79,9 +113,38 @@ class InMemoryGenomeReference : public GenomeReference {
           seqs)
       : contigs_(contigs), seqs_(seqs) {}
 
+  // Reads the contigs at indices of contigs_ from fasta_path_ into seqs_, and
+  // marks them resident.
+  tensorflow::Status LoadContigs(const std::vector<int>& indices) const;
+
+  // Reads the contig named contig_name unless it is resident.
+  tensorflow::Status EnsureResident(const string& contig_name) const;
+
   const std::vector<nucleus::genomics::v1::ContigInfo> contigs_;
-  const std::unordered_map<string, nucleus::genomics::v1::ReferenceSequence>
+  // Only mutable to fill in the contigs of a lazy reference, each before it is
+  // marked resident and by the one thread holding its load_mutexes_ entry.
+  mutable std::unordered_map<string, nucleus::genomics::v1::ReferenceSequence>
       seqs_;
+
+  // The FASTA the contigs are read from, and with how many threads. Unset for
+  // references made by Create.
+  string fasta_path_;
+  string fai_path_;
+  int num_threads_ = 0;
+  bool lazy_ = false;
+
+  // The index in contigs_ of each contig, by name.
+  std::unordered_map<string, int> contig_index_;
+  // Whether each of contigs_ has all its bases in seqs_. An entry is set,
+  // with release semantics, only once its bases have been read and is never
+  // cleared, so GetBases reads resident contigs without locking.
+  std::unique_ptr<std::atomic<bool>[]> resident_;
+  // Held while reading the corresponding contig of a lazy reference.
+  std::unique_ptr<absl::Mutex[]> load_mutexes_;
+
+  // Guards load_seconds_.
+  mutable absl::Mutex load_seconds_mutex_;
+  mutable std::unordered_map<string, double> load_seconds_;
 };
 
 }  // namespace nucleus
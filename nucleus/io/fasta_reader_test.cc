@@ -0,0 +1,125 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/fasta_reader.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+using absl::StrCat;
+
+namespace nucleus {
+
+using nucleus::genomics::v1::Range;
+
+std::unique_ptr<InMemoryGenomeReference> LoadLazily(const string& fasta) {
+  StatusOr<std::unique_ptr<InMemoryGenomeReference>> result =
+      InMemoryGenomeReference::FromFasta(fasta, StrCat(fasta, ".fai"),
+                                         /*num_threads=*/2, /*lazy=*/true);
+  TF_CHECK_OK(result.status());
+  return std::move(result.ValueOrDie());
+}
+
+TEST(InMemoryGenomeReferenceTest, ConcurrentLazyReadsMatchFai) {
+  const string fasta = GetTestData("test.fasta");
+  auto fai = std::move(
+      GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"), 0)
+          .ValueOrDie());
+  // Windows of every contig, interleaved so that the threads race to read
+  // each contig and then query it while others are still being read.
+  std::vector<Range> ranges;
+  std::vector<string> expected;
+  for (int64 start = 0; start < 100; start += 7) {
+    for (const auto& contig : fai->Contigs()) {
+      if (start >= contig.n_bases()) continue;
+      ranges.push_back(MakeRange(
+          contig.name(), start, std::min<int64>(start + 20, contig.n_bases())));
+      expected.push_back(fai->GetBases(ranges.back()).ValueOrDie());
+    }
+  }
+
+  for (int repeat = 0; repeat < 20; ++repeat) {
+    auto reference = LoadLazily(fasta);
+    constexpr int kNumThreads = 8;
+    std::vector<std::vector<string>> bases(kNumThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+      threads.emplace_back([&reference, &ranges, &bases, i]() {
+        // Each thread starts at a different range.
+        for (size_t j = 0; j < ranges.size(); ++j) {
+          const Range& range = ranges[(i + j) % ranges.size()];
+          StatusOr<string> result = reference->GetBases(range);
+          bases[i].push_back(result.ok() ? result.ValueOrDie()
+                                         : result.status().ToString());
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    for (int i = 0; i < kNumThreads; ++i) {
+      for (size_t j = 0; j < ranges.size(); ++j) {
+        const size_t k = (i + j) % ranges.size();
+        EXPECT_EQ(bases[i][j], expected[k]) << ranges[k].ShortDebugString();
+      }
+    }
+    EXPECT_EQ(reference->LoadSeconds().size(), fai->Contigs().size());
+  }
+}
+
+TEST(InMemoryGenomeReferenceTest, RetriesFailedLazyRead) {
+  const string fasta = MakeTempFile("retry.fasta");
+  const string contents = ">a\nACGTACGTAC\n>b\nGGGGCCCCAT\n";
+  tensorflow::Env* env = tensorflow::Env::Default();
+  TF_CHECK_OK(tensorflow::WriteStringToFile(env, fasta, contents));
+  TF_CHECK_OK(tensorflow::WriteStringToFile(
+      env, StrCat(fasta, ".fai"), "a\t10\t3\t10\t11\nb\t10\t17\t10\t11\n"));
+  auto reference = LoadLazily(fasta);
+  EXPECT_EQ(reference->GetBases(MakeRange("a", 2, 6)).ValueOrDie(), "GTAC");
+
+  // Reading b fails while the FASTA is gone, leaving it non-resident, but a
+  // is still served from memory.
+  TF_CHECK_OK(env->DeleteFile(fasta));
+  EXPECT_FALSE(reference->GetBases(MakeRange("b", 0, 4)).ok());
+  EXPECT_EQ(reference->LoadSeconds().count("b"), 0);
+  EXPECT_EQ(reference->ReferenceSequences().at("b").region().end(), 0);
+  EXPECT_EQ(reference->GetBases(MakeRange("a", 0, 4)).ValueOrDie(), "ACGT");
+
+  // Once the FASTA is back, the next call reads b.
+  TF_CHECK_OK(tensorflow::WriteStringToFile(env, fasta, contents));
+  EXPECT_EQ(reference->GetBases(MakeRange("b", 6, 10)).ValueOrDie(), "CCAT");
+  EXPECT_EQ(reference->LoadSeconds().count("b"), 1);
+}
+
+}  // namespace nucleus
@@ -25,6 +25,8 @@ import six
 from nucleus.io import fasta
 from nucleus.io.python import fasta_reader
 from nucleus.io.python import reference_fai
+from nucleus.io.python import reference_mmap
+from nucleus.protos import reference_pb2
 from nucleus.testing import test_utils
 
 from nucleus.util import ranges
@@ -49,6 +51,15 @@ class RefFastaReaderTests(parameterized.TestCase):
         test_utils.genomics_core_testdata('test.fasta')) as reader:
       self.assertIsInstance(reader.c_reader, reference_fai.GenomeReferenceFai)
 
+  def test_mmap_reader(self):
+    fasta_path = test_utils.genomics_core_testdata('test.fasta')
+    with fasta.RefFastaReader(fasta_path, use_mmap=True) as reader:
+      self.assertIsInstance(reader.c_reader,
+                            reference_mmap.GenomeReferenceMmap)
+      self.assertEqual(reader.query(ranges.make_range('chrM', 1, 6)), 'ATCAC')
+      self.assertEqual(
+          reader.query(ranges.make_range('chrM', 48, 53)), 'ATTTG')
+
 
 class InMemoryRefReaderTests(parameterized.TestCase):
 
@@ -118,6 +129,42 @@ class InMemoryRefReaderTests(parameterized.TestCase):
     with self.assertRaises(NotImplementedError):
       self.in_mem.iterate()
 
+  @parameterized.parameters(
+      dict(filename='test.fasta', num_threads=1, lazy=False),
+      dict(filename='test.fasta', num_threads=3, lazy=False),
+      dict(filename='test.fasta', num_threads=2, lazy=True),
+      dict(filename='test.fasta.gz', num_threads=2, lazy=False),
+  )
+  def test_from_fasta(self, filename, num_threads, lazy):
+    reader = fasta.InMemoryRefReader.from_fasta(
+        test_utils.genomics_core_testdata(filename), num_threads, lazy)
+    self.assertEqual(
+        [contig.name for contig in reader.header.contigs],
+        [contig.name for contig in self.fasta_reader.header.contigs])
+    for contig in self.fasta_reader.header.contigs:
+      region = ranges.make_range(contig.name, 0, contig.n_bases)
+      self.assertEqual(reader.query(region), self.fasta_reader.query(region))
+      self.assertIn(contig.name, reader.load_seconds)
+
+  def test_from_fasta_lazy_reads_queried_contigs(self):
+    reader = fasta.InMemoryRefReader.from_fasta(
+        test_utils.genomics_core_testdata('test.fasta'), lazy=True)
+    self.assertEqual(reader.load_seconds, {})
+    self.assertEqual(reader.query(ranges.make_range('chr1', 0, 5)), 'ACCAC')
+    self.assertEqual(list(reader.load_seconds), ['chr1'])
+    self.assertEqual(reader.query(ranges.make_range('chr1', 5, 6)), 'A')
+    self.assertEqual(list(reader.load_seconds), ['chr1'])
+
+  def test_str_of_lazy_reader_reads_no_contigs(self):
+    reader = fasta.InMemoryRefReader.from_fasta(
+        test_utils.genomics_core_testdata('test.fasta'), lazy=True)
+    self.assertIn('Contig(chrom=chr1, n_bases=', str(reader))
+    self.assertEqual(reader.load_seconds, {})
+
+  def test_from_fasta_missing_file(self):
+    with self.assertRaises(ValueError):
+      fasta.InMemoryRefReader.from_fasta('/this/path/does/not/exist')
+
   @parameterized.parameters(
       dict(region=ranges.make_range('chr1', 0, 10), expected=True),
       dict(region=ranges.make_range('chr1', 10, 50), expected=True),
@@ -149,6 +196,21 @@ class InMemoryRefReaderTests(parameterized.TestCase):
           self.assertEqual(
               self.in_mem.query(region), self.fasta_reader.query(region))
 
+  def test_query_batch(self):
+    regions = [
+        ranges.make_range('chr2', 100, 121),
+        ranges.make_range('chrM', 10, 20),
+        ranges.make_range('chrM', 0, 15),
+        ranges.make_range('chr1', 3, 7),
+        ranges.make_range('chrM', 10, 20),
+    ]
+    expected = [self.fasta_reader.query(region) for region in regions]
+    for reader in [self.fasta_reader, self.in_mem]:
+      self.assertEqual(reader.query_batch(regions), expected)
+      self.assertEqual(reader.query_batch([]), [])
+      with self.assertRaises(ValueError):
+        reader.query_batch(regions + [ranges.make_range('chr1', 0, 1000)])
+
   @parameterized.parameters(
       ranges.make_range('chr1', -1, 10),     # bad start.
       ranges.make_range('chr1', 10, 1),      # end < start.
@@ -172,5 +234,39 @@ class InMemoryRefReaderTests(parameterized.TestCase):
                           fasta_reader.InMemoryGenomeReference)
 
 
+
+class FastaWriterTests(parameterized.TestCase):
+
+  @parameterized.parameters('written.fasta', 'written.fasta.gz')
+  def test_written_fasta_is_readable(self, filename):
+    output_path = test_utils.test_tmpfile(filename)
+    with fasta.FastaWriter(output_path, line_bases=4) as writer:
+      writer.write(
+          reference_pb2.ReferenceSequence(
+              region=ranges.make_range('chr1', 0, 10), bases='ACGTACGTAC'))
+      writer.write_bases('chr2', 'ggccNNTT', description='second contig')
+      writer.start_contig('chr3')
+      for bases in ['A', 'CGTAC', 'GT']:
+        writer.append_bases(bases)
+
+    with fasta.RefFastaReader(output_path) as reader:
+      self.assertEqual([(contig.name, contig.n_bases)
+                        for contig in reader.header.contigs],
+                       [('chr1', 10), ('chr2', 8), ('chr3', 8)])
+      self.assertEqual(
+          reader.query(ranges.make_range('chr1', 2, 9)), 'GTACGTA')
+      self.assertEqual(
+          reader.query(ranges.make_range('chr2', 0, 8)), 'GGCCNNTT')
+      self.assertEqual(
+          reader.query(ranges.make_range('chr3', 0, 8)), 'ACGTACGT')
+
+  def test_partial_reference_sequence_is_rejected(self):
+    with fasta.FastaWriter(test_utils.test_tmpfile('partial.fasta')) as writer:
+      with self.assertRaisesRegexp(ValueError, 'must hold all the bases'):
+        writer.write(
+            reference_pb2.ReferenceSequence(
+                region=ranges.make_range('chr1', 5, 9), bases='ACGT'))
+
+
 if __name__ == '__main__':
   absltest.main()
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of fasta_writer.h
+#include "nucleus/io/fasta_writer.h"
+
+#include <algorithm>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "nucleus/io/hts_path.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+// 256 KB write buffer.
+constexpr size_t WRITER_BUFFER_SIZE = 256 * 1024;
+
+namespace {
+
+// Returns true if c can be written as a base: a letter (in either case, for
+// the IUPAC codes and soft-masking), or '*' or '-'.
+bool IsSequenceByte(char c) {
+  return absl::ascii_isalpha(c) || c == '*' || c == '-';
+}
+
+// Returns InvalidArgument if any of bases can't be written as a base, since
+// line breaks, spaces and '>' in particular would corrupt the FASTA and FAI.
+tf::Status CheckBases(const string& bases) {
+  const auto it = std::find_if_not(bases.begin(), bases.end(), IsSequenceByte);
+  if (it != bases.end()) {
+    return tf::errors::InvalidArgument(
+        "Invalid base '", absl::CEscape(string(1, *it)), "' at offset ",
+        it - bases.begin());
+  }
+  return tf::Status::OK();
+}
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+//
+// Writer for indexed FASTA files.
+//
+// -----------------------------------------------------------------------------
+
+StatusOr<std::unique_ptr<FastaWriter>> FastaWriter::ToFile(
+    const string& fasta_path, int line_bases) {
+  if (line_bases <= 0) {
+    return tf::errors::InvalidArgument("line_bases must be positive");
+  }
+  const char* mode = absl::EndsWith(fasta_path, ".gz") ? "wb" : "w";
+  htsFile* fp = hts_open_x(fasta_path.c_str(), mode);
+  if (fp == nullptr) {
+    return tf::errors::Unknown("Could not open file for writing: ",
+                               fasta_path);
+  }
+  // The GZI has to be built from the first block on.
+  if (fp->format.compression == bgzf &&
+      bgzf_index_build_init(fp->fp.bgzf) < 0) {
+    hts_close(fp);
+    return tf::errors::Internal("Couldn't index blocks of ", fasta_path);
+  }
+  return absl::WrapUnique(new FastaWriter(fasta_path, fp, line_bases));
+}
+
+FastaWriter::FastaWriter(const string& fasta_path, htsFile* hts_file,
+                         int line_bases)
+    : fasta_path_(fasta_path), hts_file_(hts_file), line_bases_(line_bases) {
+  CHECK(hts_file_ != nullptr);
+}
+
+FastaWriter::~FastaWriter() {
+  if (hts_file_) {
+    TF_CHECK_OK(Close());
+  }
+}
+
+tf::Status FastaWriter::Write(
+    const nucleus::genomics::v1::ReferenceSequence& record) {
+  if (record.region().start() != 0 ||
+      record.region().end() != static_cast<int64>(record.bases().size())) {
+    return tf::errors::InvalidArgument(
+        "ReferenceSequence must hold all the bases of its contig, but has ",
+        record.bases().size(), " bases for ",
+        record.region().ShortDebugString());
+  }
+  return WriteBases(record.region().reference_name(), "", record.bases());
+}
+
+tf::Status FastaWriter::WriteBases(const string& name,
+                                   const string& description,
+                                   const string& bases) {
+  // Check the bases before starting the contig, so that nothing is written.
+  TF_RETURN_IF_ERROR(CheckBases(bases));
+  TF_RETURN_IF_ERROR(StartContig(name, description));
+  return BufferBases(bases);
+}
+
+tf::Status FastaWriter::StartContig(const string& name,
+                                    const string& description) {
+  if (!hts_file_) {
+    return tf::errors::FailedPrecondition(
+        "Cannot write to closed FASTA stream.");
+  }
+  if (name.empty() ||
+      std::any_of(name.begin(), name.end(), absl::ascii_isspace)) {
+    return tf::errors::InvalidArgument("Invalid contig name '", name, "'");
+  }
+  if (absl::StrContains(description, '\n')) {
+    return tf::errors::InvalidArgument("Description of contig ", name,
+                                       " has a line break");
+  }
+  if (!names_.insert(name).second) {
+    return tf::errors::InvalidArgument("Contig ", name,
+                                       " has already been written");
+  }
+  FinishContig();
+  absl::StrAppend(&buffer_, ">", name);
+  if (!description.empty()) absl::StrAppend(&buffer_, " ", description);
+  buffer_.push_back('\n');
+  in_contig_ = true;
+  contig_name_ = name;
+  contig_offset_ = flushed_bytes_ + buffer_.size();
+  contig_bases_ = 0;
+  return tf::Status::OK();
+}
+
+tf::Status FastaWriter::AppendBases(const string& bases) {
+  if (!hts_file_) {
+    return tf::errors::FailedPrecondition(
+        "Cannot write to closed FASTA stream.");
+  }
+  if (!in_contig_) {
+    return tf::errors::FailedPrecondition(
+        "Cannot append bases before starting a contig");
+  }
+  TF_RETURN_IF_ERROR(CheckBases(bases));
+  return BufferBases(bases);
+}
+
+tf::Status FastaWriter::BufferBases(const string& bases) {
+  // Continue the current line, then break the rest into whole lines.
+  for (size_t pos = 0; pos < bases.size();) {
+    const size_t n = std::min<size_t>(
+        line_bases_ - contig_bases_ % line_bases_, bases.size() - pos);
+    buffer_.append(bases, pos, n);
+    pos += n;
+    contig_bases_ += n;
+    if (contig_bases_ % line_bases_ == 0) buffer_.push_back('\n');
+    if (buffer_.size() >= WRITER_BUFFER_SIZE) TF_RETURN_IF_ERROR(Flush());
+  }
+  return tf::Status::OK();
+}
+
+void FastaWriter::FinishContig() {
+  if (!in_contig_) return;
+  // Terminate the contig's last line unless it is full, in which case
+  // AppendBases has already done so.
+  if (contig_bases_ % line_bases_ != 0) buffer_.push_back('\n');
+  // An empty contig has no lines.
+  const int line_bases = contig_bases_ > 0 ? line_bases_ : 0;
+  const int line_width = contig_bases_ > 0 ? line_bases_ + 1 : 0;
+  absl::StrAppend(&fai_, contig_name_, "\t", contig_bases_, "\t",
+                  contig_offset_, "\t", line_bases, "\t", line_width, "\n");
+  in_contig_ = false;
+}
+
+tf::Status FastaWriter::Flush() {
+  ssize_t bytes_written;
+  switch (hts_file_->format.compression) {
+    case no_compression:
+      bytes_written = hwrite(hts_file_->fp.hfile, buffer_.data(),
+                             buffer_.size());
+      break;
+    case bgzf:
+      bytes_written = bgzf_write(hts_file_->fp.bgzf, buffer_.data(),
+                                 buffer_.size());
+      break;
+    default:
+      return tf::errors::FailedPrecondition(
+          "Unrecognized hts_file compression format");
+  }
+  if (bytes_written != static_cast<ssize_t>(buffer_.size())) {
+    return tf::errors::DataLoss("Failure to write to ", fasta_path_);
+  }
+  flushed_bytes_ += buffer_.size();
+  buffer_.clear();
+  return tf::Status::OK();
+}
+
+tf::Status FastaWriter::Close() {
+  if (!hts_file_) {
+    return tf::errors::FailedPrecondition(
+        "Cannot close an already closed FastaWriter");
+  }
+  FinishContig();
+  tf::Status status = Flush();
+  if (status.ok() && hts_file_->format.compression == bgzf &&
+      bgzf_index_dump(hts_file_->fp.bgzf, fasta_path_.c_str(), ".gzi") < 0) {
+    status = tf::errors::Internal("Couldn't write GZI index for ",
+                                  fasta_path_);
+  }
+  const int hts_ok = hts_close(hts_file_);
+  hts_file_ = nullptr;
+  TF_RETURN_IF_ERROR(status);
+  if (hts_ok < 0) {
+    return tf::errors::Internal("hts_close() failed with return code ", hts_ok);
+  }
+  return tf::WriteStringToFile(tf::Env::Default(), fasta_path_ + ".fai", fai_);
+}
+
+}  // namespace nucleus
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_FASTA_WRITER_H_
+#define THIRD_PARTY_NUCLEUS_IO_FASTA_WRITER_H_
+
+#include <memory>
+#include <unordered_set>
+
+#include "htslib/hts.h"
+#include "nucleus/protos/reference.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+constexpr int FASTA_WRITER_DEFAULT_LINE_BASES = 60;
+
+// A FASTA writer, which indexes the FASTA as it writes it.
+//
+// Each contig is written as a header line, holding its name and optional
+// description, followed by its bases wrapped to a fixed number of bases per
+// line. The FAI index of the FASTA is built up as the contigs are written, and
+// if the FASTA is bgzipped so is the GZI index of its blocks, so that once the
+// writer is closed the FASTA can be read by GenomeReferenceFai::FromFile
+// without a separate indexing pass.
+class FastaWriter {
+ public:
+  // Creates a new FastaWriter writing to the file at fasta_path, which is
+  // bgzipped if fasta_path ends with ".gz", with line_bases bases per line.
+  // The FAI is written to fasta_path + ".fai", and the GZI of a bgzipped
+  // FASTA to fasta_path + ".gzi", when the writer is closed.
+  static StatusOr<std::unique_ptr<FastaWriter>> ToFile(
+      const string& fasta_path,
+      int line_bases = FASTA_WRITER_DEFAULT_LINE_BASES);
+
+  ~FastaWriter();
+
+  // Disable copy and assignment operations.
+  FastaWriter(const FastaWriter& other) = delete;
+  FastaWriter& operator=(const FastaWriter&) = delete;
+
+  // Writes record as a contig named after its region's reference_name. The
+  // record must hold the whole contig: its region must start at 0 and end
+  // after its last base.
+  tensorflow::Status Write(
+      const nucleus::genomics::v1::ReferenceSequence& record);
+
+  // Writes a contig with name, description (which may be empty) and bases.
+  // Bases may be letters, '*' or '-'; any other byte is an InvalidArgument.
+  tensorflow::Status WriteBases(const string& name, const string& description,
+                                const string& bases);
+
+  // Starts a new contig with name and description (which may be empty), whose
+  // bases are then written by any number of calls to AppendBases. This allows
+  // contigs too large to hold in memory to be written.
+  tensorflow::Status StartContig(const string& name,
+                                 const string& description);
+
+  // Appends bases, which are checked as by WriteBases, to the contig started
+  // by the last call to StartContig.
+  tensorflow::Status AppendBases(const string& bases);
+
+  // Finishes the FASTA, writes its indexes and closes the underlying resource
+  // descriptors. Returns Status::OK() if the close was successful; otherwise
+  // the status provides information about what error occurred.
+  tensorflow::Status Close();
+
+  // This no-op function is needed only for Python context manager support.  Do
+  // not use it!
+  void PythonEnter() const {}
+
+ private:
+  // Private constructor; use ToFile to safely create a FastaWriter.
+  FastaWriter(const string& fasta_path, htsFile* hts_file, int line_bases);
+
+  // Adds the FAI record of the contig being written, if any, to fai_.
+  void FinishContig();
+
+  // Adds the checked bases to the contig being written, breaking them into
+  // lines.
+  tensorflow::Status BufferBases(const string& bases);
+
+  // Writes buffer_ to the file and clears it.
+  tensorflow::Status Flush();
+
+  const string fasta_path_;
+
+  // Underlying htslib file stream, or nullptr once closed.
+  htsFile* hts_file_;
+
+  const int line_bases_;
+
+  // The FAI records of the contigs written so far, and their names.
+  string fai_;
+  std::unordered_set<string> names_;
+
+  // The contig being written, if in_contig_, the offset of its first base in
+  // the (uncompressed) FASTA and the number of its bases written so far.
+  bool in_contig_ = false;
+  string contig_name_;
+  uint64 contig_offset_ = 0;
+  int64 contig_bases_ = 0;
+
+  // Output not yet written to the file, and the number of (uncompressed) bytes
+  // written before it.
+  string buffer_;
+  uint64 flushed_bytes_ = 0;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_FASTA_WRITER_H_
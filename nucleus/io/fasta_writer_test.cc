@@ -0,0 +1,156 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/fasta_writer.h"
+
+#include <memory>
+#include <vector>
+
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::ReferenceSequence;
+
+string ReadFile(const string& path) {
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(), path,
+                                           &contents));
+  return contents;
+}
+
+class IndexedFastaWriterTest : public ::testing::TestWithParam<string> {
+ protected:
+  // Writes the golden contigs to a temporary FASTA named by the test's
+  // parameter, with 4 bases per line, returning its path.
+  string WriteGolden() {
+    const string fasta = MakeTempFile(GetParam());
+    std::unique_ptr<FastaWriter> writer =
+        std::move(FastaWriter::ToFile(fasta, 4).ValueOrDie());
+    ReferenceSequence chr1;
+    *chr1.mutable_region() = MakeRange("chr1", 0, 10);
+    chr1.set_bases("ACGTACGTAC");
+    EXPECT_THAT(writer->Write(chr1), IsOK());
+    EXPECT_THAT(writer->WriteBases("chr2", "second contig", "ggccNNTT"),
+                IsOK());
+    EXPECT_THAT(writer->WriteBases("empty", "", ""), IsOK());
+    // A contig written a few bases at a time, across line breaks.
+    EXPECT_THAT(writer->StartContig("chr3", ""), IsOK());
+    for (const string bases : {"A", "CGTAC", "", "GT", "ACGTA"}) {
+      EXPECT_THAT(writer->AppendBases(bases), IsOK());
+    }
+    EXPECT_THAT(writer->Close(), IsOK());
+    return fasta;
+  }
+};
+
+TEST_P(IndexedFastaWriterTest, WritesIndexedFasta) {
+  const string fasta = WriteGolden();
+  EXPECT_EQ(
+      "chr1\t10\t6\t4\t5\n"
+      "chr2\t8\t39\t4\t5\n"
+      "empty\t0\t56\t0\t0\n"
+      "chr3\t13\t62\t4\t5\n",
+      ReadFile(fasta + ".fai"));
+
+  std::unique_ptr<GenomeReferenceFai> reader =
+      std::move(GenomeReferenceFai::FromFile(fasta, fasta + ".fai", 0)
+                    .ValueOrDie());
+  EXPECT_EQ("ACGTACGTAC",
+            reader->GetBases(MakeRange("chr1", 0, 10)).ValueOrDie());
+  EXPECT_EQ("GGCCNNTT",
+            reader->GetBases(MakeRange("chr2", 0, 8)).ValueOrDie());
+  EXPECT_EQ("ACGTACGTACGTA",
+            reader->GetBases(MakeRange("chr3", 0, 13)).ValueOrDie());
+  EXPECT_EQ("", reader->GetBases(MakeRange("empty", 0, 0)).ValueOrDie());
+}
+
+TEST_P(IndexedFastaWriterTest, IndexMatchesBuildIndex) {
+  const string fasta = WriteGolden();
+  const string rebuilt = fasta + ".rebuilt.fai";
+  ASSERT_THAT(GenomeReferenceFai::BuildIndex(fasta, rebuilt, 1), IsOK());
+  EXPECT_EQ(ReadFile(rebuilt), ReadFile(fasta + ".fai"));
+}
+
+INSTANTIATE_TEST_CASE_P(Compression, IndexedFastaWriterTest,
+                        ::testing::Values("writes_fasta.fasta",
+                                          "writes_fasta.fasta.gz"));
+
+TEST(FastaWriterTest, WritesUncompressedFasta) {
+  const string fasta = MakeTempFile("writes_plain.fasta");
+  std::unique_ptr<FastaWriter> writer =
+      std::move(FastaWriter::ToFile(fasta, 3).ValueOrDie());
+  ASSERT_THAT(writer->WriteBases("a", "desc", "ACGTACG"), IsOK());
+  ASSERT_THAT(writer->WriteBases("b", "", "TTT"), IsOK());
+  ASSERT_THAT(writer->Close(), IsOK());
+  EXPECT_EQ(">a desc\nACG\nTAC\nG\n>b\nTTT\n", ReadFile(fasta));
+}
+
+TEST(FastaWriterTest, RejectsInvalidContigs) {
+  std::unique_ptr<FastaWriter> writer = std::move(
+      FastaWriter::ToFile(MakeTempFile("rejects.fasta")).ValueOrDie());
+  EXPECT_THAT(writer->AppendBases("ACGT"),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::FAILED_PRECONDITION,
+                  "Cannot append bases before starting a contig"));
+  EXPECT_THAT(writer->WriteBases("", "", "ACGT"),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid contig name"));
+  EXPECT_THAT(writer->WriteBases("chr 1", "", "ACGT"),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid contig name"));
+  ASSERT_THAT(writer->WriteBases("chr1", "", "ACGT"), IsOK());
+  EXPECT_THAT(
+      writer->WriteBases("chr1", "", "ACGT"),
+      IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                "Contig chr1 has already been written"));
+
+  EXPECT_THAT(writer->WriteBases("chr2", "", "AC\nGT"),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid base '\\n' at offset 2"));
+  ASSERT_THAT(writer->StartContig("chr2", ""), IsOK());
+  ASSERT_THAT(writer->AppendBases("acgtN*-"), IsOK());
+  for (const string& bases : {"AC GT", ">chr3", "AC\rGT", "ACG1"}) {
+    EXPECT_THAT(writer->AppendBases(bases),
+                IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                          "Invalid base"));
+  }
+
+  ReferenceSequence partial;
+  *partial.mutable_region() = MakeRange("chr2", 2, 6);
+  partial.set_bases("ACGT");
+  EXPECT_THAT(writer->Write(partial),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::INVALID_ARGUMENT,
+                  "ReferenceSequence must hold all the bases of its contig"));
+
+  ASSERT_THAT(writer->Close(), IsOK());
+  EXPECT_THAT(writer->WriteBases("chr3", "", "ACGT"),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::FAILED_PRECONDITION,
+                  "Cannot write to closed FASTA stream"));
+}
+
+}  // namespace nucleus
@@ -0,0 +1,346 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of kmer_index.h
+#include "nucleus/io/kmer_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/synchronization/mutex.h"
+#include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::Position;
+
+namespace {
+
+// The first bytes of an index file, which include a format version. They are
+// followed by the rest of the Header, the contig names, each terminated by a
+// NUL and padded to a multiple of 8 bytes, and the sorted entries.
+constexpr char kMagic[] = "NUCKMI01";
+
+struct Header {
+  char magic[8];
+  int64 k;
+  int64 w;
+  int64 n_contigs;
+  int64 names_size;
+  int64 n_entries;
+};
+
+// The limits of the positions packed into an entry.
+constexpr int kContigBits = 24;
+constexpr int kPositionBits = 39;
+
+// The number of windows of a contig indexed as one unit of work by Build.
+constexpr int64 kChunkWindows = 1 << 20;
+
+// Returns the 2-bit code of base, or -1 if it isn't A, C, G or T.
+int BaseCode(char base) {
+  switch (absl::ascii_toupper(base)) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+  }
+}
+
+// Scrambles the bits of a canonical k-mer, so that minimizers are spread over
+// the genome rather than biased towards poly-A runs.
+uint64 MixKmer(uint64 kmer) {
+  kmer ^= kmer >> 33;
+  kmer *= 0xff51afd7ed558ccdULL;
+  kmer ^= kmer >> 33;
+  kmer *= 0xc4ceb9fe1a85ec53ULL;
+  kmer ^= kmer >> 33;
+  return kmer;
+}
+
+}  // namespace
+
+constexpr int KmerIndex::kMaxK;
+
+tf::Status KmerIndex::Build(const GenomeReference& reference, int k, int w,
+                            int num_threads, const string& index_path) {
+  if (k < 1 || k > kMaxK)
+    return tf::errors::InvalidArgument("k must be between 1 and ", kMaxK);
+  if (w < 1) return tf::errors::InvalidArgument("w must be positive");
+  if (num_threads < 1)
+    return tf::errors::InvalidArgument("num_threads must be positive");
+  const auto& contigs = reference.Contigs();
+  if (contigs.size() >= (1ULL << kContigBits)) {
+    return tf::errors::InvalidArgument("Can't index more than ",
+                                       1ULL << kContigBits, " contigs");
+  }
+
+  // Split the contigs into chunks of windows, as (contig, first window).
+  std::vector<std::pair<int, int64>> chunks;
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    const int64 n_bases = contigs[i].n_bases();
+    if (n_bases >= (1LL << kPositionBits)) {
+      return tf::errors::InvalidArgument("Can't index contig ",
+                                         contigs[i].name(), " of ", n_bases,
+                                         " bases");
+    }
+    const int64 n_windows = n_bases - (k + w - 1) + 1;
+    for (int64 start = 0; start < n_windows; start += kChunkWindows) {
+      chunks.emplace_back(i, start);
+    }
+  }
+
+  absl::Mutex mutex;
+  size_t next_chunk = 0;
+  std::vector<Entry> entries;
+  tf::Status status;
+  auto work = [&]() {
+    std::vector<Entry> worker_entries;
+    while (true) {
+      size_t chunk;
+      {
+        absl::MutexLock lock(&mutex);
+        if (next_chunk == chunks.size() || !status.ok()) break;
+        chunk = next_chunk++;
+      }
+      const auto& contig = contigs[chunks[chunk].first];
+      const int64 start = chunks[chunk].second;
+      const int64 n_windows = contig.n_bases() - (k + w - 1) + 1;
+      const int64 window_end = std::min(start + kChunkWindows, n_windows);
+      // The last window starts at window_end - 1 and spans k + w - 1 bases.
+      StatusOr<string> bases = reference.GetBases(
+          MakeRange(contig.name(), start, window_end + k + w - 2));
+      if (!bases.ok()) {
+        absl::MutexLock lock(&mutex);
+        if (status.ok()) status = bases.status();
+        break;
+      }
+      IndexChunk(bases.ValueOrDie(), k, w, chunks[chunk].first, start,
+                 window_end, &worker_entries);
+    }
+    absl::MutexLock lock(&mutex);
+    entries.insert(entries.end(), worker_entries.begin(),
+                   worker_entries.end());
+  };
+  num_threads = std::max(1, std::min<int>(num_threads, chunks.size()));
+  if (num_threads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++) workers.emplace_back(work);
+    for (std::thread& worker : workers) worker.join();
+  }
+  TF_RETURN_IF_ERROR(status);
+
+  // Neighbouring chunks can both pick a minimizer in the windows they share.
+  auto less = [](const Entry& a, const Entry& b) {
+    return a.kmer < b.kmer || (a.kmer == b.kmer && a.position < b.position);
+  };
+  std::sort(entries.begin(), entries.end(), less);
+  entries.erase(std::unique(entries.begin(), entries.end(),
+                            [](const Entry& a, const Entry& b) {
+                              return a.kmer == b.kmer &&
+                                     a.position == b.position;
+                            }),
+                entries.end());
+
+  string names;
+  for (const auto& contig : contigs) {
+    names.append(contig.name());
+    names.push_back('\0');
+  }
+  names.resize((names.size() + 7) / 8 * 8);
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.k = k;
+  header.w = w;
+  header.n_contigs = contigs.size();
+  header.names_size = names.size();
+  header.n_entries = entries.size();
+
+  std::unique_ptr<tf::WritableFile> file;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewWritableFile(index_path, &file));
+  TF_RETURN_IF_ERROR(file->Append(
+      tf::StringPiece(reinterpret_cast<const char*>(&header), sizeof(header))));
+  TF_RETURN_IF_ERROR(file->Append(names));
+  TF_RETURN_IF_ERROR(file->Append(
+      tf::StringPiece(reinterpret_cast<const char*>(entries.data()),
+                      entries.size() * sizeof(Entry))));
+  return file->Close();
+}
+
+void KmerIndex::IndexChunk(absl::string_view bases, int k, int w, int contig,
+                           int64 start, int64 window_end,
+                           std::vector<Entry>* entries) {
+  // The valid k-mers of the current window that might still be its minimizer,
+  // in increasing order of both position and hash.
+  struct Candidate {
+    uint64 hash;
+    int64 index;
+    uint64 kmer;
+    bool reverse;
+  };
+  std::deque<Candidate> candidates;
+  const uint64 mask = k == kMaxK ? ~0ULL : (1ULL << (2 * k)) - 1;
+  uint64 forward = 0;
+  uint64 reverse = 0;
+  int64 n_valid = 0;
+  int64 last_emitted = -1;
+  const int64 n = bases.size();
+  for (int64 p = 0; p < n; ++p) {
+    const int code = BaseCode(bases[p]);
+    if (code < 0) {
+      n_valid = 0;
+    } else {
+      forward = ((forward << 2) | code) & mask;
+      reverse = (reverse >> 2) |
+                (static_cast<uint64>(3 - code) << (2 * (k - 1)));
+      ++n_valid;
+    }
+
+    // The k-mer ending at p.
+    const int64 j = p - k + 1;
+    if (j < 0) continue;
+    if (n_valid >= k) {
+      const bool is_reverse = reverse < forward;
+      const uint64 kmer = is_reverse ? reverse : forward;
+      const uint64 hash = MixKmer(kmer);
+      while (!candidates.empty() && candidates.back().hash > hash) {
+        candidates.pop_back();
+      }
+      candidates.push_back(Candidate{hash, j, kmer, is_reverse});
+    }
+
+    // The window ending with k-mer j.
+    const int64 i = j - w + 1;
+    if (i < 0 || start + i >= window_end) continue;
+    while (!candidates.empty() && candidates.front().index < i) {
+      candidates.pop_front();
+    }
+    if (!candidates.empty() && candidates.front().index != last_emitted) {
+      const Candidate& minimizer = candidates.front();
+      last_emitted = minimizer.index;
+      entries->push_back(Entry{
+          minimizer.kmer,
+          static_cast<uint64>(contig) << (kPositionBits + 1) |
+              static_cast<uint64>(start + minimizer.index) << 1 |
+              minimizer.reverse});
+    }
+  }
+}
+
+StatusOr<std::unique_ptr<KmerIndex>> KmerIndex::FromFile(
+    const string& index_path) {
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewReadOnlyMemoryRegionFromFile(
+      index_path, &region));
+  const char* data = static_cast<const char*>(region->data());
+  const uint64 length = region->length();
+  Header header;
+  if (length < sizeof(header) ||
+      std::memcmp(data, kMagic, sizeof(header.magic)) != 0) {
+    return tf::errors::DataLoss(index_path, " is not a k-mer index");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.k < 1 || header.k > kMaxK || header.w < 1 ||
+      header.n_contigs < 0 || header.names_size < 0 ||
+      header.names_size % 8 != 0 || header.n_entries < 0 ||
+      length != sizeof(header) + header.names_size +
+                    header.n_entries * sizeof(Entry)) {
+    return tf::errors::DataLoss("Malformed k-mer index ", index_path);
+  }
+
+  std::unique_ptr<KmerIndex> index(new KmerIndex(std::move(region)));
+  index->k_ = header.k;
+  index->w_ = header.w;
+  const char* names = data + sizeof(header);
+  const char* names_end = names + header.names_size;
+  for (int64 i = 0; i < header.n_contigs; ++i) {
+    const char* nul = static_cast<const char*>(
+        std::memchr(names, '\0', names_end - names));
+    if (nul == nullptr) {
+      return tf::errors::DataLoss("Malformed k-mer index ", index_path);
+    }
+    index->contig_names_.emplace_back(names, nul - names);
+    names = nul + 1;
+  }
+  index->entries_ = reinterpret_cast<const Entry*>(names_end);
+  index->n_entries_ = header.n_entries;
+  return std::move(index);
+}
+
+KmerIndex::KmerIndex(std::unique_ptr<tf::ReadOnlyMemoryRegion> region)
+    : region_(std::move(region)) {}
+
+StatusOr<std::vector<Position>> KmerIndex::Lookup(
+    absl::string_view kmer) const {
+  if (static_cast<int>(kmer.size()) != k_) {
+    return tf::errors::InvalidArgument("Expected a ", k_, "-mer but got ",
+                                       string(kmer));
+  }
+  uint64 forward = 0;
+  uint64 reverse = 0;
+  for (int p = 0; p < k_; ++p) {
+    const int code = BaseCode(kmer[p]);
+    if (code < 0) {
+      return tf::errors::InvalidArgument(
+          "K-mer ", string(kmer), " has bases other than A, C, G and T");
+    }
+    forward = (forward << 2) | code;
+    reverse |= static_cast<uint64>(3 - code) << (2 * p);
+  }
+  const bool is_reverse = reverse < forward;
+  const uint64 canonical = is_reverse ? reverse : forward;
+
+  const auto range = std::equal_range(
+      entries_, entries_ + n_entries_, Entry{canonical, 0},
+      [](const Entry& a, const Entry& b) { return a.kmer < b.kmer; });
+  std::vector<Position> positions;
+  positions.reserve(range.second - range.first);
+  for (const Entry* entry = range.first; entry != range.second; ++entry) {
+    Position position;
+    position.set_reference_name(
+        contig_names_[entry->position >> (kPositionBits + 1)]);
+    position.set_position((entry->position >> 1) &
+                          ((1ULL << kPositionBits) - 1));
+    position.set_reverse_strand((entry->position & 1) != is_reverse);
+    positions.push_back(std::move(position));
+  }
+  return positions;
+}
+
+StatusOr<std::vector<std::vector<Position>>> KmerIndex::LookupBatch(
+    const std::vector<string>& kmers) const {
+  std::vector<std::vector<Position>> results;
+  results.reserve(kmers.size());
+  for (const string& kmer : kmers) {
+    StatusOr<std::vector<Position>> positions = Lookup(kmer);
+    if (!positions.ok()) return positions.status();
+    results.push_back(std::move(positions.ValueOrDie()));
+  }
+  return results;
+}
+
+}  // namespace nucleus
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_KMER_INDEX_H_
+#define THIRD_PARTY_NUCLEUS_IO_KMER_INDEX_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "nucleus/io/reference.h"
+#include "nucleus/platform/types.h"
+#include "nucleus/protos/position.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+// An index of the k-mers of a reference genome, for exact-match lookups of
+// short sequences such as primers, guide RNAs or read seeds.
+//
+// The index holds the (w, k)-minimizers of each contig: of every w consecutive
+// k-mers, the one whose canonical form (the smaller of its 2-bit encoding and
+// that of its reverse complement) hashes lowest. With w = 1 that's every k-mer,
+// so Lookup finds every occurrence of any k-mer; with larger w the index is
+// about 2 / (w + 1) of that size, but Lookup only finds the occurrences at
+// which the k-mer is a minimizer, which is always the case for some k-mer of
+// any sequence of at least k + w - 1 bases. K-mers with bases other than A, C,
+// G and T aren't indexed.
+//
+// The index is a sorted table of (canonical k-mer, position) pairs, which is
+// memory-mapped rather than read when the index is loaded.
+class KmerIndex {
+ public:
+  // The largest k supported, as k-mers are encoded in 64 bits.
+  static constexpr int kMaxK = 32;
+
+  // Indexes the (w, k)-minimizers of all the contigs of reference, and writes
+  // the index to index_path. The contigs are split into chunks that are
+  // indexed by num_threads threads, so reference's GetBases must be safe to
+  // call concurrently when num_threads > 1.
+  static tensorflow::Status Build(const GenomeReference& reference, int k,
+                                  int w, int num_threads,
+                                  const string& index_path);
+
+  // Maps the index written by Build at index_path.
+  static StatusOr<std::unique_ptr<KmerIndex>> FromFile(
+      const string& index_path);
+
+  // Returns the positions of the indexed occurrences of kmer, which must have
+  // k bases, sorted by contig and position. An occurrence of the reverse
+  // complement of kmer is returned with reverse_strand set, at the position of
+  // its first base on the forward strand.
+  StatusOr<std::vector<nucleus::genomics::v1::Position>> Lookup(
+      absl::string_view kmer) const;
+
+  // Returns the result of Lookup for each of kmers, in order.
+  StatusOr<std::vector<std::vector<nucleus::genomics::v1::Position>>>
+  LookupBatch(const std::vector<string>& kmers) const;
+
+  int K() const { return k_; }
+  int W() const { return w_; }
+
+  // The names of the indexed contigs, in the order of the reference.
+  const std::vector<string>& ContigNames() const { return contig_names_; }
+
+  // The number of (k-mer, position) entries in the index.
+  int64 NumEntries() const { return n_entries_; }
+
+ private:
+  // One (canonical k-mer, position) pair of the index. The position packs the
+  // contig's index into its top 24 bits, the 0-based position of the k-mer's
+  // first base into the next 39 bits, and whether the k-mer there is the
+  // reverse complement of the canonical one into the lowest bit, so entries
+  // sort by contig and position.
+  struct Entry {
+    uint64 kmer;
+    uint64 position;
+  };
+
+  explicit KmerIndex(std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region);
+
+  // Appends the entries for the k-mers of bases, a chunk of contig starting at
+  // start, whose windows begin before window_end, to entries.
+  static void IndexChunk(absl::string_view bases, int k, int w, int contig,
+                         int64 start, int64 window_end,
+                         std::vector<Entry>* entries);
+
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region_;
+  int k_ = 0;
+  int w_ = 0;
+  std::vector<string> contig_names_;
+  const Entry* entries_ = nullptr;
+  int64 n_entries_ = 0;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_KMER_INDEX_H_
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/kmer_index.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::Position;
+using ::testing::Pointwise;
+
+constexpr char kFastaFilename[] = "test.fasta";
+
+class KmerIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const string fasta = GetTestData(kFastaFilename);
+    reference_ = std::move(
+        GenomeReferenceFai::FromFile(fasta, absl::StrCat(fasta, ".fai"))
+            .ValueOrDie());
+    for (const auto& contig : reference_->Contigs()) {
+      contig_bases_.push_back(
+          reference_->GetBases(MakeRange(contig.name(), 0, contig.n_bases()))
+              .ValueOrDie());
+    }
+  }
+
+  std::unique_ptr<KmerIndex> BuildIndex(int k, int w, int num_threads) {
+    const string path = MakeTempFile(
+        absl::StrCat("test_", k, "_", w, "_", num_threads, ".kmi"));
+    TF_CHECK_OK(KmerIndex::Build(*reference_, k, w, num_threads, path));
+    return std::move(KmerIndex::FromFile(path).ValueOrDie());
+  }
+
+  // Finds the occurrences of kmer and its reverse complement by brute force.
+  std::vector<Position> FindKmer(const string& kmer) const {
+    string reverse_complement(kmer.rbegin(), kmer.rend());
+    for (char& base : reverse_complement) {
+      base = string("TGCA")[string("ACGT").find(base)];
+    }
+    std::vector<Position> positions;
+    for (size_t i = 0; i < contig_bases_.size(); ++i) {
+      const string& bases = contig_bases_[i];
+      for (size_t p = 0; p + kmer.size() <= bases.size(); ++p) {
+        for (bool reverse : {false, true}) {
+          if (reverse && reverse_complement == kmer) continue;
+          if (bases.compare(p, kmer.size(),
+                            reverse ? reverse_complement : kmer) == 0) {
+            Position position;
+            position.set_reference_name(reference_->Contigs()[i].name());
+            position.set_position(p);
+            position.set_reverse_strand(reverse);
+            positions.push_back(position);
+          }
+        }
+      }
+    }
+    return positions;
+  }
+
+  std::unique_ptr<GenomeReferenceFai> reference_;
+  std::vector<string> contig_bases_;
+};
+
+TEST_F(KmerIndexTest, FindsEveryKmerWithWindowOfOne) {
+  auto index = BuildIndex(5, 1, 1);
+  EXPECT_EQ(5, index->K());
+  EXPECT_EQ(1, index->W());
+  EXPECT_THAT(index->ContigNames(),
+              ::testing::ElementsAre("chrM", "chr1", "chr2"));
+  for (const string& bases : contig_bases_) {
+    for (size_t p = 0; p + 5 <= bases.size(); p += 3) {
+      const string kmer = bases.substr(p, 5);
+      if (kmer.find('N') != string::npos) continue;
+      StatusOr<std::vector<Position>> positions = index->Lookup(kmer);
+      ASSERT_THAT(positions, IsOK());
+      EXPECT_THAT(positions.ValueOrDie(),
+                  Pointwise(EqualsProto(), FindKmer(kmer)))
+          << kmer;
+    }
+  }
+  // Lower-case k-mers are looked up as upper-case ones.
+  EXPECT_THAT(index->Lookup("gatca").ValueOrDie(),
+              Pointwise(EqualsProto(), FindKmer("GATCA")));
+  EXPECT_TRUE(index->Lookup("AAAAA").ValueOrDie().empty());
+}
+
+TEST_F(KmerIndexTest, MinimizersCoverEveryWindow) {
+  constexpr int k = 6;
+  constexpr int w = 4;
+  auto index = BuildIndex(k, w, 1);
+  EXPECT_LT(index->NumEntries(), BuildIndex(k, 1, 1)->NumEntries());
+  // Every sequence of k + w - 1 bases has a k-mer that's indexed where it
+  // occurs.
+  for (size_t i = 0; i < contig_bases_.size(); ++i) {
+    const string& bases = contig_bases_[i];
+    for (size_t p = 0; p + k + w - 1 <= bases.size(); ++p) {
+      if (bases.substr(p, k + w - 1).find('N') != string::npos) continue;
+      bool found = false;
+      for (int j = 0; j < w && !found; ++j) {
+        for (const Position& position :
+             index->Lookup(bases.substr(p + j, k)).ValueOrDie()) {
+          if (position.reference_name() == reference_->Contigs()[i].name() &&
+              position.position() == static_cast<int64>(p + j)) {
+            found = true;
+          }
+        }
+      }
+      EXPECT_TRUE(found) << reference_->Contigs()[i].name() << ":" << p;
+    }
+  }
+}
+
+TEST_F(KmerIndexTest, BuildsTheSameIndexWithThreads) {
+  auto serial = BuildIndex(7, 3, 1);
+  auto threaded = BuildIndex(7, 3, 4);
+  EXPECT_EQ(serial->NumEntries(), threaded->NumEntries());
+  const std::vector<string> kmers = {contig_bases_[0].substr(10, 7),
+                                     contig_bases_[1].substr(40, 7),
+                                     contig_bases_[2].substr(60, 7)};
+  const auto expected = serial->LookupBatch(kmers).ValueOrDie();
+  const auto actual = threaded->LookupBatch(kmers).ValueOrDie();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_THAT(actual[i], Pointwise(EqualsProto(), expected[i]));
+  }
+}
+
+TEST_F(KmerIndexTest, LookupBatch) {
+  auto index = BuildIndex(4, 1, 2);
+  const std::vector<string> kmers = {"GATC", "ACCA", "CGCT"};
+  StatusOr<std::vector<std::vector<Position>>> batch =
+      index->LookupBatch(kmers);
+  ASSERT_THAT(batch, IsOK());
+  ASSERT_EQ(kmers.size(), batch.ValueOrDie().size());
+  for (size_t i = 0; i < kmers.size(); ++i) {
+    EXPECT_THAT(batch.ValueOrDie()[i],
+                Pointwise(EqualsProto(), FindKmer(kmers[i])));
+  }
+  EXPECT_THAT(index->LookupBatch({"GATC", "GAT"}),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Expected a 4-mer"));
+}
+
+TEST_F(KmerIndexTest, RejectsBadArguments) {
+  const string path = MakeTempFile("bad.kmi");
+  EXPECT_THAT(KmerIndex::Build(*reference_, 0, 1, 1, path),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "k must be between 1 and 32"));
+  EXPECT_THAT(KmerIndex::Build(*reference_, 33, 1, 1, path),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "k must be between 1 and 32"));
+  EXPECT_THAT(KmerIndex::Build(*reference_, 5, 0, 1, path),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "w must be positive"));
+  auto index = BuildIndex(5, 1, 1);
+  EXPECT_THAT(index->Lookup("GATC"),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Expected a 5-mer"));
+  EXPECT_THAT(index->Lookup("GATNA"),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "has bases other than A, C, G and T"));
+}
+
+TEST_F(KmerIndexTest, RejectsOtherFiles) {
+  EXPECT_THAT(KmerIndex::FromFile(GetTestData(kFastaFilename)),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "is not a k-mer index"));
+}
+
+}  // namespace nucleus
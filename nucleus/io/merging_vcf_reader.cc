@@ -0,0 +1,179 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/merging_vcf_reader.h"
+
+#include <utility>
+
+#include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::Range;
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VcfReaderOptions;
+
+// -----------------------------------------------------------------------------
+//
+// Reader class methods
+//
+// -----------------------------------------------------------------------------
+
+StatusOr<std::unique_ptr<MergingVcfReader>> MergingVcfReader::FromFiles(
+    const std::vector<string>& variants_paths,
+    const VcfReaderOptions& options) {
+  if (variants_paths.empty()) {
+    return tf::errors::InvalidArgument(
+        "MergingVcfReader requires at least one input");
+  }
+  std::vector<std::unique_ptr<VcfReader>> readers;
+  for (const string& path : variants_paths) {
+    StatusOr<std::unique_ptr<VcfReader>> reader =
+        VcfReader::FromFile(path, options);
+    TF_RETURN_IF_ERROR(reader.status());
+    readers.push_back(std::move(reader.ValueOrDie()));
+  }
+
+  const auto& samples = readers[0]->Header().sample_names();
+  for (int i = 1; i < readers.size(); i++) {
+    const auto& other_samples = readers[i]->Header().sample_names();
+    if (!std::equal(samples.begin(), samples.end(), other_samples.begin(),
+                    other_samples.end())) {
+      return tf::errors::InvalidArgument(
+          "Cannot merge ", variants_paths[i], " with ", variants_paths[0],
+          " because their samples differ");
+    }
+  }
+
+  return std::unique_ptr<MergingVcfReader>(
+      new MergingVcfReader(std::move(readers)));
+}
+
+MergingVcfReader::MergingVcfReader(
+    std::vector<std::unique_ptr<VcfReader>> readers)
+    : readers_(std::move(readers)), header_(readers_[0]->Header()) {
+  contig_name_to_pos_in_fasta_ = MapContigNameToPosInFasta(
+      {header_.contigs().begin(), header_.contigs().end()});
+}
+
+MergingVcfReader::~MergingVcfReader() {
+  if (!readers_.empty()) {
+    TF_CHECK_OK(Close());
+  }
+}
+
+tf::Status MergingVcfReader::Close() {
+  if (readers_.empty())
+    return tf::errors::FailedPrecondition("MergingVcfReader already closed");
+  tf::Status status;
+  for (const auto& reader : readers_) {
+    status.Update(reader->Close());
+  }
+  readers_.clear();
+  return status;
+}
+
+template <class MakeInput>
+StatusOr<std::shared_ptr<VariantIterable>> MergingVcfReader::Merge(
+    const MakeInput& make_input) {
+  if (readers_.empty())
+    return tf::errors::FailedPrecondition(
+        "Cannot iterate a closed MergingVcfReader.");
+  std::vector<std::shared_ptr<VariantIterable>> inputs;
+  for (const auto& reader : readers_) {
+    StatusOr<std::shared_ptr<VariantIterable>> input = make_input(*reader);
+    TF_RETURN_IF_ERROR(input.status());
+    if (input.ValueOrDie() == nullptr) {
+      return tf::errors::FailedPrecondition(
+          "Cannot merge while another iteration is active");
+    }
+    inputs.push_back(std::move(input.ValueOrDie()));
+  }
+  return StatusOr<std::shared_ptr<VariantIterable>>(
+      MakeIterable<MergingVariantIterable>(this, std::move(inputs),
+                                           &contig_name_to_pos_in_fasta_));
+}
+
+StatusOr<std::shared_ptr<VariantIterable>> MergingVcfReader::Iterate() {
+  return Merge([](VcfReader& reader) { return reader.Iterate(); });
+}
+
+StatusOr<std::shared_ptr<VariantIterable>> MergingVcfReader::Query(
+    const Range& region) {
+  return Merge([&region](VcfReader& reader) { return reader.Query(region); });
+}
+
+// -----------------------------------------------------------------------------
+//
+// Iterable class definitions.
+//
+// -----------------------------------------------------------------------------
+
+MergingVariantIterable::MergingVariantIterable(
+    const Reader* reader, std::vector<std::shared_ptr<VariantIterable>> inputs,
+    const std::map<string, int>* contig_name_to_pos_in_fasta)
+    : VariantIterable(reader),
+      inputs_(std::move(inputs)),
+      heads_(inputs_.size()),
+      contig_name_to_pos_in_fasta_(contig_name_to_pos_in_fasta) {}
+
+MergingVariantIterable::~MergingVariantIterable() {}
+
+tf::Status MergingVariantIterable::Advance(int source, const Key* previous) {
+  Variant* head = &heads_[source];
+  StatusOr<bool> more = inputs_[source]->Next(head);
+  TF_RETURN_IF_ERROR(more.status());
+  if (!more.ValueOrDie()) return tf::Status::OK();
+
+  const auto pos_in_fasta =
+      contig_name_to_pos_in_fasta_->find(head->reference_name());
+  if (pos_in_fasta == contig_name_to_pos_in_fasta_->end()) {
+    return tf::errors::NotFound("Reference name ", head->reference_name(),
+                                " not in contig info.");
+  }
+  const Key key = {pos_in_fasta->second, head->start(), head->end(), source};
+  if (previous != nullptr && key.StartsBefore(*previous)) {
+    return tf::errors::DataLoss("Input ", source, " is not sorted at ",
+                                head->reference_name(), ":",
+                                head->start() + 1);
+  }
+  heap_.push(key);
+  return tf::Status::OK();
+}
+
+StatusOr<bool> MergingVariantIterable::Next(Variant* out) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (!started_) {
+    for (int i = 0; i < inputs_.size(); i++) {
+      TF_RETURN_IF_ERROR(Advance(i, nullptr));
+    }
+    started_ = true;
+  }
+  if (heap_.empty()) return false;
+
+  const Key top = heap_.top();
+  heap_.pop();
+  out->Swap(&heads_[top.source]);
+  TF_RETURN_IF_ERROR(Advance(top.source, &top));
+  return true;
+}
+
+}  // namespace nucleus
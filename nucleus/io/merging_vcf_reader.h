@@ -0,0 +1,149 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_MERGING_VCF_READER_H_
+#define THIRD_PARTY_NUCLEUS_IO_MERGING_VCF_READER_H_
+
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "nucleus/io/reader_base.h"
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/range.pb.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// A reader that merges several coordinate-sorted VCF files into a single
+// coordinate-sorted stream of Variants.
+//
+// This is meant for stitching together VCFs that were written per-contig or
+// per-shard. Variants are ordered as by CompareVariants in util/utils.h, that
+// is by the pos_in_fasta of their contig in the header of the first file, then
+// by start, then by end. Ties are broken by the order of the input files, so
+// the merge is stable.
+//
+// All inputs must have the same samples. The merged stream uses the header of
+// the first input.
+class MergingVcfReader : public Reader {
+ public:
+  // Creates a new MergingVcfReader reading from each of variants_paths, with
+  // each file being parsed according to options.
+  static StatusOr<std::unique_ptr<MergingVcfReader>> FromFiles(
+      const std::vector<string>& variants_paths,
+      const nucleus::genomics::v1::VcfReaderOptions& options);
+
+  ~MergingVcfReader();
+
+  // Disable copy or assignment
+  MergingVcfReader(const MergingVcfReader& other) = delete;
+  MergingVcfReader& operator=(const MergingVcfReader&) = delete;
+
+  // Gets all of the variants in all of the files in sorted order.
+  StatusOr<std::shared_ptr<VariantIterable>> Iterate();
+
+  // Gets all of the variants in all of the files that overlap any bases in
+  // range, in sorted order. Every input must be indexed.
+  StatusOr<std::shared_ptr<VariantIterable>> Query(
+      const nucleus::genomics::v1::Range& region);
+
+  // Returns the VCF header of the merged stream.
+  const nucleus::genomics::v1::VcfHeader& Header() const { return header_; }
+
+  // Close the underlying resource descriptors. Returns a Status to indicate if
+  // everything went OK with the close.
+  tensorflow::Status Close();
+
+  // This no-op function is needed only for Python context manager support.  Do
+  // not use it! Returns a Status indicating whether the enter was successful.
+  tensorflow::Status PythonEnter() const { return tensorflow::Status::OK(); }
+
+ private:
+  explicit MergingVcfReader(std::vector<std::unique_ptr<VcfReader>> readers);
+
+  // Merges the iterables produced by calling make_input on each input.
+  template <class MakeInput>
+  StatusOr<std::shared_ptr<VariantIterable>> Merge(
+      const MakeInput& make_input);
+
+  std::vector<std::unique_ptr<VcfReader>> readers_;
+  nucleus::genomics::v1::VcfHeader header_;
+  std::map<string, int> contig_name_to_pos_in_fasta_;
+};
+
+// Iterable that merges N sorted VariantIterables with a binary heap.
+//
+// Each input is keyed by the (pos_in_fasta, start, end) of its next variant,
+// extracted once when the variant is read, so the heap only ever compares
+// integers. Returns a DataLoss error if an input turns out not to be sorted.
+class MergingVariantIterable : public VariantIterable {
+ public:
+  StatusOr<bool> Next(nucleus::genomics::v1::Variant* out) override;
+
+  // Constructor is invoked via MergingVcfReader::Iterate or Query.
+  MergingVariantIterable(
+      const Reader* reader,
+      std::vector<std::shared_ptr<VariantIterable>> inputs,
+      const std::map<string, int>* contig_name_to_pos_in_fasta);
+
+  ~MergingVariantIterable() override;
+
+ private:
+  // Sort key of the next variant of one input. Ordering by source last makes
+  // the merge stable.
+  struct Key {
+    int pos_in_fasta;
+    int64 start;
+    int64 end;
+    int source;
+
+    // Inputs only need to be sorted by position, so their order is checked
+    // on (contig, start) alone; end just breaks ties in the merge.
+    bool StartsBefore(const Key& other) const {
+      if (pos_in_fasta != other.pos_in_fasta)
+        return pos_in_fasta < other.pos_in_fasta;
+      return start < other.start;
+    }
+
+    bool operator>(const Key& other) const {
+      if (pos_in_fasta != other.pos_in_fasta)
+        return pos_in_fasta > other.pos_in_fasta;
+      if (start != other.start) return start > other.start;
+      if (end != other.end) return end > other.end;
+      return source > other.source;
+    }
+  };
+
+  // Reads the next variant of inputs_[source] into heads_[source] and pushes
+  // its key onto the heap, if that input isn't exhausted. previous, if not
+  // null, is the key of the variant just taken from that input.
+  tensorflow::Status Advance(int source, const Key* previous);
+
+  std::vector<std::shared_ptr<VariantIterable>> inputs_;
+  std::vector<nucleus::genomics::v1::Variant> heads_;
+  std::priority_queue<Key, std::vector<Key>, std::greater<Key>> heap_;
+  const std::map<string, int>* contig_name_to_pos_in_fasta_;
+  bool started_ = false;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_MERGING_VCF_READER_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/merging_vcf_reader.h"
+
+#include <utility>
+
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using std::vector;
+
+using ::testing::ElementsAre;
+using ::testing::Pointwise;
+using ::testing::SizeIs;
+
+using nucleus::genomics::v1::Variant;
+
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+constexpr char kVcfSamplesFilename[] = "test_samples.vcf";
+constexpr char kVcfSamplesGoldenFilename[] = "test_samples.vcf.golden.tfrecord";
+constexpr char kVcfSitesFilename[] = "test_sites.vcf";
+
+std::unique_ptr<MergingVcfReader> OpenMerged(const vector<string>& filenames) {
+  vector<string> paths;
+  for (const string& filename : filenames) {
+    paths.push_back(GetTestData(filename));
+  }
+  return std::move(MergingVcfReader::FromFiles(
+                       paths, nucleus::genomics::v1::VcfReaderOptions())
+                       .ValueOrDie());
+}
+
+TEST(MergingVcfReaderTest, SingleInputMatchesGolden) {
+  auto reader = OpenMerged({kVcfIndexSamplesFilename});
+  std::vector<Variant> golden =
+      ReadProtosFromTFRecord<Variant>(GetTestData(kVcfSamplesGoldenFilename));
+  EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), golden));
+}
+
+TEST(MergingVcfReaderTest, InterleavesInputsStably) {
+  // Merging a file with itself yields every variant twice, in order.
+  auto reader = OpenMerged({kVcfSamplesFilename, kVcfIndexSamplesFilename});
+  std::vector<Variant> golden =
+      ReadProtosFromTFRecord<Variant>(GetTestData(kVcfSamplesGoldenFilename));
+  std::vector<Variant> expected;
+  for (const Variant& v : golden) {
+    expected.push_back(v);
+    expected.push_back(v);
+  }
+  EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), expected));
+}
+
+TEST(MergingVcfReaderTest, AcceptsLongerRecordBeforeShorterAtSameStart) {
+  // Inputs only need to be sorted by start, so a record may be followed by a
+  // shorter one at the same position.
+  const string header =
+      "##fileformat=VCFv4.2\n"
+      "##contig=<ID=chr1,length=1000>\n"
+      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n";
+  const vector<std::pair<string, string>> inputs = {
+      {"same_start_1.vcf",
+       "chr1\t10\t.\tACGT\tA\t.\t.\t.\nchr1\t10\t.\tA\tC\t.\t.\t.\n"},
+      {"same_start_2.vcf", "chr1\t10\t.\tA\tG\t.\t.\t.\n"}};
+  vector<string> paths;
+  for (const auto& input : inputs) {
+    paths.push_back(MakeTempFile(input.first));
+    TF_CHECK_OK(tensorflow::WriteStringToFile(
+        tensorflow::Env::Default(), paths.back(), header + input.second));
+  }
+  auto reader = std::move(MergingVcfReader::FromFiles(
+                              paths, nucleus::genomics::v1::VcfReaderOptions())
+                              .ValueOrDie());
+  vector<string> alts;
+  for (const StatusOr<Variant*> variant : reader->Iterate().ValueOrDie()) {
+    ASSERT_THAT(variant.status(), IsOK());
+    alts.push_back(variant.ValueOrDie()->alternate_bases(0));
+  }
+  EXPECT_THAT(alts, ElementsAre("G", "A", "C"));
+}
+
+TEST(MergingVcfReaderTest, QueryMergesEachInput) {
+  auto reader =
+      OpenMerged({kVcfIndexSamplesFilename, kVcfIndexSamplesFilename});
+  EXPECT_THAT(as_vector(reader->Query(MakeRange("chr3", 99999, 500000))),
+              SizeIs(8));
+}
+
+TEST(MergingVcfReaderTest, RejectsMismatchedSamples) {
+  EXPECT_THAT(
+      MergingVcfReader::FromFiles({GetTestData(kVcfIndexSamplesFilename),
+                                   GetTestData(kVcfSitesFilename)},
+                                  nucleus::genomics::v1::VcfReaderOptions())
+          .status(),
+      IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                "samples differ"));
+}
+
+TEST(MergingVcfReaderTest, OpsOnClosedReaderFail) {
+  auto reader = OpenMerged({kVcfIndexSamplesFilename});
+  ASSERT_THAT(reader->Close(), IsOK());
+  EXPECT_THAT(reader->Iterate().status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "closed MergingVcfReader"));
+}
+
+}  // namespace nucleus
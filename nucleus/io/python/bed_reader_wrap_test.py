@@ -23,6 +23,7 @@ from absl.testing import parameterized
 from nucleus.io import clif_postproc
 from nucleus.io.python import bed_reader
 from nucleus.protos import bed_pb2
+from nucleus.protos import range_pb2
 from nucleus.testing import test_utils
 
 
@@ -79,6 +80,24 @@ class BedReaderTest(parameterized.TestCase):
     with self.assertRaisesRegexp(ValueError, 'Cannot Iterate a closed'):
       reader.iterate()
 
+  def test_bed_sweep_query(self):
+    bed = test_utils.genomics_core_testdata('test.bed')
+    with bed_reader.BedReader.from_file(bed, self.options) as reader:
+      with reader.sweep_query() as sweep:
+        def query(chrom, start, end):
+          region = range_pb2.Range(reference_name=chrom, start=start, end=end)
+          return [(r.reference_name, r.start) for r in sweep.query(region)]
+
+        self.assertEqual(query('chr1', 0, 5), [('chr1', 1)])
+        self.assertEqual(query('chr2', 0, 20), [])
+        self.assertEqual(query('chr2', 25, 45), [('chr2', 20), ('chr2', 40)])
+        self.assertEqual(query('chr2', 50, 100), [('chr2', 40)])
+        self.assertEqual(query('chr3', 0, 100), [('chr3', 80)])
+        self.assertEqual(sweep.num_rewinds, 0)
+        # Going back rereads the file.
+        self.assertEqual(query('chr2', 21, 22), [('chr2', 20)])
+        self.assertEqual(sweep.num_rewinds, 1)
+
   @parameterized.parameters('malformed.bed', 'malformed2.bed')
   def test_bed_iterate_raises_on_malformed_record(self, filename):
     malformed = test_utils.genomics_core_testdata(filename)
@@ -186,6 +186,18 @@ class WrapVcfReaderTests(absltest.TestCase):
     iterable = self.samples_reader.query(range1)
     self.assertEqual(test_utils.iterable_len(iterable), 4)
 
+  def test_vcf_query_genotype_matrix(self):
+    range1 = ranges.parse_literal('chr3:100,000-500,000')
+    options = variants_pb2.VcfGenotypeMatrixOptions()
+    with self.samples_reader.query_genotype_matrix(range1,
+                                                   options) as iterable:
+      self.assertEqual(iterable.num_samples, 1)
+      n, genotypes, values, starts = iterable.PythonNext(10)
+      self.assertEqual(n, 4)
+      self.assertLen(genotypes, 4)
+      self.assertLen(starts, 4 * 8)
+      self.assertEqual(values, b'')
+
   def test_from_file_raises_with_missing_source(self):
     with self.assertRaisesRegexp(ValueError,
                                  'Not found: Could not open missing.vcf'):
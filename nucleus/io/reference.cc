@@ -19,7 +19,9 @@
 
 #include <algorithm>
 #include <numeric>
+#include <utility>
 
+#include "nucleus/util/utils.h"
 #include "tensorflow/core/platform/logging.h"
 
 namespace nucleus {
@@ -60,6 +62,62 @@ StatusOr<const nucleus::genomics::v1::ContigInfo*> GenomeReference::Contig(
   return tensorflow::errors::NotFound("Unknown contig ", contig_name);
 }
 
+StatusOr<std::vector<string>> GenomeReference::GetBasesBatch(
+    const std::vector<Range>& ranges, int64 max_gap,
+    int64 max_fetch_bases) const {
+  for (const Range& range : ranges) {
+    if (!IsValidInterval(range))
+      return tensorflow::errors::InvalidArgument("Invalid interval: ",
+                                                 range.ShortDebugString());
+  }
+
+  // Visit the ranges sorted by contig and start.
+  std::vector<size_t> order(ranges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&ranges](size_t a, size_t b) {
+    const Range& x = ranges[a];
+    const Range& y = ranges[b];
+    if (x.reference_name() != y.reference_name())
+      return x.reference_name() < y.reference_name();
+    return x.start() < y.start();
+  });
+
+  std::vector<string> bases(ranges.size());
+  for (size_t first = 0; first < order.size();) {
+    // Extend the fetch over the following ranges while they're close enough.
+    const Range& head = ranges[order[first]];
+    int64 fetch_end = head.end();
+    size_t last = first + 1;
+    for (; last < order.size(); ++last) {
+      const Range& next = ranges[order[last]];
+      const int64 end = std::max<int64>(fetch_end, next.end());
+      if (next.reference_name() != head.reference_name() ||
+          next.start() > fetch_end + max_gap ||
+          end - head.start() > max_fetch_bases) {
+        break;
+      }
+      fetch_end = end;
+    }
+
+    StatusOr<string> fetched = GetBases(
+        MakeRange(head.reference_name(), head.start(), fetch_end));
+    if (!fetched.ok()) return fetched.status();
+    if (last == first + 1) {
+      // The range was fetched by itself, so there's nothing to slice.
+      bases[order[first]] = std::move(fetched.ValueOrDie());
+      first = last;
+      continue;
+    }
+    for (size_t i = first; i < last; ++i) {
+      const Range& range = ranges[order[i]];
+      bases[order[i]] = fetched.ValueOrDie().substr(
+          range.start() - head.start(), range.end() - range.start());
+    }
+    first = last;
+  }
+  return bases;
+}
+
 // Note that start and end are 0-based, and end is exclusive. So end
 // can go up to the number of bases on contig.
 bool GenomeReference::IsValidInterval(const Range& range) const {
@@ -70,4 +128,52 @@ bool GenomeReference::IsValidInterval(const Range& range) const {
   return range.start() >= 0 && range.start() <= range.end() &&
          range.start() < n_bases && range.end() <= n_bases;
 }
+
+// ###########################################################################
+//
+// MappedGenomeReference code
+//
+// ###########################################################################
+
+StatusOr<const nucleus::genomics::v1::ContigInfo*>
+MappedGenomeReference::Contig(const string& contig_name) const {
+  const auto it = contig_index_.find(contig_name);
+  if (it == contig_index_.end()) {
+    return tensorflow::errors::NotFound("Unknown contig ", contig_name);
+  }
+  return &contigs_[it->second];
+}
+
+StatusOr<string> MappedGenomeReference::GetBases(const Range& range) const {
+  TF_RETURN_IF_ERROR(CheckReadable(range));
+  string bases(range.end() - range.start(), '\0');
+  CopyBases(range, &bases[0]);
+  return bases;
+}
+
+tensorflow::Status MappedGenomeReference::GetBasesInto(const Range& range,
+                                                       char* buf) const {
+  TF_RETURN_IF_ERROR(CheckReadable(range));
+  CopyBases(range, buf);
+  return tensorflow::Status::OK();
+}
+
+void MappedGenomeReference::AddContig(
+    nucleus::genomics::v1::ContigInfo contig) {
+  contig_index_.emplace(contig.name(), contigs_.size());
+  contigs_.push_back(std::move(contig));
+}
+
+tensorflow::Status MappedGenomeReference::CheckReadable(
+    const Range& range) const {
+  if (IsClosed()) {
+    return tensorflow::errors::FailedPrecondition(
+        "can't read from closed ", type_name_, " object.");
+  }
+  if (!IsValidInterval(range)) {
+    return tensorflow::errors::InvalidArgument("Invalid interval: ",
+                                               range.ShortDebugString());
+  }
+  return tensorflow::Status::OK();
+}
 }  // namespace nucleus
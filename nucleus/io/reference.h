@@ -42,6 +42,7 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_H_
 #define THIRD_PARTY_NUCLEUS_IO_REFERENCE_H_
 
+#include <unordered_map>
 #include <vector>
 
 #include "nucleus/protos/range.pb.h"
@@ -51,6 +52,9 @@
 
 namespace nucleus {
 
+constexpr int64 REFERENCE_BATCH_DEFAULT_MAX_GAP = 1024;
+constexpr int64 REFERENCE_BATCH_DEFAULT_MAX_FETCH_BASES = 1024 * 1024;
+
 class GenomeReference {
  public:
   GenomeReference(const GenomeReference&) = delete;
@@ -89,6 +93,26 @@ class GenomeReference {
   virtual StatusOr<string> GetBases(
       const nucleus::genomics::v1::Range& range) const = 0;
 
+  // Gets the basepairs of each of ranges, in the same order as ranges.
+  //
+  // This is equivalent to calling GetBases on each range, but is much cheaper
+  // for many small ranges: the ranges are sorted, and ranges on the same contig
+  // that overlap or lie within max_gap bases of each other are fetched with a
+  // single GetBases call (of at most max_fetch_bases bases, unless a range is
+  // longer than that by itself), which is then sliced into their bases.
+  // Returns a value whose status is not ok() if any range isn't valid.
+  virtual StatusOr<std::vector<string>> GetBasesBatch(
+      const std::vector<nucleus::genomics::v1::Range>& ranges, int64 max_gap,
+      int64 max_fetch_bases) const;
+
+  // GetBasesBatch with a max_gap of REFERENCE_BATCH_DEFAULT_MAX_GAP and a
+  // max_fetch_bases of REFERENCE_BATCH_DEFAULT_MAX_FETCH_BASES.
+  StatusOr<std::vector<string>> GetBasesBatch(
+      const std::vector<nucleus::genomics::v1::Range>& ranges) const {
+    return GetBasesBatch(ranges, REFERENCE_BATCH_DEFAULT_MAX_GAP,
+                         REFERENCE_BATCH_DEFAULT_MAX_FETCH_BASES);
+  }
+
   // Returns true iff the Range chr:start-end is a valid interval on chr and chr
   // is a known contig in this reference.
   bool IsValidInterval(const nucleus::genomics::v1::Range& range) const;
@@ -107,6 +131,62 @@ class GenomeReference {
   GenomeReference() {}
 };
 
+// The shared part of the GenomeReferences that map a file and copy bases out
+// of it, GenomeReferenceMmap and PackedGenomeReference: they look contigs up
+// in a hash table rather than scanning Contigs(), as references can have
+// thousands of contigs, and check ranges the same way before copying their
+// bases.
+class MappedGenomeReference : public GenomeReference {
+ public:
+  const std::vector<nucleus::genomics::v1::ContigInfo>& Contigs()
+      const override {
+    return contigs_;
+  }
+
+  StatusOr<const nucleus::genomics::v1::ContigInfo*> Contig(
+      const string& contig_name) const override;
+
+  StatusOr<string> GetBases(
+      const nucleus::genomics::v1::Range& range) const override;
+
+  // Writes the end - start bases of range, upper-cased, into buf, which must
+  // have room for them. Returns the same errors as GetBases.
+  tensorflow::Status GetBasesInto(const nucleus::genomics::v1::Range& range,
+                                  char* buf) const;
+
+ protected:
+  // type_name is the name of the subclass, for error messages.
+  explicit MappedGenomeReference(const char* type_name)
+      : type_name_(type_name) {}
+
+  // Adds contig, whose pos_in_fasta must be the number of contigs added
+  // before it.
+  void AddContig(nucleus::genomics::v1::ContigInfo contig);
+
+  // Returns the pos_in_fasta of contig_name, which must be one of our contigs.
+  int ContigIndex(const string& contig_name) const {
+    return contig_index_.find(contig_name)->second;
+  }
+
+  // Returns an error unless we can read the bases of range.
+  tensorflow::Status CheckReadable(
+      const nucleus::genomics::v1::Range& range) const;
+
+  // Returns true once the file has been unmapped by Close.
+  virtual bool IsClosed() const = 0;
+
+  // Writes the bases of range, which must be readable, upper-cased into buf.
+  virtual void CopyBases(const nucleus::genomics::v1::Range& range,
+                         char* buf) const = 0;
+
+ private:
+  const char* const type_name_;
+
+  // Our contigs, by pos_in_fasta, and the pos_in_fasta of each by name.
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs_;
+  std::unordered_map<string, int> contig_index_;
+};
+
 }  // namespace nucleus
 
 #endif  // THIRD_PARTY_NUCLEUS_IO_REFERENCE_H_
@@ -0,0 +1,438 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of reference_context.h
+#include "nucleus/io/reference_context.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::Range;
+using nucleus::genomics::v1::ReferenceContext;
+
+namespace {
+
+// The last bytes of a tracks file, which include a format version.
+constexpr char kMagic[] = "NUCRCT02";
+
+// The bases of the 2-bit codes.
+constexpr char kBases[] = "ACGT";
+
+// Returns the 2-bit code of the upper-case base, or -1 if it isn't A, C, G or
+// T.
+int BaseCode(char base) {
+  switch (base) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+  }
+}
+
+// Returns true if [offset, offset + size) is within [0, limit) and offset is a
+// multiple of alignment.
+bool InBounds(int64 offset, int64 size, int64 limit, int64 alignment) {
+  return offset >= 0 && size >= 0 && offset <= limit &&
+         size <= limit - offset && offset % alignment == 0;
+}
+
+// Returns true if the period bases at unit are a repeat of a shorter unit.
+bool HasShorterPeriod(const char* unit, int period) {
+  for (int d = 1; d < period; ++d) {
+    if (period % d == 0 && std::equal(unit, unit + period - d, unit + d)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+tf::Status ReferenceContextTracks::Build(const GenomeReference& reference,
+                                         int num_threads, const string& path,
+                                         int min_homopolymer_length,
+                                         int min_tandem_repeat_length,
+                                         int gc_window) {
+  if (num_threads < 1)
+    return tf::errors::InvalidArgument("num_threads must be positive");
+  if (min_homopolymer_length < 2) {
+    return tf::errors::InvalidArgument(
+        "min_homopolymer_length must be at least 2");
+  }
+  if (min_tandem_repeat_length < 1) {
+    return tf::errors::InvalidArgument(
+        "min_tandem_repeat_length must be positive");
+  }
+  if (gc_window < 1)
+    return tf::errors::InvalidArgument("gc_window must be positive");
+  const auto& contigs = reference.Contigs();
+  for (const auto& contig : contigs) {
+    if (contig.n_bases() > std::numeric_limits<uint32>::max()) {
+      return tf::errors::InvalidArgument("Can't compute tracks of contig ",
+                                         contig.name(), " of ",
+                                         contig.n_bases(), " bases");
+    }
+  }
+
+  absl::Mutex mutex;
+  size_t next_contig = 0;
+  std::vector<ContigTracks> tracks(contigs.size());
+  tf::Status status;
+  auto work = [&]() {
+    while (true) {
+      size_t i;
+      {
+        absl::MutexLock lock(&mutex);
+        if (next_contig == contigs.size() || !status.ok()) break;
+        i = next_contig++;
+      }
+      StatusOr<string> bases = reference.GetBases(
+          MakeRange(contigs[i].name(), 0, contigs[i].n_bases()));
+      if (!bases.ok()) {
+        absl::MutexLock lock(&mutex);
+        if (status.ok()) status = bases.status();
+        break;
+      }
+      ScanContig(bases.ValueOrDie(), min_homopolymer_length,
+                 min_tandem_repeat_length, gc_window, &tracks[i]);
+    }
+  };
+  num_threads = std::max(1, std::min<int>(num_threads, contigs.size()));
+  if (num_threads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++) workers.emplace_back(work);
+    for (std::thread& worker : workers) worker.join();
+  }
+  TF_RETURN_IF_ERROR(status);
+
+  std::unique_ptr<tf::WritableFile> file;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewWritableFile(path, &file));
+  int64 offset = 0;
+  // Appends size bytes of data, padded with zeros to a multiple of 8 bytes.
+  auto append = [&file, &offset](const void* data, int64 size) {
+    const int64 padding = (8 - size % 8) % 8;
+    offset += size + padding;
+    TF_RETURN_IF_ERROR(
+        file->Append(tf::StringPiece(static_cast<const char*>(data), size)));
+    return file->Append(string(padding, '\0'));
+  };
+
+  std::vector<ContigRecord> records;
+  string names;
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    ContigTracks& contig_tracks = tracks[i];
+    ContigRecord record;
+    record.n_bases = contigs[i].n_bases();
+    record.name_offset = names.size();
+    record.name_length = contigs[i].name().size();
+    names.append(contigs[i].name());
+
+    record.homopolymers_offset = offset;
+    record.n_homopolymers = contig_tracks.homopolymers.size();
+    TF_RETURN_IF_ERROR(
+        append(contig_tracks.homopolymers.data(),
+               contig_tracks.homopolymers.size() * sizeof(Repeat)));
+    record.tandem_repeats_offset = offset;
+    record.n_tandem_repeats = contig_tracks.tandem_repeats.size();
+    std::fill(std::begin(record.n_tandem_repeats_by_period),
+              std::end(record.n_tandem_repeats_by_period), 0);
+    for (const Repeat& repeat : contig_tracks.tandem_repeats) {
+      ++record.n_tandem_repeats_by_period[repeat.period - 2];
+    }
+    TF_RETURN_IF_ERROR(
+        append(contig_tracks.tandem_repeats.data(),
+               contig_tracks.tandem_repeats.size() * sizeof(Repeat)));
+    record.gc_counts_offset = offset;
+    TF_RETURN_IF_ERROR(append(contig_tracks.gc_counts.data(),
+                              contig_tracks.gc_counts.size() * sizeof(uint32)));
+    records.push_back(record);
+    // Free each contig's tracks as soon as they're written.
+    contig_tracks = ContigTracks();
+  }
+
+  for (ContigRecord& record : records) record.name_offset += offset;
+  TF_RETURN_IF_ERROR(append(names.data(), names.size()));
+  Trailer trailer;
+  trailer.n_contigs = records.size();
+  trailer.records_offset = offset;
+  trailer.min_homopolymer_length = min_homopolymer_length;
+  trailer.min_tandem_repeat_length = min_tandem_repeat_length;
+  trailer.gc_window = gc_window;
+  std::memcpy(trailer.magic, kMagic, sizeof(trailer.magic));
+  TF_RETURN_IF_ERROR(
+      append(records.data(), records.size() * sizeof(ContigRecord)));
+  TF_RETURN_IF_ERROR(append(&trailer, sizeof(trailer)));
+  return file->Close();
+}
+
+void ReferenceContextTracks::ScanContig(const string& bases,
+                                        int min_homopolymer_length,
+                                        int min_tandem_repeat_length,
+                                        int gc_window, ContigTracks* tracks) {
+  const int64 n = bases.size();
+  const char* s = bases.data();
+
+  // Homopolymers are the runs of a single base.
+  for (int64 start = 0; start < n;) {
+    int64 end = start + 1;
+    while (end < n && s[end] == s[start]) ++end;
+    const int code = BaseCode(s[start]);
+    if (end - start >= min_homopolymer_length && code >= 0) {
+      tracks->homopolymers.push_back(Repeat{static_cast<uint32>(start),
+                                            static_cast<uint32>(end - start),
+                                            static_cast<uint16>(code), 1});
+    }
+    start = end;
+  }
+
+  // A tandem repeat of period bases is a maximal run of positions [a, b) at
+  // which each base is the same as the one period bases on, and spans
+  // [a, b + period). Each period is scanned separately, as a tight loop, so
+  // the repeats are grouped by period and sorted by start within each.
+  for (int period = 2; period <= kMaxRepeatPeriod; ++period) {
+    int64 run_start = -1;
+    for (int64 i = 0; i + period <= n; ++i) {
+      if (i + period < n && s[i] == s[i + period] && BaseCode(s[i]) >= 0) {
+        if (run_start < 0) run_start = i;
+        continue;
+      }
+      if (run_start < 0) continue;
+      const int64 length = i + period - run_start;
+      if (length >= min_tandem_repeat_length && length >= 2 * period &&
+          !HasShorterPeriod(s + run_start, period)) {
+        uint16 unit = 0;
+        for (int j = 0; j < period; ++j) {
+          unit |= BaseCode(s[run_start + j]) << (2 * j);
+        }
+        tracks->tandem_repeats.push_back(
+            Repeat{static_cast<uint32>(run_start),
+                   static_cast<uint32>(length), unit,
+                   static_cast<uint16>(period)});
+      }
+      run_start = -1;
+    }
+  }
+
+  // Count the bases of each window with comparisons rather than branches or
+  // table lookups, so that compilers vectorize the loop.
+  const int64 n_windows = (n + gc_window - 1) / gc_window;
+  tracks->gc_counts.assign(2 * (n_windows + 1), 0);
+  uint32 gc = 0;
+  uint32 acgt = 0;
+  for (int64 window = 0; window < n_windows; ++window) {
+    const int64 end = std::min<int64>((window + 1) * gc_window, n);
+    for (int64 i = window * gc_window; i < end; ++i) {
+      const char c = s[i];
+      const uint32 is_gc = (c == 'G') | (c == 'C');
+      gc += is_gc;
+      acgt += is_gc | (c == 'A') | (c == 'T');
+    }
+    tracks->gc_counts[2 * (window + 1)] = gc;
+    tracks->gc_counts[2 * (window + 1) + 1] = acgt;
+  }
+}
+
+StatusOr<std::unique_ptr<ReferenceContextTracks>>
+ReferenceContextTracks::FromFile(const string& path) {
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(
+      tf::Env::Default()->NewReadOnlyMemoryRegionFromFile(path, &region));
+  const char* data = static_cast<const char*>(region->data());
+  const int64 length = region->length();
+  Trailer trailer;
+  if (length < static_cast<int64>(sizeof(trailer))) {
+    return tf::errors::DataLoss(path, " is not a reference context file");
+  }
+  std::memcpy(&trailer, data + length - sizeof(trailer), sizeof(trailer));
+  if (std::memcmp(trailer.magic, kMagic, sizeof(trailer.magic)) != 0) {
+    return tf::errors::DataLoss(path, " is not a reference context file");
+  }
+  const int64 records_end = length - sizeof(trailer);
+  if (trailer.n_contigs < 0 || trailer.gc_window < 1 ||
+      trailer.gc_window > std::numeric_limits<int>::max() ||
+      !InBounds(trailer.records_offset,
+                trailer.n_contigs * sizeof(ContigRecord), records_end, 8) ||
+      trailer.records_offset + trailer.n_contigs * sizeof(ContigRecord) !=
+          records_end) {
+    return tf::errors::DataLoss("Malformed reference context file ", path);
+  }
+
+  std::unique_ptr<ReferenceContextTracks> tracks(
+      new ReferenceContextTracks(std::move(region)));
+  tracks->min_homopolymer_length_ = trailer.min_homopolymer_length;
+  tracks->min_tandem_repeat_length_ = trailer.min_tandem_repeat_length;
+  tracks->gc_window_ = trailer.gc_window;
+  const auto* records =
+      reinterpret_cast<const ContigRecord*>(data + trailer.records_offset);
+  const int64 limit = trailer.records_offset;
+  for (int64 i = 0; i < trailer.n_contigs; ++i) {
+    const ContigRecord& record = records[i];
+    const int64 n_windows =
+        (record.n_bases + trailer.gc_window - 1) / trailer.gc_window;
+    // The tandem repeats of each period, counted without overflowing.
+    int64 n_tandem_repeats = 0;
+    for (int64 n : record.n_tandem_repeats_by_period) {
+      if (n < 0 || n > record.n_tandem_repeats - n_tandem_repeats) {
+        n_tandem_repeats = -1;
+        break;
+      }
+      n_tandem_repeats += n;
+    }
+    if (record.n_bases < 0 ||
+        !InBounds(record.name_offset, record.name_length, limit, 1) ||
+        record.n_homopolymers < 0 ||
+        !InBounds(record.homopolymers_offset,
+                  record.n_homopolymers * sizeof(Repeat), limit, 8) ||
+        record.n_tandem_repeats < 0 ||
+        n_tandem_repeats != record.n_tandem_repeats ||
+        !InBounds(record.tandem_repeats_offset,
+                  record.n_tandem_repeats * sizeof(Repeat), limit, 8) ||
+        !InBounds(record.gc_counts_offset,
+                  2 * (n_windows + 1) * sizeof(uint32), limit, 8)) {
+      return tf::errors::DataLoss("Malformed reference context file ", path);
+    }
+    nucleus::genomics::v1::ContigInfo contig;
+    contig.set_name(string(data + record.name_offset, record.name_length));
+    contig.set_description("");
+    contig.set_n_bases(record.n_bases);
+    contig.set_pos_in_fasta(i);
+    tracks->contig_index_.emplace(contig.name(), i);
+    tracks->contigs_.push_back(std::move(contig));
+    tracks->records_.push_back(&record);
+  }
+  return std::move(tracks);
+}
+
+ReferenceContextTracks::ReferenceContextTracks(
+    std::unique_ptr<tf::ReadOnlyMemoryRegion> region)
+    : region_(std::move(region)) {}
+
+const ReferenceContextTracks::Repeat* ReferenceContextTracks::LongestOverlap(
+    const Repeat* repeats, int64 n, int64 start, int64 end) {
+  // The repeats from the first ending after start to the last starting before
+  // end are exactly those overlapping [start, end).
+  const Repeat* repeat = std::lower_bound(
+      repeats, repeats + n, start, [](const Repeat& repeat, int64 pos) {
+        return repeat.start + static_cast<int64>(repeat.length) <= pos;
+      });
+  const Repeat* longest = nullptr;
+  for (; repeat != repeats + n && repeat->start < end; ++repeat) {
+    if (longest == nullptr || repeat->length > longest->length) {
+      longest = repeat;
+    }
+  }
+  return longest;
+}
+
+StatusOr<ReferenceContext> ReferenceContextTracks::Annotate(
+    const Range& range) const {
+  const auto it = contig_index_.find(range.reference_name());
+  if (it == contig_index_.end()) {
+    return tf::errors::NotFound("Unknown contig ", range.reference_name());
+  }
+  const ContigRecord& record = *records_[it->second];
+  if (range.start() < 0 || range.start() > range.end() ||
+      range.end() > record.n_bases) {
+    return tf::errors::InvalidArgument("Invalid interval: ",
+                                       range.ShortDebugString());
+  }
+  const char* data = static_cast<const char*>(region_->data());
+  ReferenceContext context;
+  *context.mutable_region() = range;
+
+  const Repeat* homopolymer = LongestOverlap(
+      reinterpret_cast<const Repeat*>(data + record.homopolymers_offset),
+      record.n_homopolymers, range.start(), range.end());
+  if (homopolymer != nullptr) {
+    *context.mutable_homopolymer() =
+        MakeRange(range.reference_name(), homopolymer->start,
+                  homopolymer->start + homopolymer->length);
+    context.set_homopolymer_base(string(1, kBases[homopolymer->unit]));
+  }
+
+  // Of the longest tandem repeats overlapping range, report the one starting
+  // first, and of those the one with the shortest period.
+  const Repeat* repeat = nullptr;
+  const auto* tandem_repeats =
+      reinterpret_cast<const Repeat*>(data + record.tandem_repeats_offset);
+  for (int64 n : record.n_tandem_repeats_by_period) {
+    const Repeat* longest =
+        LongestOverlap(tandem_repeats, n, range.start(), range.end());
+    if (longest != nullptr &&
+        (repeat == nullptr || longest->length > repeat->length ||
+         (longest->length == repeat->length &&
+          longest->start < repeat->start))) {
+      repeat = longest;
+    }
+    tandem_repeats += n;
+  }
+  if (repeat != nullptr) {
+    *context.mutable_tandem_repeat() = MakeRange(
+        range.reference_name(), repeat->start, repeat->start + repeat->length);
+    string unit;
+    for (int j = 0; j < repeat->period; ++j) {
+      unit.push_back(kBases[(repeat->unit >> (2 * j)) & 3]);
+    }
+    context.set_tandem_repeat_unit(unit);
+  }
+
+  // The GC content of the windows overlapping range, or of the window starting
+  // at an empty range.
+  const int64 n_windows = (record.n_bases + gc_window_ - 1) / gc_window_;
+  const int64 first = std::min<int64>(range.start() / gc_window_, n_windows);
+  const int64 last = std::min<int64>(
+      std::max<int64>((range.end() + gc_window_ - 1) / gc_window_, first + 1),
+      n_windows);
+  const auto* counts =
+      reinterpret_cast<const uint32*>(data + record.gc_counts_offset);
+  const uint32 gc = counts[2 * last] - counts[2 * first];
+  const uint32 acgt = counts[2 * last + 1] - counts[2 * first + 1];
+  *context.mutable_gc_window() =
+      MakeRange(range.reference_name(), first * gc_window_,
+                std::min<int64>(last * gc_window_, record.n_bases));
+  context.set_gc_fraction(acgt > 0 ? static_cast<double>(gc) / acgt : 0.0);
+  return context;
+}
+
+StatusOr<std::vector<ReferenceContext>> ReferenceContextTracks::AnnotateBatch(
+    const std::vector<Range>& ranges) const {
+  std::vector<ReferenceContext> contexts;
+  contexts.reserve(ranges.size());
+  for (const Range& range : ranges) {
+    StatusOr<ReferenceContext> context = Annotate(range);
+    TF_RETURN_IF_ERROR(context.status());
+    contexts.push_back(std::move(context.ValueOrDie()));
+  }
+  return contexts;
+}
+
+}  // namespace nucleus
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_CONTEXT_H_
+#define THIRD_PARTY_NUCLEUS_IO_REFERENCE_CONTEXT_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "nucleus/io/reference.h"
+#include "nucleus/platform/types.h"
+#include "nucleus/protos/range.pb.h"
+#include "nucleus/protos/reference.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+constexpr int REFERENCE_CONTEXT_DEFAULT_MIN_HOMOPOLYMER_LENGTH = 4;
+constexpr int REFERENCE_CONTEXT_DEFAULT_MIN_TANDEM_REPEAT_LENGTH = 10;
+constexpr int REFERENCE_CONTEXT_DEFAULT_GC_WINDOW = 100;
+
+// Precomputed tracks of the sequence context of a reference genome, for
+// annotating sites with the homopolymers and short tandem repeats around them
+// and their local GC content without reading the reference.
+//
+// The tracks are:
+//  - the homopolymers (runs of one of A, C, G or T) of at least a minimum
+//    length;
+//  - the short tandem repeats of units of 2 to kMaxRepeatPeriod bases, of at
+//    least a minimum length and two whole units, that aren't repeats of a
+//    shorter unit;
+//  - the cumulative counts of G or C bases and of A, C, G or T bases at the
+//    boundaries of fixed-size windows.
+//
+// They're written to a file by Build, which is memory-mapped rather than read
+// when the tracks are loaded. Annotate finds the repeats overlapping a range
+// by binary search and its GC content from the counts at the windows at its
+// ends, so its cost grows with the number of repeats overlapping the range
+// rather than with the size of the genome or the range.
+class ReferenceContextTracks {
+ public:
+  // The longest repeat unit detected.
+  static constexpr int kMaxRepeatPeriod = 6;
+
+  // Computes the tracks of all the contigs of reference, and writes them to
+  // path. Contigs are scanned by num_threads threads, each holding the bases
+  // of one contig at a time, so reference's GetBases must be safe to call
+  // concurrently when num_threads > 1.
+  static tensorflow::Status Build(
+      const GenomeReference& reference, int num_threads, const string& path,
+      int min_homopolymer_length =
+          REFERENCE_CONTEXT_DEFAULT_MIN_HOMOPOLYMER_LENGTH,
+      int min_tandem_repeat_length =
+          REFERENCE_CONTEXT_DEFAULT_MIN_TANDEM_REPEAT_LENGTH,
+      int gc_window = REFERENCE_CONTEXT_DEFAULT_GC_WINDOW);
+
+  // Maps the tracks written by Build at path.
+  static StatusOr<std::unique_ptr<ReferenceContextTracks>> FromFile(
+      const string& path);
+
+  // Returns the context of range, which must be a valid interval of one of our
+  // contigs.
+  StatusOr<nucleus::genomics::v1::ReferenceContext> Annotate(
+      const nucleus::genomics::v1::Range& range) const;
+
+  // Returns the result of Annotate for each of ranges, in order.
+  StatusOr<std::vector<nucleus::genomics::v1::ReferenceContext>>
+  AnnotateBatch(
+      const std::vector<nucleus::genomics::v1::Range>& ranges) const;
+
+  // The contigs the tracks cover, in the order of the reference.
+  const std::vector<nucleus::genomics::v1::ContigInfo>& Contigs() const {
+    return contigs_;
+  }
+
+  int MinHomopolymerLength() const { return min_homopolymer_length_; }
+  int MinTandemRepeatLength() const { return min_tandem_repeat_length_; }
+  int GcWindow() const { return gc_window_; }
+
+ private:
+  // The file holds, for each contig in turn, its homopolymer Repeats sorted by
+  // start, its tandem Repeats grouped by period and sorted by start within
+  // each period, and its GC counts, padded to a multiple of 8 bytes. They're followed by the contigs' names, the
+  // ContigRecords and a Trailer. All the integers are in the host's byte
+  // order.
+  struct ContigRecord {
+    int64 n_bases;
+    int64 name_offset;
+    int64 name_length;
+    // The offsets in the file of the contig's homopolymers and tandem repeats,
+    // with the number of each, and the number of tandem repeats of each period
+    // from 2 to kMaxRepeatPeriod. Homopolymers don't overlap, and neither do
+    // the runs of tandem repeats of one period, so each of these sequences is
+    // sorted by end as well as by start.
+    int64 homopolymers_offset;
+    int64 n_homopolymers;
+    int64 tandem_repeats_offset;
+    int64 n_tandem_repeats;
+    int64 n_tandem_repeats_by_period[kMaxRepeatPeriod - 1];
+    // The offset of the contig's GC counts: for each window boundary i (of
+    // n_bases / gc_window rounded up, plus one), the number of G or C bases
+    // before the boundary and then the number of A, C, G or T bases before it,
+    // as uint32 pairs.
+    int64 gc_counts_offset;
+  };
+
+  // The repeat of period bases starting at start and spanning length bases.
+  // The bases of its unit are packed into unit two bits each (A = 0, C = 1,
+  // G = 2, T = 3), the first in the lowest bits.
+  struct Repeat {
+    uint32 start;
+    uint32 length;
+    uint16 unit;
+    uint16 period;
+  };
+
+  struct Trailer {
+    int64 n_contigs;
+    int64 records_offset;
+    int64 min_homopolymer_length;
+    int64 min_tandem_repeat_length;
+    int64 gc_window;
+    char magic[8];
+  };
+
+  // The tracks of one contig, before they are written.
+  struct ContigTracks {
+    std::vector<Repeat> homopolymers;
+    std::vector<Repeat> tandem_repeats;
+    std::vector<uint32> gc_counts;
+  };
+
+  explicit ReferenceContextTracks(
+      std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region);
+
+  // Computes the tracks of bases, the bases of a whole contig.
+  static void ScanContig(const string& bases, int min_homopolymer_length,
+                         int min_tandem_repeat_length, int gc_window,
+                         ContigTracks* tracks);
+
+  // Returns the first of the longest of the n repeats, sorted by both start and
+  // end, that overlap [start, end), or nullptr if none does. Only the repeats
+  // overlapping [start, end) are visited.
+  static const Repeat* LongestOverlap(const Repeat* repeats, int64 n,
+                                      int64 start, int64 end);
+
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region_;
+  int min_homopolymer_length_ = 0;
+  int min_tandem_repeat_length_ = 0;
+  int gc_window_ = 0;
+
+  // Our contigs, and their records in the mapped file by pos_in_fasta.
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs_;
+  std::vector<const ContigRecord*> records_;
+
+  // The pos_in_fasta of each contig, by name.
+  std::unordered_map<string, int> contig_index_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_REFERENCE_CONTEXT_H_
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/reference_context.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "nucleus/io/fasta_reader.h"
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::ContigInfo;
+using nucleus::genomics::v1::ReferenceContext;
+using nucleus::genomics::v1::ReferenceSequence;
+
+// Returns the tracks of reference built with num_threads threads and the
+// default options, except for a gc_window of 8.
+std::unique_ptr<ReferenceContextTracks> BuildTracks(
+    const GenomeReference& reference, int num_threads, const string& name) {
+  const string path = MakeTempFile(name);
+  TF_CHECK_OK(ReferenceContextTracks::Build(
+      reference, num_threads, path,
+      REFERENCE_CONTEXT_DEFAULT_MIN_HOMOPOLYMER_LENGTH,
+      REFERENCE_CONTEXT_DEFAULT_MIN_TANDEM_REPEAT_LENGTH, 8));
+  return std::move(ReferenceContextTracks::FromFile(path).ValueOrDie());
+}
+
+class ReferenceContextTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::vector<ContigInfo> contigs;
+    std::vector<ReferenceSequence> seqs;
+    const std::vector<std::pair<string, string>> contig_bases = {
+        // A homopolymer at 4, a (CA)n repeat at 11 and an (AGC)n one at 25.
+        {"c1", "GGGCAAAAAATCACACACACACGTTAGCAGCAGCAGCANN"},
+        {"c2", "ATATATATATAT"},
+    };
+    for (const auto& contig : contig_bases) {
+      ContigInfo info;
+      info.set_name(contig.first);
+      info.set_n_bases(contig.second.size());
+      info.set_pos_in_fasta(contigs.size());
+      contigs.push_back(info);
+      ReferenceSequence seq;
+      *seq.mutable_region() =
+          MakeRange(contig.first, 0, contig.second.size());
+      seq.set_bases(contig.second);
+      seqs.push_back(seq);
+    }
+    reference_ = std::move(
+        InMemoryGenomeReference::Create(contigs, seqs).ValueOrDie());
+    tracks_ = BuildTracks(*reference_, 1, "test.rct");
+  }
+
+  ReferenceContext Annotate(const string& contig, int64 start, int64 end) {
+    return tracks_->Annotate(MakeRange(contig, start, end)).ValueOrDie();
+  }
+
+  std::unique_ptr<InMemoryGenomeReference> reference_;
+  std::unique_ptr<ReferenceContextTracks> tracks_;
+};
+
+TEST_F(ReferenceContextTest, AnnotatesHomopolymers) {
+  const ReferenceContext context = Annotate("c1", 5, 6);
+  EXPECT_THAT(context.homopolymer(), EqualsProto(MakeRange("c1", 4, 10)));
+  EXPECT_EQ("A", context.homopolymer_base());
+  // Only homopolymers of at least 4 bases are tracked.
+  EXPECT_FALSE(Annotate("c1", 0, 3).has_homopolymer());
+  EXPECT_EQ("", Annotate("c1", 0, 3).homopolymer_base());
+  // A range overlapping the end of a homopolymer is annotated with it.
+  EXPECT_THAT(Annotate("c1", 9, 12).homopolymer(),
+              EqualsProto(MakeRange("c1", 4, 10)));
+  EXPECT_FALSE(Annotate("c1", 10, 12).has_homopolymer());
+}
+
+TEST_F(ReferenceContextTest, AnnotatesTandemRepeats) {
+  ReferenceContext context = Annotate("c1", 14, 15);
+  EXPECT_THAT(context.tandem_repeat(), EqualsProto(MakeRange("c1", 11, 22)));
+  EXPECT_EQ("CA", context.tandem_repeat_unit());
+  context = Annotate("c1", 30, 31);
+  EXPECT_THAT(context.tandem_repeat(), EqualsProto(MakeRange("c1", 25, 38)));
+  EXPECT_EQ("AGC", context.tandem_repeat_unit());
+  context = Annotate("c2", 11, 12);
+  EXPECT_THAT(context.tandem_repeat(), EqualsProto(MakeRange("c2", 0, 12)));
+  EXPECT_EQ("AT", context.tandem_repeat_unit());
+  // The homopolymer isn't reported as a repeat of AA, AAA and so on.
+  EXPECT_FALSE(Annotate("c1", 5, 6).has_tandem_repeat());
+  // The longer of the two repeats a range overlaps is reported.
+  EXPECT_EQ("AGC", Annotate("c1", 20, 30).tandem_repeat_unit());
+}
+
+TEST_F(ReferenceContextTest, AnnotatesGcContent) {
+  // GGGCAAAA
+  ReferenceContext context = Annotate("c1", 5, 6);
+  EXPECT_THAT(context.gc_window(), EqualsProto(MakeRange("c1", 0, 8)));
+  EXPECT_DOUBLE_EQ(0.5, context.gc_fraction());
+  // TAGCAGCAGCAGCANN; the Ns don't count.
+  context = Annotate("c1", 30, 40);
+  EXPECT_THAT(context.gc_window(), EqualsProto(MakeRange("c1", 24, 40)));
+  EXPECT_DOUBLE_EQ(8.0 / 14.0, context.gc_fraction());
+  EXPECT_DOUBLE_EQ(0.0, Annotate("c2", 0, 12).gc_fraction());
+  // An empty range gets the GC content of the window it starts.
+  EXPECT_THAT(Annotate("c1", 8, 8).gc_window(),
+              EqualsProto(MakeRange("c1", 8, 16)));
+}
+
+TEST_F(ReferenceContextTest, AnnotateBatch) {
+  const std::vector<nucleus::genomics::v1::Range> ranges = {
+      MakeRange("c1", 14, 15), MakeRange("c2", 0, 1), MakeRange("c1", 5, 6)};
+  const std::vector<ReferenceContext> contexts =
+      tracks_->AnnotateBatch(ranges).ValueOrDie();
+  ASSERT_EQ(ranges.size(), contexts.size());
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    EXPECT_THAT(contexts[i],
+                EqualsProto(tracks_->Annotate(ranges[i]).ValueOrDie()));
+  }
+}
+
+TEST_F(ReferenceContextTest, RejectsBadRanges) {
+  EXPECT_THAT(tracks_->Annotate(MakeRange("c3", 0, 1)),
+              IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                        "Unknown contig c3"));
+  EXPECT_THAT(tracks_->Annotate(MakeRange("c2", 5, 13)),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid interval"));
+  EXPECT_THAT(tracks_->AnnotateBatch({MakeRange("c1", 0, 1),
+                                      MakeRange("c2", -1, 1)}),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid interval"));
+}
+
+TEST_F(ReferenceContextTest, RecordsOptions) {
+  EXPECT_EQ(REFERENCE_CONTEXT_DEFAULT_MIN_HOMOPOLYMER_LENGTH,
+            tracks_->MinHomopolymerLength());
+  EXPECT_EQ(REFERENCE_CONTEXT_DEFAULT_MIN_TANDEM_REPEAT_LENGTH,
+            tracks_->MinTandemRepeatLength());
+  EXPECT_EQ(8, tracks_->GcWindow());
+  ASSERT_EQ(2, tracks_->Contigs().size());
+  EXPECT_EQ("c2", tracks_->Contigs()[1].name());
+  EXPECT_EQ(12, tracks_->Contigs()[1].n_bases());
+}
+
+TEST(ReferenceContextFastaTest, MatchesBases) {
+  const string fasta = GetTestData("test.fasta");
+  std::unique_ptr<GenomeReferenceFai> reference = std::move(
+      GenomeReferenceFai::FromFile(fasta, absl::StrCat(fasta, ".fai"))
+          .ValueOrDie());
+  auto tracks = BuildTracks(*reference, 1, "test_fasta_1.rct");
+  auto threaded_tracks = BuildTracks(*reference, 3, "test_fasta_3.rct");
+  for (const auto& contig : reference->Contigs()) {
+    const string bases =
+        reference->GetBases(MakeRange(contig.name(), 0, contig.n_bases()))
+            .ValueOrDie();
+    for (int64 pos = 0; pos < contig.n_bases(); ++pos) {
+      const auto range = MakeRange(contig.name(), pos, pos + 1);
+      const ReferenceContext context = tracks->Annotate(range).ValueOrDie();
+      EXPECT_THAT(threaded_tracks->Annotate(range).ValueOrDie(),
+                  EqualsProto(context));
+
+      // The homopolymer at pos, found by brute force.
+      int64 start = pos;
+      int64 end = pos + 1;
+      while (start > 0 && bases[start - 1] == bases[pos]) --start;
+      while (end < contig.n_bases() && bases[end] == bases[pos]) ++end;
+      if (end - start >= REFERENCE_CONTEXT_DEFAULT_MIN_HOMOPOLYMER_LENGTH &&
+          IsCanonicalBase(bases[pos])) {
+        EXPECT_THAT(context.homopolymer(),
+                    EqualsProto(MakeRange(contig.name(), start, end)));
+      } else {
+        EXPECT_FALSE(context.has_homopolymer());
+      }
+
+      int gc = 0;
+      int acgt = 0;
+      const auto& window = context.gc_window();
+      for (int64 i = window.start(); i < window.end(); ++i) {
+        gc += bases[i] == 'G' || bases[i] == 'C';
+        acgt += IsCanonicalBase(bases[i]);
+      }
+      EXPECT_EQ(pos / 8 * 8, window.start());
+      EXPECT_DOUBLE_EQ(acgt > 0 ? static_cast<double>(gc) / acgt : 0.0,
+                       context.gc_fraction());
+    }
+  }
+}
+
+TEST(ReferenceContextFileTest, RejectsOtherFiles) {
+  EXPECT_THAT(ReferenceContextTracks::FromFile(GetTestData("test.fasta")),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "is not a reference context file"));
+}
+
+}  // namespace nucleus
@@ -18,11 +18,23 @@
 #include "nucleus/io/reference_fai.h"
 
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <thread>  // NOLINT
+#include <unordered_set>
+#include <utility>
 
 #include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
 #include "htslib/tbx.h"
 #include "nucleus/io/hts_path.h"
 #include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
 
 namespace nucleus {
@@ -30,6 +42,21 @@ namespace nucleus {
 using nucleus::genomics::v1::Range;
 
 namespace {
+// Caches of at least kMinShardedCacheBlocks blocks are split into up to
+// kMaxCacheShards shards of at least kMinBlocksPerShard blocks each, to limit
+// contention between threads reading different blocks. Each shard evicts its
+// own least recently used block, so only smaller caches, which have a single
+// shard, are exactly LRU.
+constexpr int kMinShardedCacheBlocks = 64;
+constexpr int kMaxCacheShards = 16;
+constexpr int kMinBlocksPerShard = 16;
+
+// Returns the number of shards of a cache of cache_capacity_blocks blocks.
+int NumCacheShards(int cache_capacity_blocks) {
+  if (cache_capacity_blocks < kMinShardedCacheBlocks) return 1;
+  return std::min(cache_capacity_blocks / kMinBlocksPerShard, kMaxCacheShards);
+}
+
 // Gets information about the contigs from the fai index faidx.
 std::vector<nucleus::genomics::v1::ContigInfo> ExtractContigsFromFai(
     const faidx_t* faidx) {
@@ -47,10 +74,320 @@ std::vector<nucleus::genomics::v1::ContigInfo> ExtractContigsFromFai(
   }
   return contigs;
 }
+
+// BuildIndex scans an uncompressed FASTA in chunks of at least kMinChunkBytes
+// bytes, making up to kChunksPerThread chunks per thread so that threads that
+// finish early can pick up more of the work.
+constexpr uint64 kMinChunkBytes = 1 << 20;
+constexpr int kChunksPerThread = 4;
+
+// A run of count consecutive sequence lines of a FASTA, starting at offset,
+// which all hold bases bases in width bytes, including the line terminator.
+// Blank lines (without any bases) make up runs of their own whatever their
+// widths.
+struct LineRun {
+  uint64 offset;
+  int64 width;
+  int64 bases;
+  int64 count;
+};
+
+// A well-formed contig has at most four runs of lines: blank lines after its
+// header, full lines, a shorter last line and blank lines after it. We don't
+// keep track of any runs beyond one more than that, as the contig is malformed
+// whatever they are.
+constexpr size_t kMaxLineRuns = 5;
+
+// The lines following a header of a FASTA, or preceding the first header.
+struct FastaSegment {
+  // The name of the contig the header starts, the offset of the header and the
+  // offset of the line after it, or an empty name and zero offsets for the
+  // lines preceding the first header.
+  string name;
+  uint64 header_offset = 0;
+  uint64 sequence_offset = 0;
+  std::vector<LineRun> runs;
+};
+
+// Adds run to the end of runs, merging it with the last run if they have the
+// same shape.
+void AppendLineRun(const LineRun& run, std::vector<LineRun>* runs) {
+  if (!runs->empty()) {
+    LineRun& last = runs->back();
+    if (last.bases == run.bases &&
+        (run.bases == 0 || last.width == run.width)) {
+      last.count += run.count;
+      return;
+    }
+  }
+  if (runs->size() < kMaxLineRuns) runs->push_back(run);
+}
+
+// Whether each byte isn't a IUPAC nucleotide code, in either case.
+class InvalidBaseTable {
+ public:
+  InvalidBaseTable() {
+    std::fill(invalid_, invalid_ + 256, 1);
+    for (const char* c = "ACGTUNRYKMSWBDHV"; *c != '\0'; ++c) {
+      invalid_[static_cast<unsigned char>(*c)] = 0;
+      invalid_[static_cast<unsigned char>(absl::ascii_tolower(*c))] = 0;
+    }
+  }
+
+  // Returns whether bases has any byte that isn't a base. Bytes are checked
+  // without branching on them so that compilers can vectorize the loop; we
+  // only look for the offending byte once we know there is one.
+  bool AnyInvalid(absl::string_view bases) const {
+    unsigned char invalid = 0;
+    for (const char c : bases) {
+      invalid |= invalid_[static_cast<unsigned char>(c)];
+    }
+    return invalid != 0;
+  }
+
+  bool IsInvalid(char c) const {
+    return invalid_[static_cast<unsigned char>(c)] != 0;
+  }
+
+ private:
+  unsigned char invalid_[256];
+};
+
+const InvalidBaseTable& InvalidBases() {
+  static const InvalidBaseTable* table = new InvalidBaseTable();
+  return *table;
+}
+
+// Summarizes consecutive lines of a FASTA as the segments they make up. The
+// first segment holds the lines before the first header seen, which continue
+// the contig of whatever lines came before them.
+class FastaLineScanner {
+ public:
+  FastaLineScanner() : segments_(1) {}
+
+  // Adds the line starting at offset, which is width bytes long including its
+  // line terminator and holds text.
+  void AddLine(uint64 offset, int64 width, absl::string_view text) {
+    // Count the line terminator of an unterminated last line, as samtools
+    // does.
+    width = std::max<int64>(width, text.size() + 1);
+    if (!text.empty() && text[0] == '>') {
+      FastaSegment segment;
+      text.remove_prefix(1);
+      segment.name = string(text.substr(
+          0, std::find_if(text.begin(), text.end(), absl::ascii_isspace) -
+                 text.begin()));
+      segment.header_offset = offset;
+      segment.sequence_offset = offset + width;
+      segments_.push_back(std::move(segment));
+      return;
+    }
+    if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+    if (invalid_offset_ < 0 && InvalidBases().AnyInvalid(text)) {
+      const auto c = std::find_if(text.begin(), text.end(), [](char c) {
+        return InvalidBases().IsInvalid(c);
+      });
+      invalid_offset_ = offset + (c - text.begin());
+      invalid_char_ = *c;
+    }
+    AppendLineRun(LineRun{offset, width, static_cast<int64>(text.size()), 1},
+                  &segments_.back().runs);
+  }
+
+  // Appends the segments of other, which scanned the lines following ours.
+  void Merge(FastaLineScanner* other) {
+    for (const LineRun& run : other->segments_[0].runs) {
+      AppendLineRun(run, &segments_.back().runs);
+    }
+    std::move(other->segments_.begin() + 1, other->segments_.end(),
+              std::back_inserter(segments_));
+    if (invalid_offset_ < 0) {
+      invalid_offset_ = other->invalid_offset_;
+      invalid_char_ = other->invalid_char_;
+    }
+  }
+
+  // Returns the FAI of the lines added, which must be all those of
+  // fasta_path, or an error if they aren't a well-formed FASTA.
+  StatusOr<string> MakeFai(const string& fasta_path) const;
+
+ private:
+  std::vector<FastaSegment> segments_;
+
+  // The offset of the first character of a sequence that isn't a base, and the
+  // character, if there is one.
+  int64 invalid_offset_ = -1;
+  char invalid_char_ = '\0';
+};
+
+StatusOr<string> FastaLineScanner::MakeFai(const string& fasta_path) const {
+  if (invalid_offset_ >= 0) {
+    return tensorflow::errors::DataLoss(
+        "Malformed FASTA ", fasta_path, ": invalid base '",
+        absl::CEscape(string(1, invalid_char_)), "' at offset ",
+        invalid_offset_);
+  }
+  for (const LineRun& run : segments_[0].runs) {
+    if (run.bases > 0) {
+      return tensorflow::errors::DataLoss("Malformed FASTA ", fasta_path,
+                                          ": sequence at offset ", run.offset,
+                                          " precedes the first header");
+    }
+  }
+
+  string fai;
+  std::unordered_set<string> names;
+  for (auto segment = segments_.begin() + 1; segment != segments_.end();
+       ++segment) {
+    if (segment->name.empty()) {
+      return tensorflow::errors::DataLoss("Malformed FASTA ", fasta_path,
+                                          ": header at offset ",
+                                          segment->header_offset,
+                                          " has no name");
+    }
+    if (!names.insert(segment->name).second) {
+      return tensorflow::errors::DataLoss("Malformed FASTA ", fasta_path,
+                                          ": more than one contig is named ",
+                                          segment->name);
+    }
+
+    // Skip the blank lines after the header; the lines with bases must then be
+    // full lines, at most one shorter line, and blank lines.
+    auto run = segment->runs.begin();
+    if (run != segment->runs.end() && run->bases == 0) ++run;
+    int64 n_bases = 0;
+    uint64 offset = segment->sequence_offset;
+    int64 line_bases = 0;
+    int64 line_width = 0;
+    if (run != segment->runs.end()) {
+      offset = run->offset;
+      line_bases = run->bases;
+      line_width = run->width;
+      n_bases = run->bases * run->count;
+      ++run;
+      if (run != segment->runs.end() && run->bases > 0 && run->count == 1 &&
+          run->bases <= line_bases) {
+        n_bases += run->bases;
+        ++run;
+      }
+      if (run != segment->runs.end() && run->bases == 0) ++run;
+      if (run != segment->runs.end()) {
+        return tensorflow::errors::DataLoss(
+            "Malformed FASTA ", fasta_path, ": contig ", segment->name,
+            " has lines of different lengths");
+      }
+    }
+    absl::StrAppend(&fai, segment->name, "\t", n_bases, "\t", offset, "\t",
+                    line_bases, "\t", line_width, "\n");
+  }
+  return fai;
+}
+
+// Scans the lines of the uncompressed FASTA data of length bytes that start in
+// [begin, end).
+void ScanFastaChunk(const char* data, uint64 length, uint64 begin, uint64 end,
+                    FastaLineScanner* scanner) {
+  uint64 pos = begin;
+  if (pos > 0 && data[pos - 1] != '\n') {
+    // The line at begin started in the previous chunk.
+    const void* newline = memchr(data + pos, '\n', length - pos);
+    pos = newline == nullptr
+              ? length
+              : static_cast<const char*>(newline) - data + 1;
+  }
+  while (pos < end) {
+    const void* newline = memchr(data + pos, '\n', length - pos);
+    const uint64 line_end =
+        newline == nullptr ? length : static_cast<const char*>(newline) - data;
+    const uint64 next = newline == nullptr ? length : line_end + 1;
+    scanner->AddLine(pos, next - pos,
+                     absl::string_view(data + pos, line_end - pos));
+    pos = next;
+  }
+}
+
+// Scans the uncompressed FASTA fasta_path with num_threads threads.
+tensorflow::Status ScanFasta(const string& fasta_path, int num_threads,
+                             FastaLineScanner* scanner) {
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(
+      tensorflow::Env::Default()->NewReadOnlyMemoryRegionFromFile(fasta_path,
+                                                                  &region));
+  const char* data = static_cast<const char*>(region->data());
+  const uint64 length = region->length();
+  const int n_chunks = static_cast<int>(std::max<uint64>(
+      std::min<uint64>(num_threads * kChunksPerThread,
+                       length / kMinChunkBytes),
+      1));
+  const uint64 chunk_bytes = (length + n_chunks - 1) / n_chunks;
+  num_threads = std::min(num_threads, n_chunks);
+
+  std::vector<FastaLineScanner> chunks(n_chunks);
+  absl::Mutex mutex;
+  int next_chunk = 0;
+  auto work = [&]() {
+    while (true) {
+      int chunk;
+      {
+        absl::MutexLock lock(&mutex);
+        if (next_chunk == n_chunks) return;
+        chunk = next_chunk++;
+      }
+      const uint64 begin = std::min<uint64>(chunk * chunk_bytes, length);
+      const uint64 end = std::min<uint64>(begin + chunk_bytes, length);
+      ScanFastaChunk(data, length, begin, end, &chunks[chunk]);
+    }
+  };
+  if (num_threads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++) workers.emplace_back(work);
+    for (std::thread& worker : workers) worker.join();
+  }
+
+  // Reconcile the chunks, joining lines of a contig split between them.
+  *scanner = std::move(chunks[0]);
+  for (int i = 1; i < n_chunks; ++i) scanner->Merge(&chunks[i]);
+  return tensorflow::Status::OK();
+}
+
+// Scans the bgzipped FASTA open in bgzf, decompressing it with num_threads
+// threads, and writes its GZI index to fasta_path + ".gzi".
+tensorflow::Status ScanBgzfFasta(const string& fasta_path, BGZF* bgzf,
+                                 int num_threads, FastaLineScanner* scanner) {
+  if (num_threads > 1 && bgzf_mt(bgzf, num_threads, 256) < 0) {
+    return tensorflow::errors::Internal(
+        "Couldn't start threads to decompress ", fasta_path);
+  }
+  if (bgzf_index_build_init(bgzf) < 0) {
+    return tensorflow::errors::Internal("Couldn't index blocks of ",
+                                        fasta_path);
+  }
+  kstring_t line = {0, 0, nullptr};
+  uint64 offset = bgzf_utell(bgzf);
+  int n;
+  while ((n = bgzf_getline(bgzf, '\n', &line)) >= 0) {
+    const uint64 next = bgzf_utell(bgzf);
+    scanner->AddLine(offset, next - offset, absl::string_view(line.s, line.l));
+    offset = next;
+  }
+  free(line.s);
+  if (n < -1) {
+    return tensorflow::errors::DataLoss("Failed to decompress ", fasta_path);
+  }
+  if (bgzf_index_dump(bgzf, fasta_path.c_str(), ".gzi") < 0) {
+    return tensorflow::errors::Internal("Couldn't write GZI index for ",
+                                        fasta_path);
+  }
+  return tensorflow::Status::OK();
+}
+
 }  // namespace
 
 StatusOr<std::unique_ptr<GenomeReferenceFai>> GenomeReferenceFai::FromFile(
-    const string& fasta_path, const string& fai_path, int cache_size_bases) {
+    const string& fasta_path, const string& fai_path, int cache_size_bases,
+    int cache_capacity_blocks) {
   const string gzi = fasta_path + ".gzi";
   faidx_t* faidx =
       fai_load3_x(fasta_path.c_str(), fai_path.c_str(), gzi.c_str(), 0);
@@ -58,18 +395,57 @@ StatusOr<std::unique_ptr<GenomeReferenceFai>> GenomeReferenceFai::FromFile(
     return tensorflow::errors::NotFound(
         "could not load fasta and/or fai for fasta ", fasta_path);
   }
-  return std::unique_ptr<GenomeReferenceFai>(
-      new GenomeReferenceFai(fasta_path, faidx, cache_size_bases));
+  return std::unique_ptr<GenomeReferenceFai>(new GenomeReferenceFai(
+      fasta_path, faidx, cache_size_bases, cache_capacity_blocks));
 }
 
-GenomeReferenceFai::GenomeReferenceFai(
-    const string& fasta_path, faidx_t* faidx, int cache_size_bases)
+tensorflow::Status GenomeReferenceFai::BuildIndex(const string& fasta_path,
+                                              const string& fai_path,
+                                              int num_threads) {
+  if (num_threads < 1) {
+    return tensorflow::errors::InvalidArgument("num_threads must be positive");
+  }
+  htsFile* fp = hts_open_x(fasta_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tensorflow::errors::NotFound("Could not open ", fasta_path);
+  }
+  FastaLineScanner scanner;
+  tensorflow::Status status;
+  switch (fp->format.compression) {
+    case no_compression:
+      status = ScanFasta(fasta_path, num_threads, &scanner);
+      break;
+    case bgzf:
+      status = ScanBgzfFasta(fasta_path, fp->fp.bgzf, num_threads, &scanner);
+      break;
+    default:
+      status = tensorflow::errors::InvalidArgument(
+          "Can't index ", fasta_path,
+          ": a compressed FASTA must be compressed with bgzip");
+  }
+  if (hts_close(fp) < 0 && status.ok()) {
+    status = tensorflow::errors::Internal("Couldn't close ", fasta_path);
+  }
+  TF_RETURN_IF_ERROR(status);
+
+  StatusOr<string> fai = scanner.MakeFai(fasta_path);
+  TF_RETURN_IF_ERROR(fai.status());
+  return tensorflow::WriteStringToFile(tensorflow::Env::Default(), fai_path,
+                                       fai.ValueOrDie());
+}
+
+GenomeReferenceFai::GenomeReferenceFai(const string& fasta_path,
+                                       faidx_t* faidx, int cache_size_bases,
+                                       int cache_capacity_blocks)
     : fasta_path_(fasta_path),
       faidx_(faidx),
       contigs_(ExtractContigsFromFai(faidx)),
-      cache_size_bases_(cache_size_bases),
-      small_read_cache_(),
-      cached_range_() {}
+      cache_size_bases_(cache_capacity_blocks > 0 ? cache_size_bases : 0),
+      n_shards_(NumCacheShards(cache_capacity_blocks)),
+      shard_capacity_((cache_capacity_blocks + n_shards_ - 1) / n_shards_),
+      shards_(new CacheShard[n_shards_]),
+      cache_hits_(0),
+      cache_misses_(0) {}
 
 GenomeReferenceFai::~GenomeReferenceFai() {
   if (faidx_) {
@@ -92,31 +468,78 @@ StatusOr<string> GenomeReferenceFai::GetBases(const Range& range) const {
     return string("");
   }
 
-  bool use_cache = (cache_size_bases_ > 0) &&
-      (range.end() - range.start() <= cache_size_bases_);
-  Range range_to_fetch;
-
-  if (use_cache) {
-      if (cached_range_ && RangeContains(*cached_range_, range)) {
-        // Get from cache!
-        string result = small_read_cache_.substr(
-            range.start() - cached_range_->start(),
-            range.end() - range.start());
-        return result;
-      } else {
-        // Prepare to fetch a sizeable chunk from the FASTA.
-        int64 contig_n_bases =
-            Contig(range.reference_name()).ValueOrDie()->n_bases();
-        range_to_fetch = MakeRange(
-            range.reference_name(), range.start(),
-            std::min(static_cast<int64>(range.start() + cache_size_bases_),
-                     contig_n_bases));
-        CHECK(IsValidInterval(range_to_fetch));
-      }
-  } else {
-    range_to_fetch = range;
+  if (cache_size_bases_ <= 0 ||
+      range.end() - range.start() > cache_size_bases_) {
+    return FetchBases(range, range);
+  }
+
+  // The range spans at most two blocks; copy its bases out of each.
+  const nucleus::genomics::v1::ContigInfo* contig =
+      Contig(range.reference_name()).ValueOrDie();
+  string result;
+  result.reserve(range.end() - range.start());
+  for (int64 block = range.start() / cache_size_bases_;
+       block <= (range.end() - 1) / cache_size_bases_; ++block) {
+    StatusOr<std::shared_ptr<const string>> bases_or =
+        GetBlock(*contig, block, range);
+    if (!bases_or.ok()) return bases_or.status();
+    const string& bases = *bases_or.ValueOrDie();
+    const int64 block_start = block * cache_size_bases_;
+    const int64 block_end = block_start + bases.size();
+    const int64 from = std::max<int64>(range.start(), block_start);
+    const int64 to = std::min<int64>(range.end(), block_end);
+    result.append(bases, from - block_start, to - from);
+  }
+  return result;
+}
+
+StatusOr<std::shared_ptr<const string>> GenomeReferenceFai::GetBlock(
+    const nucleus::genomics::v1::ContigInfo& contig, int64 block,
+    const Range& requested) const {
+  const uint64 key = static_cast<uint64>(contig.pos_in_fasta()) << 40 |
+                     static_cast<uint64>(block);
+  CacheShard& shard = ShardFor(key);
+  {
+    absl::MutexLock lock(&shard.mutex);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+      // Move the block to the front of the LRU list.
+      shard.entries.splice(shard.entries.begin(), shard.entries,
+                           found->second);
+      ++cache_hits_;
+      return found->second->bases;
+    }
+  }
+
+  // Read the block without holding the shard's lock, so that lookups of other
+  // blocks in the shard aren't held up by the read.
+  ++cache_misses_;
+  const int64 start = block * cache_size_bases_;
+  const Range block_range = MakeRange(
+      contig.name(), start,
+      std::min<int64>(start + cache_size_bases_, contig.n_bases()));
+  CHECK(IsValidInterval(block_range));
+  StatusOr<string> bases_or = FetchBases(block_range, requested);
+  if (!bases_or.ok()) return bases_or.status();
+  auto bases =
+      std::make_shared<const string>(std::move(bases_or.ValueOrDie()));
+
+  absl::MutexLock lock(&shard.mutex);
+  if (shard.index.find(key) == shard.index.end()) {
+    // Another thread may have cached the block while we were reading it, in
+    // which case the two copies are identical and we keep the cached one.
+    shard.entries.push_front(CacheEntry{key, bases});
+    shard.index[key] = shard.entries.begin();
+    if (static_cast<int>(shard.entries.size()) > shard_capacity_) {
+      shard.index.erase(shard.entries.back().key);
+      shard.entries.pop_back();
+    }
   }
+  return std::shared_ptr<const string>(std::move(bases));
+}
 
+StatusOr<string> GenomeReferenceFai::FetchBases(const Range& range,
+                                                const Range& requested) const {
   // According to htslib docs, faidx_fetch_seq c_name is the contig name,
   // start is the first base (zero-based) to include and end is the last base
   // (zero-based) to include. Len is an output variable returning the length
@@ -124,25 +547,31 @@ StatusOr<string> GenomeReferenceFai::GetBases(const Range& range) const {
   // The returned pointer must be freed. We need to subtract one from our end
   // since end is exclusive in GenomeReference but faidx has an inclusive one.
   int len;
-  char* bases = faidx_fetch_seq(
-      faidx_, range_to_fetch.reference_name().c_str(),
-      range_to_fetch.start(), range_to_fetch.end() - 1, &len);
-  if (len <= 0)
+  char* bases;
+  {
+    absl::MutexLock lock(&faidx_mutex_);
+    bases = faidx_fetch_seq(faidx_, range.reference_name().c_str(),
+                            range.start(), range.end() - 1, &len);
+  }
+  if (len <= 0) {
+    free(bases);
     return tensorflow::errors::InvalidArgument("Couldn't fetch bases for ",
-                                               range.ShortDebugString());
+                                               requested.ShortDebugString());
+  }
   string result = absl::AsciiStrToUpper(bases);
   free(bases);
-
-  if (use_cache) {
-    // Update cache.
-    small_read_cache_ = result;
-    cached_range_ = range_to_fetch;
-    // Return the requested substring.
-    result = small_read_cache_.substr(0, range.end() - range.start());
-  }
   return result;
 }
 
+GenomeReferenceFai::CacheShard& GenomeReferenceFai::ShardFor(
+    uint64 key) const {
+  // Mix the key so that neighbouring blocks land in different shards.
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return shards_[key % n_shards_];
+}
+
 tensorflow::Status GenomeReferenceFai::Close() {
   if (faidx_ == nullptr) {
     return tensorflow::errors::FailedPrecondition(
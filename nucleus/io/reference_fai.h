@@ -19,9 +19,13 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_FAI_H_
 #define THIRD_PARTY_NUCLEUS_IO_REFERENCE_FAI_H_
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
-#include "absl/types/optional.h"
+#include "absl/synchronization/mutex.h"
 #include "htslib/faidx.h"
 #include "nucleus/io/reference.h"
 #include "nucleus/vendor/statusor.h"
@@ -30,6 +34,7 @@
 namespace nucleus {
 
 constexpr int REFERENCE_FAI_DEFAULT_CACHE_SIZE = 64 * 1024;
+constexpr int REFERENCE_FAI_DEFAULT_CACHE_BLOCKS = 16;
 
 
 // A FASTA reader backed by a htslib FAI index.
@@ -58,6 +63,9 @@ constexpr int REFERENCE_FAI_DEFAULT_CACHE_SIZE = 64 * 1024;
 //
 // The objects returned by iterate() or query() are strings containing the
 // bases, all upper-cased.
+//
+// GetBases may be called concurrently from any number of threads, although not
+// concurrently with Close.
 class GenomeReferenceFai : public GenomeReference {
  public:
   // Creates a new GenomeReference backed by the FASTA file fasta_path.
@@ -68,14 +76,39 @@ class GenomeReferenceFai : public GenomeReference {
   // htslib currently assumes that the FAI file is named fasta_path + '.fai',
   // so that file must exist and be readable by htslib.
   //
-  // We maintain a single entry cache of the bases from the last FASTA fetch, to
-  // reduce the number of file reads, which can be quite costly for remote
-  // filesystems.  64K is the default block size for htslib faidx fetches, so
-  // there is no penalty to rounding up all small access sizes to 64K.  The
-  // cache can be disabled using `cache_size=0`.
+  // We maintain an LRU cache of up to cache_capacity_blocks blocks of
+  // cache_size_bases bases, aligned to multiples of cache_size_bases on their
+  // contig, to reduce the number of file reads, which can be quite costly for
+  // remote filesystems. Requests of at most cache_size_bases bases are served
+  // from the (one or two) blocks they overlap, so interleaved queries at a few
+  // loci don't refetch their bases; larger requests bypass the cache. 64K is
+  // the default block size for htslib faidx fetches, so there is no penalty to
+  // rounding up all small access sizes to 64K. The cache can be disabled using
+  // `cache_size=0` or `cache_capacity_blocks=0`. Caches of 64 blocks or more
+  // are split into independently locked shards that each evict their own
+  // least recently used block; smaller ones, like the default, are exactly
+  // LRU.
   static StatusOr<std::unique_ptr<GenomeReferenceFai>> FromFile(
       const string& fasta_path, const string& fai_path,
-      int cache_size_bases = REFERENCE_FAI_DEFAULT_CACHE_SIZE);
+      int cache_size_bases = REFERENCE_FAI_DEFAULT_CACHE_SIZE,
+      int cache_capacity_blocks = REFERENCE_FAI_DEFAULT_CACHE_BLOCKS);
+
+  // Builds the FAI index of the FASTA file fasta_path, which may be
+  // uncompressed or bgzipped, and writes it to fai_path. For a bgzipped FASTA,
+  // also writes the GZI index of its blocks to fasta_path + ".gzi", where
+  // FromFile looks for it.
+  //
+  // An uncompressed FASTA is split into num_threads or more byte ranges that
+  // are scanned concurrently; a bgzipped one is decompressed by num_threads
+  // threads but scanned by one.
+  //
+  // Returns a DataLoss error if the FASTA is malformed: if it has bases before
+  // its first header, two contigs with the same name, lines other than the
+  // last of a contig with different numbers of bases, or characters in its
+  // sequences other than IUPAC nucleotide codes.
+  static tensorflow::Status BuildIndex(const string& fasta_path,
+                                       const string& fai_path,
+                                       int num_threads);
 
   ~GenomeReferenceFai();
 
@@ -94,10 +127,48 @@ class GenomeReferenceFai : public GenomeReference {
   // Close the underlying resource descriptors.
   tensorflow::Status Close() override;
 
+  // The number of cache blocks GetBases has found in, and had to read into,
+  // the cache so far.
+  int64 CacheHits() const { return cache_hits_; }
+  int64 CacheMisses() const { return cache_misses_; }
+
  private:
+  // One cached block of bases.
+  struct CacheEntry {
+    // The block's pos_in_fasta << 40 | its index on the contig.
+    uint64 key;
+    std::shared_ptr<const string> bases;
+  };
+
+  // One of the independently locked parts of the cache. A block is always
+  // cached in the shard ShardFor picks for its key.
+  struct CacheShard {
+    // Guards entries and index.
+    absl::Mutex mutex;
+    // The cached blocks, most recently used first, and their positions in
+    // entries by key.
+    std::list<CacheEntry> entries;
+    std::unordered_map<uint64, std::list<CacheEntry>::iterator> index;
+  };
+
   // Must use one of the static factory methods.
-  GenomeReferenceFai(
-      const string& fasta_path, faidx_t* faidx, int cache_size_bases);
+  GenomeReferenceFai(const string& fasta_path, faidx_t* faidx,
+                     int cache_size_bases, int cache_capacity_blocks);
+
+  // Returns the bases of block (of cache_size_bases_ bases) of contig, from
+  // the cache if possible. requested is the range GetBases was asked for, to
+  // report errors.
+  StatusOr<std::shared_ptr<const string>> GetBlock(
+      const nucleus::genomics::v1::ContigInfo& contig, int64 block,
+      const nucleus::genomics::v1::Range& requested) const;
+
+  // Reads the bases of range from the FASTA and upper-cases them.
+  StatusOr<string> FetchBases(
+      const nucleus::genomics::v1::Range& range,
+      const nucleus::genomics::v1::Range& requested) const;
+
+  // Returns the shard caching the block with key.
+  CacheShard& ShardFor(uint64 key) const;
 
   // Path to the FASTA file containing our genomic bases.
   const string fasta_path_;
@@ -107,19 +178,23 @@ class GenomeReferenceFai : public GenomeReference {
   // const.
   faidx_t* faidx_;
 
+  // Serializes reads through faidx_, which has a single file handle.
+  mutable absl::Mutex faidx_mutex_;
+
   // A list of ContigInfo, each of which contains the information about the
   // contigs used by this BAM file.
   const std::vector<nucleus::genomics::v1::ContigInfo> contigs_;
 
-  // Size, in bases, of the read cache.
+  // Size, in bases, of the cached blocks, or 0 if there is no cache.
   const int cache_size_bases_;
 
-  // Cache of the last "small" read from the FASTA (<= kFastaCacheSize).
-  mutable string small_read_cache_;
+  // The shards of the cache, and the number of blocks each may hold.
+  int n_shards_;
+  int shard_capacity_;
+  std::unique_ptr<CacheShard[]> shards_;
 
-  // The range that is held in the cache, or "empty" if there is no range cached
-  // yet.  Range must be <= kFastaCacheSize in length.
-  mutable absl::optional<nucleus::genomics::v1::Range> cached_range_;
+  mutable std::atomic<int64> cache_hits_;
+  mutable std::atomic<int64> cache_misses_;
 };
 
 }  // namespace nucleus
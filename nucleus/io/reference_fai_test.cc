@@ -18,6 +18,7 @@
 #include "nucleus/io/reference_fai.h"
 
 #include <memory>
+#include <thread>  // NOLINT
 #include <utility>
 #include <vector>
 
@@ -28,6 +29,8 @@
 #include "nucleus/util/utils.h"
 #include "nucleus/vendor/status_matchers.h"
 
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
 
 #include <gmock/gmock-generated-matchers.h>
@@ -65,6 +68,221 @@ INSTANTIATE_TEST_CASE_P(GRT3, GenomeReferenceTest,
 INSTANTIATE_TEST_CASE_P(GRT4, GenomeReferenceDeathTest,
                         ::testing::Values(make_pair(&JustLoadFai, 64 * 1024)));
 
+// Test with blocks small enough that queries span several of them.
+INSTANTIATE_TEST_CASE_P(GRT5, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&JustLoadFai, 7)));
+
+INSTANTIATE_TEST_CASE_P(GRT6, GenomeReferenceDeathTest,
+                        ::testing::Values(make_pair(&JustLoadFai, 7)));
+
+std::unique_ptr<GenomeReferenceFai> LoadFaiWithCache(
+    int cache_size_bases, int cache_capacity_blocks) {
+  const string fasta = TestFastaPath();
+  return std::move(GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"),
+                                                cache_size_bases,
+                                                cache_capacity_blocks)
+                       .ValueOrDie());
+}
+
+TEST(ReferenceFaiTest, CachesInterleavedQueries) {
+  auto reader = LoadFaiWithCache(10, 4);
+  auto uncached = LoadFaiWithCache(0, 0);
+  for (int i = 0; i < 3; ++i) {
+    for (const auto& range :
+         {MakeRange("chrM", 2, 8), MakeRange("chr2", 50, 55)}) {
+      EXPECT_THAT(reader->GetBases(range).ValueOrDie(),
+                  Eq(uncached->GetBases(range).ValueOrDie()));
+    }
+  }
+  // Each locus is read once, however the queries alternate between them.
+  EXPECT_EQ(2, reader->CacheMisses());
+  EXPECT_EQ(4, reader->CacheHits());
+  EXPECT_EQ(0, uncached->CacheHits() + uncached->CacheMisses());
+}
+
+TEST(ReferenceFaiTest, JoinsBlocksAtBoundaries) {
+  auto reader = LoadFaiWithCache(10, 4);
+  auto uncached = LoadFaiWithCache(0, 0);
+  // Ranges straddling block boundaries, ending at the end of the contig (which
+  // isn't a multiple of the block size), and longer than a block.
+  for (const auto& range :
+       {MakeRange("chr1", 5, 15), MakeRange("chr1", 9, 11),
+        MakeRange("chr1", 10, 20), MakeRange("chr1", 68, 76),
+        MakeRange("chr1", 70, 76), MakeRange("chr1", 3, 60)}) {
+    EXPECT_THAT(reader->GetBases(range).ValueOrDie(),
+                Eq(uncached->GetBases(range).ValueOrDie()))
+        << range.ShortDebugString();
+  }
+}
+
+TEST(ReferenceFaiTest, EvictsLeastRecentlyUsedBlocks) {
+  auto reader = LoadFaiWithCache(10, 1);
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 0, 5)), IsOK());
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 5, 10)), IsOK());
+  EXPECT_EQ(1, reader->CacheMisses());
+  EXPECT_EQ(1, reader->CacheHits());
+  // Reading another block evicts the first one, so it has to be read again.
+  ASSERT_THAT(reader->GetBases(MakeRange("chr1", 0, 5)), IsOK());
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 0, 5)), IsOK());
+  EXPECT_EQ(3, reader->CacheMisses());
+  EXPECT_EQ(1, reader->CacheHits());
+}
+
+TEST(ReferenceFaiTest, DefaultSizedCacheIsExactlyLru) {
+  auto reader = LoadFaiWithCache(10, REFERENCE_FAI_DEFAULT_CACHE_BLOCKS);
+  std::vector<nucleus::genomics::v1::Range> blocks;
+  for (const auto& contig : {"chrM", "chr1"}) {
+    for (int64 start = 0; start < 70; start += 10) {
+      blocks.push_back(MakeRange(contig, start, start + 10));
+    }
+  }
+  blocks.push_back(MakeRange("chrM", 70, 80));
+  blocks.push_back(MakeRange("chrM", 80, 90));
+  ASSERT_EQ(REFERENCE_FAI_DEFAULT_CACHE_BLOCKS,
+            static_cast<int>(blocks.size()));
+  for (const auto& block : blocks) {
+    ASSERT_THAT(reader->GetBases(block), IsOK());
+  }
+  // Touching the first block makes the second the least recently used, so it
+  // is the one evicted by a new block, whichever blocks it is hashed with.
+  ASSERT_THAT(reader->GetBases(blocks[0]), IsOK());
+  ASSERT_THAT(reader->GetBases(MakeRange("chr2", 0, 10)), IsOK());
+  EXPECT_EQ(17, reader->CacheMisses());
+  EXPECT_EQ(1, reader->CacheHits());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    if (i != 1) ASSERT_THAT(reader->GetBases(blocks[i]), IsOK());
+  }
+  EXPECT_EQ(17, reader->CacheMisses());
+  ASSERT_THAT(reader->GetBases(blocks[1]), IsOK());
+  EXPECT_EQ(18, reader->CacheMisses());
+}
+
+TEST(ReferenceFaiTest, GetBasesIsThreadSafe) {
+  // Large enough to be split into shards.
+  auto reader = LoadFaiWithCache(8, 64);
+  auto uncached = LoadFaiWithCache(0, 0);
+  std::vector<nucleus::genomics::v1::Range> ranges;
+  for (const auto& contig : uncached->Contigs()) {
+    for (int64 start = 0; start + 5 <= contig.n_bases(); start += 3) {
+      ranges.push_back(MakeRange(contig.name(), start, start + 5));
+    }
+  }
+  std::vector<string> expected;
+  for (const auto& range : ranges) {
+    expected.push_back(uncached->GetBases(range).ValueOrDie());
+  }
+
+  constexpr int kThreads = 8;
+  std::vector<std::vector<string>> results(kThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&reader, &ranges, &results, i]() {
+      // Each thread walks the ranges from a different offset.
+      for (size_t j = 0; j < ranges.size(); ++j) {
+        const auto& range = ranges[(j + i * 7) % ranges.size()];
+        results[i].push_back(reader->GetBases(range).ValueOrDie());
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (int i = 0; i < kThreads; ++i) {
+    for (size_t j = 0; j < ranges.size(); ++j) {
+      EXPECT_EQ(expected[(j + i * 7) % ranges.size()], results[i][j]);
+    }
+  }
+  EXPECT_GT(reader->CacheHits(), 0);
+}
+
+// Copies the test data file test_data to a temporary file named filename, and
+// returns the temporary file's path.
+string CopyTestData(const string& test_data, const string& filename) {
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                           GetTestData(test_data), &contents));
+  const string path = MakeTempFile(filename);
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), path,
+                                            contents));
+  return path;
+}
+
+string ReadFile(const string& path) {
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(), path,
+                                           &contents));
+  return contents;
+}
+
+TEST(ReferenceFaiTest, BuildIndexMatchesSamtools) {
+  const string fasta = CopyTestData("test.fasta", "build_index.fasta");
+  for (int num_threads : {1, 4}) {
+    const string fai = StrCat(fasta, ".", num_threads, ".fai");
+    ASSERT_THAT(GenomeReferenceFai::BuildIndex(fasta, fai, num_threads),
+                IsOK());
+    EXPECT_EQ(ReadFile(GetTestData("test.fasta.fai")), ReadFile(fai));
+  }
+}
+
+TEST(ReferenceFaiTest, BuildIndexOfBgzippedFasta) {
+  const string fasta = CopyTestData("test.fasta.gz", "build_index.fasta.gz");
+  const string fai = StrCat(fasta, ".fai");
+  ASSERT_THAT(GenomeReferenceFai::BuildIndex(fasta, fai, 2), IsOK());
+  EXPECT_EQ(ReadFile(GetTestData("test.fasta.gz.fai")), ReadFile(fai));
+
+  // The FAI and GZI we wrote let us read the FASTA.
+  auto expected = JustLoadFai(TestFastaPath());
+  auto reader = JustLoadFai(fasta, 0);
+  for (const auto& range :
+       {MakeRange("chrM", 0, 100), MakeRange("chr1", 49, 51),
+        MakeRange("chr2", 100, 121)}) {
+    EXPECT_EQ(expected->GetBases(range).ValueOrDie(),
+              reader->GetBases(range).ValueOrDie());
+  }
+}
+
+TEST(ReferenceFaiTest, BuildIndexJoinsLinesAcrossChunks) {
+  // Large enough to be scanned in several chunks, with contigs and lines split
+  // between them.
+  string contents;
+  string expected;
+  for (int i = 0; i < 40; ++i) {
+    const string name = StrCat("contig", i);
+    const int n_lines = 2000 + i * 37;
+    expected += StrCat(name, "\t", n_lines * 60 + i, "\t",
+                       contents.size() + name.size() + 4, "\t60\t61\n");
+    absl::StrAppend(&contents, ">", name, " x\n");
+    for (int j = 0; j < n_lines; ++j) {
+      absl::StrAppend(&contents, string(60, "ACGTN"[j % 5]), "\n");
+    }
+    absl::StrAppend(&contents, string(i, 'a'), i > 0 ? "\n" : "");
+  }
+  const string fasta = MakeTempFile("build_index_chunks.fasta");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), fasta,
+                                            contents));
+  const string fai = StrCat(fasta, ".fai");
+  ASSERT_THAT(GenomeReferenceFai::BuildIndex(fasta, fai, 8), IsOK());
+  EXPECT_EQ(expected, ReadFile(fai));
+}
+
+TEST(ReferenceFaiTest, BuildIndexRejectsMalformedFasta) {
+  const std::vector<std::pair<string, string>> cases = {
+      {">a\nACGT\nAC\nACGT\n", "contig a has lines of different lengths"},
+      {">a\nACGT\n\nACGT\n", "contig a has lines of different lengths"},
+      {"ACGT\n>a\nACGT\n", "sequence at offset 0 precedes the first header"},
+      {">a\nACGT\nAC.T\n", "invalid base '.' at offset 10"},
+      {">a\nACGT\n>a\nACGT\n", "more than one contig is named a"},
+      {"> a\nACGT\n", "header at offset 0 has no name"},
+  };
+  for (const auto& test_case : cases) {
+    const string fasta = MakeTempFile("malformed.fasta");
+    TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                              fasta, test_case.first));
+    EXPECT_THAT(
+        GenomeReferenceFai::BuildIndex(fasta, StrCat(fasta, ".fai"), 1),
+        IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                  test_case.second));
+  }
+}
+
 TEST(StatusOrLoadFromFile, ReturnsBadStatusIfFaiIsMissing) {
   StatusOr<std::unique_ptr<GenomeReferenceFai>> result =
       GenomeReferenceFai::FromFile(GetTestData("unindexed.fasta"),
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/reference_mmap.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::Range;
+
+namespace {
+
+// Copies n bytes from src to dst, upper-casing ASCII letters. It's written
+// without branches so that compilers vectorize it.
+void CopyUpperCase(const char* src, int64 n, char* dst) {
+  for (int64 i = 0; i < n; ++i) {
+    const unsigned char c = src[i];
+    dst[i] = c - ((static_cast<unsigned char>(c - 'a') < 26) << 5);
+  }
+}
+
+}  // namespace
+
+StatusOr<std::unique_ptr<GenomeReferenceMmap>> GenomeReferenceMmap::FromFile(
+    const string& fasta_path, const string& fai_path) {
+  string fai;
+  TF_RETURN_IF_ERROR(tf::ReadFileToString(tf::Env::Default(), fai_path, &fai));
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> fasta;
+  TF_RETURN_IF_ERROR(
+      tf::Env::Default()->NewReadOnlyMemoryRegionFromFile(fasta_path, &fasta));
+  const unsigned char* data =
+      static_cast<const unsigned char*>(fasta->data());
+  const uint64 length = fasta->length();
+  if (length >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+    return tf::errors::InvalidArgument(
+        "GenomeReferenceMmap can't read compressed FASTA ", fasta_path);
+  }
+
+  // Each line of the FAI is the contig's name, number of bases, offset of its
+  // first base, bases per line and bytes per line. Empty contigs may have no
+  // lines.
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs;
+  std::vector<ContigLayout> layouts;
+  for (absl::string_view line : absl::StrSplit(fai, '\n', absl::SkipEmpty())) {
+    const std::vector<absl::string_view> fields = absl::StrSplit(line, '\t');
+    int64 n_bases;
+    ContigLayout layout;
+    if (fields.size() < 5 || fields[0].empty() ||
+        !absl::SimpleAtoi(fields[1], &n_bases) ||
+        !absl::SimpleAtoi(fields[2], &layout.offset) ||
+        !absl::SimpleAtoi(fields[3], &layout.line_bases) ||
+        !absl::SimpleAtoi(fields[4], &layout.line_width) || n_bases < 0 ||
+        layout.line_bases < 0 || (layout.line_bases == 0 && n_bases > 0) ||
+        layout.line_width < layout.line_bases) {
+      return tf::errors::DataLoss("Malformed line in FAI ", fai_path, ": ",
+                                  string(line));
+    }
+    if (n_bases > 0) {
+      const int64 last_base = n_bases - 1;
+      const uint64 last = layout.offset +
+                          last_base / layout.line_bases * layout.line_width +
+                          last_base % layout.line_bases;
+      if (last >= length) {
+        return tf::errors::DataLoss("FAI ", fai_path, " places contig ",
+                                    string(fields[0]), " beyond the end of ",
+                                    fasta_path);
+      }
+    }
+    nucleus::genomics::v1::ContigInfo contig;
+    contig.set_name(string(fields[0]));
+    contig.set_description("");
+    contig.set_n_bases(n_bases);
+    contig.set_pos_in_fasta(contigs.size());
+    contigs.push_back(std::move(contig));
+    layouts.push_back(layout);
+  }
+  return std::unique_ptr<GenomeReferenceMmap>(new GenomeReferenceMmap(
+      std::move(fasta), std::move(contigs), std::move(layouts)));
+}
+
+GenomeReferenceMmap::GenomeReferenceMmap(
+    std::unique_ptr<tf::ReadOnlyMemoryRegion> fasta,
+    std::vector<nucleus::genomics::v1::ContigInfo> contigs,
+    std::vector<ContigLayout> layouts)
+    : MappedGenomeReference("GenomeReferenceMmap"),
+      fasta_(std::move(fasta)),
+      layouts_(std::move(layouts)) {
+  for (auto& contig : contigs) AddContig(std::move(contig));
+}
+
+GenomeReferenceMmap::~GenomeReferenceMmap() {}
+
+void GenomeReferenceMmap::CopyBases(const Range& range, char* buf) const {
+  // Copy the bases line by line, skipping the line terminators.
+  const ContigLayout& layout = layouts_[ContigIndex(range.reference_name())];
+  const char* data = static_cast<const char*>(fasta_->data()) + layout.offset;
+  for (int64 pos = range.start(); pos < range.end();) {
+    const int64 column = pos % layout.line_bases;
+    const int64 n =
+        std::min<int64>(layout.line_bases - column, range.end() - pos);
+    CopyUpperCase(
+        data + pos / layout.line_bases * layout.line_width + column, n, buf);
+    buf += n;
+    pos += n;
+  }
+}
+
+tf::Status GenomeReferenceMmap::Close() {
+  if (fasta_ == nullptr) {
+    return tf::errors::FailedPrecondition("GenomeReferenceMmap already closed");
+  }
+  fasta_.reset();
+  return tf::Status::OK();
+}
+
+}  // namespace nucleus
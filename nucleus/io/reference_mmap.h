@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of GenomeReference class over a memory-mapped FASTA.
+#ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_MMAP_H_
+#define THIRD_PARTY_NUCLEUS_IO_REFERENCE_MMAP_H_
+
+#include <memory>
+#include <vector>
+
+#include "nucleus/io/reference.h"
+#include "nucleus/platform/types.h"
+#include "nucleus/vendor/statusor.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+// A FASTA reader over an uncompressed FASTA file with a FAI index, which maps
+// the FASTA into memory and uses the line geometry recorded in the FAI to find
+// the bases of a range directly, instead of reading them through htslib as
+// GenomeReferenceFai does.
+//
+// Reads never allocate beyond the returned string, and GetBasesInto doesn't
+// allocate at all. The mapping is shared with the page cache, so several
+// processes reading the same reference on one host share a single copy of it.
+// Being read-only, GetBases and GetBasesInto may be called concurrently from
+// any number of threads (although not concurrently with Close).
+//
+// Like GenomeReferenceFai, the bases returned are all upper-cased.
+class GenomeReferenceMmap : public MappedGenomeReference {
+ public:
+  // Creates a new GenomeReference backed by the uncompressed FASTA file
+  // fasta_path and its FAI index fai_path. Returns an error if either can't be
+  // read, if the FASTA is compressed, or if the FAI doesn't describe the FASTA.
+  static StatusOr<std::unique_ptr<GenomeReferenceMmap>> FromFile(
+      const string& fasta_path, const string& fai_path);
+
+  ~GenomeReferenceMmap();
+
+  // Disable copy and assignment operations
+  GenomeReferenceMmap(const GenomeReferenceMmap& other) = delete;
+  GenomeReferenceMmap& operator=(const GenomeReferenceMmap&) = delete;
+
+  // Unmaps the FASTA.
+  tensorflow::Status Close() override;
+
+ private:
+  // Where the bases of a contig are in the FASTA, as recorded in the FAI.
+  struct ContigLayout {
+    // The offset of the contig's first base in the FASTA.
+    uint64 offset;
+    // The number of bases on each line, and the number of bytes of each line
+    // including its line terminator.
+    int64 line_bases;
+    int64 line_width;
+  };
+
+  bool IsClosed() const override { return fasta_ == nullptr; }
+
+  void CopyBases(const nucleus::genomics::v1::Range& range,
+                 char* buf) const override;
+
+  // Must use the static factory method.
+  GenomeReferenceMmap(
+      std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> fasta,
+      std::vector<nucleus::genomics::v1::ContigInfo> contigs,
+      std::vector<ContigLayout> layouts);
+
+  // The mapped FASTA, or nullptr once closed.
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> fasta_;
+
+  // The layouts of our contigs in the FASTA, by pos_in_fasta.
+  const std::vector<ContigLayout> layouts_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_REFERENCE_MMAP_H_
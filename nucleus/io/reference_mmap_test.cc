@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/reference_mmap.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/io/reference_test.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+using absl::StrCat;
+using std::make_pair;
+
+namespace nucleus {
+
+std::unique_ptr<GenomeReferenceMmap> LoadMmap(const string& fasta) {
+  StatusOr<std::unique_ptr<GenomeReferenceMmap>> result =
+      GenomeReferenceMmap::FromFile(fasta, StrCat(fasta, ".fai"));
+  TF_CHECK_OK(result.status());
+  return std::move(result.ValueOrDie());
+}
+
+// The cache size is ignored, as GenomeReferenceMmap has no cache.
+static std::unique_ptr<GenomeReference> JustLoadMmap(const string& fasta,
+                                                     int cache_size) {
+  return LoadMmap(fasta);
+}
+
+INSTANTIATE_TEST_CASE_P(GRT1, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&JustLoadMmap, 0)));
+
+INSTANTIATE_TEST_CASE_P(GRT2, GenomeReferenceDeathTest,
+                        ::testing::Values(make_pair(&JustLoadMmap, 0)));
+
+TEST(ReferenceMmapTest, MatchesFai) {
+  const string fasta = TestFastaPath();
+  auto mmap = LoadMmap(fasta);
+  auto fai = std::move(
+      GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"), 0)
+          .ValueOrDie());
+  for (const auto& contig : fai->Contigs()) {
+    // Every range starting and ending around the line breaks at multiples of
+    // 50 bases.
+    for (int64 start = 0; start < contig.n_bases(); ++start) {
+      for (int64 end = start + 1;
+           end <= std::min<int64>(start + 60, contig.n_bases()); ++end) {
+        const auto range = MakeRange(contig.name(), start, end);
+        EXPECT_EQ(fai->GetBases(range).ValueOrDie(),
+                  mmap->GetBases(range).ValueOrDie())
+            << range.ShortDebugString();
+      }
+    }
+  }
+}
+
+TEST(ReferenceMmapTest, GetBasesInto) {
+  auto reader = LoadMmap(TestFastaPath());
+  char buf[12] = "xxxxxxxxxxx";
+  ASSERT_THAT(reader->GetBasesInto(MakeRange("chrM", 45, 55), buf), IsOK());
+  EXPECT_EQ("TGCATTTGGTx", string(buf));
+  EXPECT_THAT(reader->GetBasesInto(MakeRange("chrM", 95, 105), buf),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid interval"));
+}
+
+TEST(ReferenceMmapTest, UpperCasesBases) {
+  const string fasta = MakeTempFile("lower.fasta");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), fasta,
+                                            ">c\nacgtN\nnaC\n"));
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                            StrCat(fasta, ".fai"),
+                                            "c\t8\t3\t5\t6\n"));
+  EXPECT_EQ("ACGTNNAC",
+            LoadMmap(fasta)->GetBases(MakeRange("c", 0, 8)).ValueOrDie());
+}
+
+TEST(ReferenceMmapTest, RejectsCompressedFasta) {
+  const string fasta = GetTestData("test.fasta.gz");
+  EXPECT_THAT(GenomeReferenceMmap::FromFile(fasta, StrCat(fasta, ".fai")),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "can't read compressed FASTA"));
+}
+
+TEST(ReferenceMmapTest, RejectsFaiThatDoesNotMatchFasta) {
+  const string fai = MakeTempFile("bad.fasta.fai");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), fai,
+                                            "chrM\t100\t6\t50\n"));
+  EXPECT_THAT(GenomeReferenceMmap::FromFile(TestFastaPath(), fai),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed line in FAI"));
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), fai,
+                                            "chrM\t1000\t6\t50\t51\n"));
+  EXPECT_THAT(GenomeReferenceMmap::FromFile(TestFastaPath(), fai),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "beyond the end of"));
+}
+
+TEST(ReferenceMmapTest, ReadAfterCloseIsntOK) {
+  auto reader = LoadMmap(TestFastaPath());
+  ASSERT_THAT(reader->Close(), IsOK());
+  EXPECT_THAT(reader->GetBases(MakeRange("chrM", 0, 100)),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::FAILED_PRECONDITION,
+                  "can't read from closed GenomeReferenceMmap object"));
+}
+
+}  // namespace nucleus
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/reference_packed.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "htslib/faidx.h"
+#include "nucleus/io/hts_path.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::Range;
+
+namespace {
+
+// The last bytes of a packed reference, which include a format version.
+constexpr char kMagic[] = "NUCPKR01";
+
+// The bases of the 2-bit codes.
+constexpr char kBases[] = "ACGT";
+
+// Returns the 2-bit code of the upper-case base, or -1 if it isn't A, C, G or
+// T.
+int BaseCode(char base) {
+  switch (base) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+  }
+}
+
+// The four bases packed in each byte, the first in its low bits, so that
+// whole bytes are unpacked by a table lookup and a 4-byte copy.
+struct UnpackTable {
+  char bases[256][4];
+
+  UnpackTable() {
+    for (int byte = 0; byte < 256; ++byte) {
+      for (int i = 0; i < 4; ++i) {
+        bases[byte][i] = kBases[(byte >> (2 * i)) & 3];
+      }
+    }
+  }
+};
+
+const UnpackTable& GetUnpackTable() {
+  static const UnpackTable* table = new UnpackTable();
+  return *table;
+}
+
+// Calls apply(run, offset, n) for each run of runs (sorted and disjoint) that
+// overlaps [start, end), where [start + offset, start + offset + n) is the
+// overlap.
+template <typename RunType, typename Apply>
+void ForEachOverlap(const RunType* runs, int64 n_runs, int64 start, int64 end,
+                    Apply apply) {
+  const RunType* run = std::upper_bound(
+      runs, runs + n_runs, start,
+      [](int64 pos, const RunType& run) { return pos < run.end; });
+  for (; run != runs + n_runs && run->start < end; ++run) {
+    const int64 from = std::max(run->start, start);
+    const int64 to = std::min(run->end, end);
+    if (from < to) apply(*run, from - start, to - from);
+  }
+}
+
+// Returns true if [offset, offset + size) is within [0, limit) and offset is a
+// multiple of alignment.
+bool InBounds(int64 offset, int64 size, int64 limit, int64 alignment) {
+  return offset >= 0 && size >= 0 && offset <= limit &&
+         size <= limit - offset && offset % alignment == 0;
+}
+
+}  // namespace
+
+tf::Status PackedGenomeReference::ConvertFasta(const string& fasta_path,
+                                               const string& fai_path,
+                                               const string& output_path) {
+  const string gzi = fasta_path + ".gzi";
+  std::unique_ptr<faidx_t, void (*)(faidx_t*)> faidx(
+      fai_load3_x(fasta_path.c_str(), fai_path.c_str(), gzi.c_str(), 0),
+      fai_destroy);
+  if (faidx == nullptr) {
+    return tf::errors::NotFound("could not load fasta and/or fai for fasta ",
+                                fasta_path);
+  }
+  std::unique_ptr<tf::WritableFile> file;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewWritableFile(output_path, &file));
+  int64 offset = 0;
+  auto append = [&file, &offset](const void* data, int64 size) {
+    offset += size;
+    return file->Append(
+        tf::StringPiece(static_cast<const char*>(data), size));
+  };
+
+  std::vector<ContigRecord> records;
+  string names;
+  for (int i = 0; i < faidx_nseq(faidx.get()); ++i) {
+    const char* name = faidx_iseq(faidx.get(), i);
+    ContigRecord record;
+    record.n_bases = faidx_seq_len(faidx.get(), name);
+    record.name_offset = names.size();
+    record.name_length = std::strlen(name);
+    names.append(name);
+
+    string bases;
+    if (record.n_bases > 0) {
+      int len;
+      char* fetched = faidx_fetch_seq(faidx.get(), name, 0,
+                                      record.n_bases - 1, &len);
+      if (len != record.n_bases) {
+        std::free(fetched);
+        return tf::errors::DataLoss("Couldn't fetch the bases of ", name,
+                                    " from ", fasta_path);
+      }
+      bases.assign(fetched, len);
+      std::free(fetched);
+    }
+
+    // Pack the bases, rounding up to a multiple of 8 bytes so that the runs
+    // after them are aligned.
+    string packed((record.n_bases + 31) / 32 * 8, '\0');
+    std::vector<BaseRun> base_runs;
+    std::vector<Run> mask_runs;
+    for (int64 pos = 0; pos < record.n_bases; ++pos) {
+      const char base = absl::ascii_toupper(bases[pos]);
+      const int code = BaseCode(base);
+      if (code >= 0) {
+        packed[pos / 4] |= code << (2 * (pos % 4));
+      } else if (!base_runs.empty() && base_runs.back().end == pos &&
+                 base_runs.back().base == base) {
+        base_runs.back().end++;
+      } else {
+        base_runs.push_back(BaseRun{pos, pos + 1, base});
+      }
+      if (absl::ascii_islower(bases[pos])) {
+        if (!mask_runs.empty() && mask_runs.back().end == pos) {
+          mask_runs.back().end++;
+        } else {
+          mask_runs.push_back(Run{pos, pos + 1});
+        }
+      }
+    }
+
+    record.bases_offset = offset;
+    TF_RETURN_IF_ERROR(append(packed.data(), packed.size()));
+    record.base_runs_offset = offset;
+    record.n_base_runs = base_runs.size();
+    TF_RETURN_IF_ERROR(
+        append(base_runs.data(), base_runs.size() * sizeof(BaseRun)));
+    record.mask_runs_offset = offset;
+    record.n_mask_runs = mask_runs.size();
+    TF_RETURN_IF_ERROR(
+        append(mask_runs.data(), mask_runs.size() * sizeof(Run)));
+    records.push_back(record);
+  }
+
+  for (ContigRecord& record : records) record.name_offset += offset;
+  names.resize((names.size() + 7) / 8 * 8);
+  TF_RETURN_IF_ERROR(append(names.data(), names.size()));
+  Trailer trailer;
+  trailer.n_contigs = records.size();
+  trailer.records_offset = offset;
+  std::memcpy(trailer.magic, kMagic, sizeof(trailer.magic));
+  TF_RETURN_IF_ERROR(
+      append(records.data(), records.size() * sizeof(ContigRecord)));
+  TF_RETURN_IF_ERROR(append(&trailer, sizeof(trailer)));
+  return file->Close();
+}
+
+StatusOr<std::unique_ptr<PackedGenomeReference>>
+PackedGenomeReference::FromFile(const string& path) {
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(
+      tf::Env::Default()->NewReadOnlyMemoryRegionFromFile(path, &region));
+  const char* data = static_cast<const char*>(region->data());
+  const int64 length = region->length();
+  Trailer trailer;
+  if (length < static_cast<int64>(sizeof(trailer))) {
+    return tf::errors::DataLoss(path, " is not a packed reference");
+  }
+  std::memcpy(&trailer, data + length - sizeof(trailer), sizeof(trailer));
+  if (std::memcmp(trailer.magic, kMagic, sizeof(trailer.magic)) != 0) {
+    return tf::errors::DataLoss(path, " is not a packed reference");
+  }
+  const int64 records_end = length - sizeof(trailer);
+  if (trailer.n_contigs < 0 ||
+      !InBounds(trailer.records_offset,
+                trailer.n_contigs * sizeof(ContigRecord), records_end, 8) ||
+      trailer.records_offset + trailer.n_contigs * sizeof(ContigRecord) !=
+          records_end) {
+    return tf::errors::DataLoss("Malformed packed reference ", path);
+  }
+
+  std::unique_ptr<PackedGenomeReference> reference(
+      new PackedGenomeReference(std::move(region)));
+  const auto* records =
+      reinterpret_cast<const ContigRecord*>(data + trailer.records_offset);
+  const int64 limit = trailer.records_offset;
+  for (int64 i = 0; i < trailer.n_contigs; ++i) {
+    const ContigRecord& record = records[i];
+    if (record.n_bases < 0 ||
+        !InBounds(record.name_offset, record.name_length, limit, 1) ||
+        !InBounds(record.bases_offset, (record.n_bases + 3) / 4, limit, 1) ||
+        record.n_base_runs < 0 ||
+        !InBounds(record.base_runs_offset,
+                  record.n_base_runs * sizeof(BaseRun), limit, 8) ||
+        record.n_mask_runs < 0 ||
+        !InBounds(record.mask_runs_offset, record.n_mask_runs * sizeof(Run),
+                  limit, 8)) {
+      return tf::errors::DataLoss("Malformed packed reference ", path);
+    }
+    nucleus::genomics::v1::ContigInfo contig;
+    contig.set_name(string(data + record.name_offset, record.name_length));
+    contig.set_description("");
+    contig.set_n_bases(record.n_bases);
+    contig.set_pos_in_fasta(i);
+    reference->AddContig(std::move(contig));
+    reference->records_.push_back(&record);
+  }
+  return std::move(reference);
+}
+
+PackedGenomeReference::PackedGenomeReference(
+    std::unique_ptr<tf::ReadOnlyMemoryRegion> region)
+    : MappedGenomeReference("PackedGenomeReference"),
+      region_(std::move(region)) {}
+
+PackedGenomeReference::~PackedGenomeReference() {}
+
+StatusOr<string> PackedGenomeReference::GetSoftMaskedBases(
+    const Range& range) const {
+  TF_RETURN_IF_ERROR(CheckReadable(range));
+  string bases(range.end() - range.start(), '\0');
+  CopyBases(range, true, &bases[0]);
+  return bases;
+}
+
+void PackedGenomeReference::CopyBases(const Range& range, bool soft_masked,
+                                      char* buf) const {
+  const ContigRecord& record =
+      *records_[ContigIndex(range.reference_name())];
+  const char* data = static_cast<const char*>(region_->data());
+  const auto* packed =
+      reinterpret_cast<const unsigned char*>(data + record.bases_offset);
+  const int64 start = range.start();
+  const int64 end = range.end();
+
+  // Unpack the bases up to the first byte boundary one by one, then whole
+  // bytes, then the rest one by one.
+  char* out = buf;
+  int64 pos = start;
+  for (; pos < end && pos % 4 != 0; ++pos) {
+    *out++ = kBases[(packed[pos / 4] >> (2 * (pos % 4))) & 3];
+  }
+  const UnpackTable& table = GetUnpackTable();
+  for (; pos + 4 <= end; pos += 4, out += 4) {
+    std::memcpy(out, table.bases[packed[pos / 4]], 4);
+  }
+  for (; pos < end; ++pos) {
+    *out++ = kBases[(packed[pos / 4] >> (2 * (pos % 4))) & 3];
+  }
+
+  // Overwrite the placeholders of the other bases, and lower-case the
+  // soft-masked bases if asked to.
+  ForEachOverlap(
+      reinterpret_cast<const BaseRun*>(data + record.base_runs_offset),
+      record.n_base_runs, start, end,
+      [buf](const BaseRun& run, int64 offset, int64 n) {
+        std::memset(buf + offset, static_cast<char>(run.base), n);
+      });
+  if (soft_masked) {
+    ForEachOverlap(
+        reinterpret_cast<const Run*>(data + record.mask_runs_offset),
+        record.n_mask_runs, start, end,
+        [buf](const Run& run, int64 offset, int64 n) {
+          for (int64 i = offset; i < offset + n; ++i) {
+            buf[i] = absl::ascii_tolower(buf[i]);
+          }
+        });
+  }
+}
+
+tf::Status PackedGenomeReference::Close() {
+  if (region_ == nullptr) {
+    return tf::errors::FailedPrecondition(
+        "PackedGenomeReference already closed");
+  }
+  region_.reset();
+  return tf::Status::OK();
+}
+
+}  // namespace nucleus
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of GenomeReference class over a 2-bit packed reference file.
+#ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_PACKED_H_
+#define THIRD_PARTY_NUCLEUS_IO_REFERENCE_PACKED_H_
+
+#include <memory>
+#include <vector>
+
+#include "nucleus/io/reference.h"
+#include "nucleus/platform/types.h"
+#include "nucleus/vendor/statusor.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+// A reference genome stored with 2 bits per base, memory-mapped from a file
+// written by PackedGenomeReference::ConvertFasta.
+//
+// The A, C, G and T bases of each contig are packed four to a byte. Any other
+// bases (N and the IUPAC ambiguity codes) are recorded as runs of a repeated
+// base that override the packed bases, as are runs of soft-masked (lower-case)
+// bases, so a reference takes up a little more than a quarter of its size in
+// memory, and opening one is just a mapping of the file rather than a parse.
+// Since the file is mapped, several processes on one host share its pages.
+//
+// Like the other GenomeReferences, GetBases returns upper-cased bases;
+// GetSoftMaskedBases returns them in their original case. All the read methods
+// may be called concurrently, although not concurrently with Close.
+class PackedGenomeReference : public MappedGenomeReference {
+ public:
+  // Writes the packed form of the FASTA fasta_path, indexed by the FAI
+  // fai_path, to output_path. The FASTA may be bgzipped, as for
+  // GenomeReferenceFai.
+  static tensorflow::Status ConvertFasta(const string& fasta_path,
+                                         const string& fai_path,
+                                         const string& output_path);
+
+  // Opens the packed reference path, which must have been written by
+  // ConvertFasta.
+  static StatusOr<std::unique_ptr<PackedGenomeReference>> FromFile(
+      const string& path);
+
+  ~PackedGenomeReference();
+
+  // Disable copy and assignment operations
+  PackedGenomeReference(const PackedGenomeReference& other) = delete;
+  PackedGenomeReference& operator=(const PackedGenomeReference&) = delete;
+
+  // Returns the bases of range as they appear in the FASTA, with soft-masked
+  // bases in lower case.
+  StatusOr<string> GetSoftMaskedBases(
+      const nucleus::genomics::v1::Range& range) const;
+
+  // Unmaps the file.
+  tensorflow::Status Close() override;
+
+ private:
+  // The file holds, for each contig in turn, its packed bases, padded to a
+  // multiple of 8 bytes, its BaseRuns and its soft-masked Runs, both sorted by
+  // start. They're followed by the contigs' names, the ContigRecords and a
+  // Trailer. All the integers are in the host's byte order.
+  struct ContigRecord {
+    int64 n_bases;
+    // The offsets in the file of the contig's name, packed bases, BaseRuns and
+    // Runs, with the number of each.
+    int64 name_offset;
+    int64 name_length;
+    int64 bases_offset;
+    int64 base_runs_offset;
+    int64 n_base_runs;
+    int64 mask_runs_offset;
+    int64 n_mask_runs;
+  };
+
+  // The bases [start, end) of a contig.
+  struct Run {
+    int64 start;
+    int64 end;
+  };
+
+  // A run of a base other than A, C, G and T, such as N.
+  struct BaseRun {
+    int64 start;
+    int64 end;
+    int64 base;
+  };
+
+  struct Trailer {
+    int64 n_contigs;
+    int64 records_offset;
+    char magic[8];
+  };
+
+  // Must use the static factory method.
+  explicit PackedGenomeReference(
+      std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region);
+
+  bool IsClosed() const override { return region_ == nullptr; }
+
+  void CopyBases(const nucleus::genomics::v1::Range& range,
+                 char* buf) const override {
+    CopyBases(range, false, buf);
+  }
+
+  // Writes the bases of range, which must be readable, into buf, in lower case
+  // where they're soft-masked if soft_masked is true and in upper case
+  // otherwise.
+  void CopyBases(const nucleus::genomics::v1::Range& range, bool soft_masked,
+                 char* buf) const;
+
+  // The mapped file, or nullptr once closed.
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region_;
+
+  // The records of our contigs in the mapped file, by pos_in_fasta.
+  std::vector<const ContigRecord*> records_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_REFERENCE_PACKED_H_
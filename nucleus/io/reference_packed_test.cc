@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/reference_packed.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/io/reference_test.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+using absl::StrCat;
+using std::make_pair;
+
+namespace nucleus {
+
+// Packs the FASTA fasta, returning the path of the packed reference.
+string PackFasta(const string& fasta) {
+  static int n_packed = 0;
+  const string packed =
+      MakeTempFile(StrCat("reference", n_packed++, ".packed"));
+  TF_CHECK_OK(PackedGenomeReference::ConvertFasta(fasta, StrCat(fasta, ".fai"),
+                                                  packed));
+  return packed;
+}
+
+std::unique_ptr<PackedGenomeReference> LoadPacked(const string& fasta) {
+  return std::move(
+      PackedGenomeReference::FromFile(PackFasta(fasta)).ValueOrDie());
+}
+
+// The cache size is ignored, as PackedGenomeReference has no cache.
+static std::unique_ptr<GenomeReference> JustLoadPacked(const string& fasta,
+                                                       int cache_size) {
+  return LoadPacked(fasta);
+}
+
+INSTANTIATE_TEST_CASE_P(GRT1, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&JustLoadPacked, 0)));
+
+INSTANTIATE_TEST_CASE_P(GRT2, GenomeReferenceDeathTest,
+                        ::testing::Values(make_pair(&JustLoadPacked, 0)));
+
+// Writes a FASTA with the given contents, and its FAI, returning its path.
+string WriteFasta(const string& name, const string& contents,
+                  const string& fai) {
+  const string fasta = MakeTempFile(name);
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), fasta,
+                                            contents));
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                            StrCat(fasta, ".fai"), fai));
+  return fasta;
+}
+
+TEST(ReferencePackedTest, MatchesFai) {
+  for (const string& fasta :
+       {TestFastaPath(), GetTestData("test.fasta.gz"),
+        GetTestData("ucsc.hg19.chr20.unittest.fasta.gz")}) {
+    auto packed = LoadPacked(fasta);
+    auto fai = std::move(
+        GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"), 0)
+            .ValueOrDie());
+    ASSERT_EQ(fai->Contigs().size(), packed->Contigs().size());
+    for (const auto& contig : fai->Contigs()) {
+      const int64 n_bases = contig.n_bases();
+      for (const auto& range :
+           {MakeRange(contig.name(), 0, n_bases),
+            MakeRange(contig.name(), 1, std::min<int64>(n_bases, 7)),
+            MakeRange(contig.name(), n_bases / 2, n_bases / 2 + 1),
+            MakeRange(contig.name(), n_bases - 3, n_bases)}) {
+        EXPECT_EQ(fai->GetBases(range).ValueOrDie(),
+                  packed->GetBases(range).ValueOrDie())
+            << fasta << " " << range.ShortDebugString();
+      }
+    }
+  }
+}
+
+TEST(ReferencePackedTest, KeepsAmbiguousAndSoftMaskedBases) {
+  const string fasta = WriteFasta(
+      "iupac.fasta", ">c1\nNNacgtRYnnACGTAcgtaW\n>c2\nGATTACA\n",
+      "c1\t20\t4\t20\t21\nc2\t7\t29\t7\t8\n");
+  auto packed = LoadPacked(fasta);
+  EXPECT_THAT(packed->ContigNames(), testing::ElementsAre("c1", "c2"));
+  EXPECT_EQ("NNACGTRYNNACGTACGTAW",
+            packed->GetBases(MakeRange("c1", 0, 20)).ValueOrDie());
+  EXPECT_EQ("NNacgtRYnnACGTAcgtaW",
+            packed->GetSoftMaskedBases(MakeRange("c1", 0, 20)).ValueOrDie());
+  // Ranges starting and ending within runs.
+  EXPECT_EQ("NA", packed->GetBases(MakeRange("c1", 1, 3)).ValueOrDie());
+  EXPECT_EQ("tRYn",
+            packed->GetSoftMaskedBases(MakeRange("c1", 5, 9)).ValueOrDie());
+  EXPECT_EQ("ACA", packed->GetBases(MakeRange("c2", 4, 7)).ValueOrDie());
+
+  char buf[5] = "xxxx";
+  ASSERT_THAT(packed->GetBasesInto(MakeRange("c1", 16, 19), buf), IsOK());
+  EXPECT_EQ("GTAx", string(buf));
+}
+
+TEST(ReferencePackedTest, RejectsOtherFiles) {
+  EXPECT_THAT(PackedGenomeReference::FromFile(TestFastaPath()),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "is not a packed reference"));
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), PackFasta(TestFastaPath()), &contents));
+  const string truncated = MakeTempFile("truncated.packed");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                            truncated, contents.substr(40)));
+  EXPECT_THAT(PackedGenomeReference::FromFile(truncated),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed packed reference"));
+}
+
+TEST(ReferencePackedTest, ReadAfterCloseIsntOK) {
+  auto reader = LoadPacked(TestFastaPath());
+  ASSERT_THAT(reader->Close(), IsOK());
+  EXPECT_THAT(reader->GetBases(MakeRange("chrM", 0, 100)),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::FAILED_PRECONDITION,
+                  "can't read from closed PackedGenomeReference object"));
+}
+
+}  // namespace nucleus
@@ -169,4 +169,37 @@ TEST_P(GenomeReferenceTest, TestGetBasesParts) {
   CheckGetBases(Ref(), "chrM", 10, 10, "");
 }
 
+TEST_P(GenomeReferenceTest, GetBasesBatchMatchesGetBases) {
+  // Unsorted, overlapping, nested, duplicated, empty and distant ranges on
+  // several contigs.
+  const std::vector<nucleus::genomics::v1::Range> ranges = {
+      MakeRange("chr2", 100, 121), MakeRange("chrM", 10, 20),
+      MakeRange("chrM", 0, 5),     MakeRange("chr1", 3, 7),
+      MakeRange("chrM", 12, 15),   MakeRange("chrM", 10, 20),
+      MakeRange("chrM", 18, 30),   MakeRange("chrM", 90, 100),
+      MakeRange("chr2", 0, 1),     MakeRange("chrM", 50, 50)};
+  for (int64 max_gap : {0, 10, 1000}) {
+    for (int64 max_fetch_bases : {1, 20, 1000}) {
+      StatusOr<std::vector<string>> batch =
+          Ref().GetBasesBatch(ranges, max_gap, max_fetch_bases);
+      ASSERT_THAT(batch, IsOK());
+      ASSERT_EQ(ranges.size(), batch.ValueOrDie().size());
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        EXPECT_EQ(Ref().GetBases(ranges[i]).ValueOrDie(),
+                  batch.ValueOrDie()[i])
+            << ranges[i].ShortDebugString() << " max_gap=" << max_gap
+            << " max_fetch_bases=" << max_fetch_bases;
+      }
+    }
+  }
+  EXPECT_THAT(Ref().GetBasesBatch({}), IsOK());
+}
+
+TEST_P(GenomeReferenceTest, GetBasesBatchRejectsInvalidRanges) {
+  EXPECT_THAT(Ref().GetBasesBatch(
+                  {MakeRange("chrM", 0, 10), MakeRange("chr1", 70, 100)}),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Invalid interval"));
+}
+
 }  // namespace nucleus
@@ -0,0 +1,426 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/variant_comparator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "nucleus/io/bed_reader.h"
+#include "nucleus/protos/bed.pb.h"
+#include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::BedReaderOptions;
+using nucleus::genomics::v1::BedRecord;
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantConcordanceCounts;
+using nucleus::genomics::v1::VariantConcordanceOptions;
+using nucleus::genomics::v1::VariantConcordanceSummary;
+using nucleus::genomics::v1::VcfHeader;
+
+const char kConcordanceInfoKey[] = "CONCORDANCE";
+const char kConcordanceTruePositive[] = "TP";
+const char kConcordanceFalsePositive[] = "FP";
+const char kConcordanceFalseNegative[] = "FN";
+const char kConcordanceGenotypeMismatch[] = "GENOTYPE_MISMATCH";
+const char kConcordanceAlleleMismatch[] = "ALLELE_MISMATCH";
+
+namespace {
+
+// Returns the index of sample in header, or of its first sample if sample is
+// empty, or -1 if it has no samples.
+StatusOr<int> SampleIndex(const VcfHeader& header, const string& sample,
+                          const char* callset) {
+  if (sample.empty()) return header.sample_names_size() > 0 ? 0 : -1;
+  for (int i = 0; i < header.sample_names_size(); i++) {
+    if (header.sample_names(i) == sample) return i;
+  }
+  return tf::errors::InvalidArgument("Sample ", sample, " is not in the ",
+                                     callset, " callset");
+}
+
+// Returns true if allele is made only of bases, as opposed to being symbolic,
+// a breakend, '*' or '.'.
+bool IsBases(const string& allele) {
+  return !allele.empty() &&
+         std::all_of(allele.begin(), allele.end(), [](char base) {
+           return std::strchr("ACGTNacgtn", base) != nullptr;
+         });
+}
+
+// Returns the alternate alleles of variant, sorted so that they can be
+// compared regardless of their order in the record.
+std::vector<string> SortedAlts(const Variant& variant) {
+  std::vector<string> alts(variant.alternate_bases().begin(),
+                           variant.alternate_bases().end());
+  std::sort(alts.begin(), alts.end());
+  return alts;
+}
+
+// Returns the alleles of the genotype of variant's sample_index'th call as
+// sorted strings, with "." for missing alleles, so that genotypes of records
+// that order their alternate alleles differently can be compared.
+std::vector<string> GenotypeAlleles(const Variant& variant, int sample_index) {
+  std::vector<string> alleles;
+  if (sample_index < 0 || sample_index >= variant.calls_size()) return alleles;
+  for (int allele : variant.calls(sample_index).genotype()) {
+    if (allele < 0 || allele > variant.alternate_bases_size()) {
+      alleles.push_back(".");
+    } else if (allele == 0) {
+      alleles.push_back(variant.reference_bases());
+    } else {
+      alleles.push_back(variant.alternate_bases(allele - 1));
+    }
+  }
+  std::sort(alleles.begin(), alleles.end());
+  return alleles;
+}
+
+void Annotate(const char* outcome, Variant* variant) {
+  nucleus::genomics::v1::ListValue& values =
+      (*variant->mutable_info())[kConcordanceInfoKey];
+  values.Clear();
+  values.add_values()->set_string_value(outcome);
+}
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+//
+// Reader class methods
+//
+// -----------------------------------------------------------------------------
+
+StatusOr<std::unique_ptr<VariantComparator>> VariantComparator::Create(
+    const VcfHeader& truth_header, const VcfHeader& eval_header,
+    const VariantConcordanceOptions& options) {
+  StatusOr<int> truth_sample_index =
+      SampleIndex(truth_header, options.truth_sample(), "truth");
+  TF_RETURN_IF_ERROR(truth_sample_index.status());
+  StatusOr<int> eval_sample_index =
+      SampleIndex(eval_header, options.eval_sample(), "eval");
+  TF_RETURN_IF_ERROR(eval_sample_index.status());
+
+  std::unique_ptr<VariantComparator> comparator(new VariantComparator(
+      truth_header, options, truth_sample_index.ValueOrDie(),
+      eval_sample_index.ValueOrDie()));
+  if (!options.confident_regions_path().empty()) {
+    TF_RETURN_IF_ERROR(
+        comparator->LoadConfidentRegions(options.confident_regions_path()));
+  }
+  return std::move(comparator);
+}
+
+VariantComparator::VariantComparator(const VcfHeader& truth_header,
+                                     const VariantConcordanceOptions& options,
+                                     int truth_sample_index,
+                                     int eval_sample_index)
+    : options_(options),
+      truth_sample_index_(truth_sample_index),
+      eval_sample_index_(eval_sample_index) {
+  contig_name_to_pos_in_fasta_ = MapContigNameToPosInFasta(
+      {truth_header.contigs().begin(), truth_header.contigs().end()});
+}
+
+VariantComparator::~VariantComparator() {}
+
+tf::Status VariantComparator::LoadConfidentRegions(const string& path) {
+  StatusOr<std::unique_ptr<BedReader>> reader =
+      BedReader::FromFile(path, BedReaderOptions());
+  TF_RETURN_IF_ERROR(reader.status());
+  StatusOr<std::shared_ptr<BedIterable>> records =
+      reader.ValueOrDie()->Iterate();
+  TF_RETURN_IF_ERROR(records.status());
+  BedRecord record;
+  while (true) {
+    StatusOr<bool> more = records.ValueOrDie()->Next(&record);
+    TF_RETURN_IF_ERROR(more.status());
+    if (!more.ValueOrDie()) break;
+    confident_regions_[record.reference_name()].emplace_back(record.start(),
+                                                             record.end());
+  }
+
+  // Sort and merge the intervals of each contig, so that a binary search finds
+  // the only one that can contain a variant.
+  for (auto& contig : confident_regions_) {
+    auto& intervals = contig.second;
+    std::sort(intervals.begin(), intervals.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < intervals.size(); i++) {
+      if (intervals[i].first <= intervals[merged].second) {
+        intervals[merged].second =
+            std::max(intervals[merged].second, intervals[i].second);
+      } else {
+        intervals[++merged] = intervals[i];
+      }
+    }
+    intervals.resize(intervals.empty() ? 0 : merged + 1);
+  }
+  return reader.ValueOrDie()->Close();
+}
+
+StatusOr<std::shared_ptr<VariantIterable>> VariantComparator::Compare(
+    std::shared_ptr<VariantIterable> truth,
+    std::shared_ptr<VariantIterable> eval) {
+  if (truth == nullptr || eval == nullptr) {
+    return tf::errors::InvalidArgument("Cannot compare a null iterable");
+  }
+  std::shared_ptr<VariantIterable> iterable =
+      MakeIterable<VariantComparisonIterable>(this, std::move(truth),
+                                              std::move(eval));
+  if (iterable != nullptr) summary_.Clear();
+  return iterable;
+}
+
+StatusOr<VariantConcordanceSummary> VariantComparator::Summarize(
+    std::shared_ptr<VariantIterable> truth,
+    std::shared_ptr<VariantIterable> eval) {
+  StatusOr<std::shared_ptr<VariantIterable>> iterable =
+      Compare(std::move(truth), std::move(eval));
+  TF_RETURN_IF_ERROR(iterable.status());
+  if (iterable.ValueOrDie() == nullptr) {
+    return tf::errors::FailedPrecondition(
+        "Cannot compare while another comparison is active");
+  }
+  Variant variant;
+  while (true) {
+    StatusOr<bool> more = iterable.ValueOrDie()->Next(&variant);
+    TF_RETURN_IF_ERROR(more.status());
+    if (!more.ValueOrDie()) break;
+  }
+  return summary_;
+}
+
+bool VariantComparator::IsConfident(const Variant& variant) const {
+  if (options_.confident_regions_path().empty()) return true;
+  const auto contig = confident_regions_.find(variant.reference_name());
+  if (contig == confident_regions_.end()) return false;
+  const auto& intervals = contig->second;
+  // The first interval ending after the variant's start.
+  const auto interval = std::upper_bound(
+      intervals.begin(), intervals.end(), variant.start(),
+      [](int64 start, const std::pair<int64, int64>& interval) {
+        return start < interval.second;
+      });
+  return interval != intervals.end() && interval->first <= variant.start() &&
+         variant.end() <= interval->second;
+}
+
+bool VariantComparator::IsCall(const Variant& variant,
+                               int sample_index) const {
+  if (variant.alternate_bases_size() == 0 ||
+      (variant.alternate_bases_size() == 1 &&
+       variant.alternate_bases(0) == ".")) {
+    return false;
+  }
+  if (!options_.include_filtered()) {
+    for (const string& filter : variant.filter()) {
+      if (filter != "PASS" && filter != ".") return false;
+    }
+  }
+  if (sample_index < 0 || sample_index >= variant.calls_size()) return true;
+  const auto& genotype = variant.calls(sample_index).genotype();
+  return std::any_of(genotype.begin(), genotype.end(),
+                     [](int allele) { return allele > 0; });
+}
+
+VariantConcordanceCounts* VariantComparator::CountsFor(
+    const Variant& variant) {
+  const auto& alts = variant.alternate_bases();
+  const bool all_bases = IsBases(variant.reference_bases()) &&
+                         std::all_of(alts.begin(), alts.end(), IsBases);
+  if (!all_bases) return summary_.mutable_others();
+  if (variant.reference_bases().size() == 1 &&
+      std::all_of(alts.begin(), alts.end(),
+                  [](const string& alt) { return alt.size() == 1; })) {
+    return summary_.mutable_snps();
+  }
+  const size_t ref_size = variant.reference_bases().size();
+  if (std::any_of(alts.begin(), alts.end(), [ref_size](const string& alt) {
+        return alt.size() != ref_size;
+      })) {
+    return summary_.mutable_indels();
+  }
+  return summary_.mutable_others();
+}
+
+void VariantComparator::CompareSite(std::vector<Variant>* truths,
+                                    std::vector<Variant>* evals,
+                                    std::deque<Variant>* out) {
+  std::vector<bool> truth_paired(truths->size(), false);
+  std::vector<int> pairs(evals->size(), -1);
+
+  // Pair eval records with truth records that have the same alleles first, so
+  // that a multi-record site isn't reported as allele mismatches just because
+  // of the order of its records.
+  for (int e = 0; e < evals->size(); e++) {
+    const std::vector<string> eval_alts = SortedAlts((*evals)[e]);
+    for (int t = 0; t < truths->size(); t++) {
+      if (!truth_paired[t] &&
+          (*truths)[t].reference_bases() == (*evals)[e].reference_bases() &&
+          SortedAlts((*truths)[t]) == eval_alts) {
+        truth_paired[t] = true;
+        pairs[e] = t;
+        break;
+      }
+    }
+  }
+  int next_truth = 0;
+  for (int e = 0; e < evals->size(); e++) {
+    if (pairs[e] >= 0) {
+      const Variant& truth = (*truths)[pairs[e]];
+      VariantConcordanceCounts* counts = CountsFor(truth);
+      if (GenotypeAlleles(truth, truth_sample_index_) ==
+          GenotypeAlleles((*evals)[e], eval_sample_index_)) {
+        counts->set_true_positives(counts->true_positives() + 1);
+        Annotate(kConcordanceTruePositive, &(*evals)[e]);
+      } else {
+        counts->set_genotype_mismatches(counts->genotype_mismatches() + 1);
+        Annotate(kConcordanceGenotypeMismatch, &(*evals)[e]);
+      }
+      continue;
+    }
+    while (next_truth < truths->size() && truth_paired[next_truth]) {
+      next_truth++;
+    }
+    if (next_truth < truths->size()) {
+      truth_paired[next_truth] = true;
+      VariantConcordanceCounts* counts = CountsFor((*truths)[next_truth]);
+      counts->set_allele_mismatches(counts->allele_mismatches() + 1);
+      Annotate(kConcordanceAlleleMismatch, &(*evals)[e]);
+    } else {
+      VariantConcordanceCounts* counts = CountsFor((*evals)[e]);
+      counts->set_false_positives(counts->false_positives() + 1);
+      Annotate(kConcordanceFalsePositive, &(*evals)[e]);
+    }
+  }
+
+  for (int t = 0; t < truths->size(); t++) {
+    if (truth_paired[t]) continue;
+    VariantConcordanceCounts* counts = CountsFor((*truths)[t]);
+    counts->set_false_negatives(counts->false_negatives() + 1);
+    Annotate(kConcordanceFalseNegative, &(*truths)[t]);
+    out->emplace_back();
+    out->back().Swap(&(*truths)[t]);
+  }
+  for (Variant& eval : *evals) {
+    out->emplace_back();
+    out->back().Swap(&eval);
+  }
+}
+
+// -----------------------------------------------------------------------------
+//
+// Iterable class definitions.
+//
+// -----------------------------------------------------------------------------
+
+VariantComparisonIterable::VariantComparisonIterable(
+    VariantComparator* comparator, std::shared_ptr<VariantIterable> truth,
+    std::shared_ptr<VariantIterable> eval)
+    : VariantIterable(comparator), comparator_(comparator) {
+  truth_.name = "truth";
+  truth_.iterable = std::move(truth);
+  truth_.sample_index = comparator->truth_sample_index_;
+  eval_.name = "eval";
+  eval_.iterable = std::move(eval);
+  eval_.sample_index = comparator->eval_sample_index_;
+}
+
+VariantComparisonIterable::~VariantComparisonIterable() {}
+
+tf::Status VariantComparisonIterable::Advance(Input* input) {
+  const bool had_head = input->has_head;
+  const Position previous = input->position;
+  input->has_head = false;
+  while (true) {
+    StatusOr<bool> more = input->iterable->Next(&input->head);
+    TF_RETURN_IF_ERROR(more.status());
+    if (!more.ValueOrDie()) return tf::Status::OK();
+
+    const Variant& head = input->head;
+    const auto pos_in_fasta =
+        comparator_->contig_name_to_pos_in_fasta_.find(head.reference_name());
+    if (pos_in_fasta == comparator_->contig_name_to_pos_in_fasta_.end()) {
+      return tf::errors::NotFound("Reference name ", head.reference_name(),
+                                  " of the ", input->name,
+                                  " callset is not in the truth contigs");
+    }
+    const Position position(pos_in_fasta->second, head.start());
+    if (had_head && position < previous) {
+      return tf::errors::DataLoss("The ", input->name,
+                                  " callset is not sorted at ",
+                                  head.reference_name(), ":", head.start() + 1);
+    }
+    if (!comparator_->IsCall(head, input->sample_index)) continue;
+    if (!comparator_->IsConfident(head)) {
+      auto* summary = &comparator_->summary_;
+      summary->set_outside_confident_regions(
+          summary->outside_confident_regions() + 1);
+      continue;
+    }
+    input->position = position;
+    input->has_head = true;
+    return tf::Status::OK();
+  }
+}
+
+tf::Status VariantComparisonIterable::TakeAt(const Position& position,
+                                             Input* input,
+                                             std::vector<Variant>* out) {
+  out->clear();
+  while (input->has_head && input->position == position) {
+    out->emplace_back();
+    out->back().Swap(&input->head);
+    TF_RETURN_IF_ERROR(Advance(input));
+  }
+  return tf::Status::OK();
+}
+
+StatusOr<bool> VariantComparisonIterable::Next(Variant* out) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (!started_) {
+    TF_RETURN_IF_ERROR(Advance(&truth_));
+    TF_RETURN_IF_ERROR(Advance(&eval_));
+    started_ = true;
+  }
+  while (pending_.empty()) {
+    if (!truth_.has_head && !eval_.has_head) return false;
+    Position position;
+    if (!truth_.has_head) {
+      position = eval_.position;
+    } else if (!eval_.has_head) {
+      position = truth_.position;
+    } else {
+      position = std::min(truth_.position, eval_.position);
+    }
+    TF_RETURN_IF_ERROR(TakeAt(position, &truth_, &site_truths_));
+    TF_RETURN_IF_ERROR(TakeAt(position, &eval_, &site_evals_));
+    comparator_->CompareSite(&site_truths_, &site_evals_, &pending_);
+  }
+  out->Swap(&pending_.front());
+  pending_.pop_front();
+  return true;
+}
+
+}  // namespace nucleus
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VARIANT_COMPARATOR_H_
+#define THIRD_PARTY_NUCLEUS_IO_VARIANT_COMPARATOR_H_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "nucleus/io/reader_base.h"
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// The INFO key under which VariantComparator records the outcome of comparing
+// each record: one of the kConcordance* values below.
+extern const char kConcordanceInfoKey[];
+extern const char kConcordanceTruePositive[];
+extern const char kConcordanceFalsePositive[];
+extern const char kConcordanceFalseNegative[];
+extern const char kConcordanceGenotypeMismatch[];
+extern const char kConcordanceAlleleMismatch[];
+
+// Compares an evaluation callset against a truth callset in a single sweep
+// over both, as is done to benchmark variant callers against truth sets such
+// as GIAB.
+//
+// Records are matched by position: at each (contig, start), eval records are
+// paired first with truth records that have the same set of alternate alleles,
+// and then with any remaining truth records. A pair is a true positive if the
+// two records' genotypes for the compared samples contain the same alleles, a
+// genotype mismatch if not, and an allele mismatch if their alternate alleles
+// differ. Unpaired eval records are false positives and unpaired truth records
+// false negatives. Both callsets should be normalized (see VariantNormalizer)
+// so that equivalent variants are represented at the same position.
+//
+// VariantComparator is a Reader so that the iterables it returns are
+// invalidated when it is destroyed; it does not own the input iterables.
+class VariantComparator : public Reader {
+ public:
+  // Creates a comparator for callsets described by the given headers. The
+  // contig order of both callsets must be that of truth_header, and the
+  // compared samples must exist in them.
+  static StatusOr<std::unique_ptr<VariantComparator>> Create(
+      const nucleus::genomics::v1::VcfHeader& truth_header,
+      const nucleus::genomics::v1::VcfHeader& eval_header,
+      const nucleus::genomics::v1::VariantConcordanceOptions& options);
+
+  ~VariantComparator();
+
+  // Disable copy or assignment
+  VariantComparator(const VariantComparator& other) = delete;
+  VariantComparator& operator=(const VariantComparator&) = delete;
+
+  // Returns an iterable that compares truth against eval, both of which must
+  // be sorted, and yields every compared record, annotated with the outcome
+  // under kConcordanceInfoKey: eval records for all outcomes but false
+  // negatives, which are truth records. Records are yielded in sorted order,
+  // and Summary() is updated as they are.
+  StatusOr<std::shared_ptr<VariantIterable>> Compare(
+      std::shared_ptr<VariantIterable> truth,
+      std::shared_ptr<VariantIterable> eval);
+
+  // Compares truth against eval and returns the summary, without keeping the
+  // annotated records.
+  StatusOr<nucleus::genomics::v1::VariantConcordanceSummary> Summarize(
+      std::shared_ptr<VariantIterable> truth,
+      std::shared_ptr<VariantIterable> eval);
+
+  // The counts of the current or last comparison.
+  const nucleus::genomics::v1::VariantConcordanceSummary& Summary() const {
+    return summary_;
+  }
+
+ private:
+  VariantComparator(
+      const nucleus::genomics::v1::VcfHeader& truth_header,
+      const nucleus::genomics::v1::VariantConcordanceOptions& options,
+      int truth_sample_index, int eval_sample_index);
+
+  // Loads and merges the intervals of the BED file at path.
+  tensorflow::Status LoadConfidentRegions(const string& path);
+
+  // Returns true if variant lies in a confident region, or if there are none.
+  bool IsConfident(const nucleus::genomics::v1::Variant& variant) const;
+
+  // Returns true if variant should be compared: it passed filters (unless
+  // include_filtered is set) and its genotype for sample_index, if any,
+  // contains an alternate allele.
+  bool IsCall(const nucleus::genomics::v1::Variant& variant,
+              int sample_index) const;
+
+  // Compares the truth and eval records at one position, appending them with
+  // their annotations to out and updating summary_.
+  void CompareSite(std::vector<nucleus::genomics::v1::Variant>* truths,
+                   std::vector<nucleus::genomics::v1::Variant>* evals,
+                   std::deque<nucleus::genomics::v1::Variant>* out);
+
+  // Returns the counts for the type of variant.
+  nucleus::genomics::v1::VariantConcordanceCounts* CountsFor(
+      const nucleus::genomics::v1::Variant& variant);
+
+  const nucleus::genomics::v1::VariantConcordanceOptions options_;
+  const int truth_sample_index_;
+  const int eval_sample_index_;
+  std::map<string, int> contig_name_to_pos_in_fasta_;
+  // The [start, end) confident intervals of each contig, sorted and merged.
+  std::map<string, std::vector<std::pair<int64, int64>>> confident_regions_;
+  nucleus::genomics::v1::VariantConcordanceSummary summary_;
+
+  friend class VariantComparisonIterable;
+};
+
+// Iterable that sweeps two sorted VariantIterables one position at a time;
+// see VariantComparator::Compare.
+class VariantComparisonIterable : public VariantIterable {
+ public:
+  StatusOr<bool> Next(nucleus::genomics::v1::Variant* out) override;
+
+  // Constructor is invoked via VariantComparator::Compare.
+  VariantComparisonIterable(VariantComparator* comparator,
+                            std::shared_ptr<VariantIterable> truth,
+                            std::shared_ptr<VariantIterable> eval);
+
+  ~VariantComparisonIterable() override;
+
+ private:
+  // The position of a record, ordered by contig and then start.
+  using Position = std::pair<int, int64>;
+
+  // One of the two callsets being compared, with a lookahead record.
+  struct Input {
+    const char* name;
+    std::shared_ptr<VariantIterable> iterable;
+    int sample_index;
+    nucleus::genomics::v1::Variant head;
+    Position position;
+    bool has_head = false;
+  };
+
+  // Reads the next record of input to be compared into its head, skipping
+  // non-calls and records outside the confident regions. Returns DataLoss if
+  // input isn't sorted.
+  tensorflow::Status Advance(Input* input);
+
+  // Moves all records of input at position into out.
+  tensorflow::Status TakeAt(const Position& position, Input* input,
+                            std::vector<nucleus::genomics::v1::Variant>* out);
+
+  VariantComparator* const comparator_;
+  Input truth_;
+  Input eval_;
+  bool started_ = false;
+  std::vector<nucleus::genomics::v1::Variant> site_truths_;
+  std::vector<nucleus::genomics::v1::Variant> site_evals_;
+  std::deque<nucleus::genomics::v1::Variant> pending_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VARIANT_COMPARATOR_H_
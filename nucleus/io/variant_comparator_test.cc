@@ -0,0 +1,160 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/variant_comparator.h"
+
+#include <memory>
+#include <vector>
+
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using std::vector;
+
+using ::testing::ElementsAre;
+
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantConcordanceOptions;
+using nucleus::genomics::v1::VariantConcordanceSummary;
+using nucleus::genomics::v1::VcfReaderOptions;
+
+constexpr char kTruthFilename[] = "test_normalize.vcf";
+constexpr char kEvalFilename[] = "test_concordance_eval.vcf";
+constexpr char kConfidentRegionsFilename[] = "test_confident.bed";
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+
+class VariantComparatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    truth_ = Open(kTruthFilename);
+    eval_ = Open(kEvalFilename);
+  }
+
+  std::unique_ptr<VcfReader> Open(const string& filename) {
+    return std::move(
+        VcfReader::FromFile(GetTestData(filename), VcfReaderOptions())
+            .ValueOrDie());
+  }
+
+  std::unique_ptr<VariantComparator> MakeComparator(
+      const VariantConcordanceOptions& options) {
+    return std::move(
+        VariantComparator::Create(truth_->Header(), eval_->Header(), options)
+            .ValueOrDie());
+  }
+
+  std::unique_ptr<VcfReader> truth_;
+  std::unique_ptr<VcfReader> eval_;
+};
+
+TEST_F(VariantComparatorTest, ClassifiesByType) {
+  auto comparator = MakeComparator(VariantConcordanceOptions());
+  StatusOr<VariantConcordanceSummary> summary = comparator->Summarize(
+      truth_->Iterate().ValueOrDie(), eval_->Iterate().ValueOrDie());
+  ASSERT_THAT(summary.status(), IsOK());
+  EXPECT_THAT(summary.ValueOrDie(), EqualsProto(R"(
+    snps { true_positives: 1 false_positives: 1 genotype_mismatches: 1 }
+    indels { false_negatives: 1 allele_mismatches: 1 }
+    others { true_positives: 1 }
+  )"));
+}
+
+TEST_F(VariantComparatorTest, AnnotatesRecords) {
+  auto comparator = MakeComparator(VariantConcordanceOptions());
+  vector<string> outcomes;
+  vector<int64> starts;
+  for (const Variant& variant :
+       as_vector(comparator->Compare(truth_->Iterate().ValueOrDie(),
+                                     eval_->Iterate().ValueOrDie()))) {
+    starts.push_back(variant.start());
+    outcomes.push_back(
+        variant.info().at(kConcordanceInfoKey).values(0).string_value());
+  }
+  EXPECT_THAT(starts, ElementsAre(7, 17, 18, 26, 53, 59));
+  EXPECT_THAT(outcomes,
+              ElementsAre("TP", "GENOTYPE_MISMATCH", "FN", "TP",
+                          "ALLELE_MISMATCH", "FP"));
+}
+
+TEST_F(VariantComparatorTest, IncludesFilteredRecords) {
+  VariantConcordanceOptions options;
+  options.set_include_filtered(true);
+  auto comparator = MakeComparator(options);
+  StatusOr<VariantConcordanceSummary> summary = comparator->Summarize(
+      truth_->Iterate().ValueOrDie(), eval_->Iterate().ValueOrDie());
+  ASSERT_THAT(summary.status(), IsOK());
+  EXPECT_EQ(summary.ValueOrDie().snps().false_positives(), 2);
+}
+
+TEST_F(VariantComparatorTest, RestrictsToConfidentRegions) {
+  VariantConcordanceOptions options;
+  options.set_confident_regions_path(GetTestData(kConfidentRegionsFilename));
+  auto comparator = MakeComparator(options);
+  StatusOr<VariantConcordanceSummary> summary = comparator->Summarize(
+      truth_->Iterate().ValueOrDie(), eval_->Iterate().ValueOrDie());
+  ASSERT_THAT(summary.status(), IsOK());
+  EXPECT_THAT(summary.ValueOrDie(), EqualsProto(R"(
+    snps { true_positives: 1 genotype_mismatches: 1 }
+    indels { false_negatives: 1 }
+    outside_confident_regions: 5
+  )"));
+}
+
+TEST_F(VariantComparatorTest, SelfComparisonIsAllTruePositives) {
+  std::unique_ptr<VcfReader> truth = Open(kVcfIndexSamplesFilename);
+  std::unique_ptr<VcfReader> eval = Open(kVcfIndexSamplesFilename);
+  auto comparator = std::move(
+      VariantComparator::Create(truth->Header(), eval->Header(),
+                                VariantConcordanceOptions())
+          .ValueOrDie());
+  StatusOr<VariantConcordanceSummary> summary = comparator->Summarize(
+      truth->Iterate().ValueOrDie(), eval->Iterate().ValueOrDie());
+  ASSERT_THAT(summary.status(), IsOK());
+  for (const auto& counts :
+       {summary.ValueOrDie().snps(), summary.ValueOrDie().indels(),
+        summary.ValueOrDie().others()}) {
+    EXPECT_EQ(counts.false_positives(), 0);
+    EXPECT_EQ(counts.false_negatives(), 0);
+    EXPECT_EQ(counts.genotype_mismatches(), 0);
+    EXPECT_EQ(counts.allele_mismatches(), 0);
+  }
+  EXPECT_GT(summary.ValueOrDie().snps().true_positives(), 0);
+}
+
+TEST_F(VariantComparatorTest, RejectsUnknownSample) {
+  VariantConcordanceOptions options;
+  options.set_eval_sample("NotASample");
+  EXPECT_THAT(
+      VariantComparator::Create(truth_->Header(), eval_->Header(), options)
+          .status(),
+      IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                "is not in the eval callset"));
+}
+
+}  // namespace nucleus
@@ -0,0 +1,409 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/variant_normalizer.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "nucleus/util/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::ListValue;
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantCall;
+using nucleus::genomics::v1::VariantNormalizerOptions;
+using nucleus::genomics::v1::VcfHeader;
+
+namespace {
+
+// Reorder window used when VariantNormalizerOptions.reorder_window is unset.
+constexpr int64 kDefaultReorderWindow = 1000;
+
+// Number of reference bases fetched at a time while extending alleles to the
+// left. Most indels only move a few bases, so this is one fetch per variant.
+constexpr int64 kLeftExtensionChunk = 64;
+
+// Returns true if allele is made only of (possibly lowercase) ACGTN, so it can
+// be trimmed and extended. Symbolic and breakend alleles, '*' and '.' can't.
+bool IsNormalizable(const string& allele) {
+  if (allele.empty()) return false;
+  for (char base : allele) {
+    switch (absl::ascii_toupper(base)) {
+      case 'A':
+      case 'C':
+      case 'G':
+      case 'T':
+      case 'N':
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+size_t ShortestLength(const std::vector<string>& alleles) {
+  size_t shortest = alleles[0].size();
+  for (const string& allele : alleles) {
+    shortest = std::min(shortest, allele.size());
+  }
+  return shortest;
+}
+
+bool ShareLastBase(const std::vector<string>& alleles) {
+  for (const string& allele : alleles) {
+    if (allele.empty() || allele.back() != alleles[0].back()) return false;
+  }
+  return true;
+}
+
+// Returns the number of leading bases shared by all alleles that can be
+// dropped while leaving at least one base in each.
+size_t TrimmablePrefixLength(const std::vector<string>& alleles) {
+  const size_t limit = ShortestLength(alleles) - 1;
+  size_t length = 0;
+  while (length < limit) {
+    for (const string& allele : alleles) {
+      if (allele[length] != alleles[0][length]) return length;
+    }
+    length++;
+  }
+  return length;
+}
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+//
+// Reader class methods
+//
+// -----------------------------------------------------------------------------
+
+StatusOr<std::unique_ptr<VariantNormalizer>> VariantNormalizer::Create(
+    const VcfHeader& header, const GenomeReference* reference,
+    const VariantNormalizerOptions& options) {
+  if (reference == nullptr) {
+    return tf::errors::InvalidArgument(
+        "VariantNormalizer requires a reference genome");
+  }
+  if (options.reorder_window() < 0) {
+    return tf::errors::InvalidArgument(
+        "reorder_window must be non-negative but got ",
+        options.reorder_window());
+  }
+  return std::unique_ptr<VariantNormalizer>(
+      new VariantNormalizer(header, reference, options));
+}
+
+VariantNormalizer::VariantNormalizer(const VcfHeader& header,
+                                     const GenomeReference* reference,
+                                     const VariantNormalizerOptions& options)
+    : header_(header),
+      reference_(reference),
+      options_(options),
+      reorder_window_(options.reorder_window() > 0 ? options.reorder_window()
+                                                   : kDefaultReorderWindow) {
+  auto parse_number = [](const string& number) {
+    if (number == "A") return FieldNumber::kPerAltAllele;
+    if (number == "R") return FieldNumber::kPerAllele;
+    if (number == "G") return FieldNumber::kPerGenotype;
+    return FieldNumber::kFixed;
+  };
+  for (const auto& info : header_.infos()) {
+    info_numbers_[info.id()] = parse_number(info.number());
+  }
+  for (const auto& format : header_.formats()) {
+    format_numbers_[format.id()] = parse_number(format.number());
+  }
+}
+
+VariantNormalizer::~VariantNormalizer() {}
+
+StatusOr<std::shared_ptr<VariantIterable>> VariantNormalizer::Normalize(
+    std::shared_ptr<VariantIterable> input) {
+  if (input == nullptr) {
+    return tf::errors::InvalidArgument("Cannot normalize a null iterable");
+  }
+  return StatusOr<std::shared_ptr<VariantIterable>>(
+      MakeIterable<NormalizingVariantIterable>(this, std::move(input)));
+}
+
+tf::Status VariantNormalizer::LeftAlign(Variant* variant) const {
+  if (variant->alternate_bases_size() == 0 ||
+      !IsNormalizable(variant->reference_bases())) {
+    return tf::Status::OK();
+  }
+  std::vector<string> alleles = {variant->reference_bases()};
+  for (const string& alt : variant->alternate_bases()) {
+    if (!IsNormalizable(alt)) return tf::Status::OK();
+    alleles.push_back(alt);
+  }
+
+  const string& contig = variant->reference_name();
+  int64 start = variant->start();
+  StatusOr<string> bases = reference_->GetBases(
+      MakeRange(contig, start, start + alleles[0].size()));
+  TF_RETURN_IF_ERROR(bases.status());
+  if (absl::AsciiStrToUpper(bases.ValueOrDie()) !=
+      absl::AsciiStrToUpper(alleles[0])) {
+    return tf::errors::InvalidArgument(
+        "Reference allele ", alleles[0], " of variant at ", contig, ":",
+        start + 1, " does not match the reference genome (",
+        bases.ValueOrDie(), ")");
+  }
+
+  // A variant whose alternate alleles all equal its reference allele has
+  // nothing to shift, and would otherwise be extended to the contig start.
+  if (std::all_of(alleles.begin() + 1, alleles.end(),
+                  [&alleles](const string& alt) {
+                    return absl::EqualsIgnoreCase(alt, alleles[0]);
+                  })) {
+    return tf::Status::OK();
+  }
+
+  // Reference bases immediately to the left of start, fetched as needed.
+  string left;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // A base can only be dropped from the right if we can extend to the left
+    // again should that empty an allele.
+    if (ShareLastBase(alleles) && (start > 0 || ShortestLength(alleles) > 1)) {
+      for (string& allele : alleles) allele.pop_back();
+      changed = true;
+    }
+    if (ShortestLength(alleles) == 0) {
+      if (left.empty()) {
+        StatusOr<string> chunk = reference_->GetBases(MakeRange(
+            contig, std::max<int64>(0, start - kLeftExtensionChunk), start));
+        TF_RETURN_IF_ERROR(chunk.status());
+        left = absl::AsciiStrToUpper(chunk.ValueOrDie());
+      }
+      const char base = left.back();
+      left.pop_back();
+      for (string& allele : alleles) allele.insert(allele.begin(), base);
+      start--;
+      changed = true;
+    }
+  }
+  const size_t prefix = TrimmablePrefixLength(alleles);
+  if (prefix > 0) {
+    for (string& allele : alleles) allele.erase(0, prefix);
+    start += prefix;
+  }
+
+  variant->set_reference_bases(alleles[0]);
+  for (int i = 1; i < alleles.size(); i++) {
+    variant->set_alternate_bases(i - 1, alleles[i]);
+  }
+  variant->set_start(start);
+  variant->set_end(start + alleles[0].size());
+  return tf::Status::OK();
+}
+
+bool VariantNormalizer::SplitIndices(FieldNumber number, int ploidy,
+                                     int n_alts, int alt_index,
+                                     int* expected_size,
+                                     std::vector<int>* indices) {
+  indices->clear();
+  switch (number) {
+    case FieldNumber::kFixed:
+      *expected_size = -1;
+      return true;
+    case FieldNumber::kPerAltAllele:
+      *expected_size = n_alts;
+      indices->push_back(alt_index - 1);
+      return true;
+    case FieldNumber::kPerAllele:
+      *expected_size = n_alts + 1;
+      indices->push_back(0);
+      indices->push_back(alt_index);
+      return true;
+    case FieldNumber::kPerGenotype:
+      if (ploidy == 1) {
+        *expected_size = n_alts + 1;
+        indices->push_back(0);
+        indices->push_back(alt_index);
+        return true;
+      }
+      if (ploidy == 2) {
+        // The genotype j/k, j <= k, is at index k * (k + 1) / 2 + j in the VCF
+        // ordering of diploid genotypes.
+        *expected_size = (n_alts + 1) * (n_alts + 2) / 2;
+        indices->push_back(0);
+        indices->push_back(alt_index * (alt_index + 1) / 2);
+        indices->push_back(alt_index * (alt_index + 1) / 2 + alt_index);
+        return true;
+      }
+      return false;
+  }
+  return false;
+}
+
+void VariantNormalizer::SplitFields(
+    const std::map<string, FieldNumber>& numbers, int ploidy, int n_alts,
+    int alt_index, google::protobuf::Map<string, ListValue>* fields) {
+  std::vector<string> dropped;
+  std::vector<int> indices;
+  for (auto& field : *fields) {
+    const auto number = numbers.find(field.first);
+    if (number == numbers.end()) continue;
+    int expected_size;
+    if (!SplitIndices(number->second, ploidy, n_alts, alt_index,
+                      &expected_size, &indices)) {
+      dropped.push_back(field.first);
+      continue;
+    }
+    ListValue& values = field.second;
+    if (values.values_size() != expected_size) continue;
+    ListValue selected;
+    for (int index : indices) {
+      *selected.add_values() = values.values(index);
+    }
+    values.Swap(&selected);
+  }
+  for (const string& key : dropped) {
+    fields->erase(key);
+  }
+}
+
+void VariantNormalizer::Split(const Variant& variant,
+                              std::vector<Variant>* out) const {
+  const int n_alts = variant.alternate_bases_size();
+  std::vector<int> indices;
+  for (int alt_index = 1; alt_index <= n_alts; alt_index++) {
+    out->push_back(variant);
+    Variant& split = out->back();
+    split.clear_alternate_bases();
+    split.add_alternate_bases(variant.alternate_bases(alt_index - 1));
+    // INFO Number=G fields are rare and have no ploidy; assume diploid.
+    SplitFields(info_numbers_, 2, n_alts, alt_index, split.mutable_info());
+
+    for (VariantCall& call : *split.mutable_calls()) {
+      const int ploidy = call.genotype_size();
+      for (int i = 0; i < ploidy; i++) {
+        const int allele = call.genotype(i);
+        if (allele > 0) call.set_genotype(i, allele == alt_index ? 1 : -1);
+      }
+      if (call.genotype_likelihood_size() > 0) {
+        int expected_size;
+        if (SplitIndices(FieldNumber::kPerGenotype, ploidy, n_alts, alt_index,
+                         &expected_size, &indices) &&
+            call.genotype_likelihood_size() == expected_size) {
+          google::protobuf::RepeatedField<double> selected;
+          for (int index : indices) {
+            selected.Add(call.genotype_likelihood(index));
+          }
+          call.mutable_genotype_likelihood()->Swap(&selected);
+        } else {
+          call.clear_genotype_likelihood();
+        }
+      }
+      SplitFields(format_numbers_, ploidy, n_alts, alt_index,
+                  call.mutable_info());
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+//
+// Iterable class definitions.
+//
+// -----------------------------------------------------------------------------
+
+NormalizingVariantIterable::NormalizingVariantIterable(
+    const VariantNormalizer* normalizer, std::shared_ptr<VariantIterable> input)
+    : VariantIterable(normalizer),
+      normalizer_(normalizer),
+      input_(std::move(input)) {}
+
+NormalizingVariantIterable::~NormalizingVariantIterable() {}
+
+tf::Status NormalizingVariantIterable::ReadInput() {
+  Variant variant;
+  StatusOr<bool> more = input_->Next(&variant);
+  TF_RETURN_IF_ERROR(more.status());
+  if (!more.ValueOrDie()) {
+    input_done_ = true;
+    return tf::Status::OK();
+  }
+
+  if (contig_index_ < 0 || variant.reference_name() != contig_) {
+    contig_ = variant.reference_name();
+    contig_index_++;
+  }
+  frontier_ = variant.start();
+
+  pieces_.clear();
+  if (normalizer_->Options().split_multiallelics() &&
+      variant.alternate_bases_size() > 1) {
+    normalizer_->Split(variant, &pieces_);
+  } else {
+    pieces_.emplace_back();
+    pieces_.back().Swap(&variant);
+  }
+  for (Variant& piece : pieces_) {
+    TF_RETURN_IF_ERROR(normalizer_->LeftAlign(&piece));
+    if (contig_index_ == emitted_contig_index_ &&
+        piece.start() < emitted_start_) {
+      return tf::errors::FailedPrecondition(
+          "Variant at ", piece.reference_name(), ":", piece.start() + 1,
+          " was left-aligned before variants already returned; increase "
+          "reorder_window above ", normalizer_->ReorderWindow());
+    }
+    Pending pending = {contig_index_, piece.start(), piece.end(), sequence_++,
+                       absl::make_unique<Variant>()};
+    pending.variant->Swap(&piece);
+    heap_.push_back(std::move(pending));
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<Pending>());
+  }
+  return tf::Status::OK();
+}
+
+bool NormalizingVariantIterable::CanEmitTop() const {
+  if (heap_.empty()) return false;
+  const Pending& top = heap_.front();
+  return top.contig_index < contig_index_ ||
+         top.start < frontier_ - normalizer_->ReorderWindow();
+}
+
+StatusOr<bool> NormalizingVariantIterable::Next(Variant* out) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  while (!input_done_ && !CanEmitTop()) {
+    TF_RETURN_IF_ERROR(ReadInput());
+  }
+  if (heap_.empty()) return false;
+
+  std::pop_heap(heap_.begin(), heap_.end(), std::greater<Pending>());
+  emitted_contig_index_ = heap_.back().contig_index;
+  emitted_start_ = heap_.back().start;
+  out->Swap(heap_.back().variant.get());
+  heap_.pop_back();
+  return true;
+}
+
+}  // namespace nucleus
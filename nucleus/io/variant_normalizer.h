@@ -0,0 +1,183 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VARIANT_NORMALIZER_H_
+#define THIRD_PARTY_NUCLEUS_IO_VARIANT_NORMALIZER_H_
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "nucleus/io/reader_base.h"
+#include "nucleus/io/reference.h"
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/struct.pb.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// Left-aligns and trims the alleles of a stream of variants against a
+// reference genome, optionally splitting multi-allelic variants first.
+//
+// A variant is normalized by repeatedly dropping the last base of its alleles
+// while they all share it, extending them to the left with reference bases
+// whenever one becomes empty, and finally dropping leading bases they all
+// share while every allele is at least two bases long. The result is the
+// unique leftmost, most parsimonious representation of the variant. Variants
+// with symbolic, breakend or '*' alleles are passed through unchanged.
+//
+// VariantNormalizer is a Reader so that the iterables it returns are
+// invalidated when it is destroyed; it does not own the reference, which must
+// outlive it, nor the input iterables.
+class VariantNormalizer : public Reader {
+ public:
+  // Creates a normalizer for variants described by header, whose contigs
+  // must be available in reference.
+  static StatusOr<std::unique_ptr<VariantNormalizer>> Create(
+      const nucleus::genomics::v1::VcfHeader& header,
+      const GenomeReference* reference,
+      const nucleus::genomics::v1::VariantNormalizerOptions& options);
+
+  ~VariantNormalizer();
+
+  // Disable copy or assignment
+  VariantNormalizer(const VariantNormalizer& other) = delete;
+  VariantNormalizer& operator=(const VariantNormalizer&) = delete;
+
+  // Returns an iterable over the normalized variants of input, which must be
+  // sorted by contig and start. Variants are normalized as they are read, so
+  // memory use is bounded by the reorder window rather than the input size.
+  StatusOr<std::shared_ptr<VariantIterable>> Normalize(
+      std::shared_ptr<VariantIterable> input);
+
+  // Left-aligns and trims the alleles of variant in place, updating its start
+  // and end. Returns InvalidArgument if its reference allele doesn't match the
+  // reference genome.
+  tensorflow::Status LeftAlign(nucleus::genomics::v1::Variant* variant) const;
+
+  // Appends one biallelic variant per alternate allele of variant to out,
+  // remapping its genotypes and per-allele fields as described in
+  // VariantNormalizerOptions. The split variants are not left-aligned.
+  void Split(const nucleus::genomics::v1::Variant& variant,
+             std::vector<nucleus::genomics::v1::Variant>* out) const;
+
+  // Returns the header describing the variants being normalized.
+  const nucleus::genomics::v1::VcfHeader& Header() const { return header_; }
+
+  // The options this normalizer was created with.
+  const nucleus::genomics::v1::VariantNormalizerOptions& Options() const {
+    return options_;
+  }
+
+  // The reorder window in effect, in bases.
+  int64 ReorderWindow() const { return reorder_window_; }
+
+ private:
+  // How the values of an INFO or FORMAT field relate to the alleles, from the
+  // Number attribute of its header line.
+  enum class FieldNumber { kFixed, kPerAltAllele, kPerAllele, kPerGenotype };
+
+  VariantNormalizer(
+      const nucleus::genomics::v1::VcfHeader& header,
+      const GenomeReference* reference,
+      const nucleus::genomics::v1::VariantNormalizerOptions& options);
+
+  // Computes which of the expected_size values of a field to keep for the
+  // alt_index'th (1-based) of n_alts alternate alleles, given the ploidy of
+  // the call the field belongs to. Returns false if the field can't be split,
+  // which is the case for Number=G fields of calls with a ploidy above two.
+  static bool SplitIndices(FieldNumber number, int ploidy, int n_alts,
+                           int alt_index, int* expected_size,
+                           std::vector<int>* indices);
+
+  // Applies SplitIndices to each of fields, described by numbers. Fields whose
+  // length doesn't match their Number are left alone, and fields that can't be
+  // split are dropped.
+  static void SplitFields(
+      const std::map<string, FieldNumber>& numbers, int ploidy, int n_alts,
+      int alt_index,
+      google::protobuf::Map<string, nucleus::genomics::v1::ListValue>* fields);
+
+  const nucleus::genomics::v1::VcfHeader header_;
+  const GenomeReference* const reference_;
+  const nucleus::genomics::v1::VariantNormalizerOptions options_;
+  const int64 reorder_window_;
+  std::map<string, FieldNumber> info_numbers_;
+  std::map<string, FieldNumber> format_numbers_;
+};
+
+// Iterable that normalizes the variants of another VariantIterable, holding
+// them in a min-heap until the input has moved a reorder window past them.
+// Returns FailedPrecondition if a variant is left-aligned before one it has
+// already returned, which only happens if it moved further than the window.
+class NormalizingVariantIterable : public VariantIterable {
+ public:
+  StatusOr<bool> Next(nucleus::genomics::v1::Variant* out) override;
+
+  // Constructor is invoked via VariantNormalizer::Normalize.
+  NormalizingVariantIterable(const VariantNormalizer* normalizer,
+                             std::shared_ptr<VariantIterable> input);
+
+  ~NormalizingVariantIterable() override;
+
+ private:
+  // A normalized variant waiting to be emitted. contig_index counts contig
+  // changes in the input, so variants of earlier contigs sort first, and
+  // sequence keeps the order of variants with equal positions stable.
+  struct Pending {
+    int64 contig_index;
+    int64 start;
+    int64 end;
+    int64 sequence;
+    std::unique_ptr<nucleus::genomics::v1::Variant> variant;
+
+    bool operator>(const Pending& other) const {
+      if (contig_index != other.contig_index)
+        return contig_index > other.contig_index;
+      if (start != other.start) return start > other.start;
+      if (end != other.end) return end > other.end;
+      return sequence > other.sequence;
+    }
+  };
+
+  // Reads, normalizes and buffers the next input variant. Sets input_done_
+  // when the input is exhausted.
+  tensorflow::Status ReadInput();
+
+  // Returns true if the top of the heap can no longer be preceded by a
+  // variant still to be read from the input.
+  bool CanEmitTop() const;
+
+  const VariantNormalizer* const normalizer_;
+  std::shared_ptr<VariantIterable> input_;
+  std::vector<Pending> heap_;
+  std::vector<nucleus::genomics::v1::Variant> pieces_;
+  string contig_;
+  int64 contig_index_ = -1;
+  int64 frontier_ = 0;
+  int64 sequence_ = 0;
+  // Contig index and start of the last variant returned by Next.
+  int64 emitted_contig_index_ = -1;
+  int64 emitted_start_ = 0;
+  bool input_done_ = false;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VARIANT_NORMALIZER_H_
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/variant_normalizer.h"
+
+#include <memory>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "nucleus/io/reference_fai.h"
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using std::vector;
+
+using ::testing::ElementsAre;
+
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantNormalizerOptions;
+using nucleus::genomics::v1::VcfReaderOptions;
+
+constexpr char kFastaFilename[] = "test.fasta";
+constexpr char kVcfNormalizeFilename[] = "test_normalize.vcf";
+
+// Summarizes the position and alleles of variant as "start:REF>ALT,ALT".
+string Alleles(const Variant& variant) {
+  return absl::StrCat(variant.start(), ":", variant.reference_bases(), ">",
+                      absl::StrJoin(variant.alternate_bases(), ","));
+}
+
+class VariantNormalizerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const string fasta = GetTestData(kFastaFilename);
+    reference_ = std::move(
+        GenomeReferenceFai::FromFile(fasta, absl::StrCat(fasta, ".fai"))
+            .ValueOrDie());
+    reader_ = std::move(VcfReader::FromFile(GetTestData(kVcfNormalizeFilename),
+                                            VcfReaderOptions())
+                            .ValueOrDie());
+  }
+
+  std::unique_ptr<VariantNormalizer> MakeNormalizer(
+      const VariantNormalizerOptions& options) {
+    return std::move(
+        VariantNormalizer::Create(reader_->Header(), reference_.get(), options)
+            .ValueOrDie());
+  }
+
+  vector<Variant> NormalizeAll(const VariantNormalizerOptions& options) {
+    auto normalizer = MakeNormalizer(options);
+    return as_vector(normalizer->Normalize(reader_->Iterate().ValueOrDie()));
+  }
+
+  Variant MakeVariant(int64 start, const string& ref, const string& alt) {
+    Variant variant;
+    variant.set_reference_name("chr1");
+    variant.set_start(start);
+    variant.set_end(start + ref.size());
+    variant.set_reference_bases(ref);
+    variant.add_alternate_bases(alt);
+    return variant;
+  }
+
+  std::unique_ptr<GenomeReferenceFai> reference_;
+  std::unique_ptr<VcfReader> reader_;
+};
+
+TEST_F(VariantNormalizerTest, LeftAlignsTrimsAndSorts) {
+  vector<string> alleles;
+  for (const Variant& variant : NormalizeAll(VariantNormalizerOptions())) {
+    alleles.push_back(Alleles(variant));
+  }
+  // The deletion at 18 moves left past the SNP at 17, and symbolic alleles are
+  // left alone.
+  EXPECT_THAT(alleles, ElementsAre("7:T>G", "15:GA>G", "17:A>C", "28:C>T",
+                                   "53:TC>T,TCC", "0:C><*>"));
+}
+
+TEST_F(VariantNormalizerTest, SplitsMultiallelics) {
+  VariantNormalizerOptions options;
+  options.set_split_multiallelics(true);
+  vector<Variant> variants = NormalizeAll(options);
+  ASSERT_EQ(variants.size(), 7);
+
+  const Variant& insertion = variants[4];
+  const Variant& deletion = variants[5];
+  EXPECT_EQ(Alleles(insertion), "53:T>TC");
+  EXPECT_EQ(Alleles(deletion), "53:TC>T");
+
+  EXPECT_EQ(deletion.info().at("AF").values(0).number_value(), 0.25);
+  EXPECT_EQ(insertion.info().at("AF").values(0).number_value(), 0.5);
+  EXPECT_THAT(deletion.calls(0).genotype(), ElementsAre(1, -1));
+  EXPECT_THAT(insertion.calls(0).genotype(), ElementsAre(-1, 1));
+  EXPECT_THAT(deletion.calls(0).genotype_likelihood(),
+              ElementsAre(-5, -4, -3));
+  EXPECT_THAT(insertion.calls(0).genotype_likelihood(),
+              ElementsAre(-5, -2, -0.5));
+  const auto& deletion_ad = deletion.calls(0).info().at("AD");
+  ASSERT_EQ(deletion_ad.values_size(), 2);
+  EXPECT_EQ(deletion_ad.values(0).int_value(), 10);
+  EXPECT_EQ(deletion_ad.values(1).int_value(), 20);
+  const auto& insertion_ad = insertion.calls(0).info().at("AD");
+  ASSERT_EQ(insertion_ad.values_size(), 2);
+  EXPECT_EQ(insertion_ad.values(0).int_value(), 10);
+  EXPECT_EQ(insertion_ad.values(1).int_value(), 30);
+}
+
+TEST_F(VariantNormalizerTest, LeftAlignExtendsToContigStart) {
+  auto normalizer = MakeNormalizer(VariantNormalizerOptions());
+  Variant variant = MakeVariant(1, "CC", "C");
+  ASSERT_THAT(normalizer->LeftAlign(&variant), IsOK());
+  EXPECT_EQ(Alleles(variant), "0:AC>A");
+  EXPECT_EQ(variant.end(), 2);
+
+  // There is no base left of the contig start to anchor this deletion on, so
+  // it can't be trimmed.
+  variant = MakeVariant(0, "AC", "C");
+  ASSERT_THAT(normalizer->LeftAlign(&variant), IsOK());
+  EXPECT_EQ(Alleles(variant), "0:AC>C");
+}
+
+TEST_F(VariantNormalizerTest, LeftAlignLeavesReferenceOnlyAllelesAlone) {
+  auto normalizer = MakeNormalizer(VariantNormalizerOptions());
+  Variant variant = MakeVariant(20, "CA", "ca");
+  ASSERT_THAT(normalizer->LeftAlign(&variant), IsOK());
+  EXPECT_EQ(Alleles(variant), "20:CA>ca");
+  EXPECT_EQ(variant.end(), 22);
+}
+
+TEST_F(VariantNormalizerTest, RejectsVariantsMovedPastReorderWindow) {
+  // The deletion of the last A of the AAA run at 16-18 left-aligns to 15, in
+  // front of the SNP at 16.
+  const string path = MakeTempFile("past_reorder_window.vcf");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(
+      tensorflow::Env::Default(), path,
+      "##fileformat=VCFv4.2\n"
+      "##contig=<ID=chr1,length=76>\n"
+      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n"
+      "chr1\t17\t.\tA\tG\t.\t.\t.\n"
+      "chr1\t19\t.\tA\tC\t.\t.\t.\n"
+      "chr1\t19\t.\tAT\tT\t.\t.\t.\n"));
+  reader_ = std::move(
+      VcfReader::FromFile(path, VcfReaderOptions()).ValueOrDie());
+
+  // The default window is wide enough to sort them.
+  vector<string> alleles;
+  for (const Variant& variant : NormalizeAll(VariantNormalizerOptions())) {
+    alleles.push_back(Alleles(variant));
+  }
+  EXPECT_THAT(alleles, ElementsAre("15:GA>G", "16:A>G", "18:A>C"));
+
+  // With a one-base window the SNP at 16 is returned once the SNP at 18 has
+  // been read, before the deletion, which then can't be put in front of it.
+  VariantNormalizerOptions options;
+  options.set_reorder_window(1);
+  auto normalizer = MakeNormalizer(options);
+  std::shared_ptr<VariantIterable> variants =
+      normalizer->Normalize(reader_->Iterate().ValueOrDie()).ValueOrDie();
+  Variant variant;
+  ASSERT_THAT(variants->Next(&variant).status(), IsOK());
+  EXPECT_EQ(Alleles(variant), "16:A>G");
+  EXPECT_THAT(variants->Next(&variant).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "increase reorder_window"));
+}
+
+TEST_F(VariantNormalizerTest, LeftAlignRejectsReferenceMismatch) {
+  auto normalizer = MakeNormalizer(VariantNormalizerOptions());
+  Variant variant = MakeVariant(7, "A", "G");
+  EXPECT_THAT(normalizer->LeftAlign(&variant),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "does not match the reference"));
+}
+
+}  // namespace nucleus
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of variant_position_index.h
+#include "nucleus/io/variant_position_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "nucleus/io/hts_path.h"
+#include "nucleus/io/vcf_filter.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+namespace {
+
+// Intervals are binned by their end into bins of 1 << kBinShift bases.
+constexpr int kBinShift = 16;
+
+// The first bytes of an index file, which include a format version.
+constexpr char kMagic[] = "NUCVPI01";
+constexpr size_t kMagicLength = sizeof(kMagic) - 1;
+
+void AppendInt32s(const int32* values, size_t n, string* out) {
+  out->append(reinterpret_cast<const char*>(values), n * sizeof(int32));
+}
+
+// Reads the contents of an index file in order, failing once they run out.
+class IndexFileParser {
+ public:
+  explicit IndexFileParser(const string& data) : data_(data) {}
+
+  bool Read(void* out, size_t n) {
+    if (data_.size() - offset_ < n) return false;
+    std::memcpy(out, data_.data() + offset_, n);
+    offset_ += n;
+    return true;
+  }
+
+  bool ReadInt32s(size_t n, std::vector<int32>* out) {
+    // Check the count before allocating for it, since it may be corrupt.
+    if ((data_.size() - offset_) / sizeof(int32) < n) return false;
+    out->resize(n);
+    return Read(out->data(), n * sizeof(int32));
+  }
+
+  bool AtEnd() const { return offset_ == data_.size(); }
+
+ private:
+  const string& data_;
+  size_t offset_ = 0;
+};
+
+}  // namespace
+
+StatusOr<std::unique_ptr<VariantPositionIndex>> VariantPositionIndex::FromVcf(
+    const string& vcf_path, const string& filter_expression) {
+  htsFile* fp = hts_open_x(vcf_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound("Could not open ", vcf_path);
+  }
+  bcf_hdr_t* header = bcf_hdr_read(fp);
+  if (header == nullptr) {
+    hts_close(fp);
+    return tf::errors::Unknown("Couldn't parse header for ", vcf_path);
+  }
+  std::unique_ptr<VcfRecordFilter> filter;
+  tf::Status status;
+  if (!filter_expression.empty()) {
+    StatusOr<std::unique_ptr<VcfRecordFilter>> compiled =
+        VcfRecordFilter::Compile(filter_expression, header);
+    status = compiled.status();
+    if (status.ok()) filter = std::move(compiled.ValueOrDie());
+  }
+
+  // The spans of the records of each contig, by htslib contig id.
+  std::vector<Contig> contigs;
+  bcf1_t* bcf1 = bcf_init();
+  while (status.ok() && bcf_read(fp, header, bcf1) >= 0) {
+    if (filter != nullptr && !filter->Matches(bcf1)) continue;
+    if (bcf1->rid >= contigs.size()) contigs.resize(bcf1->rid + 1);
+    Contig& contig = contigs[bcf1->rid];
+    contig.starts.push_back(bcf1->pos);
+    contig.ends.push_back(bcf1->pos + std::max(bcf1->rlen, 1));
+  }
+  if (status.ok() && bcf1->errcode) {
+    status = tf::errors::DataLoss("Failed to parse VCF record in ", vcf_path);
+  }
+
+  std::unique_ptr<VariantPositionIndex> index(new VariantPositionIndex());
+  if (status.ok()) {
+    for (int rid = 0; rid < contigs.size(); rid++) {
+      if (contigs[rid].starts.empty()) continue;
+      const string name = bcf_hdr_id2name(header, rid);
+      index->contig_ids_[name] = index->contigs_.size();
+      index->contig_names_.push_back(name);
+      index->contigs_.push_back(std::move(contigs[rid]));
+      MergeIntervals(&index->contigs_.back());
+    }
+  }
+  bcf_destroy(bcf1);
+  bcf_hdr_destroy(header);
+  hts_close(fp);
+  TF_RETURN_IF_ERROR(status);
+  return std::move(index);
+}
+
+StatusOr<std::unique_ptr<VariantPositionIndex>> VariantPositionIndex::FromFile(
+    const string& index_path) {
+  string data;
+  TF_RETURN_IF_ERROR(
+      tf::ReadFileToString(tf::Env::Default(), index_path, &data));
+  IndexFileParser parser(data);
+  char magic[kMagicLength];
+  if (!parser.Read(magic, kMagicLength) ||
+      std::memcmp(magic, kMagic, kMagicLength) != 0) {
+    return tf::errors::DataLoss(index_path,
+                                " is not a variant position index");
+  }
+  std::unique_ptr<VariantPositionIndex> index(new VariantPositionIndex());
+  int32 n_contigs = 0;
+  bool ok = parser.Read(&n_contigs, sizeof(n_contigs)) && n_contigs >= 0;
+  for (int i = 0; ok && i < n_contigs; i++) {
+    int32 name_length = 0;
+    int32 n_intervals = 0;
+    ok = parser.Read(&name_length, sizeof(name_length)) && name_length >= 0;
+    string name(ok ? name_length : 0, '\0');
+    Contig contig;
+    ok = ok && parser.Read(&name[0], name_length) &&
+         parser.Read(&n_intervals, sizeof(n_intervals)) && n_intervals >= 0 &&
+         parser.ReadInt32s(n_intervals, &contig.starts) &&
+         parser.ReadInt32s(n_intervals, &contig.ends) &&
+         index->contig_ids_.count(name) == 0;
+    // Overlaps relies on the intervals being sorted and disjoint.
+    for (int j = 0; ok && j < n_intervals; j++) {
+      ok = contig.starts[j] < contig.ends[j] &&
+           (j == 0 || contig.ends[j - 1] < contig.starts[j]);
+    }
+    if (!ok) break;
+    BuildBins(&contig);
+    index->contig_ids_[name] = index->contigs_.size();
+    index->contig_names_.push_back(name);
+    index->contigs_.push_back(std::move(contig));
+  }
+  if (!ok || !parser.AtEnd()) {
+    return tf::errors::DataLoss("Malformed variant position index ",
+                                index_path);
+  }
+  return std::move(index);
+}
+
+tf::Status VariantPositionIndex::WriteToFile(const string& index_path) const {
+  string data(kMagic, kMagicLength);
+  const int32 n_contigs = contigs_.size();
+  AppendInt32s(&n_contigs, 1, &data);
+  for (int i = 0; i < contigs_.size(); i++) {
+    const int32 name_length = contig_names_[i].size();
+    const int32 n_intervals = contigs_[i].starts.size();
+    AppendInt32s(&name_length, 1, &data);
+    data.append(contig_names_[i]);
+    AppendInt32s(&n_intervals, 1, &data);
+    AppendInt32s(contigs_[i].starts.data(), n_intervals, &data);
+    AppendInt32s(contigs_[i].ends.data(), n_intervals, &data);
+  }
+  return tf::WriteStringToFile(tf::Env::Default(), index_path, data);
+}
+
+bool VariantPositionIndex::Overlaps(
+    const nucleus::genomics::v1::Range& range) const {
+  if (range.start() >= range.end()) return false;
+  const auto it = contig_ids_.find(range.reference_name());
+  if (it == contig_ids_.end()) return false;
+  const Contig& contig = contigs_[it->second];
+  const int64 start = std::max<int64>(range.start(), 0);
+  const int64 bin = start >> kBinShift;
+  if (bin + 1 >= contig.bins.size()) return false;
+  // The first interval ending after start is at most bins[bin + 1], which
+  // ends after the start of the next bin.
+  const int32 n_intervals = contig.ends.size();
+  const int32 lo = contig.bins[bin];
+  const int32 hi = std::min(contig.bins[bin + 1] + 1, n_intervals);
+  const int32 i = std::upper_bound(contig.ends.begin() + lo,
+                                   contig.ends.begin() + hi, start) -
+                  contig.ends.begin();
+  return i < n_intervals && contig.starts[i] < range.end();
+}
+
+int64 VariantPositionIndex::NumIntervals() const {
+  int64 n_intervals = 0;
+  for (const Contig& contig : contigs_) n_intervals += contig.starts.size();
+  return n_intervals;
+}
+
+void VariantPositionIndex::MergeIntervals(Contig* contig) {
+  std::vector<std::pair<int32, int32>> spans;
+  spans.reserve(contig->starts.size());
+  for (int i = 0; i < contig->starts.size(); i++) {
+    spans.emplace_back(contig->starts[i], contig->ends[i]);
+  }
+  std::sort(spans.begin(), spans.end());
+  contig->starts.clear();
+  contig->ends.clear();
+  for (const auto& span : spans) {
+    // Abutting spans are merged too, as no range can tell them apart.
+    if (!contig->ends.empty() && span.first <= contig->ends.back()) {
+      contig->ends.back() = std::max(contig->ends.back(), span.second);
+    } else {
+      contig->starts.push_back(span.first);
+      contig->ends.push_back(span.second);
+    }
+  }
+  contig->starts.shrink_to_fit();
+  contig->ends.shrink_to_fit();
+  BuildBins(contig);
+}
+
+void VariantPositionIndex::BuildBins(Contig* contig) {
+  const int32 n_intervals = contig->ends.size();
+  const int64 n_bins =
+      n_intervals == 0 ? 0 : (contig->ends.back() >> kBinShift) + 1;
+  contig->bins.assign(n_bins + 1, n_intervals);
+  int32 i = 0;
+  for (int64 bin = 0; bin < n_bins; bin++) {
+    while (i < n_intervals && contig->ends[i] <= (bin << kBinShift)) i++;
+    contig->bins[bin] = i;
+  }
+}
+
+}  // namespace nucleus
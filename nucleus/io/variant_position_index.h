@@ -0,0 +1,96 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VARIANT_POSITION_INDEX_H_
+#define THIRD_PARTY_NUCLEUS_IO_VARIANT_POSITION_INDEX_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "nucleus/protos/range.pb.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+// An in-memory index of the bases covered by the records of a VCF, for
+// answering "does any variant overlap this range?" without querying the VCF
+// and converting its records, as when screening reads against a truth set.
+//
+// The reference span of every record is merged into sorted, disjoint
+// intervals per contig, stored as two int32 arrays, with a table of the first
+// interval ending in each 64 kb bin. Overlaps thus takes a hash lookup of the
+// contig and a binary search within one bin.
+//
+// An index can be written to a sidecar file, conventionally the VCF path plus
+// ".vpi", and loaded from it much faster than it can be rebuilt.
+class VariantPositionIndex {
+ public:
+  // Builds the index of the records of the VCF file vcf_path that match
+  // filter_expression (all records if it is empty; see
+  // VcfReaderOptions.filter_expression). Records are read straight from
+  // htslib, so vcf_path needs no index and can be in any order.
+  static StatusOr<std::unique_ptr<VariantPositionIndex>> FromVcf(
+      const string& vcf_path, const string& filter_expression);
+
+  // Loads an index written by WriteToFile from index_path.
+  static StatusOr<std::unique_ptr<VariantPositionIndex>> FromFile(
+      const string& index_path);
+
+  // Disable copy or assignment
+  VariantPositionIndex(const VariantPositionIndex& other) = delete;
+  VariantPositionIndex& operator=(const VariantPositionIndex&) = delete;
+
+  // Writes this index to index_path, in native byte order.
+  tensorflow::Status WriteToFile(const string& index_path) const;
+
+  // Returns true if any indexed record overlaps any bases of range. Ranges on
+  // contigs without records, and empty ranges, overlap nothing.
+  bool Overlaps(const nucleus::genomics::v1::Range& range) const;
+
+  // The number of disjoint intervals the records were merged into.
+  int64 NumIntervals() const;
+
+ private:
+  // The merged intervals of one contig.
+  struct Contig {
+    std::vector<int32> starts;
+    std::vector<int32> ends;
+    // bins[b] is the index of the first interval ending after b * kBinSize;
+    // the last entry is the number of intervals.
+    std::vector<int32> bins;
+  };
+
+  VariantPositionIndex() = default;
+
+  // Sorts and merges the spans [starts[i], ends[i]) of contig, and builds its
+  // bin table.
+  static void MergeIntervals(Contig* contig);
+
+  // Builds the bin table of contig from its merged intervals.
+  static void BuildBins(Contig* contig);
+
+  std::vector<string> contig_names_;
+  std::unordered_map<string, int> contig_ids_;
+  std::vector<Contig> contigs_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VARIANT_POSITION_INDEX_H_
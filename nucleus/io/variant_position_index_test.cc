@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/variant_position_index.h"
+
+#include <limits>
+
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+constexpr char kVcfSamplesFilename[] = "test_samples.vcf";
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+
+std::unique_ptr<VariantPositionIndex> IndexTestVcf() {
+  return std::move(
+      VariantPositionIndex::FromVcf(GetTestData(kVcfSamplesFilename), "")
+          .ValueOrDie());
+}
+
+TEST(VariantPositionIndexTest, OverlapsRecordSpans) {
+  auto index = IndexTestVcf();
+  // There's a SNP at chr3:14319.
+  EXPECT_TRUE(index->Overlaps(MakeRange("chr3", 14318, 14319)));
+  EXPECT_TRUE(index->Overlaps(MakeRange("chr3", 14000, 15000)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr3", 14317, 14318)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr3", 14319, 14320)));
+  // The deletion CTGT at chr1:14397 spans chr1:14397-14400.
+  EXPECT_TRUE(index->Overlaps(MakeRange("chr1", 14399, 14400)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr1", 14400, 14401)));
+  // Contigs without records, beyond the last record, and empty ranges.
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr4", 0, 1000000)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr3", 400000, 200000000)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr3", 14318, 14318)));
+}
+
+TEST(VariantPositionIndexTest, MatchesQuery) {
+  auto index = IndexTestVcf();
+  auto reader = std::move(
+      VcfReader::FromFile(GetTestData(kVcfIndexSamplesFilename),
+                          nucleus::genomics::v1::VcfReaderOptions())
+          .ValueOrDie());
+  int n_overlapping = 0;
+  for (int64 start = 0; start < 1000000; start += 397) {
+    const auto range = MakeRange("chr1", start, start + 150);
+    const bool expected = !as_vector(reader->Query(range)).empty();
+    EXPECT_EQ(expected, index->Overlaps(range)) << range.ShortDebugString();
+    n_overlapping += expected;
+  }
+  EXPECT_GT(n_overlapping, 0);
+}
+
+TEST(VariantPositionIndexTest, AppliesFilter) {
+  auto index = std::move(
+      VariantPositionIndex::FromVcf(GetTestData(kVcfSamplesFilename),
+                                    "CHROM == chr3")
+          .ValueOrDie());
+  EXPECT_TRUE(index->Overlaps(MakeRange("chr3", 14318, 14319)));
+  EXPECT_FALSE(index->Overlaps(MakeRange("chr1", 14399, 14400)));
+}
+
+TEST(VariantPositionIndexTest, RoundTripsThroughFile) {
+  auto index = IndexTestVcf();
+  const string path = MakeTempFile("round_trip.vpi");
+  ASSERT_THAT(index->WriteToFile(path), IsOK());
+  auto loaded = std::move(VariantPositionIndex::FromFile(path).ValueOrDie());
+  EXPECT_EQ(index->NumIntervals(), loaded->NumIntervals());
+  for (int64 start = 0; start < 1000000; start += 101) {
+    for (const char* contig : {"chr1", "chr2", "chr3"}) {
+      const auto range = MakeRange(contig, start, start + 50);
+      EXPECT_EQ(index->Overlaps(range), loaded->Overlaps(range));
+    }
+  }
+}
+
+TEST(VariantPositionIndexTest, RejectsMalformedFiles) {
+  const string path = MakeTempFile("malformed.vpi");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), path,
+                                            "not an index"));
+  EXPECT_THAT(VariantPositionIndex::FromFile(path).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "not a variant position index"));
+
+  ASSERT_THAT(IndexTestVcf()->WriteToFile(path), IsOK());
+  string data;
+  TF_CHECK_OK(
+      tensorflow::ReadFileToString(tensorflow::Env::Default(), path, &data));
+  data.resize(data.size() - 1);
+  TF_CHECK_OK(
+      tensorflow::WriteStringToFile(tensorflow::Env::Default(), path, data));
+  EXPECT_THAT(VariantPositionIndex::FromFile(path).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed variant position index"));
+
+  // A contig claiming far more intervals than the file holds is rejected
+  // without allocating for them.
+  const int32 fields[] = {1, 1};
+  const int32 n_intervals = std::numeric_limits<int32>::max();
+  data.resize(8);  // The magic.
+  data.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+  data.append("c");
+  data.append(reinterpret_cast<const char*>(&n_intervals),
+              sizeof(n_intervals));
+  TF_CHECK_OK(
+      tensorflow::WriteStringToFile(tensorflow::Env::Default(), path, data));
+  EXPECT_THAT(VariantPositionIndex::FromFile(path).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed variant position index"));
+}
+
+}  // namespace nucleus
@@ -51,6 +51,8 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import numpy as np
+
 from nucleus.io import genomics_reader
 from nucleus.io import genomics_writer
 from nucleus.io.python import vcf_reader
@@ -137,7 +139,10 @@ class NativeVcfReader(genomics_reader.GenomicsReader):
   def __init__(self,
                input_path,
                excluded_info_fields=None,
-               excluded_format_fields=None):
+               excluded_format_fields=None,
+               filter_expression=None,
+               compact_format_fields=False,
+               fast_text_parsing=False):
     """Initializer for NativeVcfReader.
 
     Args:
@@ -147,6 +152,19 @@ class NativeVcfReader(genomics_reader.GenomicsReader):
       excluded_format_fields: list(str). A list of FORMAT field IDs that should
         not be parsed into the Variants. If None, all FORMAT fields are
         included.
+      filter_expression: str. If set, only records matching this expression
+        (e.g. 'FILTER == PASS && QUAL >= 30') are returned. Records are tested
+        before they are converted to Variants. See VcfReaderOptions in
+        variants.proto for the expression language.
+      compact_format_fields: bool. If True, the FORMAT fields of each Variant
+        other than GT, GL and PL are stored as typed arrays in its
+        compact_format_fields rather than in the info map of each call, which
+        is much faster and smaller for VCFs with many samples. See
+        variantcall_utils.get_compact_format.
+      fast_text_parsing: bool. If True, simple records of text VCFs are parsed
+        directly into Variants rather than by htslib, which is faster but
+        yields the same Variants. Ignored if filter_expression or
+        compact_format_fields is set.
     """
     super(NativeVcfReader, self).__init__()
 
@@ -154,7 +172,10 @@ class NativeVcfReader(genomics_reader.GenomicsReader):
         input_path.encode('utf8'),
         variants_pb2.VcfReaderOptions(
             excluded_info_fields=excluded_info_fields,
-            excluded_format_fields=excluded_format_fields))
+            excluded_format_fields=excluded_format_fields,
+            filter_expression=filter_expression,
+            compact_format_fields=compact_format_fields,
+            fast_text_parsing=fast_text_parsing))
 
     self.header = self._reader.header
     self.field_access_cache = VcfHeaderCache(self.header)
@@ -167,6 +188,183 @@ class NativeVcfReader(genomics_reader.GenomicsReader):
     """Returns an iterator for going through variants in the region."""
     return self._reader.query(region)
 
+  def sweep_query(self, max_skip_bases=0):
+    """Returns a cursor for querying many regions in increasing order.
+
+    This is much faster than calling query() for each of a series of nearby,
+    sorted regions, such as the spans of reads from a sorted BAM: variants
+    overlapping several regions are read and converted only once, and the index
+    is only consulted again on a large jump, a new contig or a region that
+    starts before the previous one. Regions in any order give the same results
+    as query(), only more slowly. The file must be indexed.
+
+    Args:
+      max_skip_bases: int. If positive, the cursor seeks instead of reading
+        forward when a region starts more than this many bases past the last
+        record read; otherwise a default of 100000 is used.
+
+    Returns:
+      A context manager whose query(region) method returns the list of
+      nucleus.genomics.v1.Variant protos overlapping region.
+    """
+    return self._reader.sweep_query(max_skip_bases)
+
+  def lookup_by_id(self, ids):
+    """Returns the records with each of ids, such as dbSNP rsIDs.
+
+    The file must be BGZF-compressed and have a key index, built by
+    build_key_index. The records of all ids are read in file order, each once,
+    so batching many ids into one call is much faster than looking them up one
+    at a time.
+
+    Args:
+      ids: list(str). The IDs to look up.
+
+    Returns:
+      A list with, for each of ids, the list of nucleus.genomics.v1.Variant
+      protos with that ID among their names, in file order.
+    """
+    return self._reader.lookup_by_id([i.encode('utf8') for i in ids])
+
+  def lookup_by_allele(self, allele_keys):
+    """Returns the records with each of allele_keys; see lookup_by_id.
+
+    Args:
+      allele_keys: list(str). Keys of the form 'chr1:1235:CTG->C', with the
+        1-based position and the reference and one alternate allele of the
+        record, as in variant_key of a biallelic variant.
+
+    Returns:
+      A list with, for each of allele_keys, the list of
+      nucleus.genomics.v1.Variant protos with that allele, in file order.
+    """
+    return self._reader.lookup_by_allele(
+        [k.encode('utf8') for k in allele_keys])
+
+  def iterate_parallel(self, num_threads, shard_size_bases=0, ordered=True):
+    """Returns an iterable of the file's Variants, converted in parallel.
+
+    The file must be indexed. It is split along the index into per-contig
+    shards (or windows of shard_size_bases, if positive), which num_threads
+    worker threads convert independently.
+
+    Args:
+      num_threads: int. The number of worker threads.
+      shard_size_bases: int. If positive, contigs are split into shards of this
+        many bases; otherwise each contig is one shard.
+      ordered: bool. If True, variants are returned in file order, as by
+        iterate(). Otherwise they are returned as soon as they are converted.
+
+    Returns:
+      An iterable of nucleus.genomics.v1.Variant protos.
+    """
+    return self._reader.iterate_parallel(num_threads, shard_size_bases,
+                                         ordered)
+
+  def compute_stats(self, num_threads=1, shard_size_bases=0):
+    """Returns summary statistics of the file's records.
+
+    The statistics are computed in one pass straight from the htslib records,
+    without converting them to Variants, so this is much faster than tallying
+    the Variants in Python. Records not matching the reader's
+    filter_expression are left out.
+
+    Args:
+      num_threads: int. If greater than 1 and the file is indexed, the file is
+        split into shards as by iterate_parallel, which this many worker
+        threads process in parallel.
+      shard_size_bases: int. If positive, contigs are split into shards of this
+        many bases; otherwise each contig is one shard.
+
+    Returns:
+      A nucleus.genomics.v1.VcfStats proto with per-contig record counts,
+      variant type counts, transitions and transversions, genotype call counts
+      and the allele frequency spectrum.
+    """
+    return self._reader.compute_stats(num_threads, shard_size_bases)
+
+  def iterate_normalized(self,
+                         reference,
+                         region=None,
+                         split_multiallelics=False,
+                         reorder_window=0):
+    """Yields the file's Variants left-aligned and trimmed against reference.
+
+    Normalization streams in C++; variants that move left past earlier ones
+    are reordered within a window of reorder_window bases so that the output
+    stays sorted. Variants with symbolic alleles are yielded unchanged.
+
+    Args:
+      reference: fasta.RefFastaReader or fasta.InMemoryRefReader. The reference
+        genome the file was called against.
+      region: nucleus.genomics.v1.Range or None. If set, only the variants in
+        this region are normalized; the file must be indexed.
+      split_multiallelics: bool. If True, multi-allelic variants are split into
+        biallelic ones, remapping their GT, genotype likelihoods and Number=A,
+        R and G fields, before being normalized.
+      reorder_window: int. If positive, the reorder window in bases; otherwise
+        a default of 1000 is used.
+
+    Yields:
+      nucleus.genomics.v1.Variant protos, sorted by position.
+
+    Raises:
+      ValueError: if a variant's reference allele doesn't match reference.
+    """
+    normalizer = vcf_reader.VariantNormalizer.create(
+        self.header, reference.c_reader,
+        variants_pb2.VariantNormalizerOptions(
+            split_multiallelics=split_multiallelics,
+            reorder_window=reorder_window))
+    source = self.query(region) if region else self.iterate()
+    with normalizer.normalize(source.cc_iterable) as normalized:
+      for variant in normalized:
+        yield variant
+
+  def query_genotype_matrix(self,
+                            region,
+                            encoding=variants_pb2.VcfGenotypeMatrixOptions
+                            .ALT_ALLELE_DOSAGE,
+                            ploidy=2,
+                            format_field=None,
+                            block_size=4096):
+    """Yields dense genotype matrices for the variants in region.
+
+    Records are decoded straight from htslib into numpy buffers without
+    building Variant protos, in blocks of up to block_size variants.
+
+    Args:
+      region: nucleus.genomics.v1.Range. The region to query.
+      encoding: VcfGenotypeMatrixOptions.Encoding. ALT_ALLELE_DOSAGE yields one
+        int8 per sample (number of non-reference alleles, -1 if missing);
+        ALLELES yields `ploidy` int8 allele indices per sample, padded with -1.
+      ploidy: int. Number of alleles per sample in ALLELES encoding.
+      format_field: str or None. If set, the ID of an Integer or Float FORMAT
+        field whose first value per sample is returned as float32 (NaN if
+        missing).
+      block_size: int. Maximum number of variants per yielded block.
+
+    Yields:
+      (starts, genotypes, values) tuples. starts is an int64 array of shape
+      (n,); genotypes is an int8 array of shape (n, n_samples) for dosages or
+      (n, n_samples, ploidy) for alleles; values is a float32 array of shape
+      (n, n_samples), or None if format_field is not set.
+    """
+    options = variants_pb2.VcfGenotypeMatrixOptions(
+        encoding=encoding, ploidy=ploidy, format_field=format_field or '')
+    with self._reader.query_genotype_matrix(region, options) as iterable:
+      shape = (iterable.num_samples,)
+      if iterable.values_per_sample > 1:
+        shape += (iterable.values_per_sample,)
+      while True:
+        n, genotypes, values, starts = iterable.PythonNext(block_size)
+        if not n:
+          break
+        yield (np.frombuffer(starts, dtype=np.int64),
+               np.frombuffer(genotypes, dtype=np.int8).reshape((n,) + shape),
+               np.frombuffer(values, dtype=np.float32).reshape(
+                   (n, iterable.num_samples)) if format_field else None)
+
   def __exit__(self, exit_type, exit_value, exit_traceback):
     self._reader.__exit__(exit_type, exit_value, exit_traceback)
 
@@ -180,6 +378,49 @@ class VcfReader(genomics_reader.DispatchingGenomicsReader):
   def _record_proto(self):
     return variants_pb2.Variant
 
+  def sweep_query(self, **kwargs):
+    """Returns a sorted-region query cursor; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('sweep_query requires a native VCF file')
+    return self._reader.sweep_query(**kwargs)
+
+  def lookup_by_id(self, ids):
+    """Looks up records by ID; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('lookup_by_id requires a native VCF file')
+    return self._reader.lookup_by_id(ids)
+
+  def lookup_by_allele(self, allele_keys):
+    """Looks up records by allele; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('lookup_by_allele requires a native VCF file')
+    return self._reader.lookup_by_allele(allele_keys)
+
+  def iterate_parallel(self, num_threads, **kwargs):
+    """Iterates with worker threads; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('iterate_parallel requires a native VCF file')
+    return self._reader.iterate_parallel(num_threads, **kwargs)
+
+  def compute_stats(self, **kwargs):
+    """Returns summary statistics; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('compute_stats requires a native VCF file')
+    return self._reader.compute_stats(**kwargs)
+
+  def iterate_normalized(self, reference, **kwargs):
+    """Yields normalized Variants; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError('iterate_normalized requires a native VCF file')
+    return self._reader.iterate_normalized(reference, **kwargs)
+
+  def query_genotype_matrix(self, region, **kwargs):
+    """Yields dense genotype matrices; see NativeVcfReader for details."""
+    if not isinstance(self._reader, NativeVcfReader):
+      raise NotImplementedError(
+          'query_genotype_matrix requires a native VCF file')
+    return self._reader.query_genotype_matrix(region, **kwargs)
+
   def _post_init_hook(self):
     # Initialize field_access_cache.  If we are dispatching to a
     # NativeVcfReader, we use its field_access_cache. Otherwise, we need to
@@ -188,6 +429,78 @@ class VcfReader(genomics_reader.DispatchingGenomicsReader):
         self._reader, 'field_access_cache', VcfHeaderCache(self.header))
 
 
+class MergingVcfReader(genomics_reader.GenomicsReader):
+  """Class for reading the merge of several sorted VCF files as one.
+
+  Variants are returned in the order of the contigs in the header of the first
+  file, then by start and end, with ties broken by input order. The merge is
+  done in C++ and streams, so it is suitable for stitching together large
+  per-contig or per-shard VCFs:
+
+  ```python
+  with vcf.MergingVcfReader(shard_paths) as reader:
+    reader.write_to('merged.vcf.gz')
+  ```
+  """
+
+  def __init__(self,
+               input_paths,
+               excluded_info_fields=None,
+               excluded_format_fields=None):
+    """Initializer for MergingVcfReader.
+
+    Args:
+      input_paths: list(str). The paths to the sorted VCF files to merge. All
+        must have the same samples.
+      excluded_info_fields: list(str). A list of INFO field IDs that should not
+        be parsed into the Variants. If None, all INFO fields are included.
+      excluded_format_fields: list(str). A list of FORMAT field IDs that should
+        not be parsed into the Variants. If None, all FORMAT fields are
+        included.
+    """
+    super(MergingVcfReader, self).__init__()
+
+    self._reader = vcf_reader.MergingVcfReader.from_files(
+        [path.encode('utf8') for path in input_paths],
+        variants_pb2.VcfReaderOptions(
+            excluded_info_fields=excluded_info_fields,
+            excluded_format_fields=excluded_format_fields))
+
+    self.header = self._reader.header
+    self.field_access_cache = VcfHeaderCache(self.header)
+
+  def iterate(self):
+    """Returns an iterable of the merged Variant protos."""
+    return self._reader.iterate()
+
+  def query(self, region):
+    """Returns an iterator for going through merged variants in the region."""
+    return self._reader.query(region)
+
+  def write_to(self, output_path, region=None, **kwargs):
+    """Writes the merged variants to output_path with a VcfWriter.
+
+    Args:
+      output_path: str. The VCF or TFRecord file to write.
+      region: nucleus.genomics.v1.Range or None. If set, only the variants
+        overlapping region are written.
+      **kwargs: Additional keyword arguments for VcfWriter.
+
+    Returns:
+      The number of variants written.
+    """
+    n_written = 0
+    with VcfWriter(output_path, header=self.header, **kwargs) as writer:
+      with (self.query(region) if region else self.iterate()) as variants:
+        for variant in variants:
+          writer.write(variant)
+          n_written += 1
+    return n_written
+
+  def __exit__(self, exit_type, exit_value, exit_traceback):
+    self._reader.__exit__(exit_type, exit_value, exit_traceback)
+
+
 class NativeVcfWriter(genomics_writer.GenomicsWriter):
   """Class for writing to native VCF files.
 
@@ -323,3 +636,99 @@ class InMemoryVcfReader(genomics_reader.GenomicsReader):
         variant for variant in self.variants
         if ranges.ranges_overlap(variant_utils.variant_range(variant), region)
     )
+
+
+def compare_variants(truth_path,
+                     eval_path,
+                     confident_regions_path=None,
+                     truth_sample=None,
+                     eval_sample=None,
+                     include_filtered=False,
+                     annotated_variant_fn=None):
+  """Compares the variants of a VCF against a truth VCF.
+
+  Both files are swept once, in C++, and must be sorted in the contig order of
+  the truth file. Records are matched by position and classified as true
+  positives, false positives, false negatives, genotype mismatches or allele
+  mismatches; see VariantComparator in variant_comparator.h for the details.
+  Both files should be normalized first so that equivalent variants have the
+  same position.
+
+  Args:
+    truth_path: str. The path to the truth VCF.
+    eval_path: str. The path to the VCF being evaluated.
+    confident_regions_path: str or None. If set, the path of a BED file; only
+      records lying entirely within its regions are compared.
+    truth_sample: str or None. The truth sample to compare, or None for the
+      first sample.
+    eval_sample: str or None. The eval sample to compare, or None for the first
+      sample.
+    include_filtered: bool. If True, records that failed filters are compared;
+      otherwise they are ignored.
+    annotated_variant_fn: callable or None. If set, called on each compared
+      record, in order, with the outcome in its 'CONCORDANCE' INFO field: the
+      eval record, or the truth record for false negatives.
+
+  Returns:
+    A nucleus.genomics.v1.VariantConcordanceSummary.
+  """
+  options = variants_pb2.VariantConcordanceOptions(
+      truth_sample=truth_sample or '',
+      eval_sample=eval_sample or '',
+      include_filtered=include_filtered,
+      confident_regions_path=confident_regions_path or '')
+  with NativeVcfReader(truth_path) as truth_reader, NativeVcfReader(
+      eval_path) as eval_reader:
+    comparator = vcf_reader.VariantComparator.create(truth_reader.header,
+                                                     eval_reader.header,
+                                                     options)
+    with comparator.compare(truth_reader.iterate().cc_iterable,
+                            eval_reader.iterate().cc_iterable) as annotated:
+      for variant in annotated:
+        if annotated_variant_fn:
+          annotated_variant_fn(variant)
+    return comparator.summary
+
+
+def build_position_index(vcf_path, index_path=None, filter_expression=None):
+  """Builds an index of the bases covered by the records of a VCF.
+
+  The index answers whether any variant overlaps a range in C++, much faster
+  than querying the VCF, so it suits screening many reads or windows against a
+  truth set. The VCF needs no tabix index and is read straight from htslib.
+
+  Args:
+    vcf_path: str. The path to the VCF.
+    index_path: str or None. If set, the index is also written to this path,
+      conventionally vcf_path + '.vpi', for load_position_index.
+    filter_expression: str or None. If set, only records matching this
+      expression are indexed; see VcfReaderOptions.filter_expression.
+
+  Returns:
+    A VariantPositionIndex, whose overlaps(range) method returns True if any
+    indexed record overlaps the nucleus.genomics.v1.Range range.
+  """
+  index = vcf_reader.VariantPositionIndex.from_vcf(
+      vcf_path.encode('utf8'), filter_expression or '')
+  if index_path:
+    index.write_to_file(index_path.encode('utf8'))
+  return index
+
+
+def load_position_index(index_path):
+  """Loads an index written by build_position_index from index_path."""
+  return vcf_reader.VariantPositionIndex.from_file(index_path.encode('utf8'))
+
+
+def build_key_index(vcf_path):
+  """Builds the key index used by VcfReader.lookup_by_id and lookup_by_allele.
+
+  The index maps the IDs and alleles of the records of the BGZF-compressed VCF
+  at vcf_path to their offsets in it, and is written next to it, at
+  vcf_path + '.vki'.
+
+  Args:
+    vcf_path: str. The path to the VCF.
+  """
+  path = vcf_path.encode('utf8')
+  vcf_reader.VcfKeyIndex.build(path, vcf_reader.VcfKeyIndex.index_path(path))
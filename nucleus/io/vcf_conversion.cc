@@ -17,8 +17,14 @@
 
 #include "nucleus/io/vcf_conversion.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
 #include "nucleus/util/math.h"
 #include "nucleus/util/utils.h"
 
@@ -32,74 +38,224 @@ namespace {
 // these directly for FORMAT fields that have special semantics and so cannot be
 // handled by VcfFormatFieldAdapter.
 
-// Read in one of the format tags for a variant line of a VCF file, and return
-// a vector of vectors, where each subvector records values for a single sample.
-// An empty subvector represents that the field is "missing" for this sample.
-// If the tag is not represented in this variant, a zero-length vector is
-// returned.
+// Returns the ID of tag in the BCF_DT_ID dictionary of h, or -1 if h is null or
+// doesn't define tag.
+int ResolveHeaderId(const bcf_hdr_t* h, const string& tag) {
+  if (h == nullptr) return -1;
+  return bcf_hdr_id2int(h, BCF_DT_ID, tag.c_str());
+}
+
+// Returns the header ID to use for tag: resolved_id if it was resolved up
+// front, otherwise the ID looked up in h.
+int HeaderId(int resolved_id, const bcf_hdr_t* h, const string& tag) {
+  return resolved_id >= 0 ? resolved_id : ResolveHeaderId(h, tag);
+}
+
+// Returns the FORMAT field with header ID id of the unpacked record v, or
+// nullptr if it is not present in v.
+const bcf_fmt_t* FindFormat(const bcf1_t* v, int id) {
+  if (id < 0) return nullptr;
+  for (int i = 0; i < v->n_fmt; i++) {
+    const bcf_fmt_t& fmt = v->d.fmt[i];
+    // A null p marks a field that has been removed from the record.
+    if (fmt.id == id) return fmt.p != nullptr ? &fmt : nullptr;
+  }
+  return nullptr;
+}
+
+// Returns the number of values of sample in the FORMAT field fmt, i.e. the
+// number of values before the first vector end sentinel.  We only support
+// fields that are entirely missing, so if any of these values is missing the
+// whole sample is treated as missing and 0 is returned.  Returns -1 if fmt
+// isn't encoded as a ValueType.
 template <class ValueType>
-std::vector<std::vector<ValueType>> ReadFormatValues(const bcf_hdr_t* h,
-                                                     const bcf1_t* v,
-                                                     const char* tag) {
+int CountFormatValues(const bcf_fmt_t& fmt, int sample) {
   using VT = VcfType<ValueType>;
 
-  if (bcf_get_fmt(h, const_cast<bcf1_t*>(v), tag) == nullptr) {
-    return std::vector<std::vector<ValueType>>();
+  const uint8_t* p = fmt.p + sample * fmt.size;
+  for (int j = 0; j < fmt.n; j++) {
+    ValueType value;
+    if (!VT::DecodeValue(fmt.type, p, j, &value)) return -1;
+    if (VT::IsVectorEnd(value)) return j;
+    if (VT::IsMissing(value)) return 0;
   }
+  return fmt.n;
+}
 
-  int n_values, n_dst = 0;
-  ValueType* dst = nullptr;
-  n_values = VT::GetFormatValues(h, v, tag, &dst, &n_dst);
-  // TODO(b/69332066): cleanup error handling.
-  CHECK_GE(n_values, 0);
-  CHECK(dst != nullptr);
-
-  int n_values_per_sample = n_values / v->n_sample;
-  std::vector<std::vector<ValueType>> values(v->n_sample);
+// Decodes the FORMAT field fmt of the unpacked record v into the info map entry
+// `tag` of each VariantCall of variant, writing the values directly into the
+// ListValues.  Samples for which the field is missing are left untouched.
+template <class ValueType>
+tensorflow::Status DecodeFormatValues(
+    const bcf_fmt_t& fmt, const bcf1_t* v, const string& tag,
+    nucleus::genomics::v1::Variant* variant) {
+  using VT = VcfType<ValueType>;
 
   for (int i = 0; i < v->n_sample; i++) {
-    for (int j = 0; j < n_values_per_sample; j++) {
-      ValueType* p = dst + n_values_per_sample * i + j;
-      if (VT::IsVectorEnd(*p)) break;
-      // We only support fields that are entirely missing, so if we encounter a
-      // single missing field, we clear this subvector and break.
-      if (VT::IsMissing(*p)) {
-        values[i].clear();
-        break;
-      }
-      values[i].push_back(*p);
+    const int n_values = CountFormatValues<ValueType>(fmt, i);
+    if (n_values < 0) {
+      return tensorflow::errors::DataLoss(
+          "Unexpected encoding for FORMAT field ", tag);
+    }
+    if (n_values == 0) continue;
+    nucleus::genomics::v1::ListValue& list_value =
+        (*variant->mutable_calls(i)->mutable_info())[tag];
+    list_value.clear_values();
+    const uint8_t* p = fmt.p + i * fmt.size;
+    for (int j = 0; j < n_values; j++) {
+      ValueType value;
+      VT::DecodeValue(fmt.type, p, j, &value);
+      SetValuesValue<ValueType>(value, list_value.add_values());
     }
   }
+  return tensorflow::Status::OK();
+}
 
-  free(dst);
-  return values;
+// Specialized instantiation for string fields, which store a fixed-width,
+// NUL-padded character array per sample.
+template <>
+tensorflow::Status DecodeFormatValues<string>(
+    const bcf_fmt_t& fmt, const bcf1_t* v, const string& tag,
+    nucleus::genomics::v1::Variant* variant) {
+  if (fmt.type != BCF_BT_CHAR) {
+    return tensorflow::errors::DataLoss(
+        "Unexpected encoding for FORMAT field ", tag);
+  }
+  for (int i = 0; i < v->n_sample; i++) {
+    const char* s = reinterpret_cast<const char*>(fmt.p + i * fmt.size);
+    nucleus::genomics::v1::ListValue& list_value =
+        (*variant->mutable_calls(i)->mutable_info())[tag];
+    list_value.clear_values();
+    list_value.add_values()->set_string_value(s, strnlen(s, fmt.size));
+  }
+  return tensorflow::Status::OK();
 }
 
+// Appends value to the array of field that holds values of its type.
+void AddCompactValue(int value,
+                     nucleus::genomics::v1::CompactFormatField* field) {
+  field->add_int_values(value);
+}
 
-// Specialized instantiation for string fields, which require different
-// memory management and semantics.
-template<>
-std::vector<std::vector<string>> ReadFormatValues(const bcf_hdr_t* h,
-                                                  const bcf1_t* v,
-                                                  const char* tag) {
-  if (bcf_get_fmt(h, const_cast<bcf1_t*>(v), tag) == nullptr) {
-    return {};
+void AddCompactValue(float value,
+                     nucleus::genomics::v1::CompactFormatField* field) {
+  field->add_float_values(value);
+}
+
+// Returns the number of values of type ValueType in field, and the value at
+// index.
+template <class ValueType>
+int CompactValuesSize(const nucleus::genomics::v1::CompactFormatField& field);
+template <class ValueType>
+ValueType CompactValue(const nucleus::genomics::v1::CompactFormatField& field,
+                       int index);
+
+template <>
+int CompactValuesSize<int>(
+    const nucleus::genomics::v1::CompactFormatField& field) {
+  return field.int_values_size();
+}
+template <>
+int CompactValue<int>(const nucleus::genomics::v1::CompactFormatField& field,
+                      int index) {
+  return field.int_values(index);
+}
+
+template <>
+int CompactValuesSize<float>(
+    const nucleus::genomics::v1::CompactFormatField& field) {
+  return field.float_values_size();
+}
+template <>
+float CompactValue<float>(
+    const nucleus::genomics::v1::CompactFormatField& field, int index) {
+  return field.float_values(index);
+}
+
+template <>
+int CompactValuesSize<string>(
+    const nucleus::genomics::v1::CompactFormatField& field) {
+  return field.string_values_size();
+}
+template <>
+string CompactValue<string>(
+    const nucleus::genomics::v1::CompactFormatField& field, int index) {
+  return field.string_values(index);
+}
+
+// Decodes the FORMAT field fmt of the unpacked record v into field, with the
+// same handling of missing values as DecodeFormatValues.
+template <class ValueType>
+tensorflow::Status DecodeCompactFormatValues(
+    const bcf_fmt_t& fmt, const bcf1_t* v, const string& tag,
+    nucleus::genomics::v1::CompactFormatField* field) {
+  using VT = VcfType<ValueType>;
+
+  field->set_key(tag);
+  field->mutable_value_counts()->Reserve(v->n_sample);
+  for (int i = 0; i < v->n_sample; i++) {
+    const int n_values = CountFormatValues<ValueType>(fmt, i);
+    if (n_values < 0) {
+      return tensorflow::errors::DataLoss(
+          "Unexpected encoding for FORMAT field ", tag);
+    }
+    field->add_value_counts(n_values);
+    const uint8_t* p = fmt.p + i * fmt.size;
+    for (int j = 0; j < n_values; j++) {
+      ValueType value;
+      VT::DecodeValue(fmt.type, p, j, &value);
+      AddCompactValue(value, field);
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+template <>
+tensorflow::Status DecodeCompactFormatValues<string>(
+    const bcf_fmt_t& fmt, const bcf1_t* v, const string& tag,
+    nucleus::genomics::v1::CompactFormatField* field) {
+  if (fmt.type != BCF_BT_CHAR) {
+    return tensorflow::errors::DataLoss(
+        "Unexpected encoding for FORMAT field ", tag);
+  }
+  field->set_key(tag);
+  for (int i = 0; i < v->n_sample; i++) {
+    const char* s = reinterpret_cast<const char*>(fmt.p + i * fmt.size);
+    field->add_value_counts(1);
+    field->add_string_values(s, strnlen(s, fmt.size));
   }
+  return tensorflow::Status::OK();
+}
 
-  int n_dst = 0;
-  char** dst = nullptr;
-  std::vector<std::vector<string>> values(v->n_sample);
-  if (bcf_get_format_string(h, const_cast<bcf1_t*>(v), tag, &dst, &n_dst) > 0) {
-    for (int i = 0; i < bcf_hdr_nsamples(h); i++) {
-      values[i] = {dst[i]};
+// Splits the values of field into one vector per call, as taken by
+// EncodeFormatValues.
+template <class ValueType>
+tensorflow::Status CompactFormatValues(
+    const nucleus::genomics::v1::CompactFormatField& field, int n_calls,
+    std::vector<std::vector<ValueType>>* values) {
+  if (field.value_counts_size() != n_calls) {
+    return tensorflow::errors::FailedPrecondition(
+        "Compact FORMAT field ", field.key(), " has ",
+        field.value_counts_size(), " value counts for ", n_calls, " calls");
+  }
+  const int n_values = CompactValuesSize<ValueType>(field);
+  values->assign(n_calls, std::vector<ValueType>());
+  int offset = 0;
+  for (int i = 0; i < n_calls; i++) {
+    const int count = field.value_counts(i);
+    if (count < 0 || offset + count > n_values) {
+      return tensorflow::errors::FailedPrecondition(
+          "Compact FORMAT field ", field.key(), " has too few values");
     }
-    // As noted in bcf_get_format_string declaration in vcf.h, the format
-    // function we are using here allocates two arrays and both must be cleaned
-    // by the user.
-    free(dst[0]);
-    free(dst);
+    for (int j = 0; j < count; j++) {
+      (*values)[i].push_back(CompactValue<ValueType>(field, offset++));
+    }
+  }
+  if (offset != n_values) {
+    return tensorflow::errors::FailedPrecondition(
+        "Compact FORMAT field ", field.key(), " has too many values");
   }
-  return values;
+  return tensorflow::Status::OK();
 }
 
 // Sentinel value used to set variant.quality if one was not specified.
@@ -126,7 +282,7 @@ int32 vcfEncodeAllele(int pbAllele, bool isPhased) {
 //     an empty vector, it means the values are MISSING for this sample.
 //   - the subvectors of vv should all be the same length, except for potential
 //     empty subvectors
-// (This the inverse of ReadFormatValues)
+// (This the inverse of DecodeFormatValues)
 template <class ValueType>
 tensorflow::Status EncodeFormatValues(
     const std::vector<std::vector<ValueType>>& values, const char* tag,
@@ -220,63 +376,63 @@ tensorflow::Status EncodeFormatValues(
 // "Raw" low-level interface to encoding/decoding to INFO fields. These
 // functions parallel the "FORMAT" functions above.
 
+// Returns the INFO field with header ID id of the unpacked record v, or nullptr
+// if it is not present in v.
+const bcf_info_t* FindInfo(const bcf1_t* v, int id) {
+  if (id < 0) return nullptr;
+  for (int i = 0; i < v->n_info; i++) {
+    if (v->d.info[i].key == id) return &v->d.info[i];
+  }
+  return nullptr;
+}
+
+// Decodes the INFO field info (which may be nullptr if the record doesn't have
+// it) into list_value, writing the values directly into the ListValue.
 template <class ValueType>
-std::vector<ValueType> ReadInfoValue(const bcf_hdr_t* h,
-                                     const bcf1_t* v,
-                                     const char* tag) {
+tensorflow::Status DecodeInfoValues(
+    const bcf_info_t* info, const string& tag,
+    nucleus::genomics::v1::ListValue* list_value) {
   using VT = VcfType<ValueType>;
 
-  if (bcf_get_info(h, const_cast<bcf1_t*>(v), tag) == nullptr) {
-    return {};
+  // A null vptr marks a field that has been removed from the record.
+  if (info == nullptr || info->vptr == nullptr) {
+    return tensorflow::Status::OK();
   }
-
-  int n_values, n_dst = 0;
-  ValueType* dst = nullptr;
-  n_values = VT::GetInfoValues(h, v, tag, &dst, &n_dst);
-  // TODO(b/69332066): cleanup error handling.
-  CHECK_GE(n_values, 0);
-  CHECK(dst != nullptr);
-
-  std::vector<ValueType> value(dst, dst + n_values);
-
-  free(dst);
-  return value;
+  for (int j = 0; j < info->len; j++) {
+    ValueType value;
+    if (!VT::DecodeValue(info->type, info->vptr, j, &value)) {
+      return tensorflow::errors::DataLoss(
+          "Unexpected encoding for INFO field ", tag);
+    }
+    if (VT::IsVectorEnd(value)) break;
+    SetValuesValue<ValueType>(value, list_value->add_values());
+  }
+  return tensorflow::Status::OK();
 }
 
 template <>
-std::vector<string> ReadInfoValue(const bcf_hdr_t* h,
-                                  const bcf1_t* v,
-                                  const char* tag) {
-  if (bcf_get_info(h, const_cast<bcf1_t*>(v), tag) == nullptr) {
-    return {};
+tensorflow::Status DecodeInfoValues<string>(
+    const bcf_info_t* info, const string& tag,
+    nucleus::genomics::v1::ListValue* list_value) {
+  if (info == nullptr || info->vptr == nullptr) {
+    return tensorflow::Status::OK();
   }
-
-  int n_dst = 0;
-  char* dst = nullptr;
-  if (bcf_get_info_string(h, const_cast<bcf1_t*>(v), tag, &dst, &n_dst) < 0) {
-    // TODO(b/69332066): cleanup error handling.
-    LOG(FATAL) << "Failure to get INFO string";
+  if (info->type != BCF_BT_CHAR) {
+    return tensorflow::errors::DataLoss(
+        "Unexpected encoding for INFO field ", tag);
   }
-  std::string string_value(dst);
-  free(dst);
-  return std::vector<string> { string_value };
+  const char* s = reinterpret_cast<const char*>(info->vptr);
+  list_value->add_values()->set_string_value(s, strnlen(s, info->len));
+  return tensorflow::Status::OK();
 }
 
+// Flags are always decoded, as true if present in the record and false if not.
 template <>
-std::vector<bool> ReadInfoValue(const bcf_hdr_t* h,
-                                const bcf1_t* v,
-                                const char* tag) {
-  void* dst;
-  int n_dst = 0;
-  int rc = bcf_get_info_flag(h, const_cast<bcf1_t*>(v), tag, &dst, &n_dst);
-  if (rc == 1) {
-    return {true};
-  } else if (rc == 0) {
-    return {false};
-  } else {
-    // TODO(b/69332066): cleanup error handling.
-    LOG(FATAL) << "Failure to get INFO flag.";
-  }
+tensorflow::Status DecodeInfoValues<bool>(
+    const bcf_info_t* info, const string& tag,
+    nucleus::genomics::v1::ListValue* list_value) {
+  list_value->add_values()->set_bool_value(info != nullptr);
+  return tensorflow::Status::OK();
 }
 
 template <class ValueType>
@@ -332,14 +488,309 @@ tensorflow::Status EncodeInfoValue(const std::vector<bool>& value,
   return tensorflow::Status::OK();
 }
 
+
+// Returns the Phred-scaled genotype likelihoods of each call of variant, as
+// written to PL, or nothing if no call has genotype likelihoods.
+std::vector<std::vector<int>> PhredGenotypeLikelihoods(
+    const nucleus::genomics::v1::Variant& variant) {
+  bool has_ll = false;
+  for (const nucleus::genomics::v1::VariantCall& vc : variant.calls()) {
+    if (vc.genotype_likelihood_size() > 0) {
+      has_ll = true;
+    }
+  }
+
+  std::vector<std::vector<int>> ll_values_phred;
+  if (!has_ll) return ll_values_phred;
+  for (const nucleus::genomics::v1::VariantCall& vc : variant.calls()) {
+    if (vc.genotype_likelihood_size() > 0) {
+      std::vector<double> lls_this_call;
+      for (double ll_val : vc.genotype_likelihood()) {
+        lls_this_call.push_back(ll_val);
+      }
+      // "Normalize" likelihoods...
+      std::vector<double> lls_this_call_normalized =
+          ZeroShiftLikelihoods(lls_this_call);
+
+      // Phred-transform them...
+      std::vector<int> phreds_this_call(lls_this_call.size());
+      std::transform(lls_this_call_normalized.cbegin(),
+                     lls_this_call_normalized.cend(),
+                     phreds_this_call.begin(), Log10PErrorToPhred);
+      ll_values_phred.push_back(phreds_this_call);
+    } else {
+      ll_values_phred.push_back({});
+    }
+  }
+  return ll_values_phred;
+}
+
+// -----------------------------------------------------------------------------
+// Direct formatting of VCF text.  These functions format values the way
+// htslib's vcf_format formats the records built by the encoding functions
+// above, so that AppendVcfLine writes what ConvertFromPb and bcf_write would.
+
+// Returns true if h defines the field with header ID id (which is -1 if h
+// doesn't define it at all) in its header lines of type hl_type, BCF_HL_INFO
+// or BCF_HL_FMT, as htslib requires to add the field to a record.
+bool HeaderDefines(const bcf_hdr_t* h, int hl_type, int id) {
+  return bcf_hdr_idinfo_exists(h, hl_type, id);
+}
+
+// Appends s up to its first NUL, as htslib copies it as a C string.
+void AppendCString(absl::string_view s, string* out) {
+  out->append(s.data(), std::min(s.find('\0'), s.size()));
+}
+
+// Appends the string value s as htslib formats character arrays, with
+// bcf_str_missing shown as '.'.
+void AppendStringValue(absl::string_view s, string* out) {
+  for (char c : s.substr(0, s.find('\0'))) {
+    out->push_back(c == bcf_str_missing ? '.' : c);
+  }
+}
+
+void AppendNumber(int value, string* out) { absl::StrAppend(out, value); }
+
+// Floats are formatted with printf's %g, except for small integers, by far
+// the most common values, whose %g form is just their digits.
+void AppendNumber(float value, string* out) {
+  if (std::fabs(value) < 1e6 && static_cast<int>(value) == value &&
+      !(value == 0 && std::signbit(value))) {
+    absl::StrAppend(out, static_cast<int>(value));
+    return;
+  }
+  char buffer[32];
+  const int length = snprintf(buffer, sizeof(buffer), "%g", value);
+  out->append(buffer, length);
+}
+
+// Appends the n values as htslib formats numeric arrays: separated by commas,
+// with missing values shown as '.' and stopping at a vector end sentinel.
+template <class ValueType>
+void AppendNumbers(const ValueType* values, int n, string* out) {
+  using VT = VcfType<ValueType>;
+  for (int i = 0; i < n && !VT::IsVectorEnd(values[i]); i++) {
+    if (i > 0) out->push_back(',');
+    if (VT::IsMissing(values[i])) {
+      out->push_back('.');
+    } else {
+      AppendNumber(values[i], out);
+    }
+  }
+}
+
+// htslib formats an INFO field with a single value without checking for the
+// vector end sentinel, which it narrows to int8 if it is an integer.
+int SingleVectorEnd(int) { return bcf_int8_vector_end; }
+float SingleVectorEnd(float value) { return value; }
+
+// Appends the n values of a numeric INFO field.
+template <class ValueType>
+void AppendInfoNumbers(const ValueType* values, int n, string* out) {
+  using VT = VcfType<ValueType>;
+  if (n == 1 && VT::IsVectorEnd(values[0])) {
+    AppendNumber(SingleVectorEnd(values[0]), out);
+  } else {
+    AppendNumbers(values, n, out);
+  }
+}
+
+// Appends the separator before the entry for tag to the INFO column info,
+// and tag.
+void StartInfoEntry(const char* tag, string* info) {
+  if (!info->empty()) info->push_back(';');
+  info->append(tag);
+}
+
+// Appends the GT of call as htslib formats genotypes: the alleles separated
+// by '|' if the call is phased and by '/' otherwise, with '.' for missing
+// alleles, and '.' for a call without any.
+void AppendGenotype(const nucleus::genomics::v1::VariantCall& call,
+                    string* out) {
+  if (call.genotype_size() == 0) {
+    out->push_back('.');
+    return;
+  }
+  for (int i = 0; i < call.genotype_size(); i++) {
+    const int allele = call.genotype(i);
+    CHECK_GE(allele, -1);
+    if (i > 0) out->push_back(call.is_phased() ? '|' : '/');
+    if (allele < 0) {
+      out->push_back('.');
+    } else {
+      absl::StrAppend(out, allele);
+    }
+  }
+}
+
+// Formats the values of FORMAT field tag, which has header ID header_id,
+// into column, as they would be formatted after EncodeFormatValues.
+template <class ValueType>
+tensorflow::Status FormatFormatValues(
+    const std::vector<std::vector<ValueType>>& values, const char* tag,
+    int header_id, const bcf_hdr_t* h, VcfFormatColumn* column) {
+  if (values.empty()) {
+    return tensorflow::Status::OK();
+  }
+
+  if (values.size() != bcf_hdr_nsamples(h))
+    return tensorflow::errors::FailedPrecondition("Values.size() != nsamples");
+
+  size_t values_per_sample = 0;
+  for (const std::vector<ValueType>& sample_values : values) {
+    values_per_sample = std::max(values_per_sample, sample_values.size());
+  }
+  for (const std::vector<ValueType>& sample_values : values) {
+    if (!sample_values.empty() && sample_values.size() != values_per_sample)
+      return tensorflow::errors::FailedPrecondition(
+          "values[s].size() != values_per_sample");
+  }
+  // htslib doesn't add a field without values to the record.
+  if (values_per_sample == 0) {
+    return tensorflow::Status::OK();
+  }
+  if (!HeaderDefines(h, BCF_HL_FMT, header_id)) {
+    return tensorflow::errors::Internal("Failure to write VCF FORMAT field ",
+                                        tag);
+  }
+
+  column->key = tag;
+  column->sample_ends.reserve(values.size());
+  for (const std::vector<ValueType>& sample_values : values) {
+    if (sample_values.empty()) {
+      column->values.push_back('.');
+    } else {
+      AppendNumbers(sample_values.data(), sample_values.size(),
+                    &column->values);
+    }
+    column->sample_ends.push_back(column->values.size());
+  }
+  return tensorflow::Status::OK();
+}
+
+// Specialized instantiation for string.
+template <>
+tensorflow::Status FormatFormatValues(
+    const std::vector<std::vector<string>>& values, const char* tag,
+    int header_id, const bcf_hdr_t* h, VcfFormatColumn* column) {
+  if (values.empty()) {
+    return tensorflow::Status::OK();
+  }
+
+  if (values.size() != bcf_hdr_nsamples(h))
+    return tensorflow::errors::FailedPrecondition("Values.size() != nsamples");
+
+  size_t values_per_sample = 0;
+  for (const std::vector<string>& sample_values : values) {
+    values_per_sample = std::max(values_per_sample, sample_values.size());
+  }
+  if (values_per_sample > 1) {
+    return tensorflow::errors::FailedPrecondition(
+        "Can't currently handle > 1 string format entry per sample.");
+  }
+  // htslib stores the strings padded to the longest one, and doesn't add the
+  // field to the record if that is empty.  Missing values are ".".
+  bool any_characters = false;
+  for (const std::vector<string>& sample_values : values) {
+    if (sample_values.empty() || !sample_values[0].empty()) {
+      any_characters = true;
+    }
+  }
+  if (values_per_sample == 0 || !any_characters) {
+    return tensorflow::Status::OK();
+  }
+  if (!HeaderDefines(h, BCF_HL_FMT, header_id)) {
+    return tensorflow::errors::Internal("Failure to write VCF FORMAT field");
+  }
+
+  column->key = tag;
+  column->sample_ends.reserve(values.size());
+  for (const std::vector<string>& sample_values : values) {
+    if (sample_values.empty()) {
+      column->values.push_back('.');
+    } else {
+      AppendStringValue(sample_values[0], &column->values);
+    }
+    column->sample_ends.push_back(column->values.size());
+  }
+  return tensorflow::Status::OK();
+}
+
+// Appends the entry of INFO field tag, which has header ID header_id, to the
+// INFO column info, as it would be formatted after EncodeInfoValue.
+template <class ValueType>
+tensorflow::Status FormatInfoValue(const std::vector<ValueType>& value,
+                                   const char* tag, int header_id,
+                                   const bcf_hdr_t* h, string* info) {
+  if (value.empty()) {
+    return tensorflow::Status::OK();
+  }
+  if (!HeaderDefines(h, BCF_HL_INFO, header_id)) {
+    return tensorflow::errors::Internal("Failure to write VCF INFO field ",
+                                        tag);
+  }
+  StartInfoEntry(tag, info);
+  info->push_back('=');
+  AppendInfoNumbers(value.data(), value.size(), info);
+  return tensorflow::Status::OK();
+}
+
+template <>
+tensorflow::Status FormatInfoValue(const std::vector<string>& value,
+                                   const char* tag, int header_id,
+                                   const bcf_hdr_t* h, string* info) {
+  if (value.empty()) {
+    return tensorflow::Status::OK();
+  }
+  if (value.size() != 1) {
+    return tensorflow::errors::FailedPrecondition(
+        "VCF string INFO fields can only contain a single string.");
+  }
+  if (!HeaderDefines(h, BCF_HL_INFO, header_id)) {
+    return tensorflow::errors::Internal(
+        "Failure to write VCF INFO field");
+  }
+  StartInfoEntry(tag, info);
+  const absl::string_view s =
+      absl::string_view(value[0]).substr(0, value[0].find('\0'));
+  // An empty string is written like a flag, and a single character as is.
+  if (s.size() == 1) {
+    info->push_back('=');
+    info->push_back(s[0]);
+  } else if (!s.empty()) {
+    info->push_back('=');
+    AppendStringValue(s, info);
+  }
+  return tensorflow::Status::OK();
+}
+
+template <>
+tensorflow::Status FormatInfoValue(const std::vector<bool>& value,
+                                   const char* tag, int header_id,
+                                   const bcf_hdr_t* h, string* info) {
+  if (value.size() != 1) {
+    return tensorflow::errors::FailedPrecondition(
+        "Illegal setting of INFO FLAG value in Variant message.");
+  }
+  if (!HeaderDefines(h, BCF_HL_INFO, header_id)) {
+    return tensorflow::errors::Internal(
+        "Failure to write VCF INFO field");
+  }
+  if (value[0]) {
+    StartInfoEntry(tag, info);
+  }
+  return tensorflow::Status::OK();
+}
+
 }  // namespace
 
 // -----------------------------------------------------------------------------
 // VcfFormatFieldAdapter implemenation.
 
 VcfFormatFieldAdapter::VcfFormatFieldAdapter(const string& field_name,
-                                             int vcf_type)
-    : field_name_(field_name), vcf_type_(vcf_type) {}
+                                             int vcf_type, int header_id)
+    : field_name_(field_name), vcf_type_(vcf_type), header_id_(header_id) {}
 
 
 tensorflow::Status VcfFormatFieldAdapter::EncodeValues(
@@ -362,27 +813,71 @@ tensorflow::Status VcfFormatFieldAdapter::EncodeValues(
 
 // TODO(dhalexander): consider eliminating this templated function by making
 // the intermediate vectors contain variant objects (Value).
-template <class T> tensorflow::Status VcfFormatFieldAdapter::EncodeValues(
+template <class T> tensorflow::Status VcfFormatFieldAdapter::CallValues(
     const nucleus::genomics::v1::Variant& variant,
-    const bcf_hdr_t* header,
-    bcf1_t* bcf_record) const {
+    std::vector<std::vector<T>>* values) const {
 
   const int n_calls = variant.calls().size();
-  std::vector<std::vector<T>> values(n_calls, std::vector<T>{});
+  for (const auto& field : variant.compact_format_fields()) {
+    if (field.key() == field_name_) {
+      return CompactFormatValues(field, n_calls, values);
+    }
+  }
+
+  values->assign(n_calls, std::vector<T>{});
   for (int i = 0; i < n_calls; ++i) {
     const nucleus::genomics::v1::VariantCall& vc = variant.calls(i);
     auto found = vc.info().find(field_name_);
     if (found != vc.info().end()) {
-      values[i] = ListValues<T>((*found).second);
+      (*values)[i] = ListValues<T>((*found).second);
     }
     // Since we don't have a field_name_ key/value pair in this sample, we
     // just leave the values[i] empty.
   }
+  return tensorflow::Status::OK();
+}
+
+template <class T> tensorflow::Status VcfFormatFieldAdapter::EncodeValues(
+    const nucleus::genomics::v1::Variant& variant,
+    const bcf_hdr_t* header,
+    bcf1_t* bcf_record) const {
+
+  std::vector<std::vector<T>> values;
+  TF_RETURN_IF_ERROR(CallValues(variant, &values));
 
   // Encode the values from our vector into the htslib bcf_t record.
   return EncodeFormatValues(values, field_name_.c_str(), header, bcf_record);
 }
 
+tensorflow::Status VcfFormatFieldAdapter::FormatValues(
+    const nucleus::genomics::v1::Variant& variant,
+    const bcf_hdr_t* header,
+    VcfFormatColumn* column) const {
+
+  if (vcf_type_ == BCF_HT_REAL) {
+    return FormatValues<float>(variant, header, column);
+  } else if (vcf_type_ == BCF_HT_INT) {
+    return FormatValues<int>(variant, header, column);
+  } else if (vcf_type_ == BCF_HT_STR) {
+    return FormatValues<string>(variant, header, column);
+  } else {
+    return tensorflow::errors::FailedPrecondition(
+        "Unrecognized type for field ", field_name_);
+  }
+}
+
+template <class T> tensorflow::Status VcfFormatFieldAdapter::FormatValues(
+    const nucleus::genomics::v1::Variant& variant,
+    const bcf_hdr_t* header,
+    VcfFormatColumn* column) const {
+
+  std::vector<std::vector<T>> values;
+  TF_RETURN_IF_ERROR(CallValues(variant, &values));
+  return FormatFormatValues(values, field_name_.c_str(),
+                            HeaderId(header_id_, header, field_name_), header,
+                            column);
+}
+
 
 tensorflow::Status VcfFormatFieldAdapter::DecodeValues(
     const bcf_hdr_t* header, const bcf1_t* bcf_record,
@@ -406,16 +901,42 @@ template <class T> tensorflow::Status VcfFormatFieldAdapter::DecodeValues(
     nucleus::genomics::v1::Variant *variant) const {
 
   if (bcf_record->n_sample > 0) {
-    std::vector<std::vector<T>> values =
-        ReadFormatValues<T>(header, bcf_record, field_name_.c_str());
-    for (int i = 0; i < bcf_record->n_sample; i++) {
-      // Is the format field present for this variant, *and* non-missing for
-      // this sample?
-      bool have_field = !values.empty() && !values[i].empty();
-      if (have_field) {
-        nucleus::genomics::v1::VariantCall* call = variant->mutable_calls(i);
-        SetInfoField(field_name_, values[i], call);
-      }
+    const bcf_fmt_t* fmt = FindFormat(
+        bcf_record, HeaderId(header_id_, header, field_name_));
+    if (fmt != nullptr) {
+      return DecodeFormatValues<T>(*fmt, bcf_record, field_name_, variant);
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VcfFormatFieldAdapter::DecodeCompactValues(
+    const bcf_hdr_t* header, const bcf1_t* bcf_record,
+    nucleus::genomics::v1::Variant* variant) const {
+
+  if (vcf_type_ == BCF_HT_REAL) {
+    return DecodeCompactValues<float>(header, bcf_record, variant);
+  } else if (vcf_type_ == BCF_HT_INT) {
+    return DecodeCompactValues<int>(header, bcf_record, variant);
+  } else if (vcf_type_ == BCF_HT_STR) {
+    return DecodeCompactValues<string>(header, bcf_record, variant);
+  } else {
+    return tensorflow::errors::FailedPrecondition(
+        "Unrecognized type for field ", field_name_);
+  }
+}
+
+template <class T>
+tensorflow::Status VcfFormatFieldAdapter::DecodeCompactValues(
+    const bcf_hdr_t *header, const bcf1_t *bcf_record,
+    nucleus::genomics::v1::Variant *variant) const {
+
+  if (bcf_record->n_sample > 0) {
+    const bcf_fmt_t* fmt = FindFormat(
+        bcf_record, HeaderId(header_id_, header, field_name_));
+    if (fmt != nullptr) {
+      return DecodeCompactFormatValues<T>(*fmt, bcf_record, field_name_,
+                                          variant->add_compact_format_fields());
     }
   }
   return tensorflow::Status::OK();
@@ -425,8 +946,8 @@ template <class T> tensorflow::Status VcfFormatFieldAdapter::DecodeValues(
 // VcfInfoFieldAdapter implementation.
 
 VcfInfoFieldAdapter::VcfInfoFieldAdapter(const string& field_name,
-                                         int vcf_type)
-    : field_name_(field_name), vcf_type_(vcf_type) {}
+                                         int vcf_type, int header_id)
+    : field_name_(field_name), vcf_type_(vcf_type), header_id_(header_id) {}
 
 
 tensorflow::Status VcfInfoFieldAdapter::EncodeValues(
@@ -461,6 +982,35 @@ template <class T> tensorflow::Status VcfInfoFieldAdapter::EncodeValues(
   }
 }
 
+tensorflow::Status VcfInfoFieldAdapter::FormatValues(
+    const nucleus::genomics::v1::Variant& variant, const bcf_hdr_t* header,
+    string* info) const {
+  if (vcf_type_ == BCF_HT_REAL) {
+    return FormatValues<float>(variant, header, info);
+  } else if (vcf_type_ == BCF_HT_INT) {
+    return FormatValues<int>(variant, header, info);
+  } else if (vcf_type_ == BCF_HT_STR) {
+    return FormatValues<string>(variant, header, info);
+  } else if (vcf_type_ == BCF_HT_FLAG) {
+    return FormatValues<bool>(variant, header, info);
+  } else {
+    return tensorflow::errors::FailedPrecondition(
+        "Unrecognized type for field ", field_name_);
+  }
+}
+
+template <class T> tensorflow::Status VcfInfoFieldAdapter::FormatValues(
+    const nucleus::genomics::v1::Variant& variant, const bcf_hdr_t* header,
+    string* info) const {
+  auto found = variant.info().find(field_name_);
+  if (found == variant.info().end()) {
+    return tensorflow::Status::OK();
+  }
+  return FormatInfoValue(ListValues<T>((*found).second), field_name_.c_str(),
+                         HeaderId(header_id_, header, field_name_), header,
+                         info);
+}
+
 
 tensorflow::Status VcfInfoFieldAdapter::DecodeValues(
     const bcf_hdr_t* header, const bcf1_t* bcf_record,
@@ -483,10 +1033,12 @@ tensorflow::Status VcfInfoFieldAdapter::DecodeValues(
 template <class T> tensorflow::Status VcfInfoFieldAdapter::DecodeValues(
     const bcf_hdr_t *header, const bcf1_t *bcf_record,
     nucleus::genomics::v1::Variant *variant) const {
-  std::vector<T> value =
-      ReadInfoValue<T>(header, bcf_record, field_name_.c_str());
-  SetInfoField(field_name_, value, variant);
-  return tensorflow::Status::OK();
+  const bcf_info_t* info =
+      FindInfo(bcf_record, HeaderId(header_id_, header, field_name_));
+  nucleus::genomics::v1::ListValue& list_value =
+      (*variant->mutable_info())[field_name_];
+  list_value.clear_values();
+  return DecodeInfoValues<T>(info, field_name_, &list_value);
 }
 
 
@@ -497,7 +1049,16 @@ template <class T> tensorflow::Status VcfInfoFieldAdapter::DecodeValues(
 VcfRecordConverter::VcfRecordConverter(
     const nucleus::genomics::v1::VcfHeader& vcf_header,
     const std::vector<string>& infos_to_exclude,
-    const std::vector<string>& formats_to_exclude) {
+    const std::vector<string>& formats_to_exclude)
+    : VcfRecordConverter(vcf_header, infos_to_exclude, formats_to_exclude,
+                         nullptr) {}
+
+VcfRecordConverter::VcfRecordConverter(
+    const nucleus::genomics::v1::VcfHeader& vcf_header,
+    const std::vector<string>& infos_to_exclude,
+    const std::vector<string>& formats_to_exclude, const bcf_hdr_t* h,
+    bool compact_format_fields)
+    : compact_format_fields_(compact_format_fields) {
   // Install adapters for INFO fields.
   for (const auto& format_spec : vcf_header.infos()) {
     string tag = format_spec.id();
@@ -525,7 +1086,7 @@ VcfRecordConverter::VcfRecordConverter(
                    << " of type " << type;
       continue;
     }
-    info_adapters_.emplace_back(tag, vcf_type);
+    info_adapters_.emplace_back(tag, vcf_type, ResolveHeaderId(h, tag));
   }
 
   // Install adapters for FORMAT fields.
@@ -554,7 +1115,7 @@ VcfRecordConverter::VcfRecordConverter(
                    << " of type " << type;
       continue;
     }
-    format_adapters_.emplace_back(tag, vcf_type);
+    format_adapters_.emplace_back(tag, vcf_type, ResolveHeaderId(h, tag));
   }
 
   // Update special-cased variant fields.
@@ -569,6 +1130,9 @@ VcfRecordConverter::VcfRecordConverter(
        formats_to_exclude.end()) ||
       (std::find(formats_to_exclude.begin(), formats_to_exclude.end(), "PL") ==
        formats_to_exclude.end());
+  gt_id_ = ResolveHeaderId(h, "GT");
+  gl_id_ = ResolveHeaderId(h, "GL");
+  pl_id_ = ResolveHeaderId(h, "PL");
 }
 
 
@@ -624,22 +1188,24 @@ tensorflow::Status VcfRecordConverter::ConvertToPb(
 
   // Parse the calls of the variant.
   if (v->n_sample > 0) {
-    int* gt_arr = nullptr;
-    int ploidy, n_gts = 0;
-    if (bcf_get_genotypes(h, v, &gt_arr, &n_gts) < 0) {
-      free(gt_arr);
+    const bcf_fmt_t* gt_fmt = FindFormat(v, HeaderId(gt_id_, h, "GT"));
+    if (gt_fmt == nullptr) {
       return tensorflow::errors::DataLoss("Couldn't parse genotypes");
     }
-    ploidy = n_gts / v->n_sample;
+    const int ploidy = gt_fmt->n;
 
     for (int i = 0; i < v->n_sample; i++) {
       nucleus::genomics::v1::VariantCall* call = variant_message->add_calls();
       call->set_call_set_name(h->samples[i]);
       // Get the GT calls, if requested and available.
       if (want_genotypes_) {
+        const uint8_t* p = gt_fmt->p + i * gt_fmt->size;
         bool gt_is_phased = false;
         for (int j = 0; j < ploidy; j++) {
-          int gt_idx = gt_arr[i * ploidy + j];
+          int gt_idx;
+          if (!VcfType<int>::DecodeValue(gt_fmt->type, p, j, &gt_idx)) {
+            return tensorflow::errors::DataLoss("Couldn't parse genotypes");
+          }
           int gt = bcf_gt_allele(gt_idx);
           gt_is_phased = gt_is_phased || bcf_gt_is_phased(gt_idx);
           call->add_genotype(gt);
@@ -647,37 +1213,48 @@ tensorflow::Status VcfRecordConverter::ConvertToPb(
         call->set_is_phased(gt_is_phased);
       }
     }
-    free(gt_arr);
 
     // Parse "generic" FORMAT fields.
     for (const auto& adapter : format_adapters_) {
-      TF_RETURN_IF_ERROR(adapter.DecodeValues(h, v, variant_message));
+      TF_RETURN_IF_ERROR(
+          compact_format_fields_
+              ? adapter.DecodeCompactValues(h, v, variant_message)
+              : adapter.DecodeValues(h, v, variant_message));
     }
 
     // Handle FORMAT fields requiring special logic.
-    std::vector<std::vector<int>> pl_values = ReadFormatValues<int>(h, v, "PL");
-    std::vector<std::vector<float>> gl_values =
-        ReadFormatValues<float>(h, v, "GL");
-
-    for (int i = 0; i < v->n_sample; i++) {
-      // Each indicator here is true iff the format field is present for this
-      // variant, *and* is non-missing for this sample.
-      bool have_gl = !gl_values.empty() && !gl_values[i].empty();
-      bool have_pl = !pl_values.empty() && !pl_values[i].empty();
+    if (want_genotype_likelihoods_) {
+      const bcf_fmt_t* gl_fmt = FindFormat(v, HeaderId(gl_id_, h, "GL"));
+      const bcf_fmt_t* pl_fmt = FindFormat(v, HeaderId(pl_id_, h, "PL"));
+
+      for (int i = 0; i < v->n_sample; i++) {
+        // Each count here is non-zero iff the format field is present for this
+        // variant, *and* is non-missing for this sample.
+        const int n_gl = gl_fmt ? CountFormatValues<float>(*gl_fmt, i) : 0;
+        const int n_pl = pl_fmt ? CountFormatValues<int>(*pl_fmt, i) : 0;
+        if (n_gl < 0 || n_pl < 0) {
+          return tensorflow::errors::DataLoss(
+              "Couldn't parse genotype likelihoods");
+        }
 
-      nucleus::genomics::v1::VariantCall* call =
-          variant_message->mutable_calls(i);
+        nucleus::genomics::v1::VariantCall* call =
+            variant_message->mutable_calls(i);
 
-      if (want_genotype_likelihoods_) {
         // If GL and PL are *both* present, we populate the genotype_likelihood
         // fields with the GL values per the variants.proto spec, since PLs are
         // a lower resolution version of the same information.
-        if (have_gl) {
-          for (int gl : gl_values[i]) {
+        if (n_gl > 0) {
+          const uint8_t* p = gl_fmt->p + i * gl_fmt->size;
+          for (int j = 0; j < n_gl; j++) {
+            float gl;
+            VcfType<float>::DecodeValue(gl_fmt->type, p, j, &gl);
             call->add_genotype_likelihood(gl);
           }
-        } else if (have_pl) {
-          for (int pl : pl_values[i]) {
+        } else if (n_pl > 0) {
+          const uint8_t* p = pl_fmt->p + i * pl_fmt->size;
+          for (int j = 0; j < n_pl; j++) {
+            int pl;
+            VcfType<int>::DecodeValue(pl_fmt->type, p, j, &pl);
             call->add_genotype_likelihood(PhredToLog10PError(pl));
           }
         }
@@ -805,47 +1382,185 @@ tensorflow::Status VcfRecordConverter::ConvertFromPb(
     }
 
     // Write remaining FORMAT fields
-    bool has_ll = false;
+    for (const VcfFormatFieldAdapter& field : format_adapters_) {
+      TF_RETURN_IF_ERROR(field.EncodeValues(variant_message, &h, v));
+    }
+
+    TF_RETURN_IF_ERROR(EncodeFormatValues(
+        PhredGenotypeLikelihoods(variant_message), "PL", &h, v));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VcfRecordConverter::AppendVcfLine(
+    const nucleus::genomics::v1::Variant& variant_message, const bcf_hdr_t& h,
+    bool round_quality, string* line) const {
+  // This follows ConvertFromPb, checking for the same errors in the same
+  // order, and formats each column as vcf_format does.
+  if (bcf_hdr_name2id(&h, variant_message.reference_name().c_str()) < 0)
+    return tensorflow::errors::NotFound(
+        "Record's reference name is not available in VCF header.");
+
+  // Positions are int32 in htslib records.
+  const int32 pos = variant_message.start();
+  const int32 rlen = variant_message.end() - variant_message.start();
+
+  // The INFO column, which starts with END for gVCF records; see
+  // ConvertFromPb.
+  string info;
+  if (want_variant_end_ && variant_message.alternate_bases_size() == 1 &&
+      !variant_message.alternate_bases()[0].empty() &&
+      variant_message.alternate_bases()[0][0] == '<') {
+    if (!HeaderDefines(&h, BCF_HL_INFO, ResolveHeaderId(&h, "END")))
+      return tensorflow::errors::Unknown("Failure to write END to vcf record");
+    const int end = pos + rlen;
+    info.append("END=");
+    AppendInfoNumbers(&end, 1, &info);
+  }
+
+  AppendCString(variant_message.reference_name(), line);
+  line->push_back('\t');
+  absl::StrAppend(line, pos + 1);
+
+  // ID. The names are joined and then copied as a C string.
+  line->push_back('\t');
+  if (variant_message.names_size() > 0) {
+    for (int i = 0; i < variant_message.names_size(); i++) {
+      const string& name = variant_message.names(i);
+      if (i > 0) line->push_back(';');
+      AppendCString(name, line);
+      if (name.find('\0') != string::npos) break;
+    }
+  } else {
+    line->push_back('.');
+  }
+
+  // REF and ALT.
+  line->push_back('\t');
+  AppendCString(variant_message.reference_bases(), line);
+  line->push_back('\t');
+  if (variant_message.alternate_bases_size() > 0) {
+    for (int i = 0; i < variant_message.alternate_bases_size(); i++) {
+      if (i > 0) line->push_back(',');
+      AppendCString(variant_message.alternate_bases(i), line);
+    }
+  } else {
+    line->push_back('.');
+  }
+
+  // QUAL, which htslib stores as a float.
+  line->push_back('\t');
+  if (variant_message.quality() == kQualUnset) {
+    line->push_back('.');
+  } else {
+    float quality = variant_message.quality();
+    if (round_quality) {
+      quality = floor(variant_message.quality() * 10 + 0.5) / 10;
+    }
+    AppendNumber(quality, line);
+  }
+
+  // FILTER
+  line->push_back('\t');
+  if (variant_message.filter_size() > 0) {
+    for (int i = 0; i < variant_message.filter_size(); i++) {
+      const string& filter = variant_message.filter(i);
+      if (bcf_hdr_id2int(&h, BCF_DT_ID, filter.c_str()) < 0) {
+        return tensorflow::errors::NotFound("Filter must be found in header.");
+      }
+      if (i > 0) line->push_back(';');
+      AppendCString(filter, line);
+    }
+  } else {
+    line->push_back('.');
+  }
+
+  // Generic INFO fields
+  for (const VcfInfoFieldAdapter& field : info_adapters_) {
+    TF_RETURN_IF_ERROR(field.FormatValues(variant_message, &h, &info));
+  }
+  line->push_back('\t');
+  if (info.empty()) {
+    line->push_back('.');
+  } else {
+    line->append(info);
+  }
+
+  // Variant calls
+  int nCalls = variant_message.calls().size();
+  if (nCalls != bcf_hdr_nsamples(&h))
+    return tensorflow::errors::FailedPrecondition(
+        "Variant call count must match number of samples.");
+
+  // The FORMAT fields added to the record, in order.
+  std::vector<VcfFormatColumn> columns;
+  if (nCalls > 0) {
+    int ploidy = 0;
     for (int c = 0; c < nCalls; c++) {
       const nucleus::genomics::v1::VariantCall& vc = variant_message.calls(c);
-      if (vc.genotype_likelihood_size() > 0) {
-        has_ll = true;
+      ploidy = std::max(ploidy, vc.genotype_size());
+      if (vc.call_set_name() != h.samples[c])
+        return tensorflow::errors::FailedPrecondition(
+          "Out-of-order call set names, or unrecognized call set name, "
+          "with respect to samples declared in VCF header. Variant has ",
+          vc.call_set_name(), " at position ", c,
+          " while the VCF header expected a sample named ",
+          h.samples[c], " at this position");
+    }
+
+    // Genotypes, if any call has them.
+    if (ploidy > 0) {
+      if (!HeaderDefines(&h, BCF_HL_FMT, HeaderId(gt_id_, &h, "GT"))) {
+        return tensorflow::errors::Unknown(
+            "Failure to write genotypes to VCF record");
+      }
+      columns.emplace_back();
+      VcfFormatColumn& column = columns.back();
+      column.key = "GT";
+      for (const nucleus::genomics::v1::VariantCall& vc :
+           variant_message.calls()) {
+        AppendGenotype(vc, &column.values);
+        column.sample_ends.push_back(column.values.size());
       }
     }
 
+    // Remaining FORMAT fields
     for (const VcfFormatFieldAdapter& field : format_adapters_) {
-      TF_RETURN_IF_ERROR(field.EncodeValues(variant_message, &h, v));
+      columns.emplace_back();
+      TF_RETURN_IF_ERROR(
+          field.FormatValues(variant_message, &h, &columns.back()));
+      if (columns.back().sample_ends.empty()) columns.pop_back();
     }
 
-    std::vector<std::vector<int>> ll_values_phred;
+    columns.emplace_back();
+    TF_RETURN_IF_ERROR(FormatFormatValues(
+        PhredGenotypeLikelihoods(variant_message), "PL",
+        HeaderId(pl_id_, &h, "PL"), &h, &columns.back()));
+    if (columns.back().sample_ends.empty()) columns.pop_back();
+  }
+
+  if (columns.empty()) {
+    // bcf_write refuses records without FORMAT fields if there are samples.
+    if (nCalls > 0) {
+      return tensorflow::errors::Unknown(
+          "Record has no FORMAT fields for the samples of the VCF header");
+    }
+  } else {
+    for (int i = 0; i < columns.size(); i++) {
+      line->push_back(i > 0 ? ':' : '\t');
+      line->append(columns[i].key);
+    }
     for (int c = 0; c < nCalls; c++) {
-      const nucleus::genomics::v1::VariantCall& vc = variant_message.calls(c);
-      // loglikelihood
-      if (has_ll) {
-        bool ll_not_missing = vc.genotype_likelihood_size() > 0;
-        if (ll_not_missing) {
-          std::vector<double> lls_this_call;
-          for (double ll_val : vc.genotype_likelihood()) {
-            lls_this_call.push_back(ll_val);
-          }
-          // "Normalize" likelihoods...
-          std::vector<double> lls_this_call_normalized =
-              ZeroShiftLikelihoods(lls_this_call);
-
-          // Phred-transform them...
-          std::vector<int> phreds_this_call(lls_this_call.size());
-          std::transform(lls_this_call_normalized.cbegin(),
-                         lls_this_call_normalized.cend(),
-                         phreds_this_call.begin(), Log10PErrorToPhred);
-          ll_values_phred.push_back(phreds_this_call);
-        } else {
-          ll_values_phred.push_back({});
-        }
+      line->push_back('\t');
+      for (int i = 0; i < columns.size(); i++) {
+        const VcfFormatColumn& column = columns[i];
+        const size_t start = c > 0 ? column.sample_ends[c - 1] : 0;
+        if (i > 0) line->push_back(':');
+        line->append(column.values, start, column.sample_ends[c] - start);
       }
     }
-
-    TF_RETURN_IF_ERROR(EncodeFormatValues(ll_values_phred, "PL", &h, v));
   }
+  line->push_back('\n');
   return tensorflow::Status::OK();
 }
 
@@ -42,6 +42,14 @@ struct VcfType {
   // Set argument to vector end sentinel
   static void SetVectorEnd(T* v);
 
+  // Raw decoding of unpacked records: reads element i of the BCF typed array
+  // p (e.g. bcf_fmt_t::p or bcf_info_t::vptr), stored with BCF_BT_* encoding
+  // bcf_type, into *v, normalizing the missing and vector end sentinels so
+  // that IsMissing and IsVectorEnd apply.  Returns false if bcf_type cannot be
+  // decoded as a T.  Unlike Get{Format,Info}Values this neither looks up the
+  // tag nor allocates.
+  static bool DecodeValue(int bcf_type, const uint8_t* p, int i, T* v);
+
   // FORMAT field extraction: wrapper for bcf_get_format_*()
   // Given a VCF record, this will grab FORMAT tag "tag" from the record, a
   // buffer *dst for the contents, and copy them there.  The return value will
@@ -81,6 +89,34 @@ struct VcfType<int> {
   static void SetMissing(int* v)     { *v = bcf_int32_missing;  }
   static void SetVectorEnd(int* v)   { *v = bcf_int32_vector_end; }
 
+  // Reads element i of the unpacked BCF array p, whose on-disk encoding is
+  // the BCF_BT_* type bcf_type, into *v.  Narrow integer encodings are widened
+  // with their missing and vector end sentinels mapped onto the int32 ones.
+  // Returns false if bcf_type is not an integer encoding.
+  static bool DecodeValue(int bcf_type, const uint8_t* p, int i, int* v) {
+    switch (bcf_type) {
+      case BCF_BT_INT8: {
+        const int8_t x = reinterpret_cast<const int8_t*>(p)[i];
+        *v = x == bcf_int8_missing      ? bcf_int32_missing
+             : x == bcf_int8_vector_end ? bcf_int32_vector_end
+                                        : x;
+        return true;
+      }
+      case BCF_BT_INT16: {
+        const int16_t x = reinterpret_cast<const int16_t*>(p)[i];
+        *v = x == bcf_int16_missing      ? bcf_int32_missing
+             : x == bcf_int16_vector_end ? bcf_int32_vector_end
+                                         : x;
+        return true;
+      }
+      case BCF_BT_INT32:
+        *v = reinterpret_cast<const int32_t*>(p)[i];
+        return true;
+      default:
+        return false;
+    }
+  }
+
   static int GetFormatValues(const bcf_hdr_t *hdr, const bcf1_t *line,
                              const char *tag, int **dst, int *ndst) {
     return bcf_get_format_int32(hdr, const_cast<bcf1_t *>(line),
@@ -119,6 +155,12 @@ struct VcfType<float> {
   static void SetMissing(float* v) { bcf_float_set(v, bcf_float_missing); }
   static void SetVectorEnd(float* v) { bcf_float_set(v, bcf_float_vector_end); }
 
+  static bool DecodeValue(int bcf_type, const uint8_t* p, int i, float* v) {
+    if (bcf_type != BCF_BT_FLOAT) return false;
+    *v = reinterpret_cast<const float*>(p)[i];
+    return true;
+  }
+
   static int GetFormatValues(const bcf_hdr_t *hdr, const bcf1_t *line,
                              const char *tag, float **dst, int *ndst) {
     return bcf_get_format_float(hdr, const_cast<bcf1_t *>(line),
@@ -150,12 +192,23 @@ struct VcfType<float> {
 };
 
 
+// -----------------------------------------------------------------------------
+// The text of one FORMAT field of a VCF line, as built for
+// VcfRecordConverter::AppendVcfLine: the text of the field for sample i is
+// values[sample_ends[i - 1], sample_ends[i]), or values[0, sample_ends[0]) for
+// the first.  A field that isn't written has no sample_ends.
+struct VcfFormatColumn {
+  string key;
+  string values;
+  std::vector<size_t> sample_ends;
+};
+
 // -----------------------------------------------------------------------------
 // Helper class for encoding VariantCall.info values in VCF FORMAT field values.
 // This class is only intended for use with FORMAT fields that can be directly
 // mapped between a VCF record and the FORMAT info dictionary, without special
 // logic.  Where special logic is needed (e.g. for GT, GL/PL, etc.), the lower
-// level functions `ReadFormatValues` and `EncodeFormatValues` are called
+// level functions `DecodeFormatValues` and `EncodeFormatValues` are called
 // directly.
 //
 // The standard way to interact with this class is as follows.
@@ -166,10 +219,19 @@ struct VcfType<float> {
 // For each variant, we encode this format field into the vcf record:
 //   adapter.EncodeValues(variant, header, bcf_record);
 //
+// If the adapter is given the htslib header ID of its field on construction,
+// DecodeValues reads the field straight out of the unpacked record instead of
+// looking it up by tag name for every record.
+//
+// EncodeValues takes the values from the variant's compact_format_fields
+// entry for the field if it has one, and from the calls' info maps otherwise.
 class VcfFormatFieldAdapter {
  public:
-  // Creates a new adapter for a field name field_name.
-  VcfFormatFieldAdapter(const string& field_name, int vcf_type);
+  // Creates a new adapter for a field name field_name.  header_id is the ID of
+  // field_name in the BCF_DT_ID dictionary of the header this adapter will
+  // decode records from, or -1 to resolve it from the header on every call.
+  VcfFormatFieldAdapter(const string& field_name, int vcf_type,
+                        int header_id = -1);
 
   // Adds the values for our field_name from variant's calls into our bcf1_t
   // record bcf_record.
@@ -177,29 +239,58 @@ class VcfFormatFieldAdapter {
                                   const bcf_hdr_t* header,
                                   bcf1_t* bcf_record) const;
 
+  // Formats the values for our field_name from variant's calls into column,
+  // as htslib would format them after EncodeValues.
+  tensorflow::Status FormatValues(const nucleus::genomics::v1::Variant& variant,
+                                  const bcf_hdr_t* header,
+                                  VcfFormatColumn* column) const;
+
   // Add the values for this genotype field in the bcf1_t `bcf_record` to the
   // VariantCall info maps within this Variant proto message `variant`.
   tensorflow::Status DecodeValues(
       const bcf_hdr_t *header, const bcf1_t *bcf_record,
       nucleus::genomics::v1::Variant *variant) const;
 
+  // Like DecodeValues, but adds the values of all calls to a new entry of
+  // variant's compact_format_fields instead, if bcf_record has this field.
+  tensorflow::Status DecodeCompactValues(
+      const bcf_hdr_t *header, const bcf1_t *bcf_record,
+      nucleus::genomics::v1::Variant *variant) const;
+
  private:  // Non-API methods
+  // Gets the values of our field_name for each of variant's calls.
+  template <class T>
+  tensorflow::Status CallValues(const nucleus::genomics::v1::Variant& variant,
+                                std::vector<std::vector<T>>* values) const;
+
   template <class T>
   tensorflow::Status EncodeValues(const nucleus::genomics::v1::Variant& variant,
                                   const bcf_hdr_t* header,
                                   bcf1_t* bcf_record) const;
 
+  template <class T>
+  tensorflow::Status FormatValues(const nucleus::genomics::v1::Variant& variant,
+                                  const bcf_hdr_t* header,
+                                  VcfFormatColumn* column) const;
+
   template <class T>
   tensorflow::Status DecodeValues(
       const bcf_hdr_t *header, const bcf1_t *bcf_record,
       nucleus::genomics::v1::Variant *variant) const;
 
+  template <class T>
+  tensorflow::Status DecodeCompactValues(
+      const bcf_hdr_t *header, const bcf1_t *bcf_record,
+      nucleus::genomics::v1::Variant *variant) const;
+
 
  private:  // Fields
   // The name of our field, such as "DP", "AD", or "VAF".
   string field_name_;
   // The htslib/VCF "type" of this field, such as BCF_HT_INT.
   int vcf_type_;
+  // The htslib header ID of field_name_, or -1 if unresolved.
+  int header_id_;
 };
 
 
@@ -210,8 +301,10 @@ class VcfFormatFieldAdapter {
 // class.)
 class VcfInfoFieldAdapter {
  public:
-  // Creates a new adapter for a field name field_name.
-  VcfInfoFieldAdapter(const string& field_name, int vcf_type);
+  // Creates a new adapter for a field name field_name.  See
+  // VcfFormatFieldAdapter for the meaning of header_id.
+  VcfInfoFieldAdapter(const string& field_name, int vcf_type,
+                      int header_id = -1);
 
   // Adds the values for our field_name from the Variant into our bcf1_t
   // record bcf_record.
@@ -219,6 +312,12 @@ class VcfInfoFieldAdapter {
                                   const bcf_hdr_t* header,
                                   bcf1_t* bcf_record) const;
 
+  // Appends the entry for our field_name from the Variant to info, the text of
+  // an INFO column, as htslib would format it after EncodeValues.  Entries
+  // are separated by semicolons.
+  tensorflow::Status FormatValues(const nucleus::genomics::v1::Variant& variant,
+                                  const bcf_hdr_t* header, string* info) const;
+
   // Add the values for this INFO field in the bcf1_t `bcf_record` to the
   // Variant message info map.
   tensorflow::Status DecodeValues(
@@ -231,6 +330,10 @@ class VcfInfoFieldAdapter {
                                   const bcf_hdr_t* header,
                                   bcf1_t* bcf_record) const;
 
+  template <class T>
+  tensorflow::Status FormatValues(const nucleus::genomics::v1::Variant& variant,
+                                  const bcf_hdr_t* header, string* info) const;
+
   template <class T>
   tensorflow::Status DecodeValues(
       const bcf_hdr_t *header, const bcf1_t *bcf_record,
@@ -242,6 +345,8 @@ class VcfInfoFieldAdapter {
   string field_name_;
   // The htslib/VCF "type" of this field, such as BCF_HT_INT.
   int vcf_type_;
+  // The htslib header ID of field_name_, or -1 if unresolved.
+  int header_id_;
 };
 
 
@@ -253,6 +358,17 @@ class VcfRecordConverter {
                      const std::vector<string> &infos_to_exclude,
                      const std::vector<string> &formats_to_exclude);
 
+  // Constructor that also resolves the htslib header IDs of all INFO and
+  // FORMAT fields against h once, up front, so that ConvertToPb doesn't have
+  // to look each field up by tag name for every record.  ConvertToPb must only
+  // be called with records parsed against h.  If compact_format_fields is
+  // true, ConvertToPb stores the generic FORMAT fields in
+  // Variant.compact_format_fields rather than in the calls' info maps.
+  VcfRecordConverter(const nucleus::genomics::v1::VcfHeader &vcf_header,
+                     const std::vector<string> &infos_to_exclude,
+                     const std::vector<string> &formats_to_exclude,
+                     const bcf_hdr_t *h, bool compact_format_fields = false);
+
   // Not the constructor you want.
   VcfRecordConverter() = default;
 
@@ -268,6 +384,16 @@ class VcfRecordConverter {
       const nucleus::genomics::v1::Variant &variant_message, const bcf_hdr_t &h,
       bcf1_t *v) const;
 
+  // Formats a Variant protocol buffer as a line of VCF text, with its newline,
+  // and appends it to line.  The text is the same as htslib writes for the
+  // record ConvertFromPb makes of variant_message, and the same errors are
+  // returned, but no record is built.  If round_quality is true, QUAL is
+  // rounded to one digit past the decimal point.  On error, line may have
+  // been partly appended to.
+  tensorflow::Status AppendVcfLine(
+      const nucleus::genomics::v1::Variant &variant_message, const bcf_hdr_t &h,
+      bool round_quality, string *line) const;
+
  private:
   // Lookup table for variant INFO fields adapters by VCF tag name.
   // The order of adapter definitions here determines the order of the fields
@@ -283,6 +409,14 @@ class VcfRecordConverter {
   // Individual special-cased FORMAT fields.
   bool want_genotypes_;
   bool want_genotype_likelihoods_;
+
+  // Whether ConvertToPb decodes generic FORMAT fields in compact form.
+  bool compact_format_fields_ = false;
+
+  // htslib header IDs of the special-cased FORMAT fields, or -1 if unresolved.
+  int gt_id_ = -1;
+  int gl_id_ = -1;
+  int pl_id_ = -1;
 };
 
 }  // namespace nucleus
@@ -0,0 +1,481 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/vcf_filter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_replace.h"
+#include "absl/strings/string_view.h"
+#include "nucleus/io/vcf_conversion.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+namespace {
+
+enum class CmpOp { kEq, kNe, kLt, kLe, kGt, kGe };
+
+bool Compare(double lhs, CmpOp op, double rhs) {
+  switch (op) {
+    case CmpOp::kEq: return lhs == rhs;
+    case CmpOp::kNe: return lhs != rhs;
+    case CmpOp::kLt: return lhs < rhs;
+    case CmpOp::kLe: return lhs <= rhs;
+    case CmpOp::kGt: return lhs > rhs;
+    case CmpOp::kGe: return lhs >= rhs;
+  }
+  return false;
+}
+
+struct Token {
+  enum Kind { kWord, kString, kOperator, kEnd };
+  Kind kind;
+  string text;
+};
+
+// Characters that can't be part of a bare word.
+constexpr char kSpecialChars[] = "()!=<>&|\"";
+
+tf::Status Tokenize(const string& expression, std::vector<Token>* tokens) {
+  static const char* const kOperators[] = {"&&", "||", "==", "!=", "<=",
+                                           ">=", "<",  ">",  "!",  "(",
+                                           ")"};
+  size_t i = 0;
+  while (i < expression.size()) {
+    const char c = expression[i];
+    if (isspace(c)) {
+      i++;
+    } else if (c == '"') {
+      const size_t close = expression.find('"', i + 1);
+      if (close == string::npos)
+        return tf::errors::InvalidArgument("Unterminated string");
+      tokens->push_back(
+          {Token::kString, expression.substr(i + 1, close - i - 1)});
+      i = close + 1;
+    } else if (strchr(kSpecialChars, c) != nullptr) {
+      bool found = false;
+      for (const char* op : kOperators) {
+        const size_t len = strlen(op);
+        if (expression.compare(i, len, op) == 0) {
+          tokens->push_back({Token::kOperator, op});
+          i += len;
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        return tf::errors::InvalidArgument("Unexpected character '",
+                                           string(1, c), "'");
+    } else {
+      size_t end = i;
+      while (end < expression.size() && !isspace(expression[end]) &&
+             strchr(kSpecialChars, expression[end]) == nullptr) {
+        end++;
+      }
+      tokens->push_back({Token::kWord, expression.substr(i, end - i)});
+      i = end;
+    }
+  }
+  tokens->push_back({Token::kEnd, ""});
+  return tf::Status::OK();
+}
+
+bool ParseNumber(const string& text, double* value) {
+  if (text.empty()) return false;
+  char* end = nullptr;
+  *value = strtod(text.c_str(), &end);
+  return *end == '\0';
+}
+
+const bcf_info_t* FindInfo(const bcf1_t* record, int id) {
+  for (int i = 0; i < record->n_info; i++) {
+    if (record->d.info[i].key == id) return &record->d.info[i];
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+struct VcfRecordFilter::Node {
+  enum Kind {
+    kAnd, kOr, kNot,
+    kQual, kPos, kNAlt,
+    kChrom, kFilter,
+    kInfoNumber, kInfoString, kInfoPresent,
+    kSnp, kIndel, kRegion,
+  };
+
+  explicit Node(Kind k) : kind(k) {}
+
+  Kind kind;
+  CmpOp op = CmpOp::kEq;
+  double number = 0;
+  string text;
+  // Header ID of the INFO field, FILTER or contig.
+  int id = -1;
+  // Zero-based, half-open interval of kRegion.
+  int64 start = 0;
+  int64 end = 0;
+  std::unique_ptr<Node> lhs;
+  std::unique_ptr<Node> rhs;
+};
+
+namespace {
+
+using Node = VcfRecordFilter::Node;
+
+// Recursive descent parser for filter expressions:
+//
+//   or   := and ('||' and)*
+//   and  := unary ('&&' unary)*
+//   unary := '!' unary | '(' or ')' | atom
+class Parser {
+ public:
+  Parser(const std::vector<Token>& tokens, const bcf_hdr_t* header)
+      : tokens_(tokens), header_(header) {}
+
+  StatusOr<std::unique_ptr<Node>> Parse() {
+    StatusOr<std::unique_ptr<Node>> root = ParseOr();
+    TF_RETURN_IF_ERROR(root.status());
+    if (Peek().kind != Token::kEnd)
+      return tf::errors::InvalidArgument("Unexpected '", Peek().text, "'");
+    return root;
+  }
+
+ private:
+  const Token& Peek() const { return tokens_[pos_]; }
+
+  // Consumes the next token if it is the operator op.
+  bool Accept(const char* op) {
+    if (Peek().kind == Token::kOperator && Peek().text == op) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  tf::Status Expect(const char* op) {
+    if (!Accept(op))
+      return tf::errors::InvalidArgument("Expected '", op, "' but got '",
+                                         Peek().text, "'");
+    return tf::Status::OK();
+  }
+
+  // Consumes a bare word or quoted string into *text.
+  tf::Status ExpectValue(string* text) {
+    if (Peek().kind != Token::kWord && Peek().kind != Token::kString)
+      return tf::errors::InvalidArgument("Expected a value but got '",
+                                         Peek().text, "'");
+    *text = tokens_[pos_++].text;
+    return tf::Status::OK();
+  }
+
+  // Returns true and sets *op if the next token is a comparison operator.
+  bool PeekCmpOp(CmpOp* op) const {
+    static const std::pair<const char*, CmpOp> kCmpOps[] = {
+        {"==", CmpOp::kEq}, {"!=", CmpOp::kNe}, {"<", CmpOp::kLt},
+        {"<=", CmpOp::kLe}, {">", CmpOp::kGt},  {">=", CmpOp::kGe}};
+    if (Peek().kind != Token::kOperator) return false;
+    for (const auto& cmp_op : kCmpOps) {
+      if (Peek().text == cmp_op.first) {
+        *op = cmp_op.second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool AcceptCmpOp(CmpOp* op) {
+    if (!PeekCmpOp(op)) return false;
+    pos_++;
+    return true;
+  }
+
+  // Parses "<op> number" following the identifier name into node.
+  tf::Status ParseNumericComparison(const string& name, Node* node) {
+    if (!AcceptCmpOp(&node->op))
+      return tf::errors::InvalidArgument("Expected a comparison after ", name);
+    string value;
+    TF_RETURN_IF_ERROR(ExpectValue(&value));
+    if (!ParseNumber(value, &node->number))
+      return tf::errors::InvalidArgument(name, " must be compared to a number",
+                                         ", not '", value, "'");
+    return tf::Status::OK();
+  }
+
+  // Parses "== value" or "!= value" following the identifier name into node.
+  tf::Status ParseEquality(const string& name, Node* node) {
+    if (!AcceptCmpOp(&node->op) ||
+        (node->op != CmpOp::kEq && node->op != CmpOp::kNe))
+      return tf::errors::InvalidArgument("Expected == or != after ", name);
+    return ExpectValue(&node->text);
+  }
+
+  StatusOr<std::unique_ptr<Node>> ParseOr() {
+    StatusOr<std::unique_ptr<Node>> lhs = ParseAnd();
+    TF_RETURN_IF_ERROR(lhs.status());
+    std::unique_ptr<Node> node = std::move(lhs.ValueOrDie());
+    while (Accept("||")) {
+      StatusOr<std::unique_ptr<Node>> rhs = ParseAnd();
+      TF_RETURN_IF_ERROR(rhs.status());
+      std::unique_ptr<Node> parent(new Node(Node::kOr));
+      parent->lhs = std::move(node);
+      parent->rhs = std::move(rhs.ValueOrDie());
+      node = std::move(parent);
+    }
+    return std::move(node);
+  }
+
+  StatusOr<std::unique_ptr<Node>> ParseAnd() {
+    StatusOr<std::unique_ptr<Node>> lhs = ParseUnary();
+    TF_RETURN_IF_ERROR(lhs.status());
+    std::unique_ptr<Node> node = std::move(lhs.ValueOrDie());
+    while (Accept("&&")) {
+      StatusOr<std::unique_ptr<Node>> rhs = ParseUnary();
+      TF_RETURN_IF_ERROR(rhs.status());
+      std::unique_ptr<Node> parent(new Node(Node::kAnd));
+      parent->lhs = std::move(node);
+      parent->rhs = std::move(rhs.ValueOrDie());
+      node = std::move(parent);
+    }
+    return std::move(node);
+  }
+
+  StatusOr<std::unique_ptr<Node>> ParseUnary() {
+    if (Accept("!")) {
+      StatusOr<std::unique_ptr<Node>> operand = ParseUnary();
+      TF_RETURN_IF_ERROR(operand.status());
+      std::unique_ptr<Node> node(new Node(Node::kNot));
+      node->lhs = std::move(operand.ValueOrDie());
+      return std::move(node);
+    }
+    if (Accept("(")) {
+      StatusOr<std::unique_ptr<Node>> inner = ParseOr();
+      TF_RETURN_IF_ERROR(inner.status());
+      TF_RETURN_IF_ERROR(Expect(")"));
+      return inner;
+    }
+    return ParseAtom();
+  }
+
+  StatusOr<std::unique_ptr<Node>> ParseAtom() {
+    if (Peek().kind != Token::kWord)
+      return tf::errors::InvalidArgument("Unexpected '", Peek().text, "'");
+    const string name = tokens_[pos_++].text;
+    std::unique_ptr<Node> node;
+
+    if (name == "QUAL" || name == "POS" || name == "N_ALT") {
+      node.reset(new Node(name == "QUAL"  ? Node::kQual
+                          : name == "POS" ? Node::kPos
+                                          : Node::kNAlt));
+      TF_RETURN_IF_ERROR(ParseNumericComparison(name, node.get()));
+    } else if (name == "CHROM") {
+      node.reset(new Node(Node::kChrom));
+      TF_RETURN_IF_ERROR(ParseEquality(name, node.get()));
+      node->id = bcf_hdr_name2id(header_, node->text.c_str());
+      if (node->id < 0)
+        return tf::errors::InvalidArgument("Unknown contig '", node->text, "'");
+    } else if (name == "FILTER") {
+      node.reset(new Node(Node::kFilter));
+      TF_RETURN_IF_ERROR(ParseEquality(name, node.get()));
+      node->id = bcf_hdr_id2int(header_, BCF_DT_ID, node->text.c_str());
+      if (!bcf_hdr_idinfo_exists(header_, BCF_HL_FLT, node->id))
+        return tf::errors::InvalidArgument("Unknown FILTER '", node->text, "'");
+    } else if (name.compare(0, 5, "INFO/") == 0) {
+      TF_RETURN_IF_ERROR(ParseInfo(name.substr(5), &node));
+    } else if (name == "SNP") {
+      node.reset(new Node(Node::kSnp));
+    } else if (name == "INDEL") {
+      node.reset(new Node(Node::kIndel));
+    } else if (name == "REGION") {
+      node.reset(new Node(Node::kRegion));
+      TF_RETURN_IF_ERROR(Expect("("));
+      TF_RETURN_IF_ERROR(ExpectValue(&node->text));
+      TF_RETURN_IF_ERROR(Expect(")"));
+      TF_RETURN_IF_ERROR(ParseRegion(node.get()));
+    } else {
+      return tf::errors::InvalidArgument("Unknown identifier '", name, "'");
+    }
+    return std::move(node);
+  }
+
+  tf::Status ParseInfo(const string& key, std::unique_ptr<Node>* node) {
+    const int id = bcf_hdr_id2int(header_, BCF_DT_ID, key.c_str());
+    if (!bcf_hdr_idinfo_exists(header_, BCF_HL_INFO, id))
+      return tf::errors::InvalidArgument("Unknown INFO field '", key, "'");
+    const int type = bcf_hdr_id2type(header_, BCF_HL_INFO, id);
+
+    CmpOp op;
+    if (!PeekCmpOp(&op)) {
+      node->reset(new Node(Node::kInfoPresent));
+    } else if (type == BCF_HT_INT || type == BCF_HT_REAL) {
+      node->reset(new Node(Node::kInfoNumber));
+      TF_RETURN_IF_ERROR(ParseNumericComparison("INFO/" + key, node->get()));
+    } else if (type == BCF_HT_STR) {
+      node->reset(new Node(Node::kInfoString));
+      TF_RETURN_IF_ERROR(ParseEquality("INFO/" + key, node->get()));
+    } else {
+      return tf::errors::InvalidArgument("INFO/", key,
+                                         " is a Flag and can't be compared");
+    }
+    (*node)->id = id;
+    return tf::Status::OK();
+  }
+
+  // Parses node->text, a 1-based inclusive "chr:start-end" or "chr" region.
+  tf::Status ParseRegion(Node* node) {
+    string contig = node->text;
+    node->start = 0;
+    node->end = std::numeric_limits<int64>::max();
+    const size_t colon = node->text.rfind(':');
+    if (colon != string::npos) {
+      contig = node->text.substr(0, colon);
+      const string interval =
+          absl::StrReplaceAll(node->text.substr(colon + 1), {{",", ""}});
+      char* end = nullptr;
+      const int64 start = strtoll(interval.c_str(), &end, 10);
+      if (*end != '-' || start < 1)
+        return tf::errors::InvalidArgument("Malformed region '", node->text,
+                                           "'");
+      const char* end_str = end + 1;
+      node->end = strtoll(end_str, &end, 10);
+      if (*end != '\0' || end == end_str || node->end < start)
+        return tf::errors::InvalidArgument("Malformed region '", node->text,
+                                           "'");
+      node->start = start - 1;
+    }
+    node->id = bcf_hdr_name2id(header_, contig.c_str());
+    if (node->id < 0)
+      return tf::errors::InvalidArgument("Unknown contig '", contig, "'");
+    return tf::Status::OK();
+  }
+
+  const std::vector<Token>& tokens_;
+  const bcf_hdr_t* header_;
+  size_t pos_ = 0;
+};
+
+bool InfoNumberMatches(const Node& node, const bcf_info_t* info) {
+  if (info->type == BCF_BT_FLOAT) {
+    for (int j = 0; j < info->len; j++) {
+      float value;
+      if (VcfType<float>::DecodeValue(info->type, info->vptr, j, &value) &&
+          !VcfType<float>::IsMissing(value) &&
+          !VcfType<float>::IsVectorEnd(value) &&
+          Compare(value, node.op, node.number)) {
+        return true;
+      }
+    }
+  } else {
+    for (int j = 0; j < info->len; j++) {
+      int value;
+      if (VcfType<int>::DecodeValue(info->type, info->vptr, j, &value) &&
+          !VcfType<int>::IsMissing(value) &&
+          !VcfType<int>::IsVectorEnd(value) &&
+          Compare(value, node.op, node.number)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Eval(const Node& node, bcf1_t* record) {
+  switch (node.kind) {
+    case Node::kAnd:
+      return Eval(*node.lhs, record) && Eval(*node.rhs, record);
+    case Node::kOr:
+      return Eval(*node.lhs, record) || Eval(*node.rhs, record);
+    case Node::kNot:
+      return !Eval(*node.lhs, record);
+    case Node::kQual:
+      return !bcf_float_is_missing(record->qual) &&
+             Compare(record->qual, node.op, node.number);
+    case Node::kPos:
+      return Compare(record->pos + 1, node.op, node.number);
+    case Node::kNAlt:
+      return Compare(record->n_allele - 1, node.op, node.number);
+    case Node::kChrom:
+      return (record->rid == node.id) == (node.op == CmpOp::kEq);
+    case Node::kFilter: {
+      bool has_filter = false;
+      for (int i = 0; i < record->d.n_flt; i++) {
+        has_filter = has_filter || record->d.flt[i] == node.id;
+      }
+      return has_filter == (node.op == CmpOp::kEq);
+    }
+    case Node::kInfoPresent:
+    case Node::kInfoNumber:
+    case Node::kInfoString: {
+      // A null vptr marks a field that has been removed from the record.
+      const bcf_info_t* info = FindInfo(record, node.id);
+      if (info == nullptr || info->vptr == nullptr) return false;
+      if (node.kind == Node::kInfoPresent) return true;
+      if (node.kind == Node::kInfoNumber) return InfoNumberMatches(node, info);
+      if (info->type != BCF_BT_CHAR) return false;
+      const char* value = reinterpret_cast<const char*>(info->vptr);
+      const absl::string_view text(value, strnlen(value, info->len));
+      return (text == node.text) == (node.op == CmpOp::kEq);
+    }
+    case Node::kSnp:
+      return bcf_get_variant_types(record) & VCF_SNP;
+    case Node::kIndel:
+      return bcf_get_variant_types(record) & VCF_INDEL;
+    case Node::kRegion:
+      return record->rid == node.id && record->pos < node.end &&
+             record->pos + record->rlen > node.start;
+  }
+  return false;
+}
+
+}  // namespace
+
+StatusOr<std::unique_ptr<VcfRecordFilter>> VcfRecordFilter::Compile(
+    const string& expression, const bcf_hdr_t* header) {
+  std::vector<Token> tokens;
+  tf::Status status = Tokenize(expression, &tokens);
+  if (status.ok()) {
+    StatusOr<std::unique_ptr<Node>> root = Parser(tokens, header).Parse();
+    if (root.ok()) {
+      return std::unique_ptr<VcfRecordFilter>(
+          new VcfRecordFilter(std::move(root.ValueOrDie())));
+    }
+    status = root.status();
+  }
+  return tf::errors::InvalidArgument("Invalid filter expression '", expression,
+                                     "': ", status.error_message());
+}
+
+VcfRecordFilter::VcfRecordFilter(std::unique_ptr<Node> root)
+    : root_(std::move(root)) {}
+
+VcfRecordFilter::~VcfRecordFilter() {}
+
+bool VcfRecordFilter::Matches(bcf1_t* record) const {
+  bcf_unpack(record, BCF_UN_SHR);
+  return Eval(*root_, record);
+}
+
+}  // namespace nucleus
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VCF_FILTER_H_
+#define THIRD_PARTY_NUCLEUS_IO_VCF_FILTER_H_
+
+#include <memory>
+
+#include "htslib/vcf.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// A compiled VcfReaderOptions.filter_expression; see variants.proto for the
+// expression language.
+//
+// All names in the expression (INFO keys, FILTERs, contigs) are resolved to
+// header IDs once by Compile, so Matches only looks at the unpacked shared
+// fields of a record and never allocates. A VcfRecordFilter is immutable and
+// can be shared by all the iterables of a reader.
+class VcfRecordFilter {
+ public:
+  // Parses expression and binds it to header, which must outlive the filter.
+  // Returns InvalidArgument if expression is malformed or refers to fields,
+  // filters or contigs that aren't in header.
+  static StatusOr<std::unique_ptr<VcfRecordFilter>> Compile(
+      const string& expression, const bcf_hdr_t* header);
+
+  ~VcfRecordFilter();
+
+  // Disable copy or assignment
+  VcfRecordFilter(const VcfRecordFilter& other) = delete;
+  VcfRecordFilter& operator=(const VcfRecordFilter&) = delete;
+
+  // Returns true if record satisfies the expression. Unpacks the shared
+  // (non-FORMAT) fields of record if they aren't already.
+  bool Matches(bcf1_t* record) const;
+
+  // Syntax tree of a compiled expression; defined in vcf_filter.cc.
+  struct Node;
+
+ private:
+  explicit VcfRecordFilter(std::unique_ptr<Node> root);
+
+  std::unique_ptr<Node> root_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VCF_FILTER_H_
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of vcf_key_index.h
+#include "nucleus/io/vcf_key_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "htslib/bgzf.h"
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "nucleus/io/hts_path.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+namespace {
+
+// The first bytes of an index file, which include a format version. They are
+// followed by the int64 size and modification time (in nanoseconds) of the
+// indexed VCF, the int64 sizes of the ID and allele tables, and the tables.
+constexpr char kMagic[] = "NUCVKI02";
+constexpr size_t kMagicLength = sizeof(kMagic) - 1;
+constexpr size_t kHeaderLength = kMagicLength + 4 * sizeof(int64);
+
+uint64 HashKey(absl::string_view key) {
+  return tf::Hash64(key.data(), key.size());
+}
+
+}  // namespace
+
+string VcfKeyIndex::IndexPath(const string& vcf_path) {
+  return vcf_path + ".vki";
+}
+
+string VcfKeyIndex::AlleleKey(absl::string_view reference_name, int64 start,
+                              absl::string_view ref, absl::string_view alt) {
+  return absl::StrCat(reference_name, ":", start + 1, ":", ref, "->", alt);
+}
+
+tf::Status VcfKeyIndex::Build(const string& vcf_path,
+                              const string& index_path) {
+  tf::FileStatistics stat;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->Stat(vcf_path, &stat));
+  htsFile* fp = hts_open_x(vcf_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound("Could not open ", vcf_path);
+  }
+  if (fp->format.compression != bgzf) {
+    hts_close(fp);
+    return tf::errors::FailedPrecondition(
+        "Only BGZF-compressed VCFs can be key indexed: ", vcf_path);
+  }
+  bcf_hdr_t* header = bcf_hdr_read(fp);
+  if (header == nullptr) {
+    hts_close(fp);
+    return tf::errors::Unknown("Couldn't parse header for ", vcf_path);
+  }
+
+  std::vector<Entry> ids;
+  std::vector<Entry> alleles;
+  bcf1_t* bcf1 = bcf_init();
+  while (true) {
+    // The header has been read up to the #CHROM line, so this is the offset
+    // of the next record.
+    const int64 offset = bgzf_tell(fp->fp.bgzf);
+    if (bcf_read(fp, header, bcf1) < 0) break;
+    bcf_unpack(bcf1, BCF_UN_STR);
+    if (std::strcmp(bcf1->d.id, ".") != 0) {
+      for (absl::string_view id :
+           absl::StrSplit(bcf1->d.id, ';', absl::SkipEmpty())) {
+        ids.push_back({HashKey(id), offset});
+      }
+    }
+    const char* contig = bcf_hdr_id2name(header, bcf1->rid);
+    for (int i = 1; i < bcf1->n_allele; i++) {
+      alleles.push_back({HashKey(AlleleKey(contig, bcf1->pos,
+                                           bcf1->d.allele[0],
+                                           bcf1->d.allele[i])),
+                         offset});
+    }
+  }
+  const bool failed = bcf1->errcode != 0;
+  bcf_destroy(bcf1);
+  bcf_hdr_destroy(header);
+  hts_close(fp);
+  if (failed) {
+    return tf::errors::DataLoss("Failed to parse VCF record in ", vcf_path);
+  }
+
+  const auto by_hash = [](const Entry& a, const Entry& b) {
+    return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset);
+  };
+  std::sort(ids.begin(), ids.end(), by_hash);
+  std::sort(alleles.begin(), alleles.end(), by_hash);
+  const int64 sizes[] = {stat.length, stat.mtime_nsec,
+                         static_cast<int64>(ids.size()),
+                         static_cast<int64>(alleles.size())};
+  string data(kMagic, kMagicLength);
+  data.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  data.append(reinterpret_cast<const char*>(ids.data()),
+              ids.size() * sizeof(Entry));
+  data.append(reinterpret_cast<const char*>(alleles.data()),
+              alleles.size() * sizeof(Entry));
+  return tf::WriteStringToFile(tf::Env::Default(), index_path, data);
+}
+
+StatusOr<std::unique_ptr<VcfKeyIndex>> VcfKeyIndex::FromFile(
+    const string& index_path, const string& vcf_path) {
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewReadOnlyMemoryRegionFromFile(
+      index_path, &region));
+  const char* data = static_cast<const char*>(region->data());
+  const uint64 length = region->length();
+  if (length < kHeaderLength ||
+      std::memcmp(data, kMagic, kMagicLength) != 0) {
+    return tf::errors::DataLoss(index_path, " is not a VCF key index");
+  }
+  int64 sizes[4];
+  std::memcpy(sizes, data + kMagicLength, sizeof(sizes));
+  const int64 n_ids = sizes[2];
+  const int64 n_alleles = sizes[3];
+  if (n_ids < 0 || n_alleles < 0 ||
+      length != kHeaderLength + (n_ids + n_alleles) * sizeof(Entry)) {
+    return tf::errors::DataLoss("Malformed VCF key index ", index_path);
+  }
+  tf::FileStatistics stat;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->Stat(vcf_path, &stat));
+  if (stat.length != sizes[0] || stat.mtime_nsec != sizes[1]) {
+    return tf::errors::FailedPrecondition(
+        index_path, " is out of date: ", vcf_path,
+        " has changed since it was indexed");
+  }
+  std::unique_ptr<VcfKeyIndex> index(new VcfKeyIndex(std::move(region)));
+  index->ids_ = reinterpret_cast<const Entry*>(data + kHeaderLength);
+  index->n_ids_ = n_ids;
+  index->alleles_ = index->ids_ + n_ids;
+  index->n_alleles_ = n_alleles;
+  return std::move(index);
+}
+
+VcfKeyIndex::VcfKeyIndex(std::unique_ptr<tf::ReadOnlyMemoryRegion> region)
+    : region_(std::move(region)) {}
+
+void VcfKeyIndex::FindId(absl::string_view id,
+                         std::vector<int64>* offsets) const {
+  Find(ids_, n_ids_, id, offsets);
+}
+
+void VcfKeyIndex::FindAllele(absl::string_view allele_key,
+                             std::vector<int64>* offsets) const {
+  Find(alleles_, n_alleles_, allele_key, offsets);
+}
+
+void VcfKeyIndex::Find(const Entry* table, int64 n, absl::string_view key,
+                       std::vector<int64>* offsets) {
+  const uint64 hash = HashKey(key);
+  const Entry* it = std::lower_bound(
+      table, table + n, hash,
+      [](const Entry& entry, uint64 hash) { return entry.hash < hash; });
+  for (; it != table + n && it->hash == hash; ++it) {
+    offsets->push_back(it->offset);
+  }
+}
+
+}  // namespace nucleus
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VCF_KEY_INDEX_H_
+#define THIRD_PARTY_NUCLEUS_IO_VCF_KEY_INDEX_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "nucleus/vendor/statusor.h"
+#include "nucleus/platform/types.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace nucleus {
+
+// A sidecar index of a BGZF-compressed VCF mapping the IDs of its records
+// (e.g. dbSNP rsIDs) and their alleles to the BGZF virtual offsets of the
+// records, for point lookups that tabix range queries serve poorly; see
+// VcfReader::LookupById and VcfReader::LookupByAllele.
+//
+// Keys are stored as sorted tables of (64-bit hash, virtual offset) pairs, one
+// for IDs and one for allele keys, which are memory-mapped rather than read
+// when the index is loaded. Since only hashes are stored, a lookup returns the
+// offsets of the records that may have a key, which must be checked against
+// the records themselves. The index also records the size and modification
+// time of the VCF it was built from, so that it isn't used once the VCF has
+// changed.
+class VcfKeyIndex {
+ public:
+  // The path of the index of the VCF at vcf_path.
+  static string IndexPath(const string& vcf_path);
+
+  // Returns the key of the alternate allele alt of a record on
+  // reference_name at the 0-based start with reference allele ref, formatted
+  // like the variant_key of a biallelic variant: "chr1:1235:CTG->C".
+  static string AlleleKey(absl::string_view reference_name, int64 start,
+                          absl::string_view ref, absl::string_view alt);
+
+  // Indexes the IDs and allele keys of all records of the BGZF-compressed VCF
+  // at vcf_path, and writes the index to index_path. A record with several
+  // semicolon-separated IDs is indexed under each, and one with several
+  // alternate alleles under the key of each.
+  static tensorflow::Status Build(const string& vcf_path,
+                                  const string& index_path);
+
+  // Maps the index written by Build at index_path for the VCF at vcf_path.
+  // Returns FailedPrecondition if the VCF's size or modification time differs
+  // from when it was indexed.
+  static StatusOr<std::unique_ptr<VcfKeyIndex>> FromFile(
+      const string& index_path, const string& vcf_path);
+
+  // Appends the virtual offsets of the records that may have the ID id, or
+  // the allele key allele_key, to offsets.
+  void FindId(absl::string_view id, std::vector<int64>* offsets) const;
+  void FindAllele(absl::string_view allele_key,
+                  std::vector<int64>* offsets) const;
+
+  // The number of ID and allele key entries in the index.
+  int64 NumIdEntries() const { return n_ids_; }
+  int64 NumAlleleEntries() const { return n_alleles_; }
+
+ private:
+  // One (key hash, virtual offset) pair of an index table.
+  struct Entry {
+    uint64 hash;
+    int64 offset;
+  };
+
+  explicit VcfKeyIndex(
+      std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region);
+
+  // Appends the offsets of the entries of table with the hash of key.
+  static void Find(const Entry* table, int64 n, absl::string_view key,
+                   std::vector<int64>* offsets);
+
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region_;
+  const Entry* ids_ = nullptr;
+  int64 n_ids_ = 0;
+  const Entry* alleles_ = nullptr;
+  int64 n_alleles_ = 0;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VCF_KEY_INDEX_H_
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/vcf_key_index.h"
+
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VcfReaderOptions;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
+
+constexpr char kVcfSamplesFilename[] = "test_samples.vcf";
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+
+// Copies the test VCF to a temporary path and indexes it there, returning
+// that path.
+string IndexedTestVcf(const string& name) {
+  string data;
+  TF_CHECK_OK(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), GetTestData(kVcfIndexSamplesFilename),
+      &data));
+  const string path = MakeTempFile(name);
+  TF_CHECK_OK(
+      tensorflow::WriteStringToFile(tensorflow::Env::Default(), path, data));
+  TF_CHECK_OK(VcfKeyIndex::Build(path, VcfKeyIndex::IndexPath(path)));
+  return path;
+}
+
+std::unique_ptr<VcfReader> OpenVcf(const string& path,
+                                   const VcfReaderOptions& options) {
+  return std::move(VcfReader::FromFile(path, options).ValueOrDie());
+}
+
+TEST(VcfKeyIndexTest, FormatsAlleleKeys) {
+  EXPECT_EQ("chr1:14398:CTGT->C",
+            VcfKeyIndex::AlleleKey("chr1", 14397, "CTGT", "C"));
+}
+
+TEST(VcfKeyIndexTest, IndexesAllKeys) {
+  const string path = IndexedTestVcf("all_keys.vcf.gz");
+  auto index = std::move(
+      VcfKeyIndex::FromFile(VcfKeyIndex::IndexPath(path), path).ValueOrDie());
+  int64 n_ids = 0;
+  int64 n_alleles = 0;
+  for (const Variant& v : as_vector(
+           OpenVcf(GetTestData(kVcfSamplesFilename), VcfReaderOptions())
+               ->Iterate())) {
+    n_ids += v.names_size();
+    n_alleles += v.alternate_bases_size();
+  }
+  EXPECT_EQ(n_ids, index->NumIdEntries());
+  EXPECT_EQ(n_alleles, index->NumAlleleEntries());
+
+  std::vector<int64> offsets;
+  index->FindId("rs756427959", &offsets);
+  EXPECT_THAT(offsets, SizeIs(1));
+  offsets.clear();
+  index->FindId("rs0", &offsets);
+  EXPECT_THAT(offsets, IsEmpty());
+}
+
+TEST(VcfKeyIndexTest, LooksUpByIdAndAllele) {
+  const string path = IndexedTestVcf("lookup.vcf.gz");
+  auto reader = OpenVcf(path, VcfReaderOptions());
+  // Lookups are returned in the order asked, while records are read in file
+  // order.
+  auto by_id = reader->LookupById({"rs3079263", "rs0", "rs756427959"});
+  ASSERT_THAT(by_id.status(), IsOK());
+  const auto& id_results = by_id.ValueOrDie();
+  ASSERT_THAT(id_results, SizeIs(3));
+  ASSERT_THAT(id_results[0], SizeIs(1));
+  EXPECT_EQ("chr3", id_results[0][0].reference_name());
+  EXPECT_EQ(116665, id_results[0][0].start());
+  EXPECT_THAT(id_results[1], IsEmpty());
+  ASSERT_THAT(id_results[2], SizeIs(1));
+  EXPECT_EQ(14396, id_results[2][0].start());
+
+  // Each alternate allele of a multi-allelic record is a key.
+  auto by_allele = reader->LookupByAllele(
+      {"chr3:14320:T->TAAA", "chr1:14398:CTGT->C", "chr1:14398:CTGT->CT",
+       "chr3:14320:T->TA"});
+  ASSERT_THAT(by_allele.status(), IsOK());
+  const auto& allele_results = by_allele.ValueOrDie();
+  ASSERT_THAT(allele_results, SizeIs(4));
+  ASSERT_THAT(allele_results[0], SizeIs(1));
+  EXPECT_THAT(allele_results[0][0].alternate_bases(),
+              ElementsAre("TA", "TAAA"));
+  EXPECT_THAT(allele_results[1], SizeIs(1));
+  EXPECT_THAT(allele_results[2], IsEmpty());
+  EXPECT_THAT(allele_results[3], SizeIs(1));
+
+  // Lookups don't disturb iteration.
+  EXPECT_THAT(as_vector(reader->Query(MakeRange("chr3", 14318, 14320))),
+              SizeIs(1));
+}
+
+TEST(VcfKeyIndexTest, LookupsApplyFilter) {
+  const string path = IndexedTestVcf("filtered.vcf.gz");
+  VcfReaderOptions options;
+  options.set_filter_expression("CHROM == chr3");
+  auto results = OpenVcf(path, options)
+                     ->LookupById({"rs3079263", "rs756427959"})
+                     .ValueOrDie();
+  EXPECT_THAT(results[0], SizeIs(1));
+  EXPECT_THAT(results[1], IsEmpty());
+}
+
+TEST(VcfKeyIndexTest, RequiresIndex) {
+  EXPECT_FALSE(
+      OpenVcf(GetTestData(kVcfIndexSamplesFilename), VcfReaderOptions())
+          ->LookupById({"rs756427959"})
+          .ok());
+}
+
+TEST(VcfKeyIndexTest, RequiresBgzf) {
+  EXPECT_THAT(VcfKeyIndex::Build(GetTestData(kVcfSamplesFilename),
+                                 MakeTempFile("uncompressed.vki")),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "Only BGZF-compressed VCFs"));
+}
+
+TEST(VcfKeyIndexTest, RejectsMalformedFiles) {
+  const string path = MakeTempFile("malformed.vki");
+  const string vcf_path = IndexedTestVcf("truncated.vcf.gz");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(), path,
+                                            "not an index, too"));
+  EXPECT_THAT(VcfKeyIndex::FromFile(path, vcf_path).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "is not a VCF key index"));
+
+  string data;
+  TF_CHECK_OK(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), VcfKeyIndex::IndexPath(vcf_path), &data));
+  data.resize(data.size() - 1);
+  TF_CHECK_OK(
+      tensorflow::WriteStringToFile(tensorflow::Env::Default(), path, data));
+  EXPECT_THAT(VcfKeyIndex::FromFile(path, vcf_path).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed VCF key index"));
+}
+
+TEST(VcfKeyIndexTest, RejectsIndexOfChangedVcf) {
+  const string path = IndexedTestVcf("changed.vcf.gz");
+  string data;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                           GetTestData(kVcfSamplesFilename),
+                                           &data));
+  TF_CHECK_OK(
+      tensorflow::WriteStringToFile(tensorflow::Env::Default(), path, data));
+  EXPECT_THAT(VcfKeyIndex::FromFile(VcfKeyIndex::IndexPath(path), path),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "has changed since it was indexed"));
+  EXPECT_THAT(OpenVcf(path, VcfReaderOptions())->LookupById({"rs756427959"}),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "is out of date"));
+}
+
+}  // namespace nucleus
@@ -18,10 +18,23 @@
 // Implementation of vcf_reader.h
 #include "nucleus/io/vcf_reader.h"
 
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "htslib/bgzf.h"
+#include "htslib/kseq.h"
 #include "htslib/kstring.h"
 #include "htslib/vcf.h"
 #include "nucleus/io/hts_path.h"
 #include "nucleus/io/vcf_conversion.h"
+#include "nucleus/io/vcf_stats.h"
+#include "nucleus/io/vcf_text_parser.h"
 #include "nucleus/protos/range.pb.h"
 #include "nucleus/protos/reference.pb.h"
 #include "nucleus/protos/variants.pb.h"
@@ -39,6 +52,9 @@ using std::vector;
 using nucleus::genomics::v1::Range;
 using nucleus::genomics::v1::Variant;
 using nucleus::genomics::v1::VariantCall;
+using nucleus::genomics::v1::VcfContigStats;
+using nucleus::genomics::v1::VcfGenotypeMatrixOptions;
+using nucleus::genomics::v1::VcfStats;
 
 namespace {
 
@@ -202,8 +218,201 @@ class VcfFullFileIterable : public VariantIterable {
   htsFile* fp_;
   bcf_hdr_t* header_;
   bcf1_t* bcf1_;
+  // The current line, if the reader has a text parser.
+  kstring_t str_;
+};
+
+// A contiguous piece of a VCF file converted by one worker of a
+// VcfParallelIterable: the records on contig that start in [start, end).
+struct VcfShard {
+  string contig;
+  int64 start;
+  int64 end;
+};
+
+// Iterable class for traversing all VCF records in the file with a pool of
+// worker threads, each converting whole shards with its own htsFile, header,
+// index and converter. Converted variants are passed to Next in batches,
+// through a per-shard reorder buffer when ordered output is requested.
+class VcfParallelIterable : public VariantIterable {
+ public:
+  // Advance to the next record.
+  StatusOr<bool> Next(nucleus::genomics::v1::Variant* out) override;
+
+  // Constructor will be invoked via VcfReader::IterateParallel.
+  VcfParallelIterable(const VcfReader* reader, const string& variants_path,
+                      std::vector<VcfShard> shards, int num_threads,
+                      bool ordered);
+
+  ~VcfParallelIterable() override;
+
+ private:
+  // Number of variants handed from a worker to Next at once.
+  static constexpr int kBatchSize = 256;
+  // Workers pause once this many batches per thread are waiting for Next.
+  static constexpr int kMaxBatchesPerThread = 4;
+
+  struct ShardOutput {
+    std::deque<std::vector<Variant>> batches;
+    bool done = false;
+  };
+
+  // Thread body: claims and converts shards until none are left.
+  void Work();
+  tf::Status RunWorker();
+
+  // Converts the records of shards_[shard] and emits them.
+  tf::Status ProcessShard(int shard, htsFile* fp, bcf_hdr_t* header,
+                          tbx_t* idx, bcf1_t* bcf1, kstring_t* str,
+                          const VcfRecordConverter& converter,
+                          const VcfRecordFilter* filter);
+
+  // Hands *batch (which is cleared) of shard to Next, and marks shard as done
+  // if done is true. Blocks while too much output is buffered, except for the
+  // shard Next is waiting on. Returns false if the iterable is being
+  // destroyed.
+  bool Emit(int shard, std::vector<Variant>* batch, bool done);
+
+  const string variants_path_;
+  const nucleus::genomics::v1::VcfReaderOptions options_;
+  const nucleus::genomics::v1::VcfHeader vcf_header_;
+  const std::vector<VcfShard> shards_;
+  const bool ordered_;
+  const int max_buffered_batches_;
+
+  absl::Mutex mutex_;
+  absl::CondVar cond_;
+  // The next shard to be claimed by a worker.
+  int next_shard_ = 0;
+  // Output of each shard if ordered_, otherwise all output is in outputs_[0].
+  std::vector<ShardOutput> outputs_;
+  // The shard Next is consuming if ordered_.
+  int current_shard_ = 0;
+  int buffered_batches_ = 0;
+  int running_workers_;
+  bool cancelled_ = false;
+  // The first error encountered by any worker.
+  tf::Status status_;
+
+  // The batch Next is returning variants from; only used by Next.
+  std::vector<Variant> batch_;
+  size_t batch_pos_ = 0;
+
+  std::vector<std::thread> workers_;
 };
 
+namespace {
+
+// Splits the contigs with records in idx into the shards described at
+// VcfReader::IterateParallel. The index lists these contigs in the order they
+// appear in the file, which makes the shard order the file order.
+std::vector<VcfShard> MakeShards(
+    tbx_t* idx, const nucleus::genomics::v1::VcfHeader& vcf_header,
+    int64 shard_size_bases) {
+  std::map<string, int64> contig_lengths;
+  for (const auto& contig : vcf_header.contigs()) {
+    contig_lengths[contig.name()] = contig.n_bases();
+  }
+  constexpr int64 kContigEnd = std::numeric_limits<int32>::max();
+  std::vector<VcfShard> shards;
+  int n_contigs = 0;
+  const char** contigs = tbx_seqnames(idx, &n_contigs);
+  for (int i = 0; i < n_contigs; i++) {
+    const int64 length = contig_lengths[contigs[i]];
+    if (shard_size_bases <= 0 || length <= 0) {
+      shards.push_back({contigs[i], 0, kContigEnd});
+      continue;
+    }
+    for (int64 start = 0; start < length; start += shard_size_bases) {
+      // Don't trust the header length to bound the last shard.
+      const int64 end =
+          start + shard_size_bases >= length ? kContigEnd
+                                             : start + shard_size_bases;
+      shards.push_back({contigs[i], start, end});
+    }
+  }
+  free(contigs);
+  return shards;
+}
+
+// Opens variants_path and adds to *stats the records matching
+// filter_expression of the shards it claims from *next_shard, which is
+// guarded by mutex, or of the whole file if there are no shards.
+tf::Status AccumulateVcfStats(const string& variants_path,
+                              const string& filter_expression,
+                              const std::vector<VcfShard>& shards,
+                              absl::Mutex* mutex, int* next_shard,
+                              VcfStats* stats) {
+  htsFile* fp = hts_open_x(variants_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound("Could not open ", variants_path);
+  }
+  bcf_hdr_t* header = bcf_hdr_read(fp);
+  tbx_t* idx = header != nullptr && !shards.empty()
+                   ? tbx_index_load(fp->fn)
+                   : nullptr;
+  bcf1_t* bcf1 = bcf_init();
+  kstring_t str = {0, 0, nullptr};
+
+  tf::Status status;
+  if (header == nullptr) {
+    status = tf::errors::Unknown("Couldn't parse header for ", fp->fn);
+  } else if (!shards.empty() && idx == nullptr) {
+    status = tf::errors::NotFound("Couldn't load index for ", fp->fn);
+  } else {
+    // Filter and accumulator are bound to this pass's own header.
+    std::unique_ptr<VcfRecordFilter> filter;
+    if (!filter_expression.empty()) {
+      StatusOr<std::unique_ptr<VcfRecordFilter>> compiled =
+          VcfRecordFilter::Compile(filter_expression, header);
+      status = compiled.status();
+      if (status.ok()) filter = std::move(compiled.ValueOrDie());
+    }
+    VcfStatsAccumulator accumulator(header);
+    if (status.ok() && shards.empty()) {
+      while (bcf_read(fp, header, bcf1) >= 0) {
+        if (filter == nullptr || filter->Matches(bcf1)) accumulator.Add(bcf1);
+      }
+      if (bcf1->errcode) {
+        status = tf::errors::DataLoss("Failed to parse VCF record");
+      }
+    }
+    while (status.ok() && !shards.empty()) {
+      int shard;
+      {
+        absl::MutexLock lock(mutex);
+        if (*next_shard == shards.size()) break;
+        shard = (*next_shard)++;
+      }
+      const VcfShard& range = shards[shard];
+      const int tid = tbx_name2id(idx, range.contig.c_str());
+      hts_itr_t* iter =
+          tid < 0 ? nullptr : tbx_itr_queryi(idx, tid, range.start, range.end);
+      while (iter != nullptr && tbx_itr_next(fp, idx, iter, &str) >= 0) {
+        if (vcf_parse1(&str, header, bcf1) < 0) {
+          status = tf::errors::DataLoss("Failed to parse VCF record: ", str.s);
+          break;
+        }
+        // Records overlapping the start of the shard belong to the previous
+        // one.
+        if (bcf1->pos < range.start) continue;
+        if (filter == nullptr || filter->Matches(bcf1)) accumulator.Add(bcf1);
+      }
+      hts_itr_destroy(iter);
+    }
+    if (status.ok()) *stats = accumulator.Stats();
+  }
+
+  if (str.s != nullptr) free(str.s);
+  bcf_destroy(bcf1);
+  if (idx != nullptr) tbx_destroy(idx);
+  if (header != nullptr) bcf_hdr_destroy(header);
+  hts_close(fp);
+  return status;
+}
+
+}  // namespace
+
 StatusOr<std::unique_ptr<VcfReader>> VcfReader::FromFile(
     const string& variants_path,
     const nucleus::genomics::v1::VcfReaderOptions& options) {
@@ -223,15 +432,22 @@ StatusOr<std::unique_ptr<VcfReader>> VcfReader::FromFile(
     // idx may be null; only an error if we try to Query later.
   }
 
-  return std::unique_ptr<VcfReader>(
+  std::unique_ptr<VcfReader> reader(
       new VcfReader(variants_path, options, fp, header, idx));
+  if (!options.filter_expression().empty()) {
+    StatusOr<std::unique_ptr<VcfRecordFilter>> filter =
+        VcfRecordFilter::Compile(options.filter_expression(), header);
+    TF_RETURN_IF_ERROR(filter.status());
+    reader->filter_ = std::move(filter.ValueOrDie());
+  }
+  return std::move(reader);
 }
 
 VcfReader::VcfReader(const string& variants_path,
                      const nucleus::genomics::v1::VcfReaderOptions& options,
                      htsFile* fp, bcf_hdr_t* header, tbx_t* idx)
-    : options_(options), fp_(fp), header_(header), idx_(idx),
-      bcf1_(bcf_init()) {
+    : variants_path_(variants_path), options_(options), fp_(fp),
+      header_(header), idx_(idx) {
   if (header_->nhrec < 1) {
     LOG(WARNING) << "Empty header, not a valid VCF.";
     return;
@@ -290,11 +506,19 @@ VcfReader::VcfReader(const string& variants_path,
   vector<string> formats_to_exclude(options.excluded_format_fields().begin(),
                                     options.excluded_format_fields().end());
   record_converter_ =
-      VcfRecordConverter(vcf_header_, infos_to_exclude, formats_to_exclude);
+      VcfRecordConverter(vcf_header_, infos_to_exclude, formats_to_exclude,
+                         header_, options.compact_format_fields());
+  // Records skipped by a filter must be parsed by htslib to be tested anyway,
+  // and the text parser only fills the info maps of calls.
+  if (options.fast_text_parsing() && fp_->format.format == vcf &&
+      options.filter_expression().empty() &&
+      !options.compact_format_fields()) {
+    text_parser_.reset(new VcfTextParser(vcf_header_, infos_to_exclude,
+                                         formats_to_exclude, header_));
+  }
 }
 
 VcfReader::~VcfReader() {
-  bcf_destroy(bcf1_);
   if (fp_) {
     // We cannot return a value from the destructor, so the best we can do is
     // CHECK-fail if the Close() wasn't successful.
@@ -309,8 +533,82 @@ StatusOr<std::shared_ptr<VariantIterable>> VcfReader::Iterate() {
       MakeIterable<VcfFullFileIterable>(this, fp_, header_));
 }
 
-StatusOr<std::shared_ptr<VariantIterable>> VcfReader::Query(
-    const Range& region) {
+StatusOr<std::shared_ptr<VariantIterable>> VcfReader::IterateParallel(
+    int num_threads, int64 shard_size_bases, bool ordered) {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot Iterate a closed VcfReader.");
+  if (!HasIndex()) {
+    return tf::errors::FailedPrecondition(
+        "Cannot iterate in parallel without an index");
+  }
+  if (num_threads < 1)
+    return tf::errors::InvalidArgument("num_threads must be positive");
+
+  return StatusOr<std::shared_ptr<VariantIterable>>(
+      MakeIterable<VcfParallelIterable>(
+          this, variants_path_, MakeShards(idx_, vcf_header_, shard_size_bases),
+          num_threads, ordered));
+}
+
+StatusOr<VcfStats> VcfReader::ComputeStats(int num_threads,
+                                           int64 shard_size_bases) {
+  if (fp_ == nullptr) {
+    return tf::errors::FailedPrecondition(
+        "Cannot ComputeStats of a closed VcfReader.");
+  }
+  if (num_threads < 1)
+    return tf::errors::InvalidArgument("num_threads must be positive");
+
+  std::vector<VcfShard> shards;
+  if (num_threads > 1 && HasIndex()) {
+    shards = MakeShards(idx_, vcf_header_, shard_size_bases);
+  }
+  num_threads = std::max(1, std::min<int>(num_threads, shards.size()));
+
+  absl::Mutex mutex;
+  int next_shard = 0;
+  VcfStats stats;
+  tf::Status status;
+  auto work = [&]() {
+    VcfStats worker_stats;
+    const tf::Status worker_status =
+        AccumulateVcfStats(variants_path_, options_.filter_expression(),
+                           shards, &mutex, &next_shard, &worker_stats);
+    absl::MutexLock lock(&mutex);
+    if (!worker_status.ok()) {
+      if (status.ok()) status = worker_status;
+    } else {
+      MergeVcfStats(worker_stats, &stats);
+    }
+  };
+  if (num_threads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++) workers.emplace_back(work);
+    for (std::thread& worker : workers) worker.join();
+  }
+  TF_RETURN_IF_ERROR(status);
+
+  // Workers merge their contigs in no particular order.
+  std::map<string, int> contig_order;
+  for (int i = 0; i < vcf_header_.contigs_size(); i++) {
+    contig_order[vcf_header_.contigs(i).name()] = i;
+  }
+  auto rank = [&contig_order](const VcfContigStats& contig) {
+    auto it = contig_order.find(contig.name());
+    return it == contig_order.end() ? std::numeric_limits<int>::max()
+                                    : it->second;
+  };
+  std::stable_sort(stats.mutable_contigs()->begin(),
+                   stats.mutable_contigs()->end(),
+                   [&rank](const VcfContigStats& a, const VcfContigStats& b) {
+                     return rank(a) < rank(b);
+                   });
+  return stats;
+}
+
+StatusOr<hts_itr_t*> VcfReader::QueryIterator(const Range& region) const {
   if (fp_ == nullptr)
     return tf::errors::FailedPrecondition("Cannot Query a closed VcfReader.");
   if (!HasIndex()) {
@@ -341,23 +639,250 @@ StatusOr<std::shared_ptr<VariantIterable>> VcfReader::Query(
   }  // implicit else case:
   // The chromosome isn't reflected in the tabix index (meaning, no
   // variant records) => return an *empty* iterable by leaving iter empty.
-  return StatusOr<std::shared_ptr<VariantIterable>>(
-      MakeIterable<VcfQueryIterable>(this, fp_, header_, idx_, iter));
+  return iter;
+}
+
+StatusOr<std::shared_ptr<VariantIterable>> VcfReader::Query(
+    const Range& region) {
+  StatusOr<hts_itr_t*> iter = QueryIterator(region);
+  TF_RETURN_IF_ERROR(iter.status());
+  return StatusOr<std::shared_ptr<VariantIterable>>(MakeIterable<VcfQueryIterable>(
+      this, fp_, header_, idx_, iter.ValueOrDie()));
+}
+
+StatusOr<std::shared_ptr<VcfGenotypeMatrixIterable>>
+VcfReader::QueryGenotypeMatrix(const Range& region,
+                               const VcfGenotypeMatrixOptions& options) {
+  int format_type = BCF_HT_REAL;
+  if (header_ != nullptr && !options.format_field().empty()) {
+    const int id =
+        bcf_hdr_id2int(header_, BCF_DT_ID, options.format_field().c_str());
+    if (!bcf_hdr_idinfo_exists(header_, BCF_HL_FMT, id)) {
+      return tf::errors::NotFound("Unknown FORMAT field '",
+                                  options.format_field(), "'");
+    }
+    format_type = bcf_hdr_id2type(header_, BCF_HL_FMT, id);
+    if (format_type != BCF_HT_INT && format_type != BCF_HT_REAL) {
+      return tf::errors::InvalidArgument(
+          "FORMAT field '", options.format_field(),
+          "' must be of Integer or Float type");
+    }
+  }
+  if (options.ploidy() < 0) {
+    return tf::errors::InvalidArgument("ploidy must be non-negative");
+  }
+  StatusOr<hts_itr_t*> iter = QueryIterator(region);
+  TF_RETURN_IF_ERROR(iter.status());
+  return MakeIterable<VcfGenotypeMatrixIterable>(
+      this, fp_, header_, idx_, iter.ValueOrDie(), options, format_type);
+}
+
+StatusOr<std::shared_ptr<VcfSweepQuery>> VcfReader::SweepQuery(
+    int64 max_skip_bases) {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot Query a closed VcfReader.");
+  if (!HasIndex()) {
+    return tf::errors::FailedPrecondition("Cannot query without an index");
+  }
+  constexpr int64 kDefaultMaxSkipBases = 100000;
+  return MakeIterable<VcfSweepQuery>(
+      this, fp_, header_, idx_,
+      max_skip_bases > 0 ? max_skip_bases : kDefaultMaxSkipBases);
+}
+
+struct VcfReader::ParseBuffers {
+  ParseBuffers() : str({0, 0, nullptr}), bcf1(bcf_init()) {}
+  ~ParseBuffers() {
+    free(str.s);
+    bcf_destroy(bcf1);
+  }
+
+  kstring_t str;
+  bcf1_t* bcf1;
+};
+
+std::unique_ptr<VcfReader::ParseBuffers> VcfReader::AcquireParseBuffers() {
+  absl::MutexLock lock(&pool_mutex_);
+  if (parse_pool_.empty()) {
+    return std::unique_ptr<ParseBuffers>(new ParseBuffers());
+  }
+  std::unique_ptr<ParseBuffers> buffers = std::move(parse_pool_.back());
+  parse_pool_.pop_back();
+  return buffers;
+}
+
+void VcfReader::ReleaseParseBuffers(std::unique_ptr<ParseBuffers> buffers) {
+  absl::MutexLock lock(&pool_mutex_);
+  parse_pool_.push_back(std::move(buffers));
+}
+
+tf::Status VcfReader::ParseLine(absl::string_view vcf_line,
+                                ParseBuffers* buffers,
+                                nucleus::genomics::v1::Variant* v) {
+  if (header_ == nullptr) {
+    return tf::errors::FailedPrecondition(
+        "Cannot parse with a closed VcfReader.");
+  }
+  if (text_parser_ != nullptr && text_parser_->Parse(vcf_line, v)) {
+    return tf::Status::OK();
+  }
+  buffers->str.l = 0;
+  kputsn(vcf_line.data(), vcf_line.size(), &buffers->str);
+
+  // vcf_parse1 writes to the header even when every name in the line is
+  // defined (it keeps a scratch kstring_t in bcf_hdr_t::mem), so parsing
+  // needs the lock exclusively. Conversion only reads the header.
+  {
+    absl::MutexLock lock(&header_mutex_);
+    if (vcf_parse1(&buffers->str, header_, buffers->bcf1) < 0) {
+      return tf::errors::DataLoss("Failed to parse VCF record: ", vcf_line);
+    }
+  }
+  absl::ReaderMutexLock lock(&header_mutex_);
+  return RecordConverter().ConvertToPb(header_, buffers->bcf1, v);
 }
 
 StatusOr<bool> VcfReader::FromString(
     const absl::string_view& vcf_line, nucleus::genomics::v1::Variant* v) {
-  size_t len = vcf_line.length();
-  std::unique_ptr<char[]> cstr{new char[len + 1 ]};
-  std::strncpy(cstr.get(), vcf_line.data(), len);
-  *(cstr.get() + len) = '\0';
-  kstring_t str = {.l = len + 1, .m = len + 1, .s = cstr.get()};
+  std::unique_ptr<ParseBuffers> buffers = AcquireParseBuffers();
+  tf::Status status = ParseLine(vcf_line, buffers.get(), v);
+  ReleaseParseBuffers(std::move(buffers));
+  TF_RETURN_IF_ERROR(status);
+  return true;
+}
 
-  if (vcf_parse1(&str, header_, bcf1_) < 0) {
-    return tf::errors::DataLoss("Failed to parse VCF record: ", cstr.get());
+tf::Status VcfReader::FromStrings(
+    absl::Span<const absl::string_view> vcf_lines,
+    google::protobuf::RepeatedPtrField<nucleus::genomics::v1::Variant>*
+        variants) {
+  std::unique_ptr<ParseBuffers> buffers = AcquireParseBuffers();
+  variants->Reserve(variants->size() + vcf_lines.size());
+  tf::Status status;
+  for (const absl::string_view& vcf_line : vcf_lines) {
+    status = ParseLine(vcf_line, buffers.get(), variants->Add());
+    if (!status.ok()) {
+      variants->RemoveLast();
+      break;
+    }
   }
-  TF_RETURN_IF_ERROR(RecordConverter().ConvertToPb(header_, bcf1_, v));
-  return true;
+  ReleaseParseBuffers(std::move(buffers));
+  return status;
+}
+
+StatusOr<vector<vector<Variant>>> VcfReader::LookupById(
+    const vector<string>& ids) {
+  return Lookup(ids, true);
+}
+
+StatusOr<vector<vector<Variant>>> VcfReader::LookupByAllele(
+    const vector<string>& allele_keys) {
+  return Lookup(allele_keys, false);
+}
+
+namespace {
+
+// Returns true if record, unpacked up to its alleles, has the ID key if by_id
+// is true, or else the allele key key.
+bool RecordHasKey(const bcf_hdr_t* header, bcf1_t* record, const string& key,
+                  bool by_id) {
+  if (by_id) {
+    for (absl::string_view id : absl::StrSplit(record->d.id, ';')) {
+      if (id == key) return true;
+    }
+    return false;
+  }
+  const char* contig = bcf_hdr_id2name(header, record->rid);
+  for (int i = 1; i < record->n_allele; i++) {
+    if (VcfKeyIndex::AlleleKey(contig, record->pos, record->d.allele[0],
+                               record->d.allele[i]) == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+StatusOr<vector<vector<Variant>>> VcfReader::Lookup(const vector<string>& keys,
+                                                    bool by_id) {
+  absl::MutexLock lock(&lookup_mutex_);
+  if (fp_ == nullptr) {
+    return tf::errors::FailedPrecondition(
+        "Cannot Lookup in a closed VcfReader.");
+  }
+  if (key_index_ == nullptr) {
+    StatusOr<std::unique_ptr<VcfKeyIndex>> key_index =
+        VcfKeyIndex::FromFile(VcfKeyIndex::IndexPath(variants_path_),
+                              variants_path_);
+    TF_RETURN_IF_ERROR(key_index.status());
+    lookup_fp_ = hts_open_x(variants_path_.c_str(), "r");
+    if (lookup_fp_ == nullptr) {
+      return tf::errors::NotFound("Could not open ", variants_path_);
+    }
+    // The index holds BGZF virtual offsets, which are only meaningful if the
+    // VCF is still BGZF-compressed.
+    if (lookup_fp_->format.compression != bgzf) {
+      hts_close(lookup_fp_);
+      lookup_fp_ = nullptr;
+      return tf::errors::FailedPrecondition(
+          "Only BGZF-compressed VCFs can be key indexed: ", variants_path_);
+    }
+    lookup_header_ = bcf_hdr_read(lookup_fp_);
+    if (lookup_header_ == nullptr) {
+      hts_close(lookup_fp_);
+      lookup_fp_ = nullptr;
+      return tf::errors::Unknown("Couldn't parse header for ", variants_path_);
+    }
+    key_index_ = std::move(key_index.ValueOrDie());
+  }
+
+  // The (offset, key index) pairs to check, in file order.
+  vector<std::pair<int64, int>> reads;
+  vector<int64> offsets;
+  for (int i = 0; i < keys.size(); i++) {
+    offsets.clear();
+    if (by_id) {
+      key_index_->FindId(keys[i], &offsets);
+    } else {
+      key_index_->FindAllele(keys[i], &offsets);
+    }
+    for (int64 offset : offsets) reads.emplace_back(offset, i);
+  }
+  std::sort(reads.begin(), reads.end());
+
+  vector<vector<Variant>> results(keys.size());
+  BGZF* bgzf = lookup_fp_->fp.bgzf;
+  bcf1_t* bcf1 = bcf_init();
+  tf::Status status;
+  for (int i = 0; status.ok() && i < reads.size();) {
+    const int64 offset = reads[i].first;
+    // Records read in a row need no seek.
+    if ((bgzf_tell(bgzf) != offset && bgzf_seek(bgzf, offset, SEEK_SET) < 0) ||
+        bcf_read(lookup_fp_, lookup_header_, bcf1) < 0) {
+      status = tf::errors::DataLoss("Failed to read VCF record at offset ",
+                                    offset, " of ", variants_path_);
+      break;
+    }
+    bcf_unpack(bcf1, BCF_UN_STR);
+    const bool keep = KeepRecord(bcf1);
+    Variant variant;
+    bool converted = false;
+    for (; i < reads.size() && reads[i].first == offset; i++) {
+      const int key = reads[i].second;
+      if (!keep || !RecordHasKey(lookup_header_, bcf1, keys[key], by_id)) {
+        continue;
+      }
+      if (!converted) {
+        status = record_converter_.ConvertToPb(lookup_header_, bcf1, &variant);
+        if (!status.ok()) break;
+        converted = true;
+      }
+      results[key].push_back(variant);
+    }
+  }
+  bcf_destroy(bcf1);
+  TF_RETURN_IF_ERROR(status);
+  return results;
 }
 
 tf::Status VcfReader::Close() {
@@ -371,6 +896,16 @@ tf::Status VcfReader::Close() {
   header_ = nullptr;
   int retval = hts_close(fp_);
   fp_ = nullptr;
+  {
+    absl::MutexLock lock(&lookup_mutex_);
+    if (lookup_fp_ != nullptr) {
+      bcf_hdr_destroy(lookup_header_);
+      lookup_header_ = nullptr;
+      if (hts_close(lookup_fp_) < 0) retval = -1;
+      lookup_fp_ = nullptr;
+    }
+    key_index_ = nullptr;
+  }
   if (retval < 0) {
     return tf::errors::Internal("hts_close() failed");
   } else {
@@ -382,11 +917,18 @@ tf::Status VcfReader::Close() {
 
 StatusOr<bool> VcfQueryIterable::Next(Variant* out) {
   TF_RETURN_IF_ERROR(CheckIsAlive());
-  if (tbx_itr_next(fp_, idx_, iter_, &str_) < 0) return false;
-  if (vcf_parse1(&str_, header_, bcf1_) < 0) {
-    return tf::errors::DataLoss("Failed to parse VCF record: ", str_.s);
-  }
   const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  do {
+    if (tbx_itr_next(fp_, idx_, iter_, &str_) < 0) return false;
+    // The text parser is only used when there's no filter.
+    if (reader->TextParser() != nullptr &&
+        reader->TextParser()->Parse(absl::string_view(str_.s, str_.l), out)) {
+      return true;
+    }
+    if (vcf_parse1(&str_, header_, bcf1_) < 0) {
+      return tf::errors::DataLoss("Failed to parse VCF record: ", str_.s);
+    }
+  } while (!reader->KeepRecord(bcf1_));
   TF_RETURN_IF_ERROR(
       reader->RecordConverter().ConvertToPb(header_, bcf1_, out));
   return true;
@@ -415,14 +957,27 @@ VcfQueryIterable::VcfQueryIterable(const VcfReader* reader,
 
 StatusOr<bool> VcfFullFileIterable::Next(Variant* out) {
   TF_RETURN_IF_ERROR(CheckIsAlive());
-  if (bcf_read(fp_, header_, bcf1_) < 0) {
-    if (bcf1_->errcode) {
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  if (reader->TextParser() != nullptr) {
+    // This is bcf_read for text VCFs, with the text parser tried first.
+    if (hts_getline(fp_, KS_SEP_LINE, &str_) < 0) return false;
+    if (reader->TextParser()->Parse(absl::string_view(str_.s, str_.l), out)) {
+      return true;
+    }
+    if (vcf_parse1(&str_, header_, bcf1_) < 0) {
       return tf::errors::DataLoss("Failed to parse VCF record");
-    } else {
-      return false;
     }
+    return reader->RecordConverter().ConvertToPb(header_, bcf1_, out);
   }
-  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  do {
+    if (bcf_read(fp_, header_, bcf1_) < 0) {
+      if (bcf1_->errcode) {
+        return tf::errors::DataLoss("Failed to parse VCF record");
+      } else {
+        return false;
+      }
+    }
+  } while (!reader->KeepRecord(bcf1_));
   TF_RETURN_IF_ERROR(
       reader->RecordConverter().ConvertToPb(header_, bcf1_, out));
   return true;
@@ -430,6 +985,7 @@ StatusOr<bool> VcfFullFileIterable::Next(Variant* out) {
 
 VcfFullFileIterable::~VcfFullFileIterable() {
   bcf_destroy(bcf1_);
+  if (str_.s != nullptr) { free(str_.s); }
 }
 
 VcfFullFileIterable::VcfFullFileIterable(const VcfReader* reader,
@@ -438,7 +994,427 @@ VcfFullFileIterable::VcfFullFileIterable(const VcfReader* reader,
     : Iterable(reader),
       fp_(fp),
       header_(header),
-      bcf1_(bcf_init())
+      bcf1_(bcf_init()),
+      str_({0, 0, nullptr})
 {}
 
+VcfParallelIterable::VcfParallelIterable(const VcfReader* reader,
+                                         const string& variants_path,
+                                         std::vector<VcfShard> shards,
+                                         int num_threads, bool ordered)
+    : Iterable(reader),
+      variants_path_(variants_path),
+      options_(reader->Options()),
+      vcf_header_(reader->Header()),
+      shards_(std::move(shards)),
+      ordered_(ordered),
+      max_buffered_batches_(num_threads * kMaxBatchesPerThread),
+      outputs_(ordered ? shards_.size() : 1),
+      running_workers_(num_threads) {
+  for (int i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&VcfParallelIterable::Work, this);
+  }
+}
+
+VcfParallelIterable::~VcfParallelIterable() {
+  {
+    absl::MutexLock lock(&mutex_);
+    cancelled_ = true;
+    cond_.SignalAll();
+  }
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+StatusOr<bool> VcfParallelIterable::Next(Variant* out) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (batch_pos_ == batch_.size()) {
+    batch_.clear();
+    batch_pos_ = 0;
+    absl::MutexLock lock(&mutex_);
+    while (true) {
+      if (!status_.ok()) return status_;
+      ShardOutput* output = nullptr;
+      if (ordered_) {
+        if (current_shard_ == shards_.size()) return false;
+        output = &outputs_[current_shard_];
+        if (output->batches.empty() && output->done) {
+          // Let the workers blocked on the next shard proceed.
+          current_shard_++;
+          cond_.SignalAll();
+          continue;
+        }
+      } else {
+        output = &outputs_[0];
+        if (output->batches.empty() && running_workers_ == 0) return false;
+      }
+      if (!output->batches.empty()) {
+        batch_.swap(output->batches.front());
+        output->batches.pop_front();
+        buffered_batches_--;
+        cond_.SignalAll();
+        break;
+      }
+      cond_.Wait(&mutex_);
+    }
+  }
+  out->Swap(&batch_[batch_pos_++]);
+  return true;
+}
+
+bool VcfParallelIterable::Emit(int shard, std::vector<Variant>* batch,
+                               bool done) {
+  absl::MutexLock lock(&mutex_);
+  while (!cancelled_ && buffered_batches_ >= max_buffered_batches_ &&
+         !(ordered_ && shard == current_shard_)) {
+    cond_.Wait(&mutex_);
+  }
+  if (cancelled_) return false;
+  ShardOutput& output = outputs_[ordered_ ? shard : 0];
+  if (!batch->empty()) {
+    output.batches.emplace_back();
+    output.batches.back().swap(*batch);
+    buffered_batches_++;
+  }
+  if (done && ordered_) output.done = true;
+  cond_.SignalAll();
+  return true;
+}
+
+tf::Status VcfParallelIterable::ProcessShard(
+    int shard, htsFile* fp, bcf_hdr_t* header, tbx_t* idx, bcf1_t* bcf1,
+    kstring_t* str, const VcfRecordConverter& converter,
+    const VcfRecordFilter* filter) {
+  const VcfShard& range = shards_[shard];
+  const int tid = tbx_name2id(idx, range.contig.c_str());
+  hts_itr_t* iter =
+      tid < 0 ? nullptr : tbx_itr_queryi(idx, tid, range.start, range.end);
+  tf::Status status;
+  std::vector<Variant> batch;
+  while (iter != nullptr && tbx_itr_next(fp, idx, iter, str) >= 0) {
+    if (vcf_parse1(str, header, bcf1) < 0) {
+      status = tf::errors::DataLoss("Failed to parse VCF record: ", str->s);
+      break;
+    }
+    // Records overlapping the start of the shard belong to the previous one.
+    if (bcf1->pos < range.start) continue;
+    if (filter != nullptr && !filter->Matches(bcf1)) continue;
+    batch.emplace_back();
+    status = converter.ConvertToPb(header, bcf1, &batch.back());
+    if (!status.ok()) break;
+    if (batch.size() == kBatchSize && !Emit(shard, &batch, false)) break;
+  }
+  hts_itr_destroy(iter);
+  if (status.ok()) Emit(shard, &batch, true);
+  return status;
+}
+
+tf::Status VcfParallelIterable::RunWorker() {
+  htsFile* fp = hts_open_x(variants_path_.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound("Could not open ", variants_path_);
+  }
+  bcf_hdr_t* header = bcf_hdr_read(fp);
+  tbx_t* idx = header != nullptr ? tbx_index_load(fp->fn) : nullptr;
+  bcf1_t* bcf1 = bcf_init();
+  kstring_t str = {0, 0, nullptr};
+
+  tf::Status status;
+  if (header == nullptr) {
+    status = tf::errors::Unknown("Couldn't parse header for ", fp->fn);
+  } else if (idx == nullptr) {
+    status = tf::errors::NotFound("Couldn't load index for ", fp->fn);
+  } else {
+    // The converter and filter are bound to this worker's own header.
+    const VcfRecordConverter converter(
+        vcf_header_,
+        {options_.excluded_info_fields().begin(),
+         options_.excluded_info_fields().end()},
+        {options_.excluded_format_fields().begin(),
+         options_.excluded_format_fields().end()},
+        header, options_.compact_format_fields());
+    std::unique_ptr<VcfRecordFilter> filter;
+    if (!options_.filter_expression().empty()) {
+      StatusOr<std::unique_ptr<VcfRecordFilter>> compiled =
+          VcfRecordFilter::Compile(options_.filter_expression(), header);
+      status = compiled.status();
+      if (status.ok()) filter = std::move(compiled.ValueOrDie());
+    }
+    while (status.ok()) {
+      int shard;
+      {
+        absl::MutexLock lock(&mutex_);
+        if (cancelled_ || next_shard_ == shards_.size()) break;
+        shard = next_shard_++;
+      }
+      status = ProcessShard(shard, fp, header, idx, bcf1, &str, converter,
+                            filter.get());
+    }
+  }
+
+  if (str.s != nullptr) free(str.s);
+  bcf_destroy(bcf1);
+  if (idx != nullptr) tbx_destroy(idx);
+  if (header != nullptr) bcf_hdr_destroy(header);
+  hts_close(fp);
+  return status;
+}
+
+void VcfParallelIterable::Work() {
+  const tf::Status status = RunWorker();
+  absl::MutexLock lock(&mutex_);
+  if (!status.ok() && status_.ok()) status_ = status;
+  running_workers_--;
+  cond_.SignalAll();
+}
+
+VcfGenotypeMatrixIterable::VcfGenotypeMatrixIterable(
+    const VcfReader* reader, htsFile* fp, bcf_hdr_t* header, tbx_t* idx,
+    hts_itr_t* iter, const VcfGenotypeMatrixOptions& options, int format_type)
+    : IterableBase(reader),
+      fp_(fp),
+      header_(header),
+      bcf1_(bcf_init()),
+      idx_(idx),
+      iter_(iter),
+      str_({0, 0, nullptr}),
+      options_(options),
+      n_samples_(bcf_hdr_nsamples(header)),
+      format_type_(format_type)
+{}
+
+VcfGenotypeMatrixIterable::~VcfGenotypeMatrixIterable() {
+  hts_itr_destroy(iter_);
+  bcf_destroy(bcf1_);
+  if (str_.s != nullptr) { free(str_.s); }
+  free(gt_buffer_);
+  free(format_buffer_);
+}
+
+int VcfGenotypeMatrixIterable::ValuesPerSample() const {
+  if (options_.encoding() == VcfGenotypeMatrixOptions::ALLELES) {
+    return options_.ploidy() > 0 ? options_.ploidy() : 2;
+  }
+  return 1;
+}
+
+StatusOr<int> VcfGenotypeMatrixIterable::Next(int max_variants,
+                                              int8* genotypes,
+                                              float* format_values,
+                                              int64* starts) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  const bool want_format_values = !options_.format_field().empty();
+  if (max_variants > 0 &&
+      (genotypes == nullptr || (want_format_values && format_values == nullptr)))
+    return tf::errors::InvalidArgument("Missing output buffer");
+
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  const int64 genotypes_per_row = n_samples_ * ValuesPerSample();
+  int n_rows = 0;
+  // A null iterator means the query window is empty.
+  while (n_rows < max_variants && iter_ != nullptr) {
+    if (tbx_itr_next(fp_, idx_, iter_, &str_) < 0) break;
+    if (vcf_parse1(&str_, header_, bcf1_) < 0) {
+      return tf::errors::DataLoss("Failed to parse VCF record: ", str_.s);
+    }
+    if (!reader->KeepRecord(bcf1_)) continue;
+    TF_RETURN_IF_ERROR(DecodeGenotypes(genotypes + n_rows * genotypes_per_row));
+    if (want_format_values) {
+      TF_RETURN_IF_ERROR(
+          DecodeFormatValues(format_values + n_rows * int64{n_samples_}));
+    }
+    if (starts != nullptr) starts[n_rows] = bcf1_->pos;
+    n_rows++;
+  }
+  return n_rows;
+}
+
+StatusOr<int> VcfGenotypeMatrixIterable::PythonNext(int max_variants,
+                                                    string* genotypes,
+                                                    string* format_values,
+                                                    string* starts) {
+  if (max_variants < 0)
+    return tf::errors::InvalidArgument("max_variants must be non-negative");
+  const bool want_format_values = !options_.format_field().empty();
+  genotypes->resize(int64{max_variants} * n_samples_ * ValuesPerSample());
+  format_values->resize(
+      want_format_values ? int64{max_variants} * n_samples_ * sizeof(float)
+                         : 0);
+  starts->resize(int64{max_variants} * sizeof(int64));
+  StatusOr<int> n_rows = Next(
+      max_variants, reinterpret_cast<int8*>(&(*genotypes)[0]),
+      want_format_values ? reinterpret_cast<float*>(&(*format_values)[0])
+                         : nullptr,
+      reinterpret_cast<int64*>(&(*starts)[0]));
+  TF_RETURN_IF_ERROR(n_rows.status());
+  // Trim the outputs down to the rows actually decoded.
+  genotypes->resize(int64{n_rows.ValueOrDie()} * n_samples_ *
+                    ValuesPerSample());
+  if (want_format_values) {
+    format_values->resize(int64{n_rows.ValueOrDie()} * n_samples_ *
+                          sizeof(float));
+  }
+  starts->resize(int64{n_rows.ValueOrDie()} * sizeof(int64));
+  return n_rows;
+}
+
+tf::Status VcfGenotypeMatrixIterable::DecodeGenotypes(int8* row) {
+  const int width = ValuesPerSample();
+  const int n_gts =
+      bcf_get_genotypes(header_, bcf1_, &gt_buffer_, &n_gt_buffer_);
+  if (n_gts < 0 || n_samples_ == 0) {
+    // No GT in this record, so every sample's genotype is missing.
+    std::fill(row, row + n_samples_ * width, -1);
+    return tf::Status::OK();
+  }
+  const int ploidy = n_gts / n_samples_;
+  const bool dosage =
+      options_.encoding() == VcfGenotypeMatrixOptions::ALT_ALLELE_DOSAGE;
+
+  for (int i = 0; i < n_samples_; i++) {
+    const int32* gt = gt_buffer_ + i * ploidy;
+    int8* out = row + i * width;
+    int n_alleles = 0;
+    int n_alt = 0;
+    bool any_missing = false;
+    for (; n_alleles < ploidy; n_alleles++) {
+      const int32 value = gt[n_alleles];
+      if (value == bcf_int32_vector_end) break;
+      const bool missing =
+          value == bcf_int32_missing || bcf_gt_is_missing(value);
+      const int allele = missing ? -1 : bcf_gt_allele(value);
+      any_missing = any_missing || missing;
+      n_alt += allele > 0;
+      if (!dosage) {
+        if (n_alleles >= width)
+          return tf::errors::InvalidArgument(
+              "Genotype at ", bcf_seqname(header_, bcf1_), ":", bcf1_->pos + 1,
+              " has more alleles than the requested ploidy ", width);
+        if (allele > std::numeric_limits<int8>::max())
+          return tf::errors::InvalidArgument(
+              "Allele index ", allele, " at ", bcf_seqname(header_, bcf1_),
+              ":", bcf1_->pos + 1, " doesn't fit in an int8");
+        out[n_alleles] = allele;
+      }
+    }
+    if (dosage) {
+      *out = any_missing || n_alleles == 0 ? -1 : n_alt;
+    } else {
+      std::fill(out + n_alleles, out + width, -1);
+    }
+  }
+  return tf::Status::OK();
+}
+
+tf::Status VcfGenotypeMatrixIterable::DecodeFormatValues(float* row) {
+  const char* tag = options_.format_field().c_str();
+  const int n_values = bcf_get_format_values(header_, bcf1_, tag,
+                                             &format_buffer_,
+                                             &n_format_buffer_, format_type_);
+  if (n_values < 0 || n_samples_ == 0) {
+    // The field isn't present in this record.
+    std::fill(row, row + n_samples_, std::numeric_limits<float>::quiet_NaN());
+    return tf::Status::OK();
+  }
+  const int values_per_sample = n_values / n_samples_;
+  for (int i = 0; i < n_samples_; i++) {
+    const int offset = i * values_per_sample;
+    if (format_type_ == BCF_HT_INT) {
+      const int32 value = static_cast<const int32*>(format_buffer_)[offset];
+      row[i] = VcfType<int>::IsMissing(value) || VcfType<int>::IsVectorEnd(value)
+                   ? std::numeric_limits<float>::quiet_NaN()
+                   : value;
+    } else {
+      const float value = static_cast<const float*>(format_buffer_)[offset];
+      row[i] =
+          VcfType<float>::IsMissing(value) || VcfType<float>::IsVectorEnd(value)
+              ? std::numeric_limits<float>::quiet_NaN()
+              : value;
+    }
+  }
+  return tf::Status::OK();
+}
+
+VcfSweepQuery::VcfSweepQuery(const VcfReader* reader, htsFile* fp,
+                             bcf_hdr_t* header, tbx_t* idx,
+                             int64 max_skip_bases)
+    : IterableBase(reader),
+      fp_(fp),
+      header_(header),
+      bcf1_(bcf_init()),
+      idx_(idx),
+      iter_(nullptr),
+      str_({0, 0, nullptr}),
+      max_skip_bases_(max_skip_bases)
+{}
+
+VcfSweepQuery::~VcfSweepQuery() {
+  hts_itr_destroy(iter_);
+  bcf_destroy(bcf1_);
+  if (str_.s != nullptr) { free(str_.s); }
+}
+
+tf::Status VcfSweepQuery::Seek(const Range& region) {
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  Range rest = region;
+  rest.set_end(std::numeric_limits<int32>::max());
+  StatusOr<hts_itr_t*> iter = reader->QueryIterator(rest);
+  TF_RETURN_IF_ERROR(iter.status());
+  hts_itr_destroy(iter_);
+  iter_ = iter.ValueOrDie();
+  exhausted_ = iter_ == nullptr;
+  next_start_ = region.start();
+  buffer_.clear();
+  n_seeks_++;
+  return tf::Status::OK();
+}
+
+StatusOr<vector<Variant>> VcfSweepQuery::Query(const Range& region) {
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (region.start() < 0 || region.start() >= region.end())
+    return tf::errors::InvalidArgument(
+        "Malformed region '", region.ShortDebugString(), "'");
+  if (region.reference_name() != contig_ || region.start() < last_start_ ||
+      (!exhausted_ && region.start() - next_start_ > max_skip_bases_)) {
+    TF_RETURN_IF_ERROR(Seek(region));
+    contig_ = region.reference_name();
+  }
+  last_start_ = region.start();
+
+  // Variants ending by the start of region can't overlap it or any later
+  // region, so they are dropped.
+  buffer_.erase(std::remove_if(buffer_.begin(), buffer_.end(),
+                               [&region](const Variant& variant) {
+                                 return variant.end() <= region.start();
+                               }),
+                buffer_.end());
+
+  // Read on until a record starts at or after the end of region; it is kept
+  // for the next region.
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  while (!exhausted_ && next_start_ < region.end()) {
+    if (tbx_itr_next(fp_, idx_, iter_, &str_) < 0) {
+      exhausted_ = true;
+      break;
+    }
+    if (vcf_parse1(&str_, header_, bcf1_) < 0) {
+      return tf::errors::DataLoss("Failed to parse VCF record: ", str_.s);
+    }
+    next_start_ = bcf1_->pos;
+    if (bcf1_->pos + bcf1_->rlen <= region.start()) continue;
+    if (!reader->KeepRecord(bcf1_)) continue;
+    buffer_.emplace_back();
+    TF_RETURN_IF_ERROR(reader->RecordConverter().ConvertToPb(
+        header_, bcf1_, &buffer_.back()));
+  }
+
+  vector<Variant> variants;
+  for (const Variant& variant : buffer_) {
+    if (variant.start() >= region.end()) break;
+    variants.push_back(variant);
+  }
+  return variants;
+}
+
 }  // namespace nucleus
@@ -18,13 +18,22 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_VCF_READER_H_
 #define THIRD_PARTY_NUCLEUS_IO_VCF_READER_H_
 
+#include <memory>
+#include <vector>
+
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "htslib/hts.h"
+#include "htslib/kstring.h"
 #include "htslib/sam.h"
 #include "htslib/tbx.h"
 #include "htslib/vcf.h"
 #include "nucleus/io/reader_base.h"
 #include "nucleus/io/vcf_conversion.h"
+#include "nucleus/io/vcf_filter.h"
+#include "nucleus/io/vcf_key_index.h"
+#include "nucleus/io/vcf_text_parser.h"
 #include "nucleus/protos/range.pb.h"
 #include "nucleus/protos/reference.pb.h"
 #include "nucleus/protos/variants.pb.h"
@@ -37,6 +46,9 @@ namespace nucleus {
 // Alias for the abstract base class for VCF record iterables.
 using VariantIterable = Iterable<nucleus::genomics::v1::Variant>;
 
+class VcfGenotypeMatrixIterable;  // Forward declaration.
+class VcfSweepQuery;  // Forward declaration.
+
 // A VCF reader that provides access to Tabix indexed VCF files.
 //
 // VCF files store information about genetic variation:
@@ -91,6 +103,35 @@ class VcfReader : public Reader {
   // constructed, or not OK otherwise.
   StatusOr<std::shared_ptr<VariantIterable>> Iterate();
 
+  // Gets all of the variants in this file using num_threads worker threads.
+  //
+  // The file is split along its index into shards: one per contig with
+  // records, further split into windows of shard_size_bases if that is
+  // positive and the contig's length is known from the header. Each worker
+  // opens the file independently and converts whole shards, so conversion
+  // scales with num_threads on large files. If ordered is true, variants are
+  // returned in file order, exactly as by Iterate(); otherwise they are
+  // returned as soon as they are converted, in no particular order across
+  // shards, which suits consumers that don't care about order.
+  //
+  // This function is only available if an index was loaded. If no index was
+  // loaded a non-OK status value will be returned.
+  StatusOr<std::shared_ptr<VariantIterable>> IterateParallel(
+      int num_threads, int64 shard_size_bases, bool ordered);
+
+  // Computes summary statistics of all records in this file that pass
+  // options.filter_expression: per-contig counts, variant types, Ti/Tv, call
+  // rates and the allele frequency spectrum (see VcfStats).
+  //
+  // This makes a single pass over the file straight from htslib records, with
+  // no Variant protos. If an index was loaded and num_threads is greater than
+  // 1, the file is split into shards as by IterateParallel and num_threads
+  // workers, each with its own htsFile, compute the statistics of their shards
+  // in parallel; otherwise the whole file is read by one thread. This reader's
+  // iterables are unaffected.
+  StatusOr<nucleus::genomics::v1::VcfStats> ComputeStats(
+      int num_threads, int64 shard_size_bases);
+
   // Gets all of the variants that overlap any bases in range.
   //
   // This function allows one to iterate through all of the variants in this
@@ -109,10 +150,82 @@ class VcfReader : public Reader {
   StatusOr<std::shared_ptr<VariantIterable>> Query(
       const nucleus::genomics::v1::Range& region);
 
-  // Parses vcf_line and puts the result into v.
+  // Gets the genotypes of all variants that overlap any bases in range as
+  // dense matrices, with one row per variant and one column per sample.
+  //
+  // This is meant for cohort-scale analyses that only need genotypes (and
+  // perhaps one other per-sample value, such as DS or GQ): records are
+  // decoded straight into caller-provided buffers with no Variant or
+  // VariantCall protos in between. The row encoding is controlled by options.
+  //
+  // Like Query, this requires an index and returns a non-OK status if range
+  // isn't a valid interval in this VCF file, or if options.format_field isn't
+  // an Integer or Float FORMAT field of this VCF.
+  StatusOr<std::shared_ptr<VcfGenotypeMatrixIterable>> QueryGenotypeMatrix(
+      const nucleus::genomics::v1::Range& region,
+      const nucleus::genomics::v1::VcfGenotypeMatrixOptions& options);
+
+  // Gets a cursor for querying many regions in increasing order, such as the
+  // spans of reads from a sorted BAM, much faster than by calling Query on
+  // each.
+  //
+  // The cursor keeps the variants overlapping the current region and reads
+  // forward through the index iterator as the regions move on, so each record
+  // is parsed and converted only once however many regions it overlaps. It
+  // seeks only when a region starts more than max_skip_bases past the last
+  // record read (a default of 100000 if max_skip_bases isn't positive), is on
+  // another contig, or starts before the previous region. Each query returns
+  // exactly the variants Query would, so regions in any order give correct
+  // results, only more slowly.
+  //
+  // Like Query, this requires an index and returns a non-OK status if no
+  // index was loaded.
+  StatusOr<std::shared_ptr<VcfSweepQuery>> SweepQuery(int64 max_skip_bases);
+
+  // Gets the records with each of ids, such as dbSNP rsIDs, among their IDs.
+  //
+  // This needs the key index of this VCF, built by VcfKeyIndex::Build at
+  // VcfKeyIndex::IndexPath of its path, which is loaded on first use and
+  // rejected if the VCF has changed since it was built. The records of all ids are read in file order, each once, however many ids it
+  // has. The result has one list of the matching records, in file order, per
+  // id, after options.filter_expression is applied.
+  //
+  // Lookups read through their own handle on the file, so they don't disturb
+  // iterables, and concurrent lookups are serialized.
+  StatusOr<std::vector<std::vector<nucleus::genomics::v1::Variant>>>
+  LookupById(const std::vector<string>& ids);
+
+  // Like LookupById, but gets the records with each of allele_keys, formatted
+  // as by VcfKeyIndex::AlleleKey: the records on its contig at its position
+  // with its reference allele and its alternate allele among theirs.
+  StatusOr<std::vector<std::vector<nucleus::genomics::v1::Variant>>>
+  LookupByAllele(const std::vector<string>& allele_keys);
+
+  // Parses vcf_line and puts the result into v. Like FromStrings, this can be
+  // called concurrently from several threads, but not while an iterable of
+  // this reader is in use; see FromStrings.
   StatusOr<bool> FromString(const absl::string_view& vcf_line,
                             nucleus::genomics::v1::Variant* v);
 
+  // Parses each of vcf_lines and appends the results to variants. This reuses
+  // one set of htslib parse buffers for the whole batch, so it is much faster
+  // than calling FromString on each line.
+  //
+  // Concurrent calls to FromString and FromStrings each use their own buffers
+  // from a pool. htslib's parser writes to the header as it parses (a scratch
+  // buffer, plus definitions of undeclared contigs, filters and fields), so
+  // lines it parses are parsed one at a time under a lock; only lines taken by
+  // the fast text parser (see VcfReaderOptions.fast_text_parsing) and the
+  // conversion of parsed records to Variants run in parallel. The iterables
+  // returned by Iterate, Query and the other iteration methods parse with the
+  // same header without that lock, so FromString and FromStrings must not be
+  // called while one of them is in use. Returns DataLoss, with the results
+  // for the lines before it appended, if a line can't be parsed.
+  tensorflow::Status FromStrings(
+      absl::Span<const absl::string_view> vcf_lines,
+      google::protobuf::RepeatedPtrField<nucleus::genomics::v1::Variant>*
+          variants);
+
   // Returns True if this VcfReader loaded an index file.
   bool HasIndex() const { return idx_ != nullptr; }
 
@@ -137,11 +250,33 @@ class VcfReader : public Reader {
     return record_converter_;
   }
 
+  // The parser of simple text records, or null unless
+  // options.fast_text_parsing applies to this reader.
+  const VcfTextParser* TextParser() const { return text_parser_.get(); }
+
+  // Returns true if record passes options.filter_expression (always true if
+  // there is none). Iterables skip records for which this is false.
+  bool KeepRecord(bcf1_t* record) const {
+    return filter_ == nullptr || filter_->Matches(record);
+  }
+
  private:
+  // Returns the tabix iterator over region, after checking that this reader
+  // can be queried over region. The iterator is null if region's contig has no
+  // records in the index.
+  StatusOr<hts_itr_t*> QueryIterator(
+      const nucleus::genomics::v1::Range& region) const;
+
   VcfReader(const string& variants_path,
             const nucleus::genomics::v1::VcfReaderOptions& options, htsFile* fp,
             bcf_hdr_t* header, tbx_t* idx);
 
+  // Allow VcfSweepQuery to check and seek with QueryIterator.
+  friend class VcfSweepQuery;
+
+  // The path of the VCF file, so that it can be reopened by IterateParallel.
+  const string variants_path_;
+
   // The options controlling the behavior of this VcfReader.
   const nucleus::genomics::v1::VcfReaderOptions options_;
 
@@ -162,8 +297,166 @@ class VcfReader : public Reader {
   // Object for converting VCF records to to Variant proto.
   VcfRecordConverter record_converter_;
 
-  // htslib's representation of a parsed vcf line.  Only used by FromString.
+  // The compiled options_.filter_expression, or null if there is none.
+  std::unique_ptr<VcfRecordFilter> filter_;
+
+  // Parses simple text records into Variants directly if
+  // options_.fast_text_parsing applies; see TextParser().
+  std::unique_ptr<VcfTextParser> text_parser_;
+
+  // The kstring_t and bcf1_t used by FromString and FromStrings to parse a
+  // line; defined in vcf_reader.cc.
+  struct ParseBuffers;
+
+  // Takes a set of parse buffers from parse_pool_, or makes a new one if the
+  // pool is empty, and gives it back.
+  std::unique_ptr<ParseBuffers> AcquireParseBuffers();
+  void ReleaseParseBuffers(std::unique_ptr<ParseBuffers> buffers);
+
+  // Parses vcf_line into buffers and converts it into v, holding header_mutex_
+  // exclusively while parsing and shared while converting.
+  tensorflow::Status ParseLine(absl::string_view vcf_line,
+                               ParseBuffers* buffers,
+                               nucleus::genomics::v1::Variant* v);
+
+  // Implements LookupById if by_id is true, and LookupByAllele otherwise.
+  StatusOr<std::vector<std::vector<nucleus::genomics::v1::Variant>>> Lookup(
+      const std::vector<string>& keys, bool by_id);
+
+  // The key index and the file handle and header used by lookups, opened on
+  // the first one and guarded by lookup_mutex_.
+  absl::Mutex lookup_mutex_;
+  std::unique_ptr<VcfKeyIndex> key_index_;
+  htsFile* lookup_fp_ = nullptr;
+  bcf_hdr_t* lookup_header_ = nullptr;
+
+  // Guards header_ in FromString and FromStrings. vcf_parse1 writes to the
+  // header's scratch buffer on every call, and adds definitions when it meets
+  // an undefined name.
+  absl::Mutex header_mutex_;
+
+  // Parse buffers not currently in use by FromString or FromStrings.
+  absl::Mutex pool_mutex_;
+  std::vector<std::unique_ptr<ParseBuffers>> parse_pool_;
+};
+
+// Iterable class for streaming dense genotype matrices out of a VCF query
+// window; see VcfReader::QueryGenotypeMatrix.
+//
+// Matrices are row-major with one row per variant. Each row of the genotype
+// matrix has NumSamples() * ValuesPerSample() int8 values, each row of the
+// optional FORMAT field matrix has NumSamples() floats.
+class VcfGenotypeMatrixIterable : public IterableBase {
+ public:
+  // Decodes up to max_variants further variants into rows of the
+  // caller-provided buffers, and returns the number of rows written, which is
+  // less than max_variants only once the query window is exhausted.
+  //
+  // genotypes must have room for max_variants rows. format_values must have
+  // room for max_variants rows if a format_field was requested, and is
+  // otherwise ignored. If starts is not null, the start of each variant is
+  // written to it.
+  StatusOr<int> Next(int max_variants, int8* genotypes, float* format_values,
+                     int64* starts);
+
+  // Same as Next, except that the rows are returned as byte strings in
+  // native byte order (suitable for numpy.frombuffer), since raw buffers can't
+  // be passed through CLIF.
+  StatusOr<int> PythonNext(int max_variants, string* genotypes,
+                           string* format_values, string* starts);
+
+  // The number of columns of the matrices.
+  int NumSamples() const { return n_samples_; }
+
+  // The number of int8 genotype values per sample.
+  int ValuesPerSample() const;
+
+  // Constructor will be invoked via VcfReader::QueryGenotypeMatrix.
+  VcfGenotypeMatrixIterable(
+      const VcfReader* reader, htsFile* fp, bcf_hdr_t* header, tbx_t* idx,
+      hts_itr_t* iter,
+      const nucleus::genomics::v1::VcfGenotypeMatrixOptions& options,
+      int format_type);
+
+  ~VcfGenotypeMatrixIterable() override;
+
+ private:
+  // Decodes the GT field of bcf1_ into one row of the genotype matrix.
+  tensorflow::Status DecodeGenotypes(int8* row);
+
+  // Decodes the first value per sample of the requested FORMAT field of bcf1_
+  // into one row of the FORMAT field matrix.
+  tensorflow::Status DecodeFormatValues(float* row);
+
+  htsFile* fp_;
+  bcf_hdr_t* header_;
   bcf1_t* bcf1_;
+  tbx_t* idx_;
+  hts_itr_t* iter_;
+  kstring_t str_;
+
+  const nucleus::genomics::v1::VcfGenotypeMatrixOptions options_;
+  const int n_samples_;
+  // The htslib type (BCF_HT_INT or BCF_HT_REAL) of options_.format_field.
+  const int format_type_;
+
+  // Scratch buffers reused across records by the bcf_get_format_* calls.
+  int32* gt_buffer_ = nullptr;
+  int n_gt_buffer_ = 0;
+  void* format_buffer_ = nullptr;
+  int n_format_buffer_ = 0;
+};
+
+// A cursor for querying the variants overlapping a series of regions in
+// increasing order; see VcfReader::SweepQuery.
+class VcfSweepQuery : public IterableBase {
+ public:
+  // Returns the variants that overlap any bases in region, in file order.
+  //
+  // If region is on the current contig and doesn't start before the previous
+  // one, variants read for earlier regions that still overlap it are reused
+  // and the index iterator reads forward from where it left off. Otherwise
+  // this seeks to region's start as Query does.
+  StatusOr<std::vector<nucleus::genomics::v1::Variant>> Query(
+      const nucleus::genomics::v1::Range& region);
+
+  // The number of index seeks made so far, including the first.
+  int64 NumSeeks() const { return n_seeks_; }
+
+  // Constructor will be invoked via VcfReader::SweepQuery.
+  VcfSweepQuery(const VcfReader* reader, htsFile* fp, bcf_hdr_t* header,
+                tbx_t* idx, int64 max_skip_bases);
+
+  ~VcfSweepQuery() override;
+
+ private:
+  // Replaces the index iterator with one from region's start to the end of
+  // its contig, and drops the buffered variants.
+  tensorflow::Status Seek(const nucleus::genomics::v1::Range& region);
+
+  htsFile* fp_;
+  bcf_hdr_t* header_;
+  bcf1_t* bcf1_;
+  tbx_t* idx_;
+  hts_itr_t* iter_;
+  kstring_t str_;
+  const int64 max_skip_bases_;
+
+  // The contig and start of the previous region, or an empty contig before
+  // the first query.
+  string contig_;
+  int64 last_start_ = 0;
+
+  // The start of the last record read from iter_, and whether iter_ has
+  // reached the end of contig_.
+  int64 next_start_ = 0;
+  bool exhausted_ = true;
+
+  // The variants read so far that end after last_start_, in file order. The
+  // last one may start after the end of the previous region.
+  std::vector<nucleus::genomics::v1::Variant> buffer_;
+
+  int64 n_seeks_ = 0;
 };
 
 }  // namespace nucleus
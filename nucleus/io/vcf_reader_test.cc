@@ -17,26 +17,37 @@
 
 #include "nucleus/io/vcf_reader.h"
 
+#include <algorithm>
+#include <functional>
+#include <thread>  // NOLINT
+#include <vector>
+
 #include "nucleus/protos/variants.pb.h"
 #include "nucleus/testing/protocol-buffer-matchers.h"
 #include "nucleus/testing/test_utils.h"
 #include "nucleus/util/utils.h"
+#include "nucleus/util/variantcall_utils.h"
+#include "nucleus/vendor/status_matchers.h"
 
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
 #include <gmock/gmock-more-matchers.h>
 
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/test.h"
 
 namespace nucleus {
 
 using std::vector;
 
+using ::testing::ElementsAre;
 using ::testing::Eq;
 using ::testing::Not;
 using ::testing::Pointwise;
 using ::testing::SizeIs;
 
+using nucleus::genomics::v1::Range;
 using nucleus::genomics::v1::Variant;
 using nucleus::proto::IgnoringFieldPaths;
 
@@ -219,6 +230,146 @@ TEST_F(VcfWithSamplesReaderTest, IterationWorksWithIndex) {
   EXPECT_THAT(as_vector(reader_->Iterate()), Pointwise(EqualsProto(), golden_));
 }
 
+TEST_F(VcfWithSamplesReaderTest, ParallelIterationMatchesIterate) {
+  // Whole-contig shards and sub-contig shards small enough that several
+  // records straddle shard boundaries.
+  for (int64 shard_size : {0, 10000}) {
+    EXPECT_THAT(
+        as_vector(reader_->IterateParallel(3, shard_size, /*ordered=*/true)),
+        Pointwise(EqualsProto(), golden_))
+        << shard_size;
+  }
+}
+
+TEST_F(VcfWithSamplesReaderTest, UnorderedParallelIterationReturnsAll) {
+  auto by_serialization = [](const Variant& a, const Variant& b) {
+    return a.SerializeAsString() < b.SerializeAsString();
+  };
+  vector<Variant> variants =
+      as_vector(reader_->IterateParallel(4, 10000, /*ordered=*/false));
+  std::sort(variants.begin(), variants.end(), by_serialization);
+  std::sort(golden_.begin(), golden_.end(), by_serialization);
+  EXPECT_THAT(variants, Pointwise(EqualsProto(), golden_));
+}
+
+TEST_F(VcfWithSamplesReaderTest, ParallelIterationAppliesFilter) {
+  options_.set_filter_expression("QUAL >= 50");
+  RecreateReader();
+  vector<Variant> expected;
+  for (const Variant& v : golden_) {
+    if (v.quality() >= 50) expected.push_back(v);
+  }
+  EXPECT_THAT(as_vector(reader_->IterateParallel(2, 0, /*ordered=*/true)),
+              Pointwise(EqualsProto(), expected));
+}
+
+TEST(VcfReaderParallelTest, RequiresIndex) {
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(GetTestData(kVcfSamplesFilename),
+                                    nucleus::genomics::v1::VcfReaderOptions())
+                    .ValueOrDie());
+  EXPECT_THAT(reader->IterateParallel(2, 0, true).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "without an index"));
+}
+
+TEST_F(VcfWithSamplesReaderTest, CompactFormatFieldsExpandToGolden) {
+  options_.set_compact_format_fields(true);
+  RecreateReader();
+  vector<Variant> variants = as_vector(reader_->Iterate());
+  ASSERT_THAT(variants, SizeIs(golden_.size()));
+  for (Variant& variant : variants) {
+    EXPECT_GT(variant.compact_format_fields_size(), 0);
+    for (const auto& call : variant.calls()) {
+      EXPECT_TRUE(call.info().empty());
+    }
+    ASSERT_THAT(ExpandCompactFormatFields(&variant), IsOK());
+  }
+  EXPECT_THAT(variants, Pointwise(EqualsProto(), golden_));
+}
+
+TEST(VcfReaderStatsTest, ComputesStats) {
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(GetTestData("test_normalize.vcf"),
+                                    nucleus::genomics::v1::VcfReaderOptions())
+                    .ValueOrDie());
+  StatusOr<nucleus::genomics::v1::VcfStats> stats = reader->ComputeStats(1, 0);
+  ASSERT_THAT(stats.status(), IsOK());
+  EXPECT_THAT(stats.ValueOrDie(), EqualsProto(R"(
+    num_records: 6
+    contigs { name: "chr1" num_records: 5 }
+    contigs { name: "chr2" num_records: 1 }
+    num_snps: 2
+    num_mnps: 1
+    num_indels: 2
+    num_other: 1
+    num_multiallelic: 1
+    num_transversions: 2
+    num_samples: 1
+    num_genotypes: 6
+    num_called_genotypes: 6
+    called_genotypes_per_sample: 6
+    allele_count_histogram: [1, 5, 1]
+  )"));
+}
+
+TEST(VcfReaderStatsTest, HandlesPartiallyMissingGenotypes) {
+  // Sample S1 is half-missing at 10 and has no GT value at all at 30 (htslib
+  // fills it with bcf_int32_missing); S2 is haploid at 10.
+  const string path = MakeTempFile("partially_missing_genotypes.vcf");
+  TF_CHECK_OK(tensorflow::WriteStringToFile(
+      tensorflow::Env::Default(), path,
+      "##fileformat=VCFv4.2\n"
+      "##contig=<ID=chr1,length=1000>\n"
+      "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
+      "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Depth\">\n"
+      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS1\tS2\tS3\n"
+      "chr1\t10\t.\tA\tC\t.\t.\t.\tGT\t0/.\t1\t./.\n"
+      "chr1\t20\t.\tG\tT\t.\t.\t.\tGT\t1/1\t0/1\t.\n"
+      "chr1\t30\t.\tC\tG\t.\t.\t.\tDP:GT\t5\t7:0/1\t8:1/1\n"));
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(path,
+                                    nucleus::genomics::v1::VcfReaderOptions())
+                    .ValueOrDie());
+  StatusOr<nucleus::genomics::v1::VcfStats> stats = reader->ComputeStats(1, 0);
+  ASSERT_THAT(stats.status(), IsOK());
+  EXPECT_EQ(stats.ValueOrDie().num_genotypes(), 9);
+  EXPECT_EQ(stats.ValueOrDie().num_called_genotypes(), 5);
+  EXPECT_THAT(stats.ValueOrDie().called_genotypes_per_sample(),
+              ElementsAre(1, 3, 1));
+  EXPECT_THAT(stats.ValueOrDie().allele_count_histogram(),
+              ElementsAre(0, 1, 0, 2));
+}
+
+TEST_F(VcfWithSamplesReaderTest, ParallelStatsMatchSingleThreaded) {
+  StatusOr<nucleus::genomics::v1::VcfStats> expected =
+      reader_->ComputeStats(1, 0);
+  ASSERT_THAT(expected.status(), IsOK());
+  EXPECT_EQ(expected.ValueOrDie().num_records(), golden_.size());
+  for (int64 shard_size : {0, 10000}) {
+    StatusOr<nucleus::genomics::v1::VcfStats> stats =
+        reader_->ComputeStats(3, shard_size);
+    ASSERT_THAT(stats.status(), IsOK());
+    EXPECT_THAT(stats.ValueOrDie(), EqualsProto(expected.ValueOrDie()))
+        << shard_size;
+  }
+}
+
+TEST_F(VcfWithSamplesReaderTest, StatsApplyFilter) {
+  options_.set_filter_expression("QUAL >= 50");
+  RecreateReader();
+  int64 expected = 0;
+  for (const Variant& v : golden_) {
+    if (v.quality() >= 50) expected++;
+  }
+  for (int num_threads : {1, 2}) {
+    StatusOr<nucleus::genomics::v1::VcfStats> stats =
+        reader_->ComputeStats(num_threads, 0);
+    ASSERT_THAT(stats.status(), IsOK());
+    EXPECT_EQ(stats.ValueOrDie().num_records(), expected) << num_threads;
+  }
+}
+
 TEST_F(VcfWithSamplesReaderTest, FilteringInfoFieldsWorks) {
   // Checks that iterate() filters FORMAT fields out as we expect.
   nucleus::genomics::v1::VcfReaderOptions options;
@@ -294,6 +445,67 @@ TEST_F(VcfWithSamplesReaderTest, FilteringFormatFieldsWorks) {
                         golden_));
 }
 
+TEST_F(VcfWithSamplesReaderTest, FilterExpressionMatchesProtoFilter) {
+  // Each expression should keep exactly the golden variants satisfying the
+  // equivalent predicate on the converted protos.
+  const std::vector<
+      std::pair<string, std::function<bool(const Variant&)>>> cases = {
+      {"QUAL >= 50", [](const Variant& v) { return v.quality() >= 50; }},
+      {"FILTER == PASS && !INFO/DB",
+       [](const Variant& v) {
+         return std::find(v.filter().begin(), v.filter().end(), "PASS") !=
+                    v.filter().end() &&
+                !v.info().at("DB").values(0).bool_value();
+       }},
+      {"INFO/AF > 0.6 || N_ALT > 1",
+       [](const Variant& v) {
+         for (const auto& value : v.info().at("AF").values()) {
+           if (value.number_value() > 0.6) return true;
+         }
+         return v.alternate_bases_size() > 1;
+       }},
+      {"CHROM == chr3 && POS < 200000",
+       [](const Variant& v) {
+         return v.reference_name() == "chr3" && v.start() + 1 < 200000;
+       }},
+  };
+  for (const auto& test_case : cases) {
+    options_.set_filter_expression(test_case.first);
+    RecreateReader();
+    vector<Variant> expected;
+    for (const Variant& v : golden_) {
+      if (test_case.second(v)) expected.push_back(v);
+    }
+    ASSERT_THAT(expected, Not(SizeIs(0))) << test_case.first;
+    EXPECT_THAT(as_vector(reader_->Iterate()),
+                Pointwise(EqualsProto(), expected))
+        << test_case.first;
+  }
+}
+
+TEST_F(VcfWithSamplesReaderTest, FilterExpressionRegion) {
+  options_.set_filter_expression("REGION(chr3:14,300-14,400)");
+  RecreateReader();
+  vector<Variant> filtered = as_vector(reader_->Iterate());
+  vector<Variant> queried =
+      as_vector(reader_->Query(MakeRange("chr3", 14299, 14400)));
+  EXPECT_THAT(filtered, Not(SizeIs(0)));
+  EXPECT_THAT(filtered, Pointwise(EqualsProto(), queried));
+}
+
+TEST_F(VcfWithSamplesReaderTest, InvalidFilterExpressionsAreRejected) {
+  for (const char* expression :
+       {"QUAL >", "QUAL > abc", "INFO/NOT_A_FIELD", "FILTER == NOT_A_FILTER",
+        "CHROM < chr1", "(SNP", "SNP INDEL", "REGION(chr1:10)",
+        "INFO/DB == 1", "\"unterminated"}) {
+    options_.set_filter_expression(expression);
+    EXPECT_THAT(VcfReader::FromFile(indexed_vcf_, options_).status(),
+                IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                          "Invalid filter expression"))
+        << expression;
+  }
+}
+
 TEST_F(VcfWithSamplesReaderTest, QueryWorks) {
   // Get all of the variants on chr1 from golden.
   vector<Variant> subgolden;
@@ -307,6 +519,116 @@ TEST_F(VcfWithSamplesReaderTest, QueryWorks) {
               Pointwise(EqualsProto(), subgolden));
 }
 
+TEST_F(VcfWithSamplesReaderTest, GenotypeMatrixMatchesQuery) {
+  vector<Variant> subgolden;
+  for (Variant& v : golden_) {
+    if (v.reference_name() == "chr1")
+        subgolden.push_back(v);
+  }
+
+  nucleus::genomics::v1::VcfGenotypeMatrixOptions options;
+  options.set_encoding(nucleus::genomics::v1::VcfGenotypeMatrixOptions::ALLELES);
+  options.set_format_field("GQ");
+  auto iterable = reader_->QueryGenotypeMatrix(MakeRange("chr1", 0, CHR1_SIZE),
+                                               options).ValueOrDie();
+  ASSERT_EQ(1, iterable->NumSamples());
+  ASSERT_EQ(2, iterable->ValuesPerSample());
+
+  // Decode in small blocks to exercise resuming between calls.
+  const int kBlockSize = 7;
+  std::vector<int8> genotypes(kBlockSize * 2);
+  std::vector<float> gqs(kBlockSize);
+  std::vector<int64> starts(kBlockSize);
+  int n_seen = 0;
+  while (true) {
+    int n = iterable->Next(kBlockSize, genotypes.data(), gqs.data(),
+                           starts.data()).ValueOrDie();
+    if (n == 0) break;
+    for (int i = 0; i < n; i++, n_seen++) {
+      ASSERT_LT(n_seen, subgolden.size());
+      const Variant& expected = subgolden[n_seen];
+      const auto& call = expected.calls(0);
+      EXPECT_EQ(expected.start(), starts[i]);
+      for (int j = 0; j < 2; j++) {
+        EXPECT_EQ(j < call.genotype_size() ? call.genotype(j) : -1,
+                  genotypes[i * 2 + j]);
+      }
+      EXPECT_EQ(call.info().at("GQ").values(0).int_value(), gqs[i]);
+    }
+  }
+  EXPECT_EQ(subgolden.size(), n_seen);
+}
+
+TEST_F(VcfWithSamplesReaderTest, GenotypeMatrixDosages) {
+  nucleus::genomics::v1::VcfGenotypeMatrixOptions options;
+  auto iterable =
+      reader_->QueryGenotypeMatrix(MakeRange("chr3", 14317, 14319), options)
+          .ValueOrDie();
+  ASSERT_EQ(1, iterable->ValuesPerSample());
+  int8 dosage = 0;
+  EXPECT_EQ(1, iterable->Next(1, &dosage, nullptr, nullptr).ValueOrDie());
+  int n_alt = 0;
+  for (const Variant& v : golden_) {
+    if (v.reference_name() == "chr3" && v.start() == 14318) {
+      for (int allele : v.calls(0).genotype()) n_alt += allele > 0;
+    }
+  }
+  EXPECT_EQ(n_alt, dosage);
+  EXPECT_EQ(0, iterable->Next(1, &dosage, nullptr, nullptr).ValueOrDie());
+}
+
+TEST_F(VcfWithSamplesReaderTest, GenotypeMatrixRejectsBadFormatField) {
+  nucleus::genomics::v1::VcfGenotypeMatrixOptions options;
+  options.set_format_field("NOT_A_FIELD");
+  EXPECT_THAT(
+      reader_->QueryGenotypeMatrix(MakeRange("chr1", 0, 100), options).status(),
+      IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                "Unknown FORMAT field"));
+  options.set_format_field("PID");
+  EXPECT_THAT(
+      reader_->QueryGenotypeMatrix(MakeRange("chr1", 0, 100), options).status(),
+      IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                "must be of Integer or Float type"));
+}
+
+TEST_F(VcfWithSamplesReaderTest, SweepQueryMatchesQuery) {
+  // Overlapping windows in increasing order, as for sorted reads, then a jump
+  // far ahead, one to another contig and one back.
+  vector<Range> regions;
+  for (int64 start = 13000; start < 300000; start += 250) {
+    regions.push_back(MakeRange("chr1", start, start + 400));
+  }
+  regions.push_back(MakeRange("chr1", 893700, 893800));
+  regions.push_back(MakeRange("chr3", 0, CHR3_SIZE));
+  regions.push_back(MakeRange("chr1", 14000, 20000));
+
+  vector<vector<Variant>> expected;
+  for (const Range& region : regions) {
+    expected.push_back(as_vector(reader_->Query(region)));
+  }
+  auto sweep = reader_->SweepQuery(0).ValueOrDie();
+  int n_variants = 0;
+  for (int i = 0; i < regions.size(); i++) {
+    auto variants = sweep->Query(regions[i]);
+    ASSERT_THAT(variants.status(), IsOK());
+    EXPECT_THAT(variants.ValueOrDie(), Pointwise(EqualsProto(), expected[i]))
+        << regions[i].ShortDebugString();
+    n_variants += expected[i].size();
+  }
+  EXPECT_GT(n_variants, 0);
+  EXPECT_EQ(4, sweep->NumSeeks());
+}
+
+TEST_F(VcfWithSamplesReaderTest, SweepQueryRejectsBadRegions) {
+  auto sweep = reader_->SweepQuery(0).ValueOrDie();
+  EXPECT_THAT(sweep->Query(MakeRange("chr1", 100, 100)).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "Malformed region"));
+  EXPECT_THAT(sweep->Query(MakeRange("missing", 0, 100)).status(),
+              IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                        "Unknown reference_name"));
+}
+
 TEST_F(VcfWithSamplesReaderTest, QueryRangesIsCorrect) {
   // There's a variant at chr3:14319, test that query works exactly.
   EXPECT_THAT(as_vector(reader_->Query(MakeRange("chr3", 14318, 14319))),
@@ -353,6 +675,25 @@ TEST(VcfReaderLikelihoodsTest, MatchesGolden) {
   EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), golden));
 }
 
+TEST(VcfReaderLikelihoodsTest, KeepsFractionalGenotypeLikelihoods) {
+  // GL values used to be truncated to integers, turning these into 0, -1, -3.
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(GetTestData(kVcfLikelihoodsFilename),
+                                    nucleus::genomics::v1::VcfReaderOptions())
+                    .ValueOrDie());
+  Variant variant;
+  ASSERT_THAT(reader
+                  ->FromString("Chr1\t23\tDogSNP3\tA\tT\t0\t.\t.\tGT:GL\t"
+                               "0/1:-0.5,-1.25,-3.75\t0/1:-5,-4,-6",
+                               &variant)
+                  .status(),
+              IsOK());
+  ASSERT_THAT(variant.calls(), SizeIs(2));
+  EXPECT_THAT(variant.calls(0).genotype_likelihood(),
+              ElementsAre(-0.5, -1.25, -3.75));
+  EXPECT_THAT(variant.calls(1).genotype_likelihood(), ElementsAre(-5, -4, -6));
+}
+
 TEST(VcfReaderPhasesetTest, MatchesGolden) {
   // Verify that we can still read the phaseset fields correctly.
   std::unique_ptr<VcfReader> reader =
@@ -412,4 +753,71 @@ TEST(VcfReaderFromStringTest, MatchesGolden) {
   EXPECT_THAT(parsed, Pointwise(EqualsProto(), golden));
 }
 
+// The records of test_phaseset.vcf, as in its golden file.
+const std::vector<absl::string_view>& PhasesetLines() {
+  static const auto* const lines = new std::vector<absl::string_view>({
+      "Chr1\t21\tDogSNP1\tA\tT\t0\t.\t.\tGT:GQ\t0/1:.\t0/1:42",
+      "Chr1\t22\tDogSNP2\tA\tT\t0\t.\t.\tGT:PL\t0/1:.\t0|1:50,40,60",
+      "Chr1\t23\tDogSNP3\tA\tT\t0\t.\t.\tGT:GL:PS\t"
+      "0/1:.:.\t0/1:-5.0,-4.0,-6.0:.",
+      "Chr1\t24\tDogSNP4\tA\tT\t0\t.\t.\tGT:PL:PS\t"
+      "0|1:50,40,60:24\t0|1:50,40,60:.",
+      "Chr1\t25\tDogSNP5\tA\tT\t0\t.\t.\tGT:GQ:PS:PL\t"
+      "0|1:42:24:50,40,60\t1|1:42:.:50,40,60",
+  });
+  return *lines;
+}
+
+TEST(VcfReaderFromStringTest, BatchMatchesGolden) {
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(
+          GetTestData(kVcfPhasesetFilename),
+          nucleus::genomics::v1::VcfReaderOptions()).ValueOrDie());
+  vector<Variant> golden =
+      ReadProtosFromTFRecord<Variant>(GetTestData(kVcfPhasesetGoldenFilename));
+  google::protobuf::RepeatedPtrField<Variant> parsed;
+  ASSERT_THAT(reader->FromStrings(PhasesetLines(), &parsed), IsOK());
+  EXPECT_THAT(parsed, Pointwise(EqualsProto(), golden));
+}
+
+TEST(VcfReaderFromStringTest, BatchStopsAtBadLine) {
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(
+          GetTestData(kVcfPhasesetFilename),
+          nucleus::genomics::v1::VcfReaderOptions()).ValueOrDie());
+  std::vector<absl::string_view> lines = PhasesetLines();
+  // The first sample has more values than there are FORMAT fields.
+  lines.insert(lines.begin() + 2,
+               "Chr1\t22\tDogSNP2\tA\tT\t0\t.\t.\tGT\t0/1:50:40\t0/1");
+  google::protobuf::RepeatedPtrField<Variant> parsed;
+  EXPECT_THAT(reader->FromStrings(lines, &parsed),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Failed to parse VCF record"));
+  EXPECT_EQ(parsed.size(), 2);
+}
+
+TEST(VcfReaderFromStringTest, ConcurrentParsesMatchGolden) {
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(
+          GetTestData(kVcfPhasesetFilename),
+          nucleus::genomics::v1::VcfReaderOptions()).ValueOrDie());
+  vector<Variant> golden =
+      ReadProtosFromTFRecord<Variant>(GetTestData(kVcfPhasesetGoldenFilename));
+  constexpr int kNumThreads = 4;
+  std::vector<google::protobuf::RepeatedPtrField<Variant>> parsed(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&reader, &parsed, i]() {
+      for (int repeat = 0; repeat < 50; repeat++) {
+        parsed[i].Clear();
+        TF_CHECK_OK(reader->FromStrings(PhasesetLines(), &parsed[i]));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (const auto& variants : parsed) {
+    EXPECT_THAT(variants, Pointwise(EqualsProto(), golden));
+  }
+}
+
 }  // namespace nucleus
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of vcf_stats.h
+#include "nucleus/io/vcf_stats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace nucleus {
+
+using nucleus::genomics::v1::VcfStats;
+
+namespace {
+
+enum class AlleleType { kSnp, kMnp, kIndel, kOther };
+
+// Returns the type of the alternate allele alt of a record with reference
+// allele ref.
+AlleleType TypeOf(const char* ref, size_t ref_length, const char* alt) {
+  // Symbolic alleles, breakends, the missing allele and the overlapping
+  // deletion allele '*'.
+  if (alt[0] == '<' || alt[0] == '*' || alt[0] == '.' ||
+      std::strpbrk(alt, "[]") != nullptr) {
+    return AlleleType::kOther;
+  }
+  const size_t alt_length = std::strlen(alt);
+  if (alt_length != ref_length) return AlleleType::kIndel;
+  return ref_length == 1 ? AlleleType::kSnp : AlleleType::kMnp;
+}
+
+// Returns 1 if the substitution of ref by alt is a transition, 0 if it is a
+// transversion, and -1 if either isn't one of ACGT.
+int IsTransition(char ref, char alt) {
+  const char* kBases = "ACGT";
+  ref = std::toupper(ref);
+  alt = std::toupper(alt);
+  if (ref == '\0' || alt == '\0' || std::strchr(kBases, ref) == nullptr ||
+      std::strchr(kBases, alt) == nullptr) {
+    return -1;
+  }
+  // Purines are A and G, pyrimidines C and T.
+  const bool ref_purine = ref == 'A' || ref == 'G';
+  const bool alt_purine = alt == 'A' || alt == 'G';
+  return ref_purine == alt_purine ? 1 : 0;
+}
+
+// Adds from to *into element-wise, growing into as needed.
+template <typename T>
+void AddCounts(const google::protobuf::RepeatedField<T>& from,
+               google::protobuf::RepeatedField<T>* into) {
+  while (into->size() < from.size()) into->Add(0);
+  for (int i = 0; i < from.size(); i++) {
+    into->Set(i, into->Get(i) + from.Get(i));
+  }
+}
+
+}  // namespace
+
+VcfStatsAccumulator::VcfStatsAccumulator(const bcf_hdr_t* header)
+    : header_(header),
+      n_samples_(bcf_hdr_nsamples(header)),
+      pass_id_(bcf_hdr_id2int(header, BCF_DT_ID, "PASS")),
+      called_genotypes_per_sample_(n_samples_, 0) {
+  stats_.set_num_samples(n_samples_);
+}
+
+VcfStatsAccumulator::~VcfStatsAccumulator() {
+  free(gt_buffer_);
+}
+
+void VcfStatsAccumulator::Add(bcf1_t* record) {
+  bcf_unpack(record, BCF_UN_STR | BCF_UN_FLT);
+  stats_.set_num_records(stats_.num_records() + 1);
+  if (record->rid >= contig_records_.size()) {
+    contig_records_.resize(record->rid + 1, 0);
+  }
+  contig_records_[record->rid]++;
+
+  const int n_flt = record->d.n_flt;
+  if (n_flt > 1 || (n_flt == 1 && record->d.flt[0] != pass_id_)) {
+    stats_.set_num_filtered(stats_.num_filtered() + 1);
+  }
+
+  const int n_alts = record->n_allele - 1;
+  if (n_alts > 1) {
+    stats_.set_num_multiallelic(stats_.num_multiallelic() + 1);
+  }
+  const char* ref = record->d.allele[0];
+  const size_t ref_length = std::strlen(ref);
+  // The common type of all alternate alleles, if they have one.
+  AlleleType record_type = AlleleType::kOther;
+  for (int i = 1; i <= n_alts; i++) {
+    const char* alt = record->d.allele[i];
+    const AlleleType type = TypeOf(ref, ref_length, alt);
+    record_type = i == 1 || type == record_type ? type : AlleleType::kOther;
+    if (type == AlleleType::kSnp) {
+      const int transition = IsTransition(ref[0], alt[0]);
+      if (transition == 1) {
+        stats_.set_num_transitions(stats_.num_transitions() + 1);
+      } else if (transition == 0) {
+        stats_.set_num_transversions(stats_.num_transversions() + 1);
+      }
+    }
+  }
+  switch (record_type) {
+    case AlleleType::kSnp:
+      stats_.set_num_snps(stats_.num_snps() + 1);
+      break;
+    case AlleleType::kMnp:
+      stats_.set_num_mnps(stats_.num_mnps() + 1);
+      break;
+    case AlleleType::kIndel:
+      stats_.set_num_indels(stats_.num_indels() + 1);
+      break;
+    case AlleleType::kOther:
+      stats_.set_num_other(stats_.num_other() + 1);
+      break;
+  }
+
+  if (n_samples_ > 0) AddGenotypes(record);
+}
+
+void VcfStatsAccumulator::AddGenotypes(bcf1_t* record) {
+  const int n_values =
+      bcf_get_genotypes(header_, record, &gt_buffer_, &n_gt_buffer_);
+  if (n_values <= 0) return;
+  const int ploidy = n_values / n_samples_;
+  allele_counts_.assign(record->n_allele, 0);
+  int64 n_called = 0;
+  for (int i = 0; i < n_samples_; i++) {
+    const int32* gt = gt_buffer_ + i * ploidy;
+    bool called = true;
+    int n_alleles = 0;
+    for (int j = 0; j < ploidy && gt[j] != bcf_int32_vector_end; j++) {
+      if (gt[j] == bcf_int32_missing || bcf_gt_is_missing(gt[j])) {
+        called = false;
+        continue;
+      }
+      n_alleles++;
+      const int allele = bcf_gt_allele(gt[j]);
+      if (allele >= 0 && allele < record->n_allele) allele_counts_[allele]++;
+    }
+    if (called && n_alleles > 0) {
+      n_called++;
+      called_genotypes_per_sample_[i]++;
+    }
+  }
+  stats_.set_num_genotypes(stats_.num_genotypes() + n_samples_);
+  stats_.set_num_called_genotypes(stats_.num_called_genotypes() + n_called);
+
+  for (int allele = 1; allele < record->n_allele; allele++) {
+    const int count = allele_counts_[allele];
+    if (count >= allele_count_histogram_.size()) {
+      allele_count_histogram_.resize(count + 1, 0);
+    }
+    allele_count_histogram_[count]++;
+  }
+}
+
+VcfStats VcfStatsAccumulator::Stats() const {
+  VcfStats stats = stats_;
+  for (int rid = 0; rid < contig_records_.size(); rid++) {
+    if (contig_records_[rid] == 0) continue;
+    auto* contig = stats.add_contigs();
+    contig->set_name(bcf_hdr_id2name(header_, rid));
+    contig->set_num_records(contig_records_[rid]);
+  }
+  for (int64 called : called_genotypes_per_sample_) {
+    stats.add_called_genotypes_per_sample(called);
+  }
+  for (int64 count : allele_count_histogram_) {
+    stats.add_allele_count_histogram(count);
+  }
+  return stats;
+}
+
+void MergeVcfStats(const VcfStats& from, VcfStats* into) {
+  into->set_num_records(into->num_records() + from.num_records());
+  into->set_num_snps(into->num_snps() + from.num_snps());
+  into->set_num_mnps(into->num_mnps() + from.num_mnps());
+  into->set_num_indels(into->num_indels() + from.num_indels());
+  into->set_num_other(into->num_other() + from.num_other());
+  into->set_num_multiallelic(into->num_multiallelic() +
+                             from.num_multiallelic());
+  into->set_num_transitions(into->num_transitions() + from.num_transitions());
+  into->set_num_transversions(into->num_transversions() +
+                              from.num_transversions());
+  into->set_num_filtered(into->num_filtered() + from.num_filtered());
+  into->set_num_samples(std::max(into->num_samples(), from.num_samples()));
+  into->set_num_genotypes(into->num_genotypes() + from.num_genotypes());
+  into->set_num_called_genotypes(into->num_called_genotypes() +
+                                 from.num_called_genotypes());
+  AddCounts(from.called_genotypes_per_sample(),
+            into->mutable_called_genotypes_per_sample());
+  AddCounts(from.allele_count_histogram(),
+            into->mutable_allele_count_histogram());
+
+  std::map<string, int> contig_index;
+  for (int i = 0; i < into->contigs_size(); i++) {
+    contig_index[into->contigs(i).name()] = i;
+  }
+  for (const auto& contig : from.contigs()) {
+    auto it = contig_index.find(contig.name());
+    if (it == contig_index.end()) {
+      *into->add_contigs() = contig;
+    } else {
+      auto* merged = into->mutable_contigs(it->second);
+      merged->set_num_records(merged->num_records() + contig.num_records());
+    }
+  }
+}
+
+}  // namespace nucleus
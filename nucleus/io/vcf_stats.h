@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VCF_STATS_H_
+#define THIRD_PARTY_NUCLEUS_IO_VCF_STATS_H_
+
+#include <vector>
+
+#include "htslib/vcf.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// Accumulates VcfStats over htslib records, without converting them to
+// Variant protos.
+//
+// Records are only unpacked as far as needed: alleles and filters, plus the
+// GT field if the file has samples. A VcfStatsAccumulator isn't thread-safe;
+// parallel passes use one per thread and combine their results with
+// MergeVcfStats.
+class VcfStatsAccumulator {
+ public:
+  // header must outlive the accumulator.
+  explicit VcfStatsAccumulator(const bcf_hdr_t* header);
+
+  ~VcfStatsAccumulator();
+
+  // Disable copy or assignment
+  VcfStatsAccumulator(const VcfStatsAccumulator& other) = delete;
+  VcfStatsAccumulator& operator=(const VcfStatsAccumulator&) = delete;
+
+  // Adds record, which must have been read with header, to the statistics.
+  void Add(bcf1_t* record);
+
+  // Returns the statistics of the records added so far.
+  nucleus::genomics::v1::VcfStats Stats() const;
+
+ private:
+  // Adds the genotypes of record to the call rates and the allele frequency
+  // spectrum.
+  void AddGenotypes(bcf1_t* record);
+
+  const bcf_hdr_t* header_;
+  const int n_samples_;
+  // The header ID of the PASS filter.
+  const int pass_id_;
+
+  // The counts that are plain integers are accumulated in stats_ directly.
+  nucleus::genomics::v1::VcfStats stats_;
+  // Records by contig ID.
+  std::vector<int64> contig_records_;
+  std::vector<int64> called_genotypes_per_sample_;
+  std::vector<int64> allele_count_histogram_;
+
+  // Scratch buffers reused across records.
+  std::vector<int> allele_counts_;
+  int32* gt_buffer_ = nullptr;
+  int n_gt_buffer_ = 0;
+};
+
+// Adds the counts of from to into. Contigs are matched by name, and those of
+// from that aren't in into are appended to it.
+void MergeVcfStats(const nucleus::genomics::v1::VcfStats& from,
+                   nucleus::genomics::v1::VcfStats* into);
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VCF_STATS_H_
@@ -20,12 +20,14 @@ from __future__ import print_function
 from absl.testing import absltest
 from absl.testing import parameterized
 
+from nucleus.io import fasta
 from nucleus.io import vcf
 from nucleus.protos import reference_pb2
 from nucleus.protos import struct_pb2
 from nucleus.protos import variants_pb2
 from nucleus.testing import test_utils
 from nucleus.util import ranges
+from nucleus.util import variantcall_utils
 from tensorflow.python.platform import gfile
 
 
@@ -112,12 +114,157 @@ class VcfReaderTests(absltest.TestCase):
     self.assertEqual(
         test_utils.iterable_len(self.samples_reader.query(range1)), 4)
 
+  def test_vcf_sweep_query(self):
+    regions = [
+        ranges.make_range('chr1', start, start + 1000)
+        for start in range(13000, 30000, 500)
+    ] + [ranges.parse_literal('chr3:100,000-500,000')]
+    expected = [list(self.samples_reader.query(r)) for r in regions]
+    with self.samples_reader.sweep_query() as sweep:
+      self.assertEqual([sweep.query(r) for r in regions], expected)
+      self.assertEqual(sweep.num_seeks, 2)
+
   def test_vcf_iter(self):
     n = 0
     for _ in self.sites_reader:
       n += 1
     self.assertEqual(n, 5)
 
+  def test_vcf_iterate_parallel(self):
+    path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    with vcf.VcfReader(path) as reader:
+      actual = list(reader.iterate_parallel(2, shard_size_bases=10000))
+    self.assertEqual(actual, list(self.samples_reader))
+
+  def test_vcf_compute_stats(self):
+    path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    with vcf.VcfReader(path) as reader:
+      stats = reader.compute_stats(num_threads=2, shard_size_bases=10000)
+    variants = list(self.samples_reader)
+    self.assertEqual(stats.num_records, len(variants))
+    contigs = [v.reference_name for v in variants]
+    self.assertEqual([(c.name, c.num_records) for c in stats.contigs],
+                     [(name, contigs.count(name))
+                      for name in sorted(set(contigs), key=contigs.index)])
+    self.assertLen(stats.called_genotypes_per_sample, stats.num_samples)
+
+  def test_vcf_compact_format_fields(self):
+    path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    with vcf.VcfReader(path, compact_format_fields=True) as reader:
+      variants = list(reader)
+    self.assertTrue(all(v.compact_format_fields for v in variants))
+    for variant in variants:
+      variantcall_utils.expand_compact_format(variant)
+    self.assertEqual(variants, list(self.samples_reader))
+
+  def test_vcf_fast_text_parsing(self):
+    path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    with vcf.VcfReader(path, fast_text_parsing=True) as reader:
+      self.assertEqual(list(reader), list(self.samples_reader))
+      region = ranges.parse_literal('chr1:10,000-1,000,000')
+      with vcf.VcfReader(path) as htslib_reader:
+        self.assertEqual(
+            list(reader.query(region)), list(htslib_reader.query(region)))
+
+  def test_vcf_filter_expression(self):
+    path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    with vcf.VcfReader(path, filter_expression='QUAL >= 100') as reader:
+      qualities = [v.quality for v in reader]
+    expected = [v.quality for v in self.samples_reader if v.quality >= 100]
+    self.assertNotEmpty(qualities)
+    self.assertEqual(qualities, expected)
+
+  def test_vcf_iterate_normalized(self):
+    path = test_utils.genomics_core_testdata('test_normalize.vcf')
+    fasta_path = test_utils.genomics_core_testdata('test.fasta')
+    with vcf.VcfReader(path) as reader, fasta.RefFastaReader(
+        fasta_path) as reference:
+      actual = [(v.start, v.reference_bases, list(v.alternate_bases))
+                for v in reader.iterate_normalized(
+                    reference, split_multiallelics=True)]
+    self.assertEqual(actual, [(7, 'T', ['G']), (15, 'GA', ['G']),
+                              (17, 'A', ['C']), (28, 'C', ['T']),
+                              (53, 'T', ['TC']), (53, 'TC', ['T']),
+                              (0, 'C', ['<*>'])])
+
+
+class CompareVariantsTests(absltest.TestCase):
+  """Tests for vcf.compare_variants."""
+
+  def test_compare_variants(self):
+    outcomes = []
+    summary = vcf.compare_variants(
+        test_utils.genomics_core_testdata('test_normalize.vcf'),
+        test_utils.genomics_core_testdata('test_concordance_eval.vcf'),
+        annotated_variant_fn=lambda v: outcomes.append(
+            v.info['CONCORDANCE'].values[0].string_value))
+    self.assertEqual(outcomes, [
+        'TP', 'GENOTYPE_MISMATCH', 'FN', 'TP', 'ALLELE_MISMATCH', 'FP'
+    ])
+    self.assertEqual(summary.snps.true_positives, 1)
+    self.assertEqual(summary.indels.false_negatives, 1)
+
+
+class PositionIndexTests(absltest.TestCase):
+  """Tests for vcf.build_position_index and vcf.load_position_index."""
+
+  def test_position_index(self):
+    vcf_path = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    index_path = test_utils.test_tmpfile('test_samples.vcf.gz.vpi')
+    built = vcf.build_position_index(vcf_path, index_path=index_path)
+    loaded = vcf.load_position_index(index_path)
+    self.assertEqual(built.num_intervals, loaded.num_intervals)
+    with vcf.VcfReader(vcf_path) as reader:
+      for start in range(14000, 15000, 50):
+        region = ranges.make_range('chr1', start, start + 20)
+        expected = bool(list(reader.query(region)))
+        self.assertEqual(built.overlaps(region), expected)
+        self.assertEqual(loaded.overlaps(region), expected)
+
+  def test_position_index_filter(self):
+    index = vcf.build_position_index(
+        test_utils.genomics_core_testdata('test_samples.vcf.gz'),
+        filter_expression='CHROM == chr3')
+    self.assertTrue(index.overlaps(ranges.make_range('chr3', 14318, 14319)))
+    self.assertFalse(index.overlaps(ranges.make_range('chr1', 14399, 14400)))
+
+
+class KeyIndexTests(absltest.TestCase):
+  """Tests for vcf.build_key_index and the lookups it enables."""
+
+  def test_lookups(self):
+    vcf_path = test_utils.test_tmpfile('key_index.vcf.gz')
+    gfile.Copy(
+        test_utils.genomics_core_testdata('test_samples.vcf.gz'), vcf_path)
+    vcf.build_key_index(vcf_path)
+    with vcf.VcfReader(vcf_path) as reader:
+      by_id = reader.lookup_by_id(['rs756427959', 'rs0'])
+      self.assertEqual([[v.start for v in vs] for vs in by_id], [[14396], []])
+      by_allele = reader.lookup_by_allele(['chr3:14320:T->TAAA'])
+      self.assertEqual([[v.alternate_bases for v in vs] for vs in by_allele],
+                       [[['TA', 'TAAA']]])
+
+
+class MergingVcfReaderTests(absltest.TestCase):
+  """Tests for vcf.MergingVcfReader."""
+
+  def setUp(self):
+    samples_vcf = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+    self.reader = vcf.MergingVcfReader([samples_vcf, samples_vcf])
+
+  def test_query(self):
+    range1 = ranges.parse_literal('chr3:100,000-500,000')
+    starts = [v.start for v in self.reader.query(range1)]
+    self.assertLen(starts, 8)
+    self.assertEqual(starts, sorted(starts))
+
+  def test_write_to(self):
+    output_path = test_utils.test_tmpfile('merged.vcf')
+    range1 = ranges.parse_literal('chr3:100,000-500,000')
+    self.assertEqual(self.reader.write_to(output_path, region=range1), 8)
+    with vcf.VcfReader(output_path) as reader:
+      self.assertEqual(test_utils.iterable_len(reader.iterate()), 8)
+
 
 def _format_expected_variant(ref, alts, format_spec, *samples):
   base = ['20', 1, '.', ref, alts, 0, '.', '.', format_spec]
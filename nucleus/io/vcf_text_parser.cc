@@ -0,0 +1,556 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Implementation of vcf_text_parser.h
+#include "nucleus/io/vcf_text_parser.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "nucleus/util/math.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::ListValue;
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantCall;
+
+namespace {
+
+// Must match the value VcfRecordConverter uses for a missing QUAL.
+constexpr double kQualUnset = -1;
+
+// Integers outside this range would collide with htslib's missing and vector
+// end sentinels, so records with them are left to htslib.
+constexpr int64 kMinInt = std::numeric_limits<int32>::min() + 8;
+constexpr int64 kMaxInt = std::numeric_limits<int32>::max();
+
+// Genotypes with larger allele indices are left to htslib.
+constexpr int kMaxAlleleDigits = 6;
+
+// The powers of ten that are exactly representable as doubles.
+constexpr double kPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+constexpr int kMaxExactPowerOfTen = 22;
+constexpr uint64 kMaxExactMantissa = uint64{1} << 53;
+
+// Splits text into the tokens between delimiters. The delimiters are found
+// with memchr, which libc implementations vectorize, so long columns such as
+// INFO are skipped through many bytes at a time.
+class Tokenizer {
+ public:
+  Tokenizer(absl::string_view text, char delimiter)
+      : pos_(text.data()), end_(text.data() + text.size()),
+        delimiter_(delimiter) {}
+
+  // Sets *token to the next token and returns true, or returns false if all
+  // tokens have been returned. Empty text has a single empty token.
+  bool Next(absl::string_view* token) {
+    if (done_) return false;
+    const char* stop = static_cast<const char*>(
+        std::memchr(pos_, delimiter_, end_ - pos_));
+    if (stop == nullptr) {
+      *token = absl::string_view(pos_, end_ - pos_);
+      done_ = true;
+    } else {
+      *token = absl::string_view(pos_, stop - pos_);
+      pos_ = stop + 1;
+    }
+    return true;
+  }
+
+  // True once all tokens have been returned.
+  bool Done() const { return done_; }
+
+  // The text after the last token returned.
+  absl::string_view Rest() const {
+    return done_ ? absl::string_view() : absl::string_view(pos_, end_ - pos_);
+  }
+
+ private:
+  const char* pos_;
+  const char* end_;
+  const char delimiter_;
+  bool done_ = false;
+};
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Parses text, a decimal integer with an optional minus sign, into *value.
+// Returns false if text is anything else or its value is outside [min, max].
+bool ParseInt(absl::string_view text, int64 min, int64 max, int64* value) {
+  const bool negative = !text.empty() && text[0] == '-';
+  if (negative) text.remove_prefix(1);
+  // Longer numbers are out of range anyway, and could overflow.
+  if (text.empty() || text.size() > 12) return false;
+  int64 magnitude = 0;
+  for (char c : text) {
+    if (!IsDigit(c)) return false;
+    magnitude = magnitude * 10 + (c - '0');
+  }
+  *value = negative ? -magnitude : magnitude;
+  return *value >= min && *value <= max;
+}
+
+// Parses text, a decimal number like 7, -0.25, .5 or 1.5e-08, into *value
+// exactly as strtod (which htslib uses) would. Returns false for anything
+// else, including missing values, "nan" and "inf".
+//
+// Most values have few enough significant digits and a small enough exponent
+// that their mantissa and power of ten are both exact doubles, and then a
+// single multiplication or division is correctly rounded; the rest are handed
+// to strtod.
+bool ParseDouble(absl::string_view text, double* value) {
+  size_t i = 0;
+  const size_t n = text.size();
+  const bool negative = i < n && text[i] == '-';
+  if (i < n && (text[i] == '-' || text[i] == '+')) i++;
+  uint64 mantissa = 0;
+  int exponent = 0;
+  int n_digits = 0;
+  bool exact = true;
+  for (; i < n && IsDigit(text[i]); i++, n_digits++) {
+    if (mantissa < kMaxExactMantissa / 10) {
+      mantissa = mantissa * 10 + (text[i] - '0');
+    } else {
+      exact = false;
+    }
+  }
+  if (i < n && text[i] == '.') {
+    for (i++; i < n && IsDigit(text[i]); i++, n_digits++) {
+      if (mantissa < kMaxExactMantissa / 10) {
+        mantissa = mantissa * 10 + (text[i] - '0');
+        exponent--;
+      } else {
+        exact = false;
+      }
+    }
+  }
+  if (n_digits == 0) return false;
+  if (i < n && (text[i] == 'e' || text[i] == 'E')) {
+    int64 written_exponent;
+    if (!ParseInt(text.substr(i + 1), -9999, 9999, &written_exponent)) {
+      // Also allow an explicit plus sign in the exponent.
+      if (i + 1 >= n || text[i + 1] != '+' ||
+          !ParseInt(text.substr(i + 2), 0, 9999, &written_exponent)) {
+        return false;
+      }
+    }
+    exponent += written_exponent;
+    i = n;
+  }
+  if (i != n) return false;
+
+  if (exact && exponent >= -kMaxExactPowerOfTen &&
+      exponent <= kMaxExactPowerOfTen) {
+    const double m = static_cast<double>(mantissa);
+    *value = exponent < 0 ? m / kPowersOfTen[-exponent]
+                          : m * kPowersOfTen[exponent];
+    if (negative) *value = -*value;
+  } else {
+    char buffer[64];
+    if (n >= sizeof(buffer)) return false;
+    std::memcpy(buffer, text.data(), n);
+    buffer[n] = '\0';
+    *value = std::strtod(buffer, nullptr);
+  }
+  return true;
+}
+
+// Parses text, comma-separated numbers of htslib type type, into *numbers.
+// Floats are rounded to float precision, as htslib stores them. Sets *missing
+// if any of the values is missing (".").
+bool ParseNumbers(absl::string_view text, int type,
+                  std::vector<double>* numbers, bool* missing) {
+  numbers->clear();
+  *missing = false;
+  Tokenizer tokens(text, ',');
+  absl::string_view token;
+  while (tokens.Next(&token)) {
+    if (token == ".") {
+      *missing = true;
+    } else if (type == BCF_HT_INT) {
+      int64 value;
+      if (!ParseInt(token, kMinInt, kMaxInt, &value)) return false;
+      numbers->push_back(value);
+    } else if (type == BCF_HT_REAL) {
+      double value;
+      if (!ParseDouble(token, &value)) return false;
+      numbers->push_back(static_cast<float>(value));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Appends numbers, of htslib type type, to list.
+void AddNumbers(const std::vector<double>& numbers, int type,
+                ListValue* list) {
+  for (double number : numbers) {
+    if (type == BCF_HT_INT) {
+      list->add_values()->set_int_value(static_cast<int>(number));
+    } else {
+      list->add_values()->set_number_value(number);
+    }
+  }
+}
+
+// Returns true if text is a non-empty sequence of bases (or, as in ALTs,
+// asterisks). Symbolic and breakend alleles are left to htslib.
+bool IsPlainAllele(absl::string_view text) {
+  if (text.empty()) return false;
+  for (char c : text) {
+    if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '*')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parses text, a GT value like 0/1, 1|0 or ./., into the genotype and
+// phasing of call (unless call is null), and sets *ploidy to its number of
+// alleles. As htslib does, the call is phased if any allele is preceded by |.
+bool ParseGenotype(absl::string_view text, VariantCall* call, int* ploidy) {
+  bool is_phased = false;
+  int n_alleles = 0;
+  size_t i = 0;
+  while (true) {
+    int allele = -1;
+    if (i < text.size() && text[i] == '.') {
+      i++;
+    } else {
+      const size_t start = i;
+      allele = 0;
+      for (; i < text.size() && IsDigit(text[i]); i++) {
+        allele = allele * 10 + (text[i] - '0');
+      }
+      if (i == start || i - start > kMaxAlleleDigits) return false;
+    }
+    if (call != nullptr) call->add_genotype(allele);
+    n_alleles++;
+    if (i == text.size()) break;
+    if (text[i] == '|') {
+      is_phased = true;
+    } else if (text[i] != '/') {
+      return false;
+    }
+    i++;
+  }
+  if (call != nullptr) call->set_is_phased(is_phased);
+  *ploidy = n_alleles;
+  return true;
+}
+
+bool Excluded(const std::vector<string>& excluded, const string& tag) {
+  return std::find(excluded.begin(), excluded.end(), tag) != excluded.end();
+}
+
+// Returns the htslib type the adapter VcfRecordConverter installs for a
+// field of the header type type decodes as, or -1 if it doesn't install one.
+int AdapterType(const string& type, bool is_info) {
+  if (type == "Integer") return BCF_HT_INT;
+  if (type == "Float") return BCF_HT_REAL;
+  if (type == "String") return BCF_HT_STR;
+  if (type == "Flag" && is_info) return BCF_HT_FLAG;
+  return -1;
+}
+
+}  // namespace
+
+VcfTextParser::VcfTextParser(
+    const nucleus::genomics::v1::VcfHeader& vcf_header,
+    const std::vector<string>& infos_to_exclude,
+    const std::vector<string>& formats_to_exclude, const bcf_hdr_t* h) {
+  for (int i = 0; i < h->n[BCF_DT_CTG]; i++) {
+    contigs_.push_back(bcf_hdr_id2name(h, i));
+  }
+  for (int i = 0; i < h->n[BCF_DT_ID]; i++) {
+    const char* key = h->id[BCF_DT_ID][i].key;
+    if (bcf_hdr_idinfo_exists(h, BCF_HL_FLT, i)) filters_.push_back(key);
+    if (bcf_hdr_idinfo_exists(h, BCF_HL_INFO, i)) {
+      infos_.push_back({key, static_cast<int>(bcf_hdr_id2type(
+                                 h, BCF_HL_INFO, i)), -1});
+    }
+    if (bcf_hdr_idinfo_exists(h, BCF_HL_FMT, i)) {
+      formats_.push_back({key, static_cast<int>(bcf_hdr_id2type(
+                                   h, BCF_HL_FMT, i)), -1});
+    }
+  }
+  const auto by_key = [](const Field& a, const Field& b) {
+    return a.key < b.key;
+  };
+  std::sort(contigs_.begin(), contigs_.end());
+  std::sort(filters_.begin(), filters_.end());
+  std::sort(infos_.begin(), infos_.end(), by_key);
+  std::sort(formats_.begin(), formats_.end(), by_key);
+
+  // Mirror the adapters VcfRecordConverter installs. If one would decode a
+  // field as another type than htslib parses it as, records with the field
+  // are left to htslib.
+  for (const auto& info : vcf_header.infos()) {
+    const int type = AdapterType(info.type(), true);
+    if (info.id() == "END" || Excluded(infos_to_exclude, info.id()) ||
+        type < 0) {
+      continue;
+    }
+    stored_infos_.push_back({info.id(), type, -1});
+    Field* field = FindField(&infos_, info.id());
+    if (field != nullptr && field->slot < 0) {
+      field->slot = stored_infos_.size() - 1;
+      if (field->type != type) field->type = -1;
+    }
+  }
+  for (const auto& format : vcf_header.formats()) {
+    const int type = AdapterType(format.type(), false);
+    if (format.id() == "GT" || format.id() == "GL" || format.id() == "PL" ||
+        Excluded(formats_to_exclude, format.id()) || type < 0) {
+      continue;
+    }
+    Field* field = FindField(&formats_, format.id());
+    if (field != nullptr) {
+      field->slot = 0;
+      if (field->type != type) field->type = -1;
+    }
+  }
+  for (int i = 0; i < bcf_hdr_nsamples(h); i++) {
+    sample_names_.push_back(h->samples[i]);
+  }
+  want_genotypes_ = !Excluded(formats_to_exclude, "GT");
+  want_genotype_likelihoods_ = !Excluded(formats_to_exclude, "GL") ||
+                               !Excluded(formats_to_exclude, "PL");
+}
+
+const VcfTextParser::Field* VcfTextParser::FindField(
+    const std::vector<Field>& fields, absl::string_view key) {
+  const auto it = std::lower_bound(
+      fields.begin(), fields.end(), key,
+      [](const Field& field, absl::string_view key) {
+        return absl::string_view(field.key) < key;
+      });
+  return it != fields.end() && it->key == key ? &*it : nullptr;
+}
+
+bool VcfTextParser::Contains(const std::vector<string>& names,
+                             absl::string_view name) {
+  const auto it = std::lower_bound(
+      names.begin(), names.end(), name,
+      [](const string& a, absl::string_view b) {
+        return absl::string_view(a) < b;
+      });
+  return it != names.end() && *it == name;
+}
+
+bool VcfTextParser::Parse(absl::string_view line, Variant* variant) const {
+  variant->Clear();
+  Tokenizer columns(line, '\t');
+  absl::string_view fields[8];
+  for (absl::string_view& field : fields) {
+    if (!columns.Next(&field)) return false;
+  }
+  const absl::string_view chrom = fields[0], pos = fields[1], id = fields[2],
+                          ref = fields[3], alt = fields[4], qual = fields[5],
+                          filter = fields[6], info = fields[7];
+
+  int64 position;
+  if (!Contains(contigs_, chrom) || !ParseInt(pos, 1, kMaxInt, &position) ||
+      id.empty() || !IsPlainAllele(ref)) {
+    return false;
+  }
+  variant->set_reference_name(chrom.data(), chrom.size());
+  variant->set_start(position - 1);
+  variant->set_end(position - 1 + ref.size());
+  if (id != ".") variant->add_names(id.data(), id.size());
+  variant->set_reference_bases(ref.data(), ref.size());
+  if (alt != ".") {
+    Tokenizer alts(alt, ',');
+    absl::string_view allele;
+    while (alts.Next(&allele)) {
+      if (!IsPlainAllele(allele)) return false;
+      variant->add_alternate_bases(allele.data(), allele.size());
+    }
+  }
+
+  if (qual == ".") {
+    variant->set_quality(kQualUnset);
+  } else {
+    double quality;
+    if (!ParseDouble(qual, &quality)) return false;
+    variant->set_quality(static_cast<float>(quality));
+  }
+
+  if (filter != ".") {
+    Tokenizer filters(filter, ';');
+    absl::string_view name;
+    while (filters.Next(&name)) {
+      if (!Contains(filters_, name)) return false;
+      variant->add_filter(name.data(), name.size());
+    }
+  }
+
+  if (!ParseInfo(info, variant)) return false;
+  if (sample_names_.empty()) return columns.Done();
+  absl::string_view format;
+  if (!columns.Next(&format)) return false;
+  return ParseSamples(format, columns.Rest(), variant);
+}
+
+bool VcfTextParser::ParseInfo(absl::string_view info, Variant* variant) const {
+  // Every stored field gets an entry, and flags a value, even when absent.
+  std::vector<ListValue*> lists(stored_infos_.size());
+  for (size_t i = 0; i < stored_infos_.size(); i++) {
+    lists[i] = &(*variant->mutable_info())[stored_infos_[i].key];
+    if (stored_infos_[i].type == BCF_HT_FLAG) {
+      lists[i]->add_values()->set_bool_value(false);
+    }
+  }
+  if (info == ".") return true;
+
+  Tokenizer entries(info, ';');
+  absl::string_view entry;
+  std::vector<double> numbers;
+  while (entries.Next(&entry)) {
+    const size_t equals = entry.find('=');
+    const absl::string_view key = entry.substr(0, equals);
+    const Field* field = FindField(infos_, key);
+    // END changes the span of the record.
+    if (field == nullptr || key == "END") return false;
+    ListValue* list = field->slot >= 0 ? lists[field->slot] : nullptr;
+    if (field->type == BCF_HT_FLAG) {
+      if (equals != absl::string_view::npos) return false;
+      if (list != nullptr) {
+        if (list->values(0).bool_value()) return false;
+        list->mutable_values(0)->set_bool_value(true);
+      }
+      continue;
+    }
+    if (equals == absl::string_view::npos) return false;
+    const absl::string_view value = entry.substr(equals + 1);
+    if (list != nullptr && list->values_size() > 0) return false;
+    if (field->type == BCF_HT_STR) {
+      if (value.empty() || value == ".") return false;
+      if (list != nullptr) {
+        list->add_values()->set_string_value(value.data(), value.size());
+      }
+    } else {
+      bool missing;
+      if (!ParseNumbers(value, field->type, &numbers, &missing) || missing) {
+        return false;
+      }
+      if (list != nullptr) AddNumbers(numbers, field->type, list);
+    }
+  }
+  return true;
+}
+
+bool VcfTextParser::ParseSamples(absl::string_view format,
+                                 absl::string_view samples,
+                                 Variant* variant) const {
+  std::vector<const Field*> keys;
+  int gt = -1, gl = -1, pl = -1;
+  Tokenizer format_keys(format, ':');
+  absl::string_view key;
+  while (format_keys.Next(&key)) {
+    const Field* field = FindField(formats_, key);
+    if (field == nullptr ||
+        std::find(keys.begin(), keys.end(), field) != keys.end()) {
+      return false;
+    }
+    if (key == "GT") {
+      gt = keys.size();
+    } else if (key == "GL") {
+      if (field->type != BCF_HT_REAL) return false;
+      gl = keys.size();
+    } else if (key == "PL") {
+      if (field->type != BCF_HT_INT) return false;
+      pl = keys.size();
+    } else if (field->type != BCF_HT_INT && field->type != BCF_HT_REAL &&
+               field->type != BCF_HT_STR) {
+      return false;
+    }
+    keys.push_back(field);
+  }
+  // VcfRecordConverter fails records with samples but no genotypes.
+  if (gt < 0) return false;
+
+  Tokenizer columns(samples, '\t');
+  int ploidy = -1;
+  std::vector<double> numbers, likelihoods, phred_likelihoods;
+  for (const string& sample_name : sample_names_) {
+    absl::string_view column;
+    if (!columns.Next(&column)) return false;
+    VariantCall* call = variant->add_calls();
+    call->set_call_set_name(sample_name);
+    likelihoods.clear();
+    phred_likelihoods.clear();
+
+    Tokenizer values(column, ':');
+    for (int j = 0; j < keys.size(); j++) {
+      absl::string_view value;
+      if (!values.Next(&value)) return false;
+      const Field& field = *keys[j];
+      if (j == gt) {
+        int n_alleles;
+        if (!ParseGenotype(value, want_genotypes_ ? call : nullptr,
+                           &n_alleles) ||
+            (ploidy >= 0 && n_alleles != ploidy)) {
+          return false;
+        }
+        ploidy = n_alleles;
+      } else if (field.type == BCF_HT_STR) {
+        if (field.slot >= 0) {
+          (*call->mutable_info())[field.key].add_values()->set_string_value(
+              value.data(), value.size());
+        }
+      } else {
+        // A sample with any missing value is missing the field entirely.
+        bool missing;
+        if (!ParseNumbers(value, field.type, &numbers, &missing)) return false;
+        if (missing) continue;
+        if (j == gl) {
+          likelihoods.swap(numbers);
+        } else if (j == pl) {
+          phred_likelihoods.swap(numbers);
+        } else if (field.slot >= 0) {
+          AddNumbers(numbers, field.type,
+                     &(*call->mutable_info())[field.key]);
+        }
+      }
+    }
+    if (!values.Done()) return false;
+
+    // GLs take precedence over the lower resolution PLs.
+    if (want_genotype_likelihoods_) {
+      if (!likelihoods.empty()) {
+        for (double likelihood : likelihoods) {
+          call->add_genotype_likelihood(likelihood);
+        }
+      } else {
+        for (double phred : phred_likelihoods) {
+          call->add_genotype_likelihood(
+              PhredToLog10PError(static_cast<int>(phred)));
+        }
+      }
+    }
+  }
+  return columns.Done();
+}
+
+}  // namespace nucleus
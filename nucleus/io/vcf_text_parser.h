@@ -0,0 +1,107 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_VCF_TEXT_PARSER_H_
+#define THIRD_PARTY_NUCLEUS_IO_VCF_TEXT_PARSER_H_
+
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "htslib/vcf.h"
+#include "nucleus/platform/types.h"
+#include "nucleus/protos/variants.pb.h"
+
+namespace nucleus {
+
+// Parses the text lines of simple VCF records straight into Variant protos,
+// without going through htslib's vcf_parse and a bcf1_t; see
+// VcfReaderOptions.fast_text_parsing.
+//
+// Parse produces exactly the Variant that VcfRecordConverter::ConvertToPb
+// (without compact FORMAT fields) would produce from the record htslib parses
+// out of the same line, but only handles records whose meaning is unambiguous:
+//
+//   - CHROM, INFO keys, FORMAT keys and FILTERs are all defined in the header;
+//   - alleles are plain bases (no symbolic or breakend alleles), and there's
+//     no END INFO field;
+//   - numbers are plain decimals within range, every key appears once, and
+//     each sample has a GT of the same ploidy and a value for every FORMAT
+//     key (although numeric values may be missing).
+//
+// For any other line it returns false, and the line should be handed to
+// htslib, which also handles (or reports) malformed records.
+class VcfTextParser {
+ public:
+  // The parser of records under the htslib header h, with the INFO and FORMAT
+  // fields of vcf_header (which must describe h) other than infos_to_exclude
+  // and formats_to_exclude, as VcfRecordConverter takes them.
+  VcfTextParser(const nucleus::genomics::v1::VcfHeader& vcf_header,
+                const std::vector<string>& infos_to_exclude,
+                const std::vector<string>& formats_to_exclude,
+                const bcf_hdr_t* h);
+
+  // Parses line, a VCF record without its trailing newline, into *variant and
+  // returns true, or returns false (leaving *variant in an unspecified state)
+  // if line isn't a simple record.
+  bool Parse(absl::string_view line,
+             nucleus::genomics::v1::Variant* variant) const;
+
+ private:
+  // An INFO or FORMAT key defined in the header.
+  struct Field {
+    string key;
+    // The htslib type (BCF_HT_*) its values are parsed as.
+    int type;
+    // The index of the field among the stored fields, or -1 if it isn't
+    // converted into Variants.
+    int slot;
+  };
+
+  // Returns the field of fields (sorted by key) with key, or nullptr.
+  static const Field* FindField(const std::vector<Field>& fields,
+                                absl::string_view key);
+  static Field* FindField(std::vector<Field>* fields, absl::string_view key) {
+    return const_cast<Field*>(FindField(*fields, key));
+  }
+
+  // Returns true if names (sorted) contains name.
+  static bool Contains(const std::vector<string>& names,
+                       absl::string_view name);
+
+  // Parses the INFO column info into variant.
+  bool ParseInfo(absl::string_view info,
+                 nucleus::genomics::v1::Variant* variant) const;
+
+  // Parses the FORMAT column format and the sample columns in samples into
+  // the calls of variant.
+  bool ParseSamples(absl::string_view format, absl::string_view samples,
+                    nucleus::genomics::v1::Variant* variant) const;
+
+  std::vector<string> contigs_;
+  std::vector<string> filters_;
+  std::vector<Field> infos_;
+  std::vector<Field> formats_;
+  // The INFO fields converted into Variants, in header order, by slot.
+  std::vector<Field> stored_infos_;
+  std::vector<string> sample_names_;
+  bool want_genotypes_;
+  bool want_genotype_likelihoods_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_VCF_TEXT_PARSER_H_
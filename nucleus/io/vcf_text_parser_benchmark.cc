@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Compares the time to read all the records of a text VCF into Variants with
+// htslib's parsing and with VcfReaderOptions.fast_text_parsing:
+//
+//   vcf_text_parser_benchmark <path.vcf[.gz]> [repeats]
+#include <chrono>  // NOLINT
+#include <cstdio>
+#include <cstdlib>
+
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/variants.pb.h"
+
+namespace nucleus {
+namespace {
+
+// Reads all records of path, returning the number read and setting *seconds
+// to the time taken.
+int64 ReadAll(const string& path, bool fast_text_parsing, double* seconds) {
+  nucleus::genomics::v1::VcfReaderOptions options;
+  options.set_fast_text_parsing(fast_text_parsing);
+  const auto start = std::chrono::steady_clock::now();
+  auto reader = std::move(VcfReader::FromFile(path, options).ValueOrDie());
+  auto iterable = reader->Iterate().ValueOrDie();
+  nucleus::genomics::v1::Variant variant;
+  int64 n_records = 0;
+  while (iterable->Next(&variant).ValueOrDie()) n_records++;
+  *seconds = std::chrono::duration<double>(
+                 std::chrono::steady_clock::now() - start).count();
+  return n_records;
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <path.vcf[.gz]> [repeats]\n", argv[0]);
+    return 1;
+  }
+  const string path = argv[1];
+  const int repeats = argc > 2 ? std::atoi(argv[2]) : 3;
+  for (bool fast_text_parsing : {false, true}) {
+    // Report the best of repeats, so that a cold file cache doesn't count.
+    double best = 0;
+    int64 n_records = 0;
+    for (int i = 0; i < repeats; i++) {
+      double seconds;
+      n_records = ReadAll(path, fast_text_parsing, &seconds);
+      if (i == 0 || seconds < best) best = seconds;
+    }
+    std::printf("%-8s %lld records in %.3f s (%.0f records/s)\n",
+                fast_text_parsing ? "fast" : "htslib", n_records, best,
+                n_records / best);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace nucleus
+
+int main(int argc, char** argv) { return nucleus::Run(argc, argv); }
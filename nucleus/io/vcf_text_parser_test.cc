@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/io/vcf_text_parser.h"
+
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "nucleus/io/vcf_reader.h"
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/util/utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using std::vector;
+
+using ::testing::Pointwise;
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VcfReaderOptions;
+
+constexpr char kVcfSamplesFilename[] = "test_samples.vcf";
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+
+std::unique_ptr<VcfReader> OpenVcf(const string& filename,
+                                   VcfReaderOptions options,
+                                   bool fast_text_parsing) {
+  options.set_fast_text_parsing(fast_text_parsing);
+  return std::move(
+      VcfReader::FromFile(GetTestData(filename), options).ValueOrDie());
+}
+
+TEST(VcfTextParserTest, MatchesHtslibOnTestVcfs) {
+  for (const char* filename :
+       {"test_samples.vcf", "test_samples.vcf.gz", "test_sites.vcf",
+        "test_vaf.vcf", "test_allele_depth.vcf", "test_phaseset.vcf",
+        "test_likelihoods_input.vcf", "test_normalize.vcf",
+        "test_nist.b37_chr20_100kbp_at_10mb.vcf.gz"}) {
+    auto fast = OpenVcf(filename, VcfReaderOptions(), true);
+    auto htslib = OpenVcf(filename, VcfReaderOptions(), false);
+    ASSERT_NE(nullptr, fast->TextParser());
+    EXPECT_EQ(nullptr, htslib->TextParser());
+    const vector<Variant> expected = as_vector(htslib->Iterate());
+    EXPECT_FALSE(expected.empty());
+    EXPECT_THAT(as_vector(fast->Iterate()), Pointwise(EqualsProto(), expected))
+        << filename;
+  }
+}
+
+TEST(VcfTextParserTest, MatchesGolden) {
+  for (const char* filename : {"test_samples.vcf", "test_phaseset.vcf"}) {
+    auto reader = OpenVcf(filename, VcfReaderOptions(), true);
+    const vector<Variant> golden = ReadProtosFromTFRecord<Variant>(
+        GetTestData(absl::StrCat(filename, ".golden.tfrecord")));
+    EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), golden))
+        << filename;
+  }
+}
+
+TEST(VcfTextParserTest, HonorsExcludedFields) {
+  VcfReaderOptions options;
+  options.add_excluded_info_fields("AF");
+  options.add_excluded_info_fields("DB");
+  options.add_excluded_format_fields("GT");
+  options.add_excluded_format_fields("AD");
+  options.add_excluded_format_fields("PL");
+  auto fast = OpenVcf(kVcfSamplesFilename, options, true);
+  auto htslib = OpenVcf(kVcfSamplesFilename, options, false);
+  EXPECT_THAT(as_vector(fast->Iterate()),
+              Pointwise(EqualsProto(), as_vector(htslib->Iterate())));
+}
+
+TEST(VcfTextParserTest, MatchesHtslibOnQueries) {
+  auto fast = OpenVcf(kVcfIndexSamplesFilename, VcfReaderOptions(), true);
+  auto htslib = OpenVcf(kVcfIndexSamplesFilename, VcfReaderOptions(), false);
+  for (const auto& range : {MakeRange("chr1", 0, 1000000),
+                            MakeRange("chr3", 14000, 15000)}) {
+    EXPECT_THAT(as_vector(fast->Query(range)),
+                Pointwise(EqualsProto(), as_vector(htslib->Query(range))));
+  }
+}
+
+TEST(VcfTextParserTest, IsOnlyUsedWhereItApplies) {
+  VcfReaderOptions options;
+  options.set_filter_expression("QUAL > 10");
+  EXPECT_EQ(nullptr, OpenVcf(kVcfSamplesFilename, options, true)->TextParser());
+  options.Clear();
+  options.set_compact_format_fields(true);
+  EXPECT_EQ(nullptr, OpenVcf(kVcfSamplesFilename, options, true)->TextParser());
+}
+
+// Lines under the header of test_samples.vcf, with the expected result of
+// VcfTextParser::Parse.
+struct ParseCase {
+  const char* line;
+  bool parsed;
+};
+
+TEST(VcfTextParserTest, ParsesSimpleLinesLikeHtslib) {
+  const ParseCase cases[] = {
+      {"chr1\t13613\t.\tT\tA\t39.88\tVQSRTrancheSNP99.90to99.95\tAC=1;AF=0.500;"
+       "DB;MQ=22.29;VQSLOD=-2.146e+00;culprit=MQ\tGT:AD:DP:GQ:PL\t"
+       "0/1:1,3:4:16:68,0,16",
+       true},
+      // Missing values.
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tGT:AD:DP:PGT\t./.:.:.:.", true},
+      {"chr1\t100\t.\tA\tG\t0\tPASS;LowQual\tAC=1,2\tGT:AD\t.|1:3,.", true},
+      // Multiple and spanning-deletion alleles, and a phased genotype.
+      {"chr1\t100\trs1\tACGT\tA,AC,*\t1e3\tPASS\tDS;AF=0.1,0.2,0.3\t"
+       "GT:PID\t0|3:x",
+       true},
+      // Symbolic alleles and END are left to htslib.
+      {"chr1\t100\t.\tA\t<NON_REF>\t.\t.\t.\tGT\t0/0", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\tEND=200\tGT\t0/1", false},
+      // As are undefined contigs, FILTERs, INFO and FORMAT fields.
+      {"chrZ\t100\t.\tA\tG\t.\t.\t.\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\tUndefined\t.\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\tUndefined=1\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tGT:Undefined\t0/1:1", false},
+      // Missing INFO values, dropped FORMAT values and mixed ploidy.
+      {"chr1\t100\t.\tA\tG\t.\t.\tDP=.\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tGT:DP\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tGT:DP\t0/1:1:2", false},
+      // Malformed records, on which htslib reports the errors.
+      {"chr1\t100\t.\tA\tG\t.\t.", false},
+      {"chr1\tx\t.\tA\tG\t.\t.\t.\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\tx\t.\t.\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\tDP=1x\tGT\t0/1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tDP\t1", false},
+      {"chr1\t100\t.\tA\tG\t.\t.\t.\tGT\t0/1\t0/1", false},
+  };
+  auto fast = OpenVcf(kVcfSamplesFilename, VcfReaderOptions(), true);
+  auto htslib = OpenVcf(kVcfSamplesFilename, VcfReaderOptions(), false);
+  for (const ParseCase& c : cases) {
+    Variant variant;
+    EXPECT_EQ(c.parsed, fast->TextParser()->Parse(c.line, &variant))
+        << c.line;
+    if (c.parsed) {
+      Variant expected;
+      ASSERT_THAT(htslib->FromString(c.line, &expected).status(), IsOK());
+      EXPECT_THAT(variant, EqualsProto(expected)) << c.line;
+    }
+  }
+}
+
+TEST(VcfTextParserTest, FallsBackToHtslib) {
+  auto fast = OpenVcf(kVcfSamplesFilename, VcfReaderOptions(), true);
+  auto htslib = OpenVcf(kVcfSamplesFilename, VcfReaderOptions(), false);
+  for (const char* line :
+       {"chr1\t100\t.\tA\t<NON_REF>\t.\t.\tEND=200\tGT:DP\t0/0:3",
+        "chr1\t100\t.\tA\tG\t.\t.\t.\tGT:DP\t0/1"}) {
+    Variant expected, variant;
+    ASSERT_THAT(htslib->FromString(line, &expected).status(), IsOK());
+    ASSERT_THAT(fast->FromString(line, &variant).status(), IsOK());
+    EXPECT_THAT(variant, EqualsProto(expected)) << line;
+  }
+  Variant variant;
+  EXPECT_THAT(
+      fast->FromString("chr1\t100\t.\tA\tG\t.\t.\t.\tDP\t1", &variant)
+          .status(),
+      IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                "Couldn't parse genotypes"));
+}
+
+}  // namespace nucleus
@@ -26,6 +26,8 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/substitute.h"
 
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
 #include "htslib/hts.h"
 #include "htslib/sam.h"
 
@@ -166,8 +168,13 @@ VcfWriter::VcfWriter(const nucleus::genomics::v1::VcfHeader& header,
           std::vector<string>(options_.excluded_info_fields().begin(),
                               options_.excluded_info_fields().end()),
           std::vector<string>(options_.excluded_format_fields().begin(),
-                              options_.excluded_format_fields().end())) {
+                              options_.excluded_format_fields().end())),
+      format_directly_(!options_.format_with_htslib()) {
   CHECK(fp != nullptr);
+  // Only VCF text is formatted directly; see bcf_write.
+  if (fp_->format.format != vcf && fp_->format.format != text_format) {
+    format_directly_ = false;
+  }
 
   // Note: bcf_hdr_init writes the fileformat= and the FILTER=<ID=PASS,...>
   // filter automatically.
@@ -221,6 +228,12 @@ VcfWriter::~VcfWriter() {
 tf::Status VcfWriter::Write(const Variant& variant_message) {
   if (fp_ == nullptr)
     return tf::errors::FailedPrecondition("Cannot write to closed VCF stream.");
+  if (format_directly_) {
+    line_.clear();
+    TF_RETURN_IF_ERROR(RecordConverter().AppendVcfLine(
+        variant_message, *header_, options_.round_qual_values(), &line_));
+    return WriteLine();
+  }
   bcf1_t* v = bcf_init();
   if (v == nullptr)
     return tf::errors::Unknown("bcf_init call failed");
@@ -237,6 +250,16 @@ tf::Status VcfWriter::Write(const Variant& variant_message) {
   return tf::Status::OK();
 }
 
+tf::Status VcfWriter::WriteLine() {
+  const ssize_t written =
+      fp_->format.compression == no_compression
+          ? hwrite(fp_->fp.hfile, line_.data(), line_.size())
+          : bgzf_write(fp_->fp.bgzf, line_.data(), line_.size());
+  if (written != line_.size())
+    return tf::errors::Unknown("Failed to write VCF record");
+  return tf::Status::OK();
+}
+
 tf::Status VcfWriter::Close() {
   if (fp_ == nullptr)
     return tf::errors::FailedPrecondition(
@@ -50,6 +50,10 @@ class VcfWriter {
   // Note that variant calls must be provided in the same order as samples
   // listed in the options. Returns Status::OK() if the write was successful;
   // otherwise the status provides information about what error occurred.
+  //
+  // Unless options.format_with_htslib is set, records are formatted straight
+  // into a reusable line buffer by VcfRecordConverter::AppendVcfLine instead of
+  // being converted into bcf1_t records for htslib to format.
   tensorflow::Status Write(
       const nucleus::genomics::v1::Variant& variant_message);
 
@@ -74,6 +78,9 @@ class VcfWriter {
 
   tensorflow::Status WriteHeader();
 
+  // Writes the VCF text line_ to fp_, as htslib's vcf_write does.
+  tensorflow::Status WriteLine();
+
   // A pointer to the htslib file used to write the VCF data.
   htsFile* fp_;
 
@@ -88,6 +95,11 @@ class VcfWriter {
 
   // VCF record interconverter.
   VcfRecordConverter record_converter_;
+
+  // Whether records are formatted by AppendVcfLine rather than htslib, and
+  // the buffer they are formatted into.
+  bool format_directly_;
+  string line_;
 };
 
 }  // namespace nucleus
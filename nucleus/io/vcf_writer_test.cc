@@ -20,6 +20,7 @@
 #include <memory>
 #include <vector>
 
+#include "nucleus/io/vcf_reader.h"
 #include "nucleus/protos/variants.pb.h"
 #include "nucleus/testing/test_utils.h"
 #include "nucleus/util/utils.h"
@@ -89,7 +90,8 @@ constexpr char kExpectedHeaderFmt[] =
 std::unique_ptr<VcfWriter> MakeDogVcfWriter(
     const string& fname, const bool round_qual,
     const std::vector<string>& excluded_infos = {},
-    const std::vector<string>& excluded_formats = {}) {
+    const std::vector<string>& excluded_formats = {},
+    const bool format_with_htslib = false) {
   nucleus::genomics::v1::VcfHeader header;
   // FILTERs. Note that the PASS filter automatically gets added even though it
   // is not present here.
@@ -209,6 +211,7 @@ std::unique_ptr<VcfWriter> MakeDogVcfWriter(
   for (const string& fmt : excluded_formats) {
     writer_options.add_excluded_format_fields(fmt);
   }
+  writer_options.set_format_with_htslib(format_with_htslib);
 
   return std::move(
       VcfWriter::ToFile(fname, header, writer_options).ValueOrDie());
@@ -412,6 +415,45 @@ TEST(VcfWriterTest, ExcludesFields) {
   EXPECT_EQ(kExpectedVcfContent, vcf_contents);
 }
 
+TEST(VcfWriterTest, WritesCompactFormatFields) {
+  string output_filename = MakeTempFile("compact_format_fields.vcf");
+  auto writer = MakeDogVcfWriter(output_filename, false);
+
+  Variant v1 = MakeVariant({}, "Chr1", 20, 21, "A", {"T"});
+  v1.set_quality(10);
+  *v1.add_calls() = MakeVariantCall("Fido", {0, 1});
+  *v1.add_calls() = MakeVariantCall("Spot", {0, 0});
+  auto* gq = v1.add_compact_format_fields();
+  gq->set_key("GQ");
+  for (int count : {0, 1}) gq->add_value_counts(count);
+  gq->add_int_values(15);
+  auto* ad = v1.add_compact_format_fields();
+  ad->set_key("AD");
+  for (int count : {2, 2}) ad->add_value_counts(count);
+  for (int value : {10, 5, 20, 0}) ad->add_int_values(value);
+  auto* vaf = v1.add_compact_format_fields();
+  vaf->set_key("VAF");
+  for (int count : {1, 1}) vaf->add_value_counts(count);
+  for (float value : {0.5, 0.0}) vaf->add_float_values(value);
+  ASSERT_THAT(writer->Write(v1), IsOK());
+
+  // The values don't match the value counts.
+  Variant v2 = v1;
+  v2.mutable_compact_format_fields(1)->add_int_values(1);
+  EXPECT_THAT(writer->Write(v2),
+              IsNotOKWithCodeAndMessage(tensorflow::error::FAILED_PRECONDITION,
+                                        "has too many values"));
+  writer.reset();
+
+  string vcf_contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                           output_filename, &vcf_contents));
+  EXPECT_EQ(string(kExpectedHeaderFmt) +
+                "Chr1\t21\t.\tA\tT\t10\t.\t.\tGT:GQ:AD:VAF\t"
+                "0/1:.:10,5:0.5\t0/0:15:20,0:0\n",
+            vcf_contents);
+}
+
 TEST(VcfWriterTest, WritesVCFWithLikelihoods) {
   std::vector<Variant> variants = ReadProtosFromTFRecord<Variant>(
       GetTestData(kVcfLikelihoodsGoldenFilename));
@@ -434,6 +476,124 @@ TEST(VcfWriterTest, WritesVCFWithLikelihoods) {
   EXPECT_EQ(expected_vcf_contents, vcf_contents);
 }
 
+// Writes variants with a Dog VCF writer to a temporary file, formatting them
+// with htslib or directly, and returns the contents of the file.
+string WriteDogVcf(const string& fname, const vector<Variant>& variants,
+                   bool round_qual, bool format_with_htslib) {
+  const string path = MakeTempFile(fname);
+  auto writer =
+      MakeDogVcfWriter(path, round_qual, {}, {}, format_with_htslib);
+  for (const Variant& variant : variants) {
+    TF_CHECK_OK(writer->Write(variant));
+  }
+  TF_CHECK_OK(writer->Close());
+  string contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(), path,
+                                           &contents));
+  return contents;
+}
+
+TEST(VcfWriterTest, DirectFormattingMatchesHtslib) {
+  vector<Variant> variants;
+  // Floats that %g writes in various ways.
+  Variant v1 = MakeVariant({"a", "b"}, "Chr1", 0, 1, "A", {"T", "G"});
+  v1.set_quality(1234567.5);
+  SetInfoField("AF", std::vector<float>{1e-7, -0.0}, &v1);
+  SetInfoField("AC", std::vector<int>{-128, 100000}, &v1);
+  SetInfoField("DB", std::vector<bool>{true}, &v1);
+  *v1.add_calls() = MakeVariantCall("Fido", {1, 2});
+  VariantCall call = MakeVariantCall("Spot", {2, -1, 0});
+  call.set_is_phased(true);
+  SetInfoField("VAF", std::vector<float>{3.14159265, 999999}, &call);
+  SetInfoField("GQ", std::vector<int>{-1}, &call);
+  *v1.add_calls() = call;
+  variants.push_back(v1);
+
+  // A gVCF record, with END and missing values.
+  Variant v2 = MakeVariant({}, "Chr2", 4, 20, "C", {"<*>"});
+  v2.set_quality(0.04999);
+  SetInfoField("AF", std::vector<float>{0.5}, &v2);
+  SetInfoField("DB", std::vector<bool>{false}, &v2);
+  *v2.add_calls() = MakeVariantCall("Fido", {0, 0});
+  call = MakeVariantCall("Spot", {});
+  SetInfoField("MIN_DP", std::vector<int>{7}, &call);
+  SetInfoField("AD", std::vector<int>{1, 2}, &call);
+  *v2.add_calls() = call;
+  variants.push_back(v2);
+
+  // Genotype likelihoods, written as PL, and no genotypes.
+  Variant v3 = MakeVariant({"c"}, "Chr2", 21, 22, "G", {"A"});
+  v3.set_quality(-1);
+  v3.add_filter("RefCall");
+  v3.add_filter("PASS");
+  *v3.add_calls() = MakeVariantCall("Fido", {});
+  call = MakeVariantCall("Spot", {});
+  for (double gl : {-0.1, -2.5, -10.0}) call.add_genotype_likelihood(gl);
+  *v3.add_calls() = call;
+  variants.push_back(v3);
+
+  for (bool round_qual : {false, true}) {
+    EXPECT_EQ(WriteDogVcf("dog_htslib.vcf", variants, round_qual, true),
+              WriteDogVcf("dog_direct.vcf", variants, round_qual, false));
+  }
+}
+
+TEST(VcfWriterTest, DirectFormattingMatchesHtslibOnTestVcfs) {
+  for (const char* filename :
+       {"test_samples.vcf", "test_sites.vcf", "test_vaf.vcf",
+        "test_allele_depth.vcf", "test_phaseset.vcf",
+        "test_likelihoods_input.vcf"}) {
+    auto reader = std::move(
+        VcfReader::FromFile(GetTestData(filename),
+                            nucleus::genomics::v1::VcfReaderOptions())
+            .ValueOrDie());
+    const vector<Variant> variants = as_vector(reader->Iterate());
+    string contents[2];
+    for (int format_with_htslib : {0, 1}) {
+      const string path = MakeTempFile(
+          format_with_htslib ? "htslib_formatted.vcf" : "direct.vcf");
+      nucleus::genomics::v1::VcfWriterOptions options;
+      options.set_format_with_htslib(format_with_htslib);
+      auto writer = std::move(
+          VcfWriter::ToFile(path, reader->Header(), options).ValueOrDie());
+      for (const Variant& variant : variants) {
+        ASSERT_THAT(writer->Write(variant), IsOK());
+      }
+      ASSERT_THAT(writer->Close(), IsOK());
+      TF_CHECK_OK(tensorflow::ReadFileToString(
+          tensorflow::Env::Default(), path, &contents[format_with_htslib]));
+    }
+    EXPECT_EQ(contents[1], contents[0]) << filename;
+  }
+}
+
+TEST(VcfWriterTest, DirectFormattingReturnsHtslibErrors) {
+  for (bool format_with_htslib : {false, true}) {
+    auto writer = MakeDogVcfWriter(MakeTempFile("errors.vcf"), false, {}, {},
+                                   format_with_htslib);
+    Variant v = MakeVariant({}, "Chr3", 1, 2, "A", {"T"});
+    EXPECT_THAT(writer->Write(v),
+                IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                          "reference name is not available"));
+    v.set_reference_name("Chr1");
+    v.add_filter("Unknown");
+    EXPECT_THAT(writer->Write(v),
+                IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                          "Filter must be found in header"));
+    v.clear_filter();
+    EXPECT_THAT(writer->Write(v),
+                IsNotOKWithCodeAndMessage(
+                    tensorflow::error::FAILED_PRECONDITION,
+                    "Variant call count must match number of samples"));
+    *v.add_calls() = MakeVariantCall("Spot", {0, 1});
+    *v.add_calls() = MakeVariantCall("Fido", {0, 1});
+    EXPECT_THAT(writer->Write(v),
+                IsNotOKWithCodeAndMessage(
+                    tensorflow::error::FAILED_PRECONDITION,
+                    "Out-of-order call set names"));
+  }
+}
+
 TEST(VcfWriterTest, WritesGzippedVCF) {
   string output_filename = MakeTempFile("writes_gzipped_vcf.vcf.gz");
   auto writer = MakeDogVcfWriter(output_filename, false);
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/util/variantcall_utils.h"
+
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace nucleus {
+
+namespace tf = tensorflow;
+
+using nucleus::genomics::v1::CompactFormatField;
+using nucleus::genomics::v1::ListValue;
+using nucleus::genomics::v1::Variant;
+
+namespace {
+
+// Returns the values of call_index in values, one of the arrays of field,
+// given that they start at offset.
+template <typename T, typename Values>
+std::vector<T> CallValues(const CompactFormatField& field, int offset,
+                          int call_index, const Values& values) {
+  if (call_index < 0 || call_index >= field.value_counts_size()) return {};
+  const int count = field.value_counts(call_index);
+  if (offset < 0 || count < 0 || offset + count > values.size()) return {};
+  return std::vector<T>(values.begin() + offset,
+                        values.begin() + offset + count);
+}
+
+// Returns the offset of the values of call_index by summing the value counts
+// of the preceding calls.
+int SummedOffset(const CompactFormatField& field, int call_index) {
+  int offset = 0;
+  for (int i = 0; i < call_index && i < field.value_counts_size(); i++) {
+    offset += field.value_counts(i);
+  }
+  return offset;
+}
+
+// Returns offsets[call_index], or -1 if call_index is out of its range.
+int OffsetAt(const std::vector<int>& offsets, int call_index) {
+  if (call_index < 0 || call_index >= static_cast<int>(offsets.size()))
+    return -1;
+  return offsets[call_index];
+}
+
+}  // namespace
+
+const CompactFormatField* FindCompactFormatField(const Variant& variant,
+                                                 const string& key) {
+  for (const CompactFormatField& field : variant.compact_format_fields()) {
+    if (field.key() == key) return &field;
+  }
+  return nullptr;
+}
+
+std::vector<int> CompactFormatOffsets(const CompactFormatField& field) {
+  std::vector<int> offsets(field.value_counts_size() + 1, 0);
+  for (int i = 0; i < field.value_counts_size(); i++) {
+    offsets[i + 1] = offsets[i] + field.value_counts(i);
+  }
+  return offsets;
+}
+
+template <>
+std::vector<int> CompactFormatValues<int>(const CompactFormatField& field,
+                                          int call_index) {
+  return CallValues<int>(field, SummedOffset(field, call_index), call_index,
+                         field.int_values());
+}
+
+template <>
+std::vector<float> CompactFormatValues<float>(const CompactFormatField& field,
+                                              int call_index) {
+  return CallValues<float>(field, SummedOffset(field, call_index),
+                           call_index, field.float_values());
+}
+
+template <>
+std::vector<string> CompactFormatValues<string>(
+    const CompactFormatField& field, int call_index) {
+  return CallValues<string>(field, SummedOffset(field, call_index),
+                            call_index, field.string_values());
+}
+
+template <>
+std::vector<int> CompactFormatValues<int>(const CompactFormatField& field,
+                                          const std::vector<int>& offsets,
+                                          int call_index) {
+  return CallValues<int>(field, OffsetAt(offsets, call_index), call_index,
+                         field.int_values());
+}
+
+template <>
+std::vector<float> CompactFormatValues<float>(const CompactFormatField& field,
+                                              const std::vector<int>& offsets,
+                                              int call_index) {
+  return CallValues<float>(field, OffsetAt(offsets, call_index), call_index,
+                           field.float_values());
+}
+
+template <>
+std::vector<string> CompactFormatValues<string>(
+    const CompactFormatField& field, const std::vector<int>& offsets,
+    int call_index) {
+  return CallValues<string>(field, OffsetAt(offsets, call_index), call_index,
+                            field.string_values());
+}
+
+tf::Status ExpandCompactFormatFields(Variant* variant) {
+  for (const CompactFormatField& field : variant->compact_format_fields()) {
+    if (field.value_counts_size() != variant->calls_size()) {
+      return tf::errors::InvalidArgument(
+          "Compact FORMAT field ", field.key(), " has ",
+          field.value_counts_size(), " value counts for ",
+          variant->calls_size(), " calls");
+    }
+    if ((field.int_values_size() > 0) + (field.float_values_size() > 0) +
+            (field.string_values_size() > 0) > 1) {
+      return tf::errors::InvalidArgument(
+          "Compact FORMAT field ", field.key(), " has values of several types");
+    }
+    const int n_values = field.int_values_size() + field.float_values_size() +
+                         field.string_values_size();
+    int offset = 0;
+    for (int i = 0; i < variant->calls_size(); i++) {
+      const int count = field.value_counts(i);
+      if (count < 0 || offset + count > n_values) {
+        return tf::errors::InvalidArgument(
+            "Compact FORMAT field ", field.key(), " has too few values");
+      }
+      if (count == 0) continue;
+      ListValue& list_value =
+          (*variant->mutable_calls(i)->mutable_info())[field.key()];
+      list_value.clear_values();
+      for (int j = offset; j < offset + count; j++) {
+        if (field.int_values_size() > 0) {
+          list_value.add_values()->set_int_value(field.int_values(j));
+        } else if (field.float_values_size() > 0) {
+          list_value.add_values()->set_number_value(field.float_values(j));
+        } else {
+          list_value.add_values()->set_string_value(field.string_values(j));
+        }
+      }
+      offset += count;
+    }
+    if (offset != n_values) {
+      return tf::errors::InvalidArgument(
+          "Compact FORMAT field ", field.key(), " has too many values");
+    }
+  }
+  variant->clear_compact_format_fields();
+  return tf::Status::OK();
+}
+
+}  // namespace nucleus
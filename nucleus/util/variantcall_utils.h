@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Accessors for the FORMAT fields of VariantCalls, including those stored in
+// Variant.compact_format_fields.
+#ifndef THIRD_PARTY_NUCLEUS_UTIL_VARIANTCALL_UTILS_H_
+#define THIRD_PARTY_NUCLEUS_UTIL_VARIANTCALL_UTILS_H_
+
+#include <vector>
+
+#include "nucleus/protos/variants.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "nucleus/platform/types.h"
+
+namespace nucleus {
+
+// Returns the entry of variant.compact_format_fields() for the FORMAT field
+// key, or nullptr if variant has none.
+const nucleus::genomics::v1::CompactFormatField* FindCompactFormatField(
+    const nucleus::genomics::v1::Variant& variant, const string& key);
+
+// Returns the values of field for the call with index call_index, which are
+// empty if the field is missing for the call. The function is templated like
+// ListValues, for int, float and string fields:
+//
+// vector<int> ad = CompactFormatValues<int>(*ad_field, call_index);
+//
+// This has to sum the value counts of the preceding calls. To read the values
+// of many calls, compute their offsets once with CompactFormatOffsets and use
+// the overload taking them.
+template <typename T>
+std::vector<T> CompactFormatValues(
+    const nucleus::genomics::v1::CompactFormatField& field, int call_index);
+
+template <>
+std::vector<int> CompactFormatValues<int>(
+    const nucleus::genomics::v1::CompactFormatField& field, int call_index);
+template <>
+std::vector<float> CompactFormatValues<float>(
+    const nucleus::genomics::v1::CompactFormatField& field, int call_index);
+template <>
+std::vector<string> CompactFormatValues<string>(
+    const nucleus::genomics::v1::CompactFormatField& field, int call_index);
+
+// Returns the offset of the values of each call of field in its value arrays,
+// followed by the total number of values: the prefix sums of
+// field.value_counts().
+std::vector<int> CompactFormatOffsets(
+    const nucleus::genomics::v1::CompactFormatField& field);
+
+// Like CompactFormatValues above, but finds the values of the call directly
+// from offsets, which must be CompactFormatOffsets(field):
+//
+// const vector<int> offsets = CompactFormatOffsets(*ad_field);
+// for (int i = 0; i < variant.calls_size(); i++) {
+//   vector<int> ad = CompactFormatValues<int>(*ad_field, offsets, i);
+// }
+template <typename T>
+std::vector<T> CompactFormatValues(
+    const nucleus::genomics::v1::CompactFormatField& field,
+    const std::vector<int>& offsets, int call_index);
+
+template <>
+std::vector<int> CompactFormatValues<int>(
+    const nucleus::genomics::v1::CompactFormatField& field,
+    const std::vector<int>& offsets, int call_index);
+template <>
+std::vector<float> CompactFormatValues<float>(
+    const nucleus::genomics::v1::CompactFormatField& field,
+    const std::vector<int>& offsets, int call_index);
+template <>
+std::vector<string> CompactFormatValues<string>(
+    const nucleus::genomics::v1::CompactFormatField& field,
+    const std::vector<int>& offsets, int call_index);
+
+// Moves the compact_format_fields of variant into the info maps of its calls,
+// as if it had been read without VcfReaderOptions.compact_format_fields.
+// Returns InvalidArgument, leaving variant partially expanded, if a field
+// doesn't have one value count per call, or its values are of several types or
+// don't match its counts.
+tensorflow::Status ExpandCompactFormatFields(
+    nucleus::genomics::v1::Variant* variant);
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_UTIL_VARIANTCALL_UTILS_H_
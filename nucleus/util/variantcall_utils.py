@@ -94,6 +94,56 @@ def get_format(variant_call, field_name, vcf_object=None):
   return get_field_fn(variant_call.info, field_name)
 
 
+def get_compact_format(variant, field_name):
+  """Returns the values of a FORMAT field of a variant read in compact form.
+
+  When a VCF is read with compact_format_fields=True, the generic FORMAT fields
+  of all calls are stored as typed arrays in variant.compact_format_fields
+  rather than in the info map of each call.
+
+  Args:
+    variant: Variant proto. The Variant of interest.
+    field_name: str. The name of the FORMAT field, such as 'AD'.
+
+  Returns:
+    A list with the list of values of each call of variant, in call order (empty
+    for calls missing the field), or None if variant has no compact field_name.
+  """
+  for field in variant.compact_format_fields:
+    if field.key == field_name:
+      values = field.int_values or field.float_values or field.string_values
+      per_call = []
+      offset = 0
+      for count in field.value_counts:
+        per_call.append(list(values[offset:offset + count]))
+        offset += count
+      return per_call
+  return None
+
+
+def expand_compact_format(variant):
+  """Moves the compact FORMAT fields of variant into the info maps of its calls.
+
+  The result is the Variant as it would have been read without
+  compact_format_fields=True, so that get_format works on its calls.
+
+  Args:
+    variant: Variant proto. The Variant to modify.
+  """
+  for field in variant.compact_format_fields:
+    if field.int_values:
+      set_field_fn = struct_utils.set_int_field
+    elif field.float_values:
+      set_field_fn = struct_utils.set_number_field
+    else:
+      set_field_fn = struct_utils.set_string_field
+    per_call = get_compact_format(variant, field.key)
+    for call, values in zip(variant.calls, per_call):
+      if values:
+        set_field_fn(call.info, field.key, values)
+  del variant.compact_format_fields[:]
+
+
 # The following functions are convenience methods for getting/setting some
 # reserved FORMAT fields of a VariantCall as well as some non-reserved FORMAT
 # fields used by DeepVariant. Note that these functions will use the types of
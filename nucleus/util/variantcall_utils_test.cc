@@ -0,0 +1,127 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "nucleus/util/variantcall_utils.h"
+
+#include "nucleus/protos/variants.pb.h"
+#include "nucleus/testing/protocol-buffer-matchers.h"
+#include "nucleus/testing/test_utils.h"
+#include "nucleus/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::CompactFormatField;
+using nucleus::genomics::v1::Variant;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// Makes a Variant with two calls, whose AD field is 10,5 for the first call
+// and missing for the second, and whose GL field is 0.5 for both.
+Variant MakeCompactVariant() {
+  Variant variant;
+  variant.add_calls()->set_call_set_name("s1");
+  variant.add_calls()->set_call_set_name("s2");
+  CompactFormatField* ad = variant.add_compact_format_fields();
+  ad->set_key("AD");
+  ad->add_value_counts(2);
+  ad->add_value_counts(0);
+  ad->add_int_values(10);
+  ad->add_int_values(5);
+  CompactFormatField* gl = variant.add_compact_format_fields();
+  gl->set_key("GL");
+  gl->add_value_counts(1);
+  gl->add_value_counts(1);
+  gl->add_float_values(0.5);
+  gl->add_float_values(0.5);
+  return variant;
+}
+
+TEST(VariantCallUtilsTest, FindsCompactFormatFields) {
+  const Variant variant = MakeCompactVariant();
+  ASSERT_NE(FindCompactFormatField(variant, "AD"), nullptr);
+  EXPECT_EQ(FindCompactFormatField(variant, "AD")->key(), "AD");
+  EXPECT_EQ(FindCompactFormatField(variant, "DP"), nullptr);
+}
+
+TEST(VariantCallUtilsTest, ReturnsCompactFormatValuesOfCall) {
+  const Variant variant = MakeCompactVariant();
+  const CompactFormatField& ad = *FindCompactFormatField(variant, "AD");
+  EXPECT_THAT(CompactFormatValues<int>(ad, 0), ElementsAre(10, 5));
+  EXPECT_THAT(CompactFormatValues<int>(ad, 1), IsEmpty());
+  const CompactFormatField& gl = *FindCompactFormatField(variant, "GL");
+  EXPECT_THAT(CompactFormatValues<float>(gl, 1), ElementsAre(0.5));
+}
+
+TEST(VariantCallUtilsTest, ReturnsCompactFormatValuesByOffsets) {
+  const Variant variant = MakeCompactVariant();
+  const CompactFormatField& ad = *FindCompactFormatField(variant, "AD");
+  const std::vector<int> offsets = CompactFormatOffsets(ad);
+  EXPECT_THAT(offsets, ElementsAre(0, 2, 2));
+  EXPECT_THAT(CompactFormatValues<int>(ad, offsets, 0), ElementsAre(10, 5));
+  EXPECT_THAT(CompactFormatValues<int>(ad, offsets, 1), IsEmpty());
+  EXPECT_THAT(CompactFormatValues<int>(ad, offsets, 2), IsEmpty());
+  const CompactFormatField& gl = *FindCompactFormatField(variant, "GL");
+  EXPECT_THAT(CompactFormatValues<float>(gl, CompactFormatOffsets(gl), 1),
+              ElementsAre(0.5));
+}
+
+TEST(VariantCallUtilsTest, ExpandsCompactFormatFields) {
+  Variant variant = MakeCompactVariant();
+  ASSERT_THAT(ExpandCompactFormatFields(&variant), IsOK());
+  EXPECT_THAT(variant, EqualsProto(R"(
+    calls {
+      call_set_name: "s1"
+      info {
+        key: "AD"
+        value { values { int_value: 10 } values { int_value: 5 } }
+      }
+      info {
+        key: "GL"
+        value { values { number_value: 0.5 } }
+      }
+    }
+    calls {
+      call_set_name: "s2"
+      info {
+        key: "GL"
+        value { values { number_value: 0.5 } }
+      }
+    }
+  )"));
+}
+
+TEST(VariantCallUtilsTest, RejectsMalformedCompactFormatFields) {
+  Variant variant = MakeCompactVariant();
+  variant.mutable_compact_format_fields(0)->add_int_values(1);
+  EXPECT_THAT(ExpandCompactFormatFields(&variant),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "has too many values"));
+
+  variant = MakeCompactVariant();
+  variant.mutable_compact_format_fields(1)->add_value_counts(1);
+  EXPECT_THAT(ExpandCompactFormatFields(&variant),
+              IsNotOKWithCodeAndMessage(tensorflow::error::INVALID_ARGUMENT,
+                                        "3 value counts for 2 calls"));
+}
+
+}  // namespace nucleus
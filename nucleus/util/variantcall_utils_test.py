@@ -167,6 +167,26 @@ class VariantcallUtilsTests(parameterized.TestCase):
     actual = variantcall_utils.ploidy(call)
     self.assertEqual(actual, expected)
 
+  def test_compact_format(self):
+    variant = variants_pb2.Variant(
+        calls=[variants_pb2.VariantCall(), variants_pb2.VariantCall()],
+        compact_format_fields=[
+            variants_pb2.CompactFormatField(
+                key='AD', value_counts=[2, 0], int_values=[10, 5]),
+            variants_pb2.CompactFormatField(
+                key='VAF', value_counts=[1, 1], float_values=[0.5, 0.25]),
+        ])
+    self.assertEqual(
+        variantcall_utils.get_compact_format(variant, 'AD'), [[10, 5], []])
+    self.assertIsNone(variantcall_utils.get_compact_format(variant, 'DP'))
+
+    variantcall_utils.expand_compact_format(variant)
+    self.assertEmpty(variant.compact_format_fields)
+    self.assertEqual(variantcall_utils.get_ad(variant.calls[0]), [10, 5])
+    self.assertNotIn('AD', variant.calls[1].info)
+    self.assertEqual(
+        struct_utils.get_number_field(variant.calls[1].info, 'VAF'), [0.25])
+
 
 if __name__ == '__main__':
   absltest.main()